@@ -83,7 +83,7 @@ empty_handler_t home_handler(
 
 tagd::code fill_query(transaction&, const view&, tagd_template&, const tagd::interrogator&, const tagd::tag_set&);
 
-tagd::code fill_tag(transaction& tx, const view&, tagd_template& tpl, const tagd::abstract_tag& this_tag) {
+tagd::code fill_tag(transaction& tx, const view&, tagd_template& tpl, const tagd::abstract_tag& this_tag, const tagdb::neighborhood_set& N) {
 	tpl.set_value("REQUEST_URL_VIEW_TAGL", tx.req->abs_url_view(DEFAULT_VIEW));
 	tpl.set_value("REQUEST_URL_VIEW_TAG_HTML", tx.req->abs_url_view(TAG_VIEW_ID.name()));
 
@@ -139,63 +139,53 @@ tagd::code fill_tag(transaction& tx, const view&, tagd_template& tpl, const tagd
 		}
 	}
 
-	/* TODO implement code to fill the referents_refers_to section
-	 * fill query won't cut it
-	tagd::tag_set S;
-	tagd::interrogator q_refers_to(HARD_TAG_INTERROGATOR, HARD_TAG_REFERENT);
-	q_refers_to.relation(HARD_TAG_REFERS_TO, t.id());
-	tagd::code tc = tx.tdb->query(S, q_refers_to);
-	if (tc != tagd::TAGD_OK) return tc;
-
-	if (S.size() > 0) {
-		tagd_template refers_tpl("refers_html_tpl", tx.res->output_buffer());
-		tc = fill_query(tx, vw, refers_tpl, q_refers_to, S);
-		if (tc != tagd::TAGD_OK) return tc;
-	}
-	*/
-
-	/*
-	S.clear();
-	tagd::interrogator q_refers(HARD_TAG_INTERROGATOR, HARD_TAG_REFERENT);
-	q_refers.relation(HARD_TAG_REFERS, t.id());
-	tc = tx.tdb->query(S, q_refers);
-
-	if (tc == tagd::TAGD_OK) {
-		if (S.size() > 0)
-			this->expand_query(query_view, q_refers, S, tpl);
-	}
-
-	S.clear();
-	tagd::interrogator q_related(HARD_TAG_INTERROGATOR);
-	q_related.relation("", t.id());
-	tc = tx.tdb->query(S, q_related);
-
-	if (tc == tagd::TAGD_OK) {
-		if (S.size() > 0) {
-			set_query_related_link(&tpl, "query_related", t.id());
-			this->expand_query(query_view, q_related, S, tpl);
+	// referents, with their refers, refers_to and context links
+	auto f_referents = [&tx, &tpl](const tagd::tag_set& R, const std::string& section) {
+		if (R.empty()) return;
+
+		tpl.show_section(section);
+		for (auto& r : R) {
+			auto s1 = tpl.add_section(section + "_referent");
+			s1->set_tag_link(tx, "refers", r.id());
+			s1->set_relator_link(tx, "refers_to_relator", HARD_TAG_REFERS_TO);
+			s1->set_tag_link(tx, "refers_to", r.super_object());
+			for (auto& p : r.relations) {
+				if (p.relator == HARD_TAG_CONTEXT) {
+					auto s2 = s1->add_section("has_context");
+					s2->set_relator_link(tx, "context_relator", HARD_TAG_CONTEXT);
+					s2->set_tag_link(tx, "context", p.object);
+				}
+			}
 		}
-	}
+	};
+	f_referents(N.refers_to, "referents_refers_to");
+	f_referents(N.refers, "referents_refers");
 
-	S.clear();
-	tagd::interrogator q_siblings(HARD_TAG_INTERROGATOR, t.super_object());
-	tc = tx.tdb->query(S, q_siblings);
+	return tagd::TAGD_OK;
+}
 
-	set_query_link(&tpl, "query_siblings", t.super_object());
-	if (tc == tagd::TAGD_OK && S.size() > 1) {
-		if (S.size() > 0)
-			this->expand_query(query_view, q_siblings, S, tpl);
+// related tags, siblings and children of the tag page
+// (the browse page renders these with the tree and query templates instead)
+tagd::code fill_neighbors(transaction& tx, tagd_template& tpl, const tagd::abstract_tag& this_tag, const tagdb::neighborhood_set& N) {
+	if (N.related.size() > 0) {
+		tpl.show_section("related");
+		for (auto& r : N.related)
+			tpl.add_section("related_tag")->set_tag_link(tx, "related_id", r.id());
 	}
 
-	S.clear();
-	tagd::interrogator q_children(HARD_TAG_INTERROGATOR, t.id());
-	tc = tx.tdb->query(S, q_children);
+	if (N.tree.siblings.size() > 1) {
+		tpl.show_section("siblings");
+		for (auto& sibling : N.tree.siblings) {
+			if (sibling.id() != this_tag.id())
+				tpl.add_section("sibling")->set_tag_link(tx, "sibling_id", sibling.id());
+		}
+	}
 
-	if (tc == tagd::TAGD_OK) {
-		if (S.size() > 0)
-			this->expand_query(query_view, q_children, S, tpl);
+	if (N.tree.children.size() > 0) {
+		tpl.show_section("children");
+		for (auto& child : N.tree.children)
+			tpl.add_section("child")->set_tag_link(tx, "child_id", child.id());
 	}
-	*/
 
 	return tagd::TAGD_OK;
 }
@@ -204,17 +194,26 @@ get_handler_t tag_handler(
 	[](transaction& tx, const view& vw, const tagd::abstract_tag& this_tag) -> tagd::code {
 		tx.res->add_header_content_type(HTML_CONTENT_TYPE);
 		tagd_template tpl("tag", tx.res->output_buffer());
-		fill_tag(tx, vw, tpl, this_tag);
+
+		tagdb::neighborhood_set N;
+		tagd::code tc = tx.tdb->neighborhood(N, this_tag, tx.drvr->session_ptr());
+		if (tc != tagd::TAGD_OK) return tc;
+
+		tc = fill_tag(tx, vw, tpl, this_tag, N);
+		if (tc != tagd::TAGD_OK) return tc;
+
+		tc = fill_neighbors(tx, tpl, this_tag, N);
+		if (tc != tagd::TAGD_OK) return tc;
 
 		std::string fname;
-		tagd::code tc = tpl_fname(fname, tx, vw);
+		tc = tpl_fname(fname, tx, vw);
 		if (tc != tagd::TAGD_OK) return tc;
 
 		return tpl.expand(*tx.vws, fname);
 	}
 );
 
-tagd::code fill_tree(transaction& tx, const view&, tagd_template& tpl, const tagd::abstract_tag& this_tag) {
+tagd::code fill_tree(transaction& tx, const view&, tagd_template& tpl, const tagd::abstract_tag& this_tag, const tagdb::tree_set& tree) {
 	const std::string context = tx.req->query_opt_context();
 	/*
 	if (this_tag.pos() == tagd::POS_URL) {
@@ -227,38 +226,31 @@ tagd::code fill_tree(transaction& tx, const view&, tagd_template& tpl, const tag
 	tpl.set_tag_link(tx, "sub_relator", this_tag.sub_relator());
 	tpl.set_tag_link(tx, "super_object", this_tag.super_object());
 
-	tagd::tag_set sibling_set;
-	auto ssn = tx.drvr->session_ptr();
-	tagd::code tc = tx.tdb->query(sibling_set,
-			tagd::interrogator(HARD_TAG_INTERROGATOR, this_tag.super_object()), ssn);
-
-	if (tc == tagd::TAGD_OK) {
-		for (auto sibling : sibling_set) {
-			auto sec_siblings = tpl.add_section("siblings");
-			if (sibling.id() == this_tag.id()) {
-				auto sec_this_tag = sec_siblings->add_section("this_tag");
-				sec_this_tag->set_tag_link(tx, "this_tag_id", sibling.id());
-				// query children
-				tagd::tag_set child_set;
-				tc = tx.tdb->query(child_set,
-						tagd::interrogator(HARD_TAG_INTERROGATOR, this_tag.id()), ssn);
-
-				if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
-					return tx.tdb->code();
-
-				if (child_set.size() > 0) {
-					auto s1 = tpl.add_section("has_children");
-					for (auto child : child_set) {
-						auto s2 = s1->add_section("children");
-						if (child.id() != this_tag.id()) {
-							s2->set_tag_link(tx, "child", child.id());
-						}
-					}
+	// breadcrumbs, from _entity down to the super_object
+	if (tree.ancestors.size() > 0) {
+		tpl.show_section("has_ancestors");
+		for (auto& ancestor : tree.ancestors) {
+			auto sec_ancestors = tpl.add_section("ancestors");
+			sec_ancestors->set_tag_link(tx, "ancestor_id", ancestor.id());
+		}
+	}
+
+	for (auto& sibling : tree.siblings) {
+		auto sec_siblings = tpl.add_section("siblings");
+		if (sibling.id() == this_tag.id()) {
+			auto sec_this_tag = sec_siblings->add_section("this_tag");
+			sec_this_tag->set_tag_link(tx, "this_tag_id", sibling.id());
+
+			if (tree.children.size() > 0) {
+				auto s1 = tpl.add_section("has_children");
+				for (auto& child : tree.children) {
+					auto s2 = s1->add_section("children");
+					s2->set_tag_link(tx, "child", child.id());
 				}
-			} else {
-				auto sec_sibling = sec_siblings->add_section("sibling");
-				sec_sibling->set_tag_link(tx, "sibling_id", sibling.id());
 			}
+		} else {
+			auto sec_sibling = sec_siblings->add_section("sibling");
+			sec_sibling->set_tag_link(tx, "sibling_id", sibling.id());
 		}
 	}
 
@@ -269,7 +261,13 @@ get_handler_t tree_handler(
 	[](transaction& tx, const view& vw, const tagd::abstract_tag& this_tag) -> tagd::code {
 		tx.res->add_header_content_type(HTML_CONTENT_TYPE);
 		tagd_template tpl("tree", tx.res->output_buffer());
-		tagd::code tc = fill_tree(tx, vw, tpl, this_tag);
+
+		// ancestors, siblings and children in one query
+		tagdb::tree_set tree;
+		tagd::code tc = tx.tdb->tree(tree, this_tag.id(), tx.drvr->session_ptr());
+		if (tc != tagd::TAGD_OK) return tc;
+
+		tc = fill_tree(tx, vw, tpl, this_tag, tree);
 		if (tc != tagd::TAGD_OK) return tc;
 
 		std::string fname;
@@ -377,28 +375,37 @@ get_handler_t browse_handler(
 			main_tpl->set_value("id", this_tag.id());
 		}
 
+		// the tree, tag and related results all come from one neighborhood
+		tagdb::neighborhood_set N;
+		tc = tx.tdb->neighborhood(N, this_tag, tx.drvr->session_ptr());
+		if (tc != tagd::TAGD_OK) return tc;
+
 		auto tree_tpl = main_tpl->include("tree_html_tpl", tx.vws->fpath(TREE_TPL));
-		tc = fill_tree(tx, vw, *tree_tpl, this_tag);
+		tc = fill_tree(tx, vw, *tree_tpl, this_tag, N.tree);
 		if (tc != tagd::TAGD_OK) return tc;
 
 		auto tag_tpl = main_tpl->include("tag_html_tpl", tx.vws->fpath(TAG_TPL));
-		tc = fill_tag(tx, vw, *tag_tpl, this_tag);
+		tc = fill_tag(tx, vw, *tag_tpl, this_tag, N);
 		if (tc != tagd::TAGD_OK) return tc;
 
-		tagd::tag_set results;
-		tagd::interrogator q_related(HARD_TAG_INTERROGATOR);
-		if (this_tag.pos() == tagd::POS_RELATOR)
-			(void)q_related.relation(this_tag.id(), "");
-		else
-			(void)q_related.relation("", this_tag.id());
-		tc = tx.tdb->query(results, q_related, tx.drvr->session_ptr(), tagdb::F_NO_NOT_FOUND_ERROR);
-
-		if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
-			return tc;
+		if (N.related.size() > 0) {
+			// the interrogator the related tags would have been queried by
+			tagd::interrogator q_related(HARD_TAG_INTERROGATOR);
+			if (this_tag.pos() == tagd::POS_RELATOR)
+				(void)q_related.relation(this_tag.id(), "");
+			else
+				(void)q_related.relation("", this_tag.id());
+
+			// related tags have only the relations relating them, so load all of their relations at once
+			tagd::id_vec ids;
+			for (auto& r : N.related)
+				ids.push_back(r.id());
+			tagd::tag_set related;
+			tc = tx.tdb->get_many(related, ids, tx.drvr->session_ptr());
+			if (tc != tagd::TAGD_OK) return tc;
 
-		if (results.size() > 0) {
 			auto results_tpl = main_tpl->include("results_html_tpl", tx.vws->fpath(QUERY_TPL));
-			tc = fill_query(tx, vw, *results_tpl, q_related, results);
+			tc = fill_query(tx, vw, *results_tpl, q_related, related);
 			if (tc != tagd::TAGD_OK) return tc;
 		}
 
@@ -524,6 +531,11 @@ int main(int argc, char ** argv) {
 		return tdb.code();
 	}
 
+	// browse and tree views repeat the same queries, puts invalidate the results they overlap
+	tdb.query_cache_size(args.query_cache_size);
+	// faceted queries intersect in memory
+	tdb.use_bitmap_index(args.bitmap_index);
+
 	if (args.tpl_dir.empty())
 		args.tpl_dir = "./app/tpl/";
 
@@ -539,6 +551,12 @@ int main(int argc, char ** argv) {
 		return vws.code();
 	}
 
+	// templates are compiled once at startup, SIGHUP reloads those changed
+	if (vws.load_templates() != tagd::TAGD_OK) {
+		vws.print_errors();
+		return vws.code();
+	}
+
 	tagsh shell(&tdb);
 	args.opt_noshell = true; // no REPL shell
 	args.interpret(shell);
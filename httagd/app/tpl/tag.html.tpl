@@ -22,6 +22,7 @@
 <h3>Referents</h3>
  <h4>Refers To</h4>
   <ul>
+  {{#referents_refers_to_referent}}
    <li>
 	<a href="{{refers_lnk}}">{{refers}}</a>
 	<a href="{{refers_to_relator_lnk}}">{{refers_to_relator}}</a>
@@ -31,12 +32,14 @@
 	<a href="{{context_lnk}}">{{context}}</a>
 	{{/has_context}}
    </li>
+  {{/referents_refers_to_referent}}
  </ul>
 {{/referents_refers_to}}
 
 {{#referents_refers}}
  <h4>Refers</h4>
   <ul>
+  {{#referents_refers_referent}}
    <li>
 	<a href="{{refers_lnk}}">{{refers}}</a>
 	<small><a href="{{refers_to_relator_lnk}}">{{refers_to_relator}}</a></small>
@@ -46,5 +49,33 @@
 	<a href="{{context_lnk}}">{{context}}</a>
     {{/has_context}}
    </li>
+  {{/referents_refers_referent}}
  </ul>
 {{/referents_refers}}
+
+{{#related}}
+<h3>Related</h3>
+ <ul>
+ {{#related_tag}}
+  <li><a href="{{related_id_lnk}}">{{related_id}}</a></li>
+ {{/related_tag}}
+ </ul>
+{{/related}}
+
+{{#siblings}}
+<h3>Siblings</h3>
+ <ul>
+ {{#sibling}}
+  <li><a href="{{sibling_id_lnk}}">{{sibling_id}}</a></li>
+ {{/sibling}}
+ </ul>
+{{/siblings}}
+
+{{#children}}
+<h3>Children</h3>
+ <ul>
+ {{#child}}
+  <li><a href="{{child_id_lnk}}">{{child_id}}</a></li>
+ {{/child}}
+ </ul>
+{{/children}}
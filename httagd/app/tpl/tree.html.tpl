@@ -1,3 +1,8 @@
+{{#has_ancestors}}
+<p class="ancestors">
+{{#ancestors}}<a href="{{ancestor_id_lnk}}">{{ancestor_id}}</a> &rarr; {{/ancestors}}
+</p>
+{{/has_ancestors}}
 <ul class="tree">
 <li class="super"><a href="{{super_object_lnk}}">{{super_object}}</a>
  <ul>
@@ -6,12 +6,19 @@
 #include "tagsh.h"
 
 #include <cstring>
+#include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
+#include <sys/types.h>
 #include <evhtp.h>
 #include <ctemplate/template.h>
+#include <ctemplate/template_cache.h>
 
 const char* evhtp_res_str(int);
+const char* evhtp_method_str(int);
+
+struct z_stream_s;  // zlib.h
 
 extern bool HTTAGD_TRACE_ON;
 
@@ -43,8 +50,13 @@ class httagd_args : public cmd_args {
 		std::string default_view;
 		std::string bind_addr;
 		uint16_t bind_port;
+		size_t query_cache_size;  // 0 disables
+		bool bitmap_index;
+		size_t request_budget;  // milliseconds per request, 0 is unlimited
+		size_t response_cache_size;  // 0 disables
 
-		httagd_args () : bind_port{0} {
+		httagd_args () : bind_port{0}, query_cache_size{1024}, bitmap_index{false}, request_budget{0},
+			response_cache_size{256} {
 			_cmds["--tpl-dir"] = {
 				[this](char *val) {
 						if (!tagd::io::dir_exists(val)) {
@@ -91,10 +103,235 @@ class httagd_args : public cmd_args {
 				},
 				true
 			};
+
+			_cmds["--query-cache"] = {
+				[this](char *val) {
+						this->query_cache_size = static_cast<size_t>(
+								atol( static_cast<const char*>(val) )
+							);
+				},
+				true
+			};
+
+			_cmds["--bitmap-index"] = {
+				[this](char *) {
+						this->bitmap_index = true;
+				},
+				false
+			};
+
+			_cmds["--request-budget"] = {
+				[this](char *val) {
+						this->request_budget = static_cast<size_t>(
+								atol( static_cast<const char*>(val) )
+							);
+				},
+				true
+			};
+
+			_cmds["--response-cache"] = {
+				[this](char *val) {
+						this->response_cache_size = static_cast<size_t>(
+								atol( static_cast<const char*>(val) )
+							);
+				},
+				true
+			};
 		}
 };
 
+// a rendered GET response, valid while the etag it was rendered under is current
+struct cached_response {
+	std::string etag;
+	std::string content_type;
+	std::string content_encoding;
+	std::string body;
+};
+
+// bounded LRU cache of rendered GET responses keyed by path and query string
+// (the query holds the view and context), a max_size of 0 disables the cache
+class response_cache {
+	public:
+		// larger bodies are not cached
+		static const size_t MAX_BODY_SIZE = 1 << 20;
+
+	private:
+		typedef std::list<std::pair<std::string, cached_response>> entry_list;
+
+		size_t _max_size;
+		entry_list _entries;  // most recently used first
+		std::unordered_map<std::string, entry_list::iterator> _index;
+		size_t _hits = 0;
+		size_t _misses = 0;
+
+	public:
+		response_cache(size_t max_size = 0) : _max_size{max_size} {}
+
+		size_t max_size() const { return _max_size; }
+		bool enabled() const { return _max_size > 0; }
+		size_t size() const { return _entries.size(); }
+		size_t hits() const { return _hits; }
+		size_t misses() const { return _misses; }
+
+		// the response cached for the key, or nullptr when missing or rendered under another etag
+		const cached_response* get(const std::string&, const std::string&);
+		void put(const std::string&, cached_response&&);
+		void clear();
+};
+
+// whether an If-None-Match header value matches the etag
+bool etag_match(const char*, const std::string&);
+
+// gzip content encoding of response bodies
+struct gzip {
+	// smaller bodies aren't worth compressing
+	static const size_t MIN_SIZE = 1024;
+	static const int LEVEL = 6;
+
+	// whether an Accept-Encoding header value accepts gzip
+	static bool accepted(const char*);
+	// compresses the buffer in place, streaming its chunks through deflate
+	// returns false, leaving the buffer as is, on failure or if not smaller
+	static bool compress(evbuffer*);
+};
+
+// a gzip body compressed as its chunks are sent, each chunk
+// is flushed so it can be inflated as soon as it is received
+class gzip_stream {
+	private:
+		::z_stream_s *_zs;
+		bool _ok;
+
+	public:
+		gzip_stream();
+		gzip_stream(const gzip_stream&) = delete;
+		~gzip_stream();
+
+		bool ok() const { return _ok; }
+
+		// adds the compressed input, left as is, to the output
+		// finish ends the gzip body, after which nothing can be compressed
+		bool compress(evbuffer *in, evbuffer *out, bool finish = false);
+};
+
+// writes json straight into an evbuffer, strings are escaped as they are added
+// commas are written between the values of an array or object as they are added
+class json_writer {
+	private:
+		evbuffer *_buf;
+		bool _comma = false;  // a value precedes in the current array or object
+
+		void sep() {
+			if (_comma)
+				evbuffer_add(_buf, ",", 1);
+		}
+
+	public:
+		json_writer(evbuffer *buf) : _buf{buf} {}
+
+		evbuffer* buffer() { return _buf; }
+
+		void begin_object() { this->sep(); evbuffer_add(_buf, "{", 1); _comma = false; }
+		void end_object() { evbuffer_add(_buf, "}", 1); _comma = true; }
+		void begin_array() { this->sep(); evbuffer_add(_buf, "[", 1); _comma = false; }
+		void end_array() { evbuffer_add(_buf, "]", 1); _comma = true; }
+
+		void key(const char*, size_t);
+		void key(const char *k) { this->key(k, strlen(k)); }
+		void value(const char*, size_t);
+		void value(const char *v) { this->value(v, strlen(v)); }
+		void value(const std::string& v) { this->value(v.data(), v.size()); }
+		void value(size_t);
+
+		// the code points of each level, as a dotted string
+		void rank(const tagd::rank&);
+		void predicate(const tagd::predicate&);
+		// object of the id, sub_relator, super_object, pos, rank and relations
+		void tag(const tagd::abstract_tag&);
+		void tags(const tagd::tag_set&);
+		// array of the errors, or of the code when there are none
+		void errors(const tagd::errorable&);
+
+		// adds a string escaped as the contents of a json string, without quotes
+		static void escape(evbuffer*, const char*, size_t);
+};
+
+// an open static file, with the headers computed when it was opened
+struct cached_file {
+	dev_t dev = 0;
+	ino_t ino = 0;
+	time_t mtime = 0;
+	off_t size = 0;
+	time_t checked = 0;  // when last validated against the file system
+
+	std::string content_type;
+	std::string content_length;
+	std::string etag;
+	std::string last_modified;
+
+	// small files are preloaded, others are sent from a segment that owns the open fd
+	std::string data;
+	evbuffer_file_segment *seg = nullptr;
+};
+
+// table of open static files by path, revalidated by inode, size and mtime
+// at most once a second rather than opened and stat'd for every request
+class file_cache {
+	public:
+		// files no larger are read into memory
+		static const size_t PRELOAD_MAX_SIZE = 16384;
+		static const time_t REVALIDATE_SECS = 1;
+
+	private:
+		size_t _max_files;
+		std::unordered_map<std::string, cached_file> _files;
+
+		// paths found missing, and when, so absent .gz siblings aren't opened on every request
+		std::unordered_map<std::string, time_t> _missing;
+
+		static void release(cached_file&);
+
+	public:
+		file_cache(size_t max_files = 1024) : _max_files{max_files} {}
+		file_cache(const file_cache&) = delete;
+		~file_cache() { this->clear(); }
+
+		size_t size() const { return _files.size(); }
+
+		// the cached file, opened or reopened when missing or changed
+		// returns nullptr and sets an error on the errorable when it can't be opened
+		// getting a file doesn't evict others, so a request can hold a file while getting another
+		const cached_file* get(const std::string&, tagd::errorable* = nullptr);
+		// the precompressed .gz sibling of a file, when present and not older than the file
+		const cached_file* get_gzip(const std::string&, const cached_file&);
+		// clears the cache once it holds max_files, called before a request gets its files
+		void trim() {
+			if (_files.size() >= _max_files)
+				this->clear();
+		}
+		void clear();
+};
+
+// latencies (microseconds) and statuses of the replies sent, exposed at /_stats
+// requests are all served by the one event loop thread, so these are plain counters
+struct request_stats {
+	// by route (the view of a tagd request, or the path of another callback) and HTTP method
+	std::map<std::pair<std::string, std::string>, tagdb::histogram> latency;
+	std::map<int, size_t> statuses;  // replies by status code
+
+	void record(const std::string& route, const char *method, int status, uint64_t us) {
+		latency[std::make_pair(route, std::string(method))].record(us);
+		if (status >= 0)
+			statuses[status]++;
+	}
+};
+
+// route of views that aren't tagd or registered views, so requesting
+// any view name doesn't add histograms without bound
+const std::string UNKNOWN_ROUTE{"_unknown"};
+
 struct viewspace;
+class request;
 
 class server : public tagsh, public tagd::errorable {
 	protected:
@@ -104,6 +341,12 @@ class server : public tagsh, public tagd::errorable {
 		uint16_t _bind_port;
 		evbase_t *_evbase;
 		evhtp_t  *_htp;
+		response_cache _responses;
+		file_cache _files;
+		// changes when the templates reload, and differs between server runs,
+		// so etags of the same tagspace version don't match across them
+		uint64_t _generation;
+		request_stats _stats;
 
 		void init() {
 			_evbase = event_base_new();
@@ -111,8 +354,9 @@ class server : public tagsh, public tagd::errorable {
 		}
 	public:
 		server(tagdb::sqlite *tdb, viewspace *vs, httagd_args *args)
-			: tagsh(tdb), _vws{vs}, _args{args}
+			: tagsh(tdb), _vws{vs}, _args{args}, _responses{args->response_cache_size}
 		{
+			this->new_generation();
 			_bind_addr = (!args->bind_addr.empty() ? args->bind_addr : "localhost");
 			_bind_port = (args->bind_port ? args->bind_port : 2112);
 			this->init();
@@ -139,6 +383,29 @@ class server : public tagsh, public tagd::errorable {
 			return _args;
 		}
 
+		response_cache* responses() {
+			return &_responses;
+		}
+
+		file_cache* files() {
+			return &_files;
+		}
+
+		request_stats* stats() {
+			return &_stats;
+		}
+
+		// the view requested, or the default view
+		std::string effective_view(const request&) const;
+		// the view, or UNKNOWN_ROUTE
+		std::string stats_route(const std::string&) const;
+
+		// etag of responses rendered from the current tagspace version and templates
+		std::string etag() const;
+
+		// the templates were reloaded, so cached responses and etags are stale
+		void new_generation();
+
 		tagd::code start();
 };
 
@@ -146,6 +413,7 @@ class base_transaction;
 class transaction;
 
 static const std::string DEFAULT_CONTENT_TYPE{"text/plain; charset=utf-8"};
+static const std::string JSON_CONTENT_TYPE{"application/json; charset=utf-8"};
 
 class response {
 	protected:
@@ -155,7 +423,18 @@ class response {
 		// send this code instead of translated tagd::code to EVHTP_RES_*
 		int _res_code = -1;
 		bool _reply_sent = false;
+		// the body is being sent in chunks, rather than from the output buffer
+		bool _chunked = false;
 		bool _header_content_type_added = false;
+		std::string _content_type;
+		std::string _content_encoding;
+		// OK replies of at least gzip::MIN_SIZE are compressed
+		bool _gzip = false;
+		// sent with OK and not modified replies
+		std::string _etag;
+		// when set, an OK reply is put into the cache under the key
+		response_cache *_cache = nullptr;
+		std::string _cache_key;
 
 	public:
 		response() = delete;
@@ -191,20 +470,53 @@ class response {
 			return _ev_req->buffer_out;
 		}
 
+		bool chunked() const {
+			return _chunked;
+		}
+
 		void send_reply(tagd::code c);
 		void send_ev_reply(evhtp_res);
+		// starts a chunked reply, which isn't cached, nor compressed but by the sender of the chunks
+		// chunks are sent with evhtp_send_reply_chunk() until evhtp_send_reply_chunk_end()
+		void send_chunk_start(evhtp_res);
 
 		void add_header(const std::string &key, const std::string &val);
 
 		void add_header_content_type(const std::string& content_type) {
 			this->add_header("Content-Type", content_type);
 			_header_content_type_added = true;
+			_content_type = content_type;
+		}
+
+		void etag(const std::string& e) {
+			_etag = e;
+		}
+
+		void gzip_reply(bool b) {
+			_gzip = b;
+		}
+
+		bool gzip_reply() const {
+			return _gzip;
+		}
+
+		void add_header_content_encoding(const std::string& encoding) {
+			this->add_header("Content-Encoding", encoding);
+			this->add_header("Vary", "Accept-Encoding");
+			_content_encoding = encoding;
+		}
+
+		void cache_reply(response_cache *cache, const std::string& key) {
+			_cache = cache;
+			_cache_key = key;
 		}
 		void add_header_content_length(size_t sz) {
 			this->add_header("Content-Length", std::to_string(sz));
 		}
 
 		tagd::code add_file(const std::string& path, tagd::errorable *err=nullptr);
+		// adds the contents of a cached file and its headers, the content type unless already added
+		void add_file(const cached_file&);
 
 		void add_error_str(const tagd::errorable &err) {
 			std::stringstream ss;
@@ -219,8 +531,14 @@ class response {
 const std::string QUERY_OPT_SEARCH{"q"};    // full text search
 const std::string QUERY_OPT_VIEW{"v"};		// view name
 const std::string QUERY_OPT_CONTEXT{"c"};   // tagspace context
+const std::string QUERY_OPT_LIMIT{"n"};     // max number of query results
+const std::string QUERY_OPT_AFTER{"a"};     // query results after tag id (next page)
+const std::string QUERY_OPT_DEPTH{"d"};     // max levels of descendants in query results
+const std::string QUERY_OPT_ON_ERROR{"on_error"};  // "continue" past failed statements of a batch
 
 const std::string DEFAULT_VIEW{"tagl"};     // plain text tagl
+const std::string JSON_VIEW{"json"};        // tags, query results and errors as json
+const std::string JSON_TREE_VIEW{"tree.json"};  // ancestors, siblings and children of a tag as json
 
 // supported HTTP methods
 typedef enum {
@@ -273,6 +591,18 @@ class request {
 			return this->query_opt(QUERY_OPT_CONTEXT);
 		}
 
+		std::string query_opt_limit() const {
+			return this->query_opt(QUERY_OPT_LIMIT);
+		}
+
+		std::string query_opt_after() const {
+			return this->query_opt(QUERY_OPT_AFTER);
+		}
+
+		std::string query_opt_depth() const {
+			return this->query_opt(QUERY_OPT_DEPTH);
+		}
+
 		const url_query_map_t &query_map() const {
 			return _query_map;
 		}
@@ -295,6 +625,86 @@ class request {
 		std::string abs_url_view(const std::string&) const;
 };
 
+// records a request in the stats when it goes out of scope, timed until its reply
+// was sent, or the first chunk of a streamed reply
+class request_timer {
+	private:
+		request_stats *_stats;
+		const response *_res;
+		std::string _route;
+		const char *_method;
+		std::chrono::steady_clock::time_point _start;
+
+	public:
+		request_timer(request_stats *stats, const request& req, const response *res, const std::string& route)
+			: _stats{stats}, _res{res}, _route{route},
+			  _method{evhtp_method_str(evhtp_request_get_method(req.ev_req()))},
+			  _start{std::chrono::steady_clock::now()} {}
+		request_timer(const request_timer&) = delete;
+
+		~request_timer();
+};
+
+// streams the ids of query results from a cursor as a chunked reply, rather than
+// collecting them into a tag_set and the output buffer before replying
+// the cursor is stepped until the connection's output buffer is past HIGH_WATERMARK,
+// then from the connection's on_write hook once the buffer has been written
+// deleted by the request's fini hook, when the reply is done or the connection closed
+class query_stream {
+	public:
+		// results are sent in chunks of about this size, and smaller results in a plain reply
+		static const size_t CHUNK_SIZE = 16384;
+		static const size_t HIGH_WATERMARK = 262144;
+
+	private:
+		evhtp_request_t *_ev_req;
+		// copy of the request session, as the cursor outlives the request callback
+		tagdb::session _ssn;
+		tagdb::cursor *_cursor = nullptr;
+		// results not yet sent, and once the cursor is deleted, the rest of the body
+		evbuffer *_chunk;
+		// comma separated ids, or with json, an object of the array of tags
+		bool _as_json;
+		json_writer _json;
+		// compresses the chunks of a gzipped reply
+		gzip_stream *_gz = nullptr;
+		size_t _n = 0;  // results added
+		bool _done = false;
+
+		query_stream(evhtp_request_t *req, const tagdb::session& ssn, bool as_json)
+			: _ev_req{req}, _ssn{ssn}, _chunk{evbuffer_new()}, _as_json{as_json}, _json{_chunk} {}
+
+		void add(const tagd::abstract_tag&);
+		// ends the body in the chunk, with the errors unless the results were exhausted
+		void add_tail(tagd::code);
+		// adds the tail and deletes the cursor
+		void end_results(tagd::code);
+		// sends and drains the buffer, compressed when gzipped, finish ends the gzip body
+		void send_chunk(evbuffer*, bool finish = false);
+		// sends chunks until the body is sent or the output buffer is past HIGH_WATERMARK
+		// the cursor isn't stepped across turns of the event loop, as other requests
+		// may write to the tagspace in between, so results are read before pausing
+		void pump();
+		void end();
+
+		static evhtp_res on_write(evhtp_connection_t*, void*);
+		static evhtp_res on_fini(evhtp_request_t*, void*);
+
+	public:
+		query_stream(const query_stream&) = delete;
+		~query_stream() {
+			delete _cursor;
+			delete _gz;
+			evbuffer_free(_chunk);
+		}
+
+		// TAGD_OK when the results are streamed, or fit in a chunk and were added to the response
+		// TS_NOT_FOUND, having added nothing, when there are no results
+		// otherwise the error, having added nothing, as set on the session
+		static tagd::code start(request*, response*, tagdb::tagdb*,
+			const tagd::interrogator&, tagdb::session*, tagdb::flags_t, bool as_json = false);
+};
+
 class httagl;
 
 class htscanner : public TAGL::scanner {
@@ -855,12 +1265,23 @@ class viewspace : public tagd::errorable {
 		view_map_t _views;
 		std::string _tpl_dir;
 
+		// templates are loaded once into the master cache, and expanded from
+		// a frozen clone of it, so expanding never checks or reloads files
+		ctemplate::TemplateCache *_tpl_master = nullptr;
+		ctemplate::TemplateCache *_tpl_frozen = nullptr;
+
 	public:
 		// called if no error view has been inserted for a given name
 		view fallback_error_view;
 
 		viewspace(const std::string& tpl_dir) :
 			_tpl_dir{tpl_dir}, fallback_error_view(default_error_view) {} 
+		viewspace(const viewspace&) = delete;
+
+		~viewspace() {
+			delete _tpl_frozen;
+			delete _tpl_master;
+		}
 		// TODO add a flags variable to get(), put(), etc.
 		// such as F_DISABLE_ERROR_REPORTING
 
@@ -880,6 +1301,15 @@ class viewspace : public tagd::errorable {
 			return tagd::TAGD_OK;
 		}
 
+		// whether a view of any action has the name
+		bool has_view(const std::string& name) const {
+			for (auto& it : _views) {
+				if (it.first.name() == name)
+					return true;
+			}
+			return false;
+		}
+
 		tagd::code get(view&& vw, const view_id& id) {
 			auto it = _views.find(id);
 			if (it == _views.end())
@@ -892,6 +1322,16 @@ class viewspace : public tagd::errorable {
 		std::string fpath(const std::string& tpl_fname) {
 			return tagd::io::concat_dir(_tpl_dir, tpl_fname); 
 		}
+
+		// loads and compiles each template in the tpl dir
+		tagd::code load_templates();
+		// reloads templates changed since they were loaded, and loads new ones
+		tagd::code reload_templates();
+
+		// templates to expand from, nullptr when not loaded
+		const ctemplate::TemplateCache* templates() const {
+			return _tpl_frozen;
+		}
 };
 
 class callback : public TAGL::callback {
@@ -919,6 +1359,11 @@ class callback : public TAGL::callback {
         void default_cmd_error();
         void default_empty();  // welcome message or home page
 
+		// methods that handle JSON_VIEW and JSON_TREE_VIEW, written straight to the output buffer
+		void json_cmd_get(const tagd::abstract_tag&, bool tree = false);
+		void json_cmd_query(const tagd::interrogator&);
+		void json_errors(const tagd::errorable&);
+
 		transaction* tx() {
 			return _tx;
 		}
@@ -928,28 +1373,89 @@ class callback : public TAGL::callback {
 		void output_errors(tagd::code);
 };
 
+// executes the statements POSTed to /_batch in one tagdb batch, each as a batch statement
+// the reply is a line per statement of its number, code and tag id, followed by its errors
+// gets and queries only report their code
+// a failed statement rolls back the batch and stops it, or with on_error=continue,
+// only the failed statement is rolled back; TAGL that can't be parsed always stops it
+class batch_callback : public callback {
+	protected:
+		bool _continue_on_error;
+		size_t _statements = 0;
+		size_t _failed = 0;
+		tagd::code _first_error = tagd::TAGD_OK;
+		bool _stopped = false;  // by unparsable TAGL
+
+		// executes a TOK_CMD_* within a batch statement
+		void statement(int, const tagd::abstract_tag&);
+		void add_summary(tagd::code, const tagd::id_type&);
+
+	public:
+		batch_callback(transaction* tx, bool continue_on_error)
+			: callback(tx), _continue_on_error{continue_on_error} {}
+
+		void cmd_get(const tagd::abstract_tag&);
+		void cmd_put(const tagd::abstract_tag&);
+		void cmd_del(const tagd::abstract_tag&);
+		void cmd_query(const tagd::interrogator&);
+		void cmd_error();
+		// ends the batch and sends the reply
+		void finish();
+};
+
 // ExpandEmitter class allows ctemplate to output directly to an evbuffer
+// ctemplate emits a marker or a few chars at a time, so output is coalesced
+// into chunks before being added to the evbuffer
 class  evbuffer_emitter : public ctemplate::ExpandEmitter {
 	private:
 		evbuffer* _buf;
+		std::string _chunk;
 
 	public:
-		evbuffer_emitter(evbuffer* b) : _buf{b} {}
+		static const size_t CHUNK_SIZE = 16384;
+
+		evbuffer_emitter(evbuffer* b) : _buf{b} {
+			_chunk.reserve(CHUNK_SIZE);
+		}
+
+		virtual ~evbuffer_emitter() {
+			this->flush();
+		}
+
+		// adds the coalesced output to the evbuffer
+		void flush() {
+			if (!_chunk.empty()) {
+				evbuffer_add(_buf, _chunk.data(), _chunk.size());
+				_chunk.clear();
+			}
+		}
 
 		virtual void Emit(char c) {
-			evbuffer_add(_buf, &c, sizeof(char));
+			_chunk.push_back(c);
+			if (_chunk.size() >= CHUNK_SIZE)
+				this->flush();
 		}
 
 		virtual void Emit(const std::string& s) {
-			evbuffer_add(_buf, s.c_str(), s.size());
+			this->Emit(s.data(), s.size());
 		}
 
 		virtual void Emit(const char* s) {
-			evbuffer_add(_buf, s, strlen(s));
+			this->Emit(s, strlen(s));
 		}
 
 		virtual void Emit(const char* s, size_t l) {
-			evbuffer_add(_buf, s, l);
+			if (_chunk.size() + l < CHUNK_SIZE) {
+				_chunk.append(s, l);
+				return;
+			}
+
+			// output larger than a chunk isn't copied
+			this->flush();
+			if (l < CHUNK_SIZE)
+				_chunk.append(s, l);
+			else
+				evbuffer_add(_buf, s, l);
 		}
 };
 
@@ -1011,6 +1517,9 @@ class tagd_template : public tagd::errorable {
 		// expand template filname; add errors to viewspace if they occur
 		tagd::code expand(viewspace&, const std::string&);
 
+		// adds output coalesced by an evbuffer output to its buffer
+		void flush();
+
 		// output of the last expansion
 		const std::string& output_str() const {
 			return _output_str;
@@ -1,13 +1,18 @@
 #include "httagd.h"
 #include "tagl.h"
 #include "parser.h"  // for CMDs
+#include <chrono>
+#include <cinttypes>
 #include <evhtp.h>
 
 // functions stat, open, close
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <zlib.h>
 
 bool HTTAGD_TRACE_ON = false;
 
@@ -152,6 +157,32 @@ void htscanner::scan_tagdurl_path(int cmd, const request& req) {
 		this->_driver->parse_tok(TOK_QUOTED_STR, new std::string(opt_search));
 	};
 
+	// query options: _has _limit = {n}, _after = {a}, _depth = {d}
+	std::string opt_limit = req.query_opt_limit();
+	std::string opt_after = req.query_opt_after();
+	std::string opt_depth = req.query_opt_depth();
+	auto f_parse_query_options = [this, &opt_limit, &opt_after, &opt_depth]() {
+		if (opt_limit.empty() && opt_after.empty() && opt_depth.empty())
+			return;
+
+		bool comma = false;
+		auto f_parse_option = [this, &comma](const char *option, int tok, const std::string &value) {
+			if (value.empty())
+				return;
+			if (comma)
+				this->_driver->parse_tok(TOK_COMMA, NULL);
+			this->_driver->parse_tok(TOK_TAG, new std::string(option));
+			this->_driver->parse_tok(TOK_EQ, NULL);
+			this->_driver->parse_tok(tok, new std::string(value));
+			comma = true;
+		};
+
+		this->_driver->parse_tok(TOK_RELATOR, new std::string(HARD_TAG_HAS));
+		f_parse_option(HARD_TAG_LIMIT, TOK_QUANTIFIER, opt_limit);
+		f_parse_option(HARD_TAG_AFTER, TOK_MODIFIER, opt_after);
+		f_parse_option(HARD_TAG_DEPTH, TOK_QUANTIFIER, opt_depth);
+	};
+
 	if ((path == "" || path == "/") && cmd == TOK_CMD_GET) {
 		if (opt_search.empty()) {
 			// home page or welcome message
@@ -294,6 +325,9 @@ void htscanner::scan_tagdurl_path(int cmd, const request& req) {
 
 	if (cmd == TOK_CMD_QUERY && !opt_search.empty())
 		f_parse_search_terms();
+
+	if (cmd == TOK_CMD_QUERY)
+		f_parse_query_options();
 }
 
 // translate an HTTP request into a TAGL statement and execute
@@ -400,12 +434,209 @@ void callback::default_cmd_del(const tagd::abstract_tag& t) {
 	}
 }
 
+tagd::code query_stream::start(request *req, response *res, tagdb::tagdb *tdb,
+		const tagd::interrogator& q, tagdb::session *ssn, tagdb::flags_t flags, bool as_json) {
+	auto qs = new query_stream(req->ev_req(), *ssn, as_json);
+	// the request session's error list is created lazily, so it may not
+	// have been copied, and errors of the copy would be lost to the request
+	qs->_ssn.share_errors(*ssn);
+
+	// errors are shared with the request session, but not its code
+	auto f_error = [qs, ssn](tagd::code tc) {
+		ssn->code(tc);
+		delete qs;
+		return tc;
+	};
+
+	qs->_cursor = tdb->query_cursor(q, &qs->_ssn, flags);
+	if (qs->_cursor == nullptr)
+		return f_error(qs->_ssn.code() == tagd::TAGD_OK ? tagd::TS_INTERNAL_ERR : qs->_ssn.code());
+
+	if (as_json) {
+		qs->_json.begin_object();
+		qs->_json.key("tags");
+		qs->_json.begin_array();
+	}
+
+	// fill the first chunk before replying, so small results are replied as usual
+	tagd::abstract_tag t;
+	tagd::code tc;
+	while ((tc = qs->_cursor->next(t)) == tagd::TAGD_OK) {
+		qs->add(t);
+		if (evbuffer_get_length(qs->_chunk) >= CHUNK_SIZE)
+			break;
+	}
+
+	if (tc == tagd::TS_NOT_FOUND) {
+		if (qs->_n == 0) {
+			// as tagdb::query() of no results
+			delete qs;
+			return (flags & tagdb::F_NO_NOT_FOUND_ERROR) ? tagd::TS_NOT_FOUND : ssn->code(tagd::TS_NOT_FOUND);
+		}
+		qs->add_tail(tc);
+		evbuffer_add_buffer(res->output_buffer(), qs->_chunk);
+		delete qs;
+		return tagd::TAGD_OK;
+	}
+
+	if (tc != tagd::TAGD_OK)
+		return f_error(tc);
+
+	if (!res->header_content_type_added())
+		res->add_header_content_type(DEFAULT_CONTENT_TYPE);
+	// send_reply() compresses the output buffer, but chunks are compressed as they are sent
+	if (res->gzip_reply()) {
+		qs->_gz = new gzip_stream();
+		res->add_header_content_encoding("gzip");
+	}
+	res->send_chunk_start(EVHTP_RES_OK);
+
+	evhtp_request_set_hook(qs->_ev_req, evhtp_hook_on_request_fini, (evhtp_hook)query_stream::on_fini, qs);
+	evhtp_connection_set_hook(evhtp_request_get_connection(qs->_ev_req),
+		evhtp_hook_on_write, (evhtp_hook)query_stream::on_write, qs);
+
+	qs->send_chunk(qs->_chunk);
+	qs->pump();
+	return tagd::TAGD_OK;
+}
+
+void query_stream::add(const tagd::abstract_tag& t) {
+	_n++;
+	if (_as_json) {
+		_json.tag(t);
+		return;
+	}
+
+	if (_n > 1)
+		evbuffer_add(_chunk, ", ", 2);
+	evbuffer_add(_chunk, t.id().data(), t.id().size());
+}
+
+void query_stream::add_tail(tagd::code tc) {
+	if (_as_json) {
+		_json.end_array();
+		if (tc != tagd::TS_NOT_FOUND) {
+			_json.key("errors");
+			_json.errors(_ssn);
+		}
+		_json.end_object();
+		evbuffer_add(_chunk, "\n", 1);
+		return;
+	}
+
+	evbuffer_add(_chunk, "\n", 1);
+	if (tc == tagd::TS_NOT_FOUND) {
+		evbuffer_add(_chunk, "\n", 1);
+	} else {
+		std::stringstream ss;
+		_ssn.print_errors(ss);
+		evbuffer_add(_chunk, ss.str().c_str(), ss.str().size());
+	}
+}
+
+void query_stream::end_results(tagd::code tc) {
+	// the status has been sent, so the errors end the body
+	if (tc != tagd::TS_NOT_FOUND)
+		LOG_ERROR( "query stream failed after " << _n << " results: " << tagd::code_str(tc) << std::endl )
+	this->add_tail(tc);
+
+	delete _cursor;
+	_cursor = nullptr;
+}
+
+void query_stream::send_chunk(evbuffer *buf, bool finish) {
+	if (_gz == nullptr) {
+		// an empty chunk would end the body
+		if (evbuffer_get_length(buf) > 0)
+			evhtp_send_reply_chunk(_ev_req, buf);
+		return;
+	}
+
+	evbuffer *z = evbuffer_new();
+	if (!_gz->compress(buf, z, finish))
+		LOG_ERROR( "query stream gzip failed after " << _n << " results" << std::endl )
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	if (evbuffer_get_length(z) > 0)
+		evhtp_send_reply_chunk(_ev_req, z);
+	evbuffer_free(z);
+}
+
+void query_stream::pump() {
+	evbuffer *output = bufferevent_get_output(
+		evhtp_connection_get_bev(evhtp_request_get_connection(_ev_req)));
+
+	tagd::abstract_tag t;
+	tagd::code tc;
+	while (_cursor != nullptr && evbuffer_get_length(output) < HIGH_WATERMARK) {
+		if ((tc = _cursor->next(t)) != tagd::TAGD_OK) {
+			this->end_results(tc);
+			break;
+		}
+		this->add(t);
+		if (evbuffer_get_length(_chunk) >= CHUNK_SIZE)
+			this->send_chunk(_chunk);
+	}
+
+	// past the watermark, the rest is read before pausing
+	if (_cursor != nullptr) {
+		while ((tc = _cursor->next(t)) == tagd::TAGD_OK)
+			this->add(t);
+		this->end_results(tc);
+		return;  // on_write resumes
+	}
+
+	// the rest of the body is sent a chunk at a time, as the output buffer drains
+	evbuffer *buf = evbuffer_new();
+	while (evbuffer_get_length(_chunk) > 0 && evbuffer_get_length(output) < HIGH_WATERMARK) {
+		evbuffer_remove_buffer(_chunk, buf, CHUNK_SIZE);
+		this->send_chunk(buf);
+	}
+	evbuffer_free(buf);
+
+	if (evbuffer_get_length(_chunk) == 0)
+		this->end();
+}
+
+void query_stream::end() {
+	_done = true;
+	evhtp_unset_hook(&evhtp_request_get_connection(_ev_req)->hooks, evhtp_hook_on_write);
+
+	this->send_chunk(_chunk, true);
+	evhtp_send_reply_chunk_end(_ev_req);
+}
+
+evhtp_res query_stream::on_write(evhtp_connection_t *, void *arg) {
+	auto qs = static_cast<query_stream*>(arg);
+	if (!qs->_done)
+		qs->pump();
+	return EVHTP_RES_OK;
+}
+
+evhtp_res query_stream::on_fini(evhtp_request_t *ev_req, void *arg) {
+	auto qs = static_cast<query_stream*>(arg);
+	// closed before the reply was done
+	if (!qs->_done)
+		evhtp_unset_hook(&evhtp_request_get_connection(ev_req)->hooks, evhtp_hook_on_write);
+	delete qs;
+	return EVHTP_RES_OK;
+}
+
 void callback::default_cmd_query(const tagd::interrogator& q) {
 	tagd::tag_set T;
 	auto ssn = _tx->drvr->session_ptr();
 	std::stringstream ss;
 
-	if (_tx->tdb->query(T, q, ssn, _driver->flags) == tagd::TAGD_OK) {
+	if (q.id() == HARD_TAG_HOW_MANY) {
+		size_t n;
+		if (_tx->tdb->query_count(n, q, ssn, _driver->flags) == tagd::TAGD_OK)
+			ss << n << std::endl;
+		else
+			ssn->print_errors(ss);
+	} else if (_tx->req->method == HTTP_GET) {
+		// results are added, or streamed when larger than a chunk
+		if (query_stream::start(_tx->req, _tx->res, _tx->tdb, q, ssn, _driver->flags) != tagd::TAGD_OK)
+			ssn->print_errors(ss);
+	} else if (_tx->tdb->query(T, q, ssn, _driver->flags) == tagd::TAGD_OK) {
 		tagd::print_tag_ids(T, ss);
 		ss << std::endl;
 	} else {
@@ -426,7 +657,115 @@ void callback::default_empty() {
 	_tx->res->add("This is tagd\n");
 }
 
+void callback::json_errors(const tagd::errorable& E) {
+	if (!_tx->res->header_content_type_added())
+		_tx->res->add_header_content_type(JSON_CONTENT_TYPE);
+
+	json_writer w(_tx->res->output_buffer());
+	w.begin_object();
+	w.key("errors");
+	w.errors(E);
+	w.end_object();
+	evbuffer_add(w.buffer(), "\n", 1);
+}
+
+void callback::json_cmd_get(const tagd::abstract_tag& t, bool tree) {
+	tagd::abstract_tag *T;
+	tagd::code tc;
+	auto ssn = _tx->drvr->session_ptr();
+
+	if (t.pos() == tagd::POS_URL) {
+		T = new tagd::url(t.id());
+		if (!T->ok())
+			tc = ssn->ferror(T->code(), "json_cmd_get parse url failed: %s", t.id().c_str());
+		else
+			tc = _tx->tdb->get(*T, static_cast<tagd::url *>(T)->hduri(), ssn, _driver->flags);
+	} else {
+		T = new tagd::abstract_tag();
+		tc = _tx->tdb->get(*T, t.id(), ssn, _driver->flags);
+	}
+
+	tagdb::tree_set S;
+	if (tc == tagd::TAGD_OK && tree)
+		tc = _tx->tdb->tree(S, T->id(), ssn, _driver->flags);
+
+	if (tc != tagd::TAGD_OK) {
+		this->json_errors(*ssn);
+		delete T;
+		return;
+	}
+
+	if (!_tx->res->header_content_type_added())
+		_tx->res->add_header_content_type(JSON_CONTENT_TYPE);
+
+	// added for HEAD requests as well, see cmd_get()
+	json_writer w(_tx->res->output_buffer());
+	if (tree) {
+		w.begin_object();
+		w.key("tag");
+		w.tag(*T);
+		w.key("ancestors");
+		w.tags(S.ancestors);
+		w.key("siblings");
+		w.tags(S.siblings);
+		w.key("children");
+		w.tags(S.children);
+		w.end_object();
+	} else {
+		w.tag(*T);
+	}
+	evbuffer_add(w.buffer(), "\n", 1);
+
+	delete T;
+}
+
+void callback::json_cmd_query(const tagd::interrogator& q) {
+	auto ssn = _tx->drvr->session_ptr();
+	if (!_tx->res->header_content_type_added())
+		_tx->res->add_header_content_type(JSON_CONTENT_TYPE);
+
+	json_writer w(_tx->res->output_buffer());
+	tagd::code tc;
+	tagd::tag_set T;
+
+	if (q.id() == HARD_TAG_HOW_MANY) {
+		size_t n;
+		tc = _tx->tdb->query_count(n, q, ssn, _driver->flags);
+		if (tc == tagd::TAGD_OK) {
+			w.begin_object();
+			w.key("count");
+			w.value(n);
+			w.end_object();
+			evbuffer_add(w.buffer(), "\n", 1);
+			return;
+		}
+	} else if (_tx->req->method == HTTP_GET) {
+		// results are added, or streamed when larger than a chunk
+		tc = query_stream::start(_tx->req, _tx->res, _tx->tdb, q, ssn, _driver->flags, true);
+		if (tc == tagd::TAGD_OK)
+			return;
+	} else {
+		tc = _tx->tdb->query(T, q, ssn, _driver->flags);
+	}
+
+	// no results without an error (F_NO_NOT_FOUND_ERROR) are an empty set
+	if (tc == tagd::TAGD_OK || (tc == tagd::TS_NOT_FOUND && !ssn->has_errors())) {
+		w.begin_object();
+		w.key("tags");
+		w.tags(T);
+		w.end_object();
+		evbuffer_add(w.buffer(), "\n", 1);
+		return;
+	}
+
+	this->json_errors(*ssn);
+}
+
 void callback::finish() {
+	// a streamed query ends its own reply
+	if (_tx->res->chunked())
+		return;
+
 	assert(!_tx->res->reply_sent());  // should only be called once
 	if (_tx->res->reply_sent()) {
 		LOG_ERROR( "reply already sent" << std::endl )
@@ -455,6 +794,10 @@ evhtp_res tagd_code_evhtp_res(tagd::code tc) {
 		case tagd::TS_DUPLICATE:
 			// using 409 - Conflict, 422 - Unprocessable Entity might also be exceptable
 			return EVHTP_RES_CONFLICT;
+		case tagd::TS_TIMEOUT:
+		case tagd::TS_CANCELLED:
+			// request budget exceeded, the server is still available to cheaper requests
+			return EVHTP_RES_SERVUNAVAIL;  // 503
 		default:
 			return EVHTP_RES_SERVERR;	// 500
 	}
@@ -474,11 +817,44 @@ void response::send_ev_reply(evhtp_res res) {
 
 	HTTAGD_LOG_TRACE( "send_reply(" << res << "): " << evhtp_res_str(res) << std::endl )
 
+	if (_gzip && res == EVHTP_RES_OK && evbuffer_get_length(_ev_req->buffer_out) >= gzip::MIN_SIZE) {
+		if (gzip::compress(_ev_req->buffer_out))
+			this->add_header_content_encoding("gzip");
+	}
+
+	if (!_etag.empty() && (res == EVHTP_RES_OK || res == EVHTP_RES_NOTMOD))
+		this->add_header("ETag", _etag);
+
+	if (_cache != nullptr && _cache->enabled() && res == EVHTP_RES_OK) {
+		size_t sz = evbuffer_get_length(_ev_req->buffer_out);
+		if (sz <= response_cache::MAX_BODY_SIZE) {
+			cached_response cr{_etag, _content_type, _content_encoding, std::string(sz, '\0')};
+			if (sz > 0)
+				evbuffer_copyout(_ev_req->buffer_out, &cr.body[0], sz);
+			_cache->put(_cache_key, std::move(cr));
+		}
+	}
+
 	evhtp_send_reply(_ev_req, res);
 	_res_code = res;
 	_reply_sent = true;
 }
 
+void response::send_chunk_start(evhtp_res res) {
+	assert(!_reply_sent);
+	if (_reply_sent) {
+		LOG_ERROR( "reply already sent" << std::endl )
+		return;
+	}
+
+	HTTAGD_LOG_TRACE( "send_chunk_start(" << res << "): " << evhtp_res_str(res) << std::endl )
+
+	evhtp_send_reply_chunk_start(_ev_req, res);
+	_res_code = res;
+	_reply_sent = true;
+	_chunked = true;
+}
+
 void response::add_header(const std::string &k, const std::string &v) {
 	HTTAGD_LOG_TRACE( "add_header(" << '"' << k << '"' << ", " << '"' << v << '"' << ")" << std::endl )
 
@@ -585,14 +961,7 @@ std::string request::abs_url_view(const std::string& view_name) const {
 }
 
 std::string transaction::effective_opt_view() const {
-	std::string view_opt = this->req->query_opt(QUERY_OPT_VIEW);
-	if (view_opt.empty()) {
-		if (!this->svr->args()->default_view.empty())
-			return this->svr->args()->default_view;  // user supplied default
-		else
-			return DEFAULT_VIEW;  // hard-coded default
-	}
-	return view_opt;
+	return this->svr->effective_view(*this->req);
 }
 
 void callback::output_errors(tagd::code ret_tc) {
@@ -673,6 +1042,8 @@ void callback::cmd_get(const tagd::abstract_tag& t) {
 	std::string view_name = _tx->effective_opt_view();
 	if (view_name == DEFAULT_VIEW)
 		return this->default_cmd_get(t);
+	if (view_name == JSON_VIEW || view_name == JSON_TREE_VIEW)
+		return this->json_cmd_get(t, (view_name == JSON_TREE_VIEW));
 
 	/*
 	 * In the case of HEAD requests, we are still adding
@@ -727,12 +1098,16 @@ void callback::cmd_query(const tagd::interrogator& q) {
 	HTTAGD_LOG_TRACE( "cmd_query()" << std::endl )
 
 	std::string view_name = _tx->effective_opt_view();
-	if (view_name == DEFAULT_VIEW)
+	if (view_name == JSON_VIEW)
+		return this->json_cmd_query(q);
+	// counts have no tag set to render
+	if (view_name == DEFAULT_VIEW || q.id() == HARD_TAG_HOW_MANY)
 		return this->default_cmd_query(q);
 
+	// views render all relations of the results, loaded with the results
 	tagd::tag_set R;
 	auto ssn = _tx->drvr->session_ptr();
-	tagd::code tc = _tx->tdb->query(R, q, ssn, _driver->flags);
+	tagd::code tc = _tx->tdb->query(R, q, ssn, (_driver->flags|tagdb::F_HYDRATE_RELATIONS));
 
 	if (tc != tagd::TAGD_OK) {
 		this->output_errors(tc);
@@ -756,8 +1131,11 @@ void callback::cmd_query(const tagd::interrogator& q) {
 void callback::cmd_error() {
 	HTTAGD_LOG_TRACE( "cmd_error()" << std::endl )
 
-	if (_tx->effective_opt_view() == DEFAULT_VIEW)
+	std::string view_name = _tx->effective_opt_view();
+	if (view_name == DEFAULT_VIEW)
 		return this->default_cmd_error();
+	if (view_name == JSON_VIEW || view_name == JSON_TREE_VIEW)
+		return this->json_errors(*_driver);
 
 	this->output_errors(_tx->code());
 }
@@ -769,6 +1147,11 @@ void callback::empty() {
 	std::string view_name = _tx->effective_opt_view();
 	if (view_name == DEFAULT_VIEW)
 		return this->default_empty();
+	if (view_name == JSON_VIEW || view_name == JSON_TREE_VIEW) {
+		_tx->res->add_header_content_type(JSON_CONTENT_TYPE);
+		_tx->res->add("{}\n");
+		return;
+	}
 
 	view vw;
 	tagd::code tc = _tx->vws->get(vw, empty_view_id(view_name));
@@ -784,6 +1167,115 @@ void callback::empty() {
 	}
 }
 
+void batch_callback::cmd_get(const tagd::abstract_tag& t) {
+	this->statement(TOK_CMD_GET, t);
+}
+
+void batch_callback::cmd_put(const tagd::abstract_tag& t) {
+	this->statement(TOK_CMD_PUT, t);
+}
+
+void batch_callback::cmd_del(const tagd::abstract_tag& t) {
+	this->statement(TOK_CMD_DEL, t);
+}
+
+void batch_callback::cmd_query(const tagd::interrogator& q) {
+	this->statement(TOK_CMD_QUERY, q);
+}
+
+void batch_callback::statement(int cmd, const tagd::abstract_tag& t) {
+	auto ssn = _tx->drvr->session_ptr();
+	_statements++;
+
+	tagd::code tc = _tx->tdb->statement_begin(ssn);
+	if (tc == tagd::TAGD_OK) {
+		switch (cmd) {
+			case TOK_CMD_PUT:
+				tc = _tx->tdb->put(t, ssn, _driver->flags);
+				break;
+			case TOK_CMD_DEL:
+				tc = _tx->tdb->del(t, ssn, _driver->flags);
+				break;
+			case TOK_CMD_GET: {
+				tagd::abstract_tag g;
+				tc = _tx->tdb->get(g, t.id(), ssn, _driver->flags);
+				break;
+			}
+			default: {
+				tagd::tag_set T;
+				tc = _tx->tdb->query(T, (const tagd::interrogator&)t, ssn, _driver->flags);
+			}
+		}
+
+		// a failed put may have written part of the tag
+		tagd::code end_tc = _tx->tdb->statement_end((tc == tagd::TAGD_OK), ssn);
+		if (tc == tagd::TAGD_OK)
+			tc = end_tc;
+	}
+
+	this->add_summary(tc, t.id());
+	if (tc == tagd::TAGD_OK)
+		return;
+
+	if (_continue_on_error) {
+		// so the driver goes on to the next statement
+		_tx->clear_errors();
+		ssn->code(tagd::TAGD_OK);
+	} else if (!_driver->has_errors()) {
+		// the driver stops given errors
+		_driver->ferror(tc, "batch stopped at statement: %zu", _statements);
+	}
+}
+
+void batch_callback::add_summary(tagd::code tc, const tagd::id_type& id) {
+	std::stringstream ss;
+	ss << _statements << '\t' << tagd::code_str(tc) << '\t' << id << std::endl;
+
+	if (tc != tagd::TAGD_OK) {
+		_failed++;
+		if (_first_error == tagd::TAGD_OK)
+			_first_error = tc;
+		_tx->print_errors(ss);
+	}
+
+	_tx->res->add(ss.str());
+}
+
+void batch_callback::cmd_error() {
+	// the parser can't resume after the statement, so even a continued batch stops
+	_statements++;
+	_stopped = true;
+	tagd::code tc = _driver->code();
+	this->add_summary((tc == tagd::TAGD_OK ? tagd::TAGL_ERR : tc), tagd::id_type());
+}
+
+void batch_callback::finish() {
+	auto ssn = _tx->drvr->session_ptr();
+
+	// errors of the statements have been added to the summary
+	_tx->clear_errors();
+
+	const bool commit = (_failed == 0 || _continue_on_error);
+	tagd::code tc = _tx->tdb->batch_end(commit, ssn);
+
+	std::stringstream ss;
+	if (tc != tagd::TAGD_OK) {
+		_tx->print_errors(ss);
+		ss << "rolled back " << _statements << " statements" << std::endl;
+	} else if (commit) {
+		ss << "committed " << (_statements - _failed) << " of " << _statements << " statements" << std::endl;
+		if (_stopped)
+			tc = _first_error;
+	} else {
+		ss << "rolled back " << _statements << " statements" << std::endl;
+		tc = _first_error;
+	}
+	_tx->res->add(ss.str());
+
+	_tx->res->add_header_content_type(DEFAULT_CONTENT_TYPE);
+	_tx->res->send_reply(tc);
+}
+
 tagd::code tagd_template::load(tagd::errorable& E, const std::string& fname) {
 	if (fname.empty()) {
 		E.ferror( tagd::TAGD_ERR, "template file required" );
@@ -808,17 +1300,77 @@ tagd::code tagd_template::expand(const std::string& fname) {
 		this->ferror( tagd::TAGD_ERR, "expand template failed: %s" , fname.c_str() );
 		return tagd::TAGD_ERR;
 	}
+	this->flush();
 
 	return tagd::TAGD_OK;
 }
 
 tagd::code tagd_template::expand(viewspace& vws, const std::string& fname) {
-	if (this->expand(vws.fpath(fname)) != tagd::TAGD_OK)
+	if (vws.templates() == nullptr) {
+		if (this->expand(vws.fpath(fname)) != tagd::TAGD_OK)
+			return vws.copy_errors(*this).code();
+		return tagd::TAGD_OK;
+	}
+
+	// templates were compiled by load_templates(), including those of include dictionaries
+	const std::string path = vws.fpath(fname);
+	if (!vws.templates()->ExpandNoLoad(path, ctemplate::DO_NOT_STRIP, _dict, nullptr, _output)) {
+		this->ferror( tagd::TAGD_ERR, "expand template failed: %s" , path.c_str() );
 		return vws.copy_errors(*this).code();
+	}
+	this->flush();
 
 	return tagd::TAGD_OK;
 }
 
+void tagd_template::flush() {
+	auto ev_output = dynamic_cast<evbuffer_emitter*>(_output);
+	if (ev_output != nullptr)
+		ev_output->flush();
+}
+
+tagd::code viewspace::load_templates() {
+	DIR *dir = opendir(_tpl_dir.c_str());
+	if (dir == nullptr)
+		return this->ferror(tagd::TAGD_ERR, "open template dir failed: %s", _tpl_dir.c_str());
+
+	if (_tpl_master == nullptr)
+		_tpl_master = new ctemplate::TemplateCache();
+
+	// templates already in the master are not loaded again
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != nullptr) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		std::string path = this->fpath(ent->d_name);
+		if (tagd::io::dir_exists(path))
+			continue;
+
+		if (!_tpl_master->LoadTemplate(path, ctemplate::DO_NOT_STRIP))
+			this->ferror(tagd::TAGD_ERR, "load template failed: %s", path.c_str());
+	}
+	closedir(dir);
+
+	if (this->has_errors())
+		return this->code();
+
+	// clones share the compiled templates
+	auto frozen = _tpl_master->Clone();
+	frozen->Freeze();
+	delete _tpl_frozen;
+	_tpl_frozen = frozen;
+
+	return tagd::TAGD_OK;
+}
+
+tagd::code viewspace::reload_templates() {
+	if (_tpl_master != nullptr)
+		_tpl_master->ReloadAllIfChanged(ctemplate::TemplateCache::IMMEDIATE_RELOAD);
+
+	return this->load_templates();
+}
+
 tagd_template* tagd_template::include(const std::string &id, const std::string &fname) {
 	auto d = _dict->AddIncludeDictionary(id);
 	d->SetFilename(fname);
@@ -874,6 +1426,345 @@ void tagd_template::set_tag_link(const url_query_map_t& query_map, const std::st
 	}
 }
 
+const cached_response* response_cache::get(const std::string& key, const std::string& etag) {
+	auto it = _index.find(key);
+	if (it == _index.end()) {
+		_misses++;
+		return nullptr;
+	}
+
+	// rendered from an older tagspace or templates
+	if (it->second->second.etag != etag) {
+		_entries.erase(it->second);
+		_index.erase(it);
+		_misses++;
+		return nullptr;
+	}
+
+	// move to the front as most recently used
+	_entries.splice(_entries.begin(), _entries, it->second);
+	_hits++;
+	return &_entries.front().second;
+}
+
+void response_cache::put(const std::string& key, cached_response&& cr) {
+	if (!this->enabled())
+		return;
+
+	auto it = _index.find(key);
+	if (it != _index.end()) {
+		it->second->second = std::move(cr);
+		_entries.splice(_entries.begin(), _entries, it->second);
+		return;
+	}
+
+	if (_entries.size() >= _max_size) {
+		_index.erase(_entries.back().first);
+		_entries.pop_back();
+	}
+
+	_entries.emplace_front(key, std::move(cr));
+	_index[key] = _entries.begin();
+}
+
+void response_cache::clear() {
+	_entries.clear();
+	_index.clear();
+}
+
+// the header is a comma separated list of codings with optional q values, e.g.
+// "gzip, deflate, br" or "gzip;q=1.0, identity; q=0.5, *;q=0"
+bool gzip::accepted(const char *accept_encoding) {
+	if (accept_encoding == nullptr)
+		return false;
+
+	std::stringstream ss(accept_encoding);
+	std::string coding;
+	while (std::getline(ss, coding, ',')) {
+		auto f_trim = [](std::string& str) {
+			str.erase(0, str.find_first_not_of(" \t"));
+			str.erase(str.find_last_not_of(" \t") + 1);
+		};
+
+		std::string params;
+		auto pos = coding.find(';');
+		if (pos != std::string::npos) {
+			params = coding.substr(pos + 1);
+			coding.erase(pos);
+		}
+		f_trim(coding);
+
+		if (coding != "gzip" && coding != "x-gzip" && coding != "*")
+			continue;
+
+		// q=0 refuses the coding
+		f_trim(params);
+		if (params.compare(0, 2, "q=") == 0 && atof(params.c_str() + 2) <= 0)
+			return false;
+
+		return true;
+	}
+
+	return false;
+}
+
+bool gzip::compress(evbuffer *buf) {
+	size_t len = evbuffer_get_length(buf);
+	if (len == 0)
+		return false;
+
+	gzip_stream gz;
+	evbuffer *out = evbuffer_new();
+	bool ok = gz.compress(buf, out, true) && (evbuffer_get_length(out) < len);
+	if (ok) {
+		evbuffer_drain(buf, len);
+		evbuffer_add_buffer(buf, out);
+	}
+	evbuffer_free(out);
+
+	return ok;
+}
+
+gzip_stream::gzip_stream() : _zs{new z_stream} {
+	memset(_zs, 0, sizeof(z_stream));
+	// 16 added to the window bits writes a gzip header and trailer
+	_ok = (deflateInit2(_zs, gzip::LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+}
+
+gzip_stream::~gzip_stream() {
+	deflateEnd(_zs);
+	delete _zs;
+}
+
+bool gzip_stream::compress(evbuffer *in, evbuffer *out, bool finish) {
+	if (!_ok)
+		return false;
+
+	int n = evbuffer_peek(in, -1, nullptr, nullptr, 0);
+	std::vector<evbuffer_iovec> v_in(n);
+	evbuffer_peek(in, -1, nullptr, v_in.data(), n);
+
+	const size_t OUT_CHUNK_SIZE = 16384;
+
+	// the input chunks, then the flush
+	for (int i = 0; _ok && i <= n; i++) {
+		int flush = Z_NO_FLUSH;
+		if (i < n) {
+			_zs->next_in = static_cast<Bytef*>(v_in[i].iov_base);
+			_zs->avail_in = v_in[i].iov_len;
+		} else {
+			flush = (finish ? Z_FINISH : Z_SYNC_FLUSH);
+			_zs->next_in = nullptr;
+			_zs->avail_in = 0;
+		}
+
+		int rc;
+		do {
+			evbuffer_iovec v;
+			if (evbuffer_reserve_space(out, OUT_CHUNK_SIZE, &v, 1) < 1) {
+				_ok = false;
+				break;
+			}
+			size_t reserved = v.iov_len;
+			_zs->next_out = static_cast<Bytef*>(v.iov_base);
+			_zs->avail_out = reserved;
+
+			rc = deflate(_zs, flush);
+			if (rc == Z_STREAM_ERROR) {
+				_ok = false;
+				break;
+			}
+
+			v.iov_len = reserved - _zs->avail_out;
+			evbuffer_commit_space(out, &v, 1);
+		} while (_zs->avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+	}
+
+	return _ok;
+}
+
+void json_writer::escape(evbuffer *buf, const char *s, size_t sz) {
+	static const char HEX[] = "0123456789abcdef";
+
+	// runs of bytes that need no escape are added at once
+	size_t run = 0;
+	for (size_t i = 0; i < sz; i++) {
+		unsigned char c = static_cast<unsigned char>(s[i]);
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		if (i > run)
+			evbuffer_add(buf, s + run, i - run);
+		run = i + 1;
+
+		switch (c) {
+			case '"':  evbuffer_add(buf, "\\\"", 2); break;
+			case '\\': evbuffer_add(buf, "\\\\", 2); break;
+			case '\n': evbuffer_add(buf, "\\n", 2); break;
+			case '\r': evbuffer_add(buf, "\\r", 2); break;
+			case '\t': evbuffer_add(buf, "\\t", 2); break;
+			default: {
+				char u[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+				evbuffer_add(buf, u, sizeof(u));
+			}
+		}
+	}
+
+	if (sz > run)
+		evbuffer_add(buf, s + run, sz - run);
+}
+
+void json_writer::key(const char *k, size_t sz) {
+	this->sep();
+	evbuffer_add(_buf, "\"", 1);
+	escape(_buf, k, sz);
+	evbuffer_add(_buf, "\":", 2);
+	_comma = false;
+}
+
+void json_writer::value(const char *v, size_t sz) {
+	this->sep();
+	evbuffer_add(_buf, "\"", 1);
+	escape(_buf, v, sz);
+	evbuffer_add(_buf, "\"", 1);
+	_comma = true;
+}
+
+void json_writer::value(size_t n) {
+	this->sep();
+	evbuffer_add_printf(_buf, "%zu", n);
+	_comma = true;
+}
+
+// decodes the utf8 of the rank itself, rather than going through rank::dotted_str()
+void json_writer::rank(const tagd::rank& r) {
+	this->sep();
+	evbuffer_add(_buf, "\"", 1);
+
+	// code points dotted, as rank::dotted_str()
+	const std::string data(r.c_str());
+	size_t pos = 0;
+	while (pos < data.size()) {
+		uint32_t cp = tagd::utf8_read(data, &pos);
+		evbuffer_add_printf(_buf, (pos < data.size() ? "%" PRIu32 "." : "%" PRIu32), cp);
+	}
+
+	evbuffer_add(_buf, "\"", 1);
+	_comma = true;
+}
+
+void json_writer::predicate(const tagd::predicate& p) {
+	this->begin_object();
+	this->key("relator");
+	this->value(p.relator);
+	this->key("object");
+	this->value(p.object);
+	if (!p.modifier.empty()) {
+		if (p.opr8r != tagd::OP_EQ) {
+			this->key("operator");
+			this->value(p.op_c_str());
+		}
+		this->key("modifier");
+		this->value(p.modifier);
+	}
+	this->end_object();
+}
+
+void json_writer::tag(const tagd::abstract_tag& t) {
+	this->begin_object();
+	this->key("id");
+	this->value(t.id());
+	if (!t.sub_relator().empty()) {
+		this->key("sub_relator");
+		this->value(t.sub_relator());
+	}
+	if (!t.super_object().empty()) {
+		this->key("super_object");
+		this->value(t.super_object());
+	}
+	this->key("pos");
+	this->value(tagd::pos_str(t.pos()));
+	if (!t.rank().empty()) {
+		this->key("rank");
+		this->rank(t.rank());
+	}
+	if (!t.relations.empty()) {
+		this->key("relations");
+		this->begin_array();
+		for (auto& p : t.relations)
+			this->predicate(p);
+		this->end_array();
+	}
+	this->end_object();
+}
+
+void json_writer::tags(const tagd::tag_set& T) {
+	this->begin_array();
+	for (auto& t : T)
+		this->tag(t);
+	this->end_array();
+}
+
+void json_writer::errors(const tagd::errorable& E) {
+	this->begin_array();
+	if (E.size()) {
+		for (auto& err : E.errors())
+			this->tag(err);
+	} else {
+		this->begin_object();
+		this->key("id");
+		this->value(tagd::code_str(E.code()));
+		this->end_object();
+	}
+	this->end_array();
+}
+
+// the header is a comma separated list of quoted etags (optionally weak W/"..."), or *
+bool etag_match(const char *if_none_match, const std::string& etag) {
+	if (if_none_match == nullptr || etag.empty())
+		return false;
+
+	const char *p = if_none_match;
+	while (*p == ' ' || *p == '\t') p++;
+	if (*p == '*')
+		return true;
+
+	// etags are quoted, so one can't match inside another
+	return (strstr(p, etag.c_str()) != nullptr);
+}
+
+std::string server::etag() const {
+	return std::string("\"")
+		.append(std::to_string(_generation))
+		.append("-")
+		.append(std::to_string(_tdb->version()))
+		.append("\"");
+}
+
+std::string server::effective_view(const request& req) const {
+	std::string view_opt = req.query_opt(QUERY_OPT_VIEW);
+	if (view_opt.empty()) {
+		if (!_args->default_view.empty())
+			return _args->default_view;  // user supplied default
+		else
+			return DEFAULT_VIEW;  // hard-coded default
+	}
+	return view_opt;
+}
+
+std::string server::stats_route(const std::string& view_name) const {
+	if (view_name == DEFAULT_VIEW || view_name == JSON_VIEW || view_name == JSON_TREE_VIEW
+			|| _vws->has_view(view_name))
+		return view_name;
+	return UNKNOWN_ROUTE;
+}
+
+void server::new_generation() {
+	_generation = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	_responses.clear();
+}
+
 void main_cb(evhtp_request_t *ev_req, void *arg) {
 	httagd::server *svr = (httagd::server*)arg;
 
@@ -886,6 +1777,46 @@ void main_cb(evhtp_request_t *ev_req, void *arg) {
 
 	request req(ev_req);
 	response res(ev_req);
+	request_timer timer(svr->stats(), req, &res, svr->stats_route(svr->effective_view(req)));
+
+	// reads of an unchanged tagspace are answered by etag or the response cache, without tagdb
+	htp_method ev_method = evhtp_request_get_method(ev_req);
+	if (ev_method == htp_method_GET || ev_method == htp_method_HEAD) {
+		// the gzip encoded variant has its own etag and cache entry
+		bool accepts_gzip = (ev_method == htp_method_GET
+				&& gzip::accepted(evhtp_header_find(ev_req->headers_in, "Accept-Encoding")));
+		std::string etag = svr->etag();
+		if (accepts_gzip)
+			etag.insert(etag.size() - 1, "-gzip");
+		res.etag(etag);
+
+		if (etag_match(evhtp_header_find(ev_req->headers_in, "If-None-Match"), etag)) {
+			res.send_ev_reply(EVHTP_RES_NOTMOD);
+			return;
+		}
+
+		if (ev_method == htp_method_GET) {
+			std::string key(req.path());
+			if (ev_req->uri->query_raw != NULL)
+				key.append("?").append((const char*)ev_req->uri->query_raw);
+			if (accepts_gzip)
+				key.append(" gzip");
+
+			auto cr = svr->responses()->get(key, etag);
+			if (cr != nullptr) {
+				if (!cr->content_type.empty())
+					res.add_header_content_type(cr->content_type);
+				if (!cr->content_encoding.empty())
+					res.add_header_content_encoding(cr->content_encoding);
+				res.add(cr->body);
+				res.send_ev_reply(EVHTP_RES_OK);
+				return;
+			}
+
+			res.gzip_reply(accepts_gzip);
+			res.cache_reply(svr->responses(), key);
+		}
+	}
 
 	// nullptr driver becuase circular depends httagl
 	transaction tx(svr, &req, &res, tdb, nullptr, vws);
@@ -893,6 +1824,8 @@ void main_cb(evhtp_request_t *ev_req, void *arg) {
 	auto ssn = tdb->get_session();
 	if (!req.query_opt_context().empty())
 		ssn.push_context(req.query_opt_context());
+	if (svr->args()->request_budget)
+		ssn.timeout(std::chrono::milliseconds(svr->args()->request_budget));
 
 	callback CB(&tx);
 	httagl tagl(tdb, &CB, &ssn);
@@ -962,11 +1895,197 @@ tagd::code response::add_file(const std::string& path, tagd::errorable* err) {
 	return tagd::TAGD_OK;
 }
 
+void file_cache::release(cached_file& f) {
+	if (f.seg != nullptr) {
+		// closes the fd once replies still sending the segment are done with it
+		evbuffer_file_segment_free(f.seg);
+		f.seg = nullptr;
+	}
+}
+
+const cached_file* file_cache::get(const std::string& path, tagd::errorable *err) {
+	auto f_ferror =
+		[err](tagd::code tc, const char* msg, const char *arg) -> const cached_file* {
+			if(HTTAGD_TRACE_ON)
+				printf(msg, arg);
+			if (err != nullptr)
+				err->ferror(tc, msg, arg);
+			return nullptr;
+		};
+
+	time_t now = time(nullptr);
+	struct stat st;
+
+	auto it = _files.find(path);
+	if (it != _files.end()) {
+		cached_file& f = it->second;
+		if ((now - f.checked) < REVALIDATE_SECS)
+			return &f;
+
+		if (stat(path.c_str(), &st) == 0 && st.st_dev == f.dev && st.st_ino == f.ino
+				&& st.st_size == f.size && st.st_mtime == f.mtime) {
+			f.checked = now;
+			return &f;
+		}
+
+		// changed or removed
+		release(f);
+		_files.erase(it);
+	}
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return f_ferror(tagd::TS_NOT_FOUND, "failed to open: %s", path.c_str());
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return f_ferror(tagd::TS_NOT_FOUND, "stat failed: %s", path.c_str());
+	}
+
+	cached_file f;
+	f.dev = st.st_dev;
+	f.ino = st.st_ino;
+	f.size = st.st_size;
+	f.mtime = st.st_mtime;
+	f.checked = now;
+
+	if (static_cast<size_t>(st.st_size) <= PRELOAD_MAX_SIZE) {
+		f.data.resize(st.st_size);
+		size_t n = 0;
+		while (n < f.data.size()) {
+			ssize_t r = read(fd, &f.data[n], f.data.size() - n);
+			if (r <= 0) {
+				close(fd);
+				return f_ferror(tagd::TAGD_ERR, "read failed: %s", path.c_str());
+			}
+			n += r;
+		}
+		close(fd);
+	} else {
+		f.seg = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE);
+		if (f.seg == nullptr) {
+			close(fd);
+			return f_ferror(tagd::TAGD_ERR, "evbuffer_file_segment_new failed: %s", path.c_str());
+		}
+	}
+
+	auto pos = tagd::file::ext_pos(path);
+	if (pos != std::string::npos) {
+		const char *media_type = tagd::file::ext_media_type(path.substr(pos));
+		if (media_type != nullptr)
+			f.content_type = media_type;
+	}
+
+	f.content_length = std::to_string(st.st_size);
+
+	std::stringstream ss;
+	ss << std::hex << '"' << st.st_ino << '-' << st.st_size << '-' << st.st_mtime << '"';
+	f.etag = ss.str();
+
+	char date[64];
+	struct tm tm;
+	gmtime_r(&st.st_mtime, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	f.last_modified = date;
+
+	return &(_files[path] = std::move(f));
+}
+
+const cached_file* file_cache::get_gzip(const std::string& path, const cached_file& f) {
+	std::string gz_path(path);
+	gz_path.append(".gz");
+
+	time_t now = time(nullptr);
+	auto it = _missing.find(gz_path);
+	if (it != _missing.end()) {
+		if ((now - it->second) < REVALIDATE_SECS)
+			return nullptr;
+		_missing.erase(it);
+	}
+
+	auto gz = this->get(gz_path);
+	if (gz == nullptr) {
+		if (_missing.size() >= _max_files)
+			_missing.clear();
+		_missing[gz_path] = now;
+		return nullptr;
+	}
+
+	// a stale sibling isn't the same content
+	return (gz->mtime >= f.mtime ? gz : nullptr);
+}
+
+void file_cache::clear() {
+	for (auto& p : _files)
+		release(p.second);
+	_files.clear();
+	_missing.clear();
+}
+
+void response::add_file(const cached_file& f) {
+	if (!_header_content_type_added && !f.content_type.empty())
+		this->add_header_content_type(f.content_type);
+	this->add_header("Content-Length", f.content_length);
+	this->add_header("ETag", f.etag);
+	this->add_header("Last-Modified", f.last_modified);
+
+	if (f.seg != nullptr) {
+		// sent by sendfile or mmap, without copying into the buffer
+		evbuffer_add_file_segment(_ev_req->buffer_out, f.seg, 0, f.size);
+	} else if (!f.data.empty()) {
+		this->add(f.data);
+	}
+}
+
+// whether the client has the current version of the cached file
+static bool
+file_not_modified(evhtp_request_t *evreq, const cached_file& f) {
+	const char *inm = evhtp_header_find(evreq->headers_in, "If-None-Match");
+	if (inm != nullptr)
+		return httagd::etag_match(inm, f.etag);
+
+	const char *ims = evhtp_header_find(evreq->headers_in, "If-Modified-Since");
+	return (ims != nullptr && f.last_modified == ims);
+}
+
+// send a file from the servers file cache, or a 304 when not modified
+static tagd::code
+send_cached_file(httagd::server *svr, base_transaction& tx, const std::string& path) {
+	// evicted up front, so the file stays cached while its gzip sibling is gotten
+	svr->files()->trim();
+	auto f = svr->files()->get(path, &tx);
+	if (f == nullptr)
+		return tx.code();
+
+	// the precompressed sibling is sent with the media type of the file
+	auto evreq = tx.req->ev_req();
+	if (httagd::gzip::accepted(evhtp_header_find(evreq->headers_in, "Accept-Encoding"))) {
+		auto gz = svr->files()->get_gzip(path, *f);
+		if (gz != nullptr) {
+			if (!tx.res->header_content_type_added() && !f->content_type.empty())
+				tx.res->add_header_content_type(f->content_type);
+			tx.res->add_header_content_encoding("gzip");
+			f = gz;
+		}
+	}
+
+	if (file_not_modified(evreq, *f)) {
+		tx.res->add_header("ETag", f->etag);
+		tx.res->add_header("Last-Modified", f->last_modified);
+		tx.res->send_ev_reply(EVHTP_RES_NOTMOD);
+		return tagd::TAGD_OK;
+	}
+
+	tx.res->add_file(*f);
+	return tagd::TAGD_OK;
+}
+
 static void
 file_cb(evhtp_request_t * evreq, void * arg) {
 	httagd::server *svr = (httagd::server*)arg;
 	request req(evreq);
 	response res(evreq);
+	request_timer timer(svr->stats(), req, &res, "/_file");
 	base_transaction tx(svr, &req, &res);
 	tagd::code tc;
 	size_t pos;
@@ -988,18 +2107,10 @@ file_cb(evhtp_request_t * evreq, void * arg) {
 	HTTAGD_LOG_TRACE( "req path: " << req.path() << std::endl )
 	HTTAGD_LOG_TRACE( "sys path: " << path << std::endl )
 
-	// add content_type given file extension if possible
-	pos = tagd::file::ext_pos(path);
-	if (pos != std::string::npos) {
-		auto ext = path.substr(pos);
-		const char *media_type = tagd::file::ext_media_type(ext);
-		if(media_type != nullptr)
-			res.add_header_content_type(media_type);
-
-		HTTAGD_LOG_TRACE( "media_type: " << media_type << std::endl )
-	}
-
-	tc = res.add_file(path, &tx);
+	// content type given the file extension is computed when cached
+	tc = send_cached_file(svr, tx, path);
+	if (res.reply_sent())
+		return;
 
 	if (tc != tagd::TAGD_OK) {
 		if (HTTAGD_TRACE_ON)
@@ -1023,10 +2134,14 @@ favicon_cb(evhtp_request_t * evreq, void * arg) {
 
 	request req(evreq);
 	response res(evreq);
+	request_timer timer(svr->stats(), req, &res, "/favicon.ico");
 	base_transaction tx(svr, &req, &res);
 
 	res.add_header_content_type("image/x-icon");
-	tagd::code tc = res.add_file(svr->args()->favicon, &tx);
+	tagd::code tc = send_cached_file(svr, tx, svr->args()->favicon);
+	if (res.reply_sent())
+		return;
+
 	if (tc != tagd::TAGD_OK) {
 		// TODO log errors
 		if (HTTAGD_TRACE_ON)
@@ -1036,6 +2151,269 @@ favicon_cb(evhtp_request_t * evreq, void * arg) {
 	res.send_reply(tc);
 }
 
+// executes the TAGL POSTed as one tagdb batch, see batch_callback
+static void
+batch_cb(evhtp_request_t * evreq, void * arg) {
+	httagd::server *svr = (httagd::server*)arg;
+	auto tdb = svr->tdb();
+
+	request req(evreq);
+	response res(evreq);
+	request_timer timer(svr->stats(), req, &res, "/_batch");
+
+	if (evhtp_request_get_method(evreq) != htp_method_POST) {
+		res.add_header("Allow", "POST");
+		res.add_header_content_type(DEFAULT_CONTENT_TYPE);
+		res.add("batches must be POSTed\n");
+		res.send_ev_reply(EVHTP_RES_METHNALLOWED);
+		return;
+	}
+	req.method = HTTP_POST;
+
+	transaction tx(svr, &req, &res, tdb, nullptr, svr->vws());
+
+	auto ssn = tdb->get_session();
+	if (!req.query_opt_context().empty())
+		ssn.push_context(req.query_opt_context());
+	if (svr->args()->request_budget)
+		ssn.timeout(std::chrono::milliseconds(svr->args()->request_budget));
+
+	batch_callback CB(&tx, (req.query_opt(QUERY_OPT_ON_ERROR) == "continue"));
+	httagl tagl(tdb, &CB, &ssn);
+	tx.drvr = &tagl;
+
+	tx.share_errors(tagl)
+	  .share_errors(*tdb)
+	  .share_errors(ssn);
+
+	// the callback ends the batch and replies when the driver finishes
+	if (tdb->batch_begin(&ssn) == tagd::TAGD_OK) {
+		tagl.execute(evreq->buffer_in);
+	} else {
+		std::stringstream ss;
+		tx.print_errors(ss);
+		res.add(ss.str());
+		res.add_header_content_type(DEFAULT_CONTENT_TYPE);
+		res.send_reply(ssn.code());
+	}
+
+	if (HTTAGD_TRACE_ON && tx.has_errors())
+		tx.print_errors();
+
+	// tdb will accumulate errors between requests, so clear
+	if (tdb->has_errors())
+		tdb->clear_errors();
+}
+
+request_timer::~request_timer() {
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - _start);
+	_stats->record(_route, _method, _res->res_code(), us.count());
+}
+
+// prometheus histogram buckets are powers of two microseconds, where the tagdb::histogram
+// bucket boundaries are exact, so a bucket counts the values below its le
+static const uint64_t PROMETHEUS_MIN_LE = 1 << 5;   // 32us
+static const uint64_t PROMETHEUS_MAX_LE = 1 << 24;  // ~16.8s
+
+static void prometheus_help(evbuffer *buf, const char *name, const char *type, const char *help) {
+	evbuffer_add_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// a histogram of microseconds in seconds, the labels are a comma separated list of label="value"
+static void prometheus_histogram(evbuffer *buf, const char *name, const std::string& labels, const tagdb::histogram& h) {
+	for (uint64_t le = PROMETHEUS_MIN_LE; le <= PROMETHEUS_MAX_LE; le <<= 1) {
+		evbuffer_add_printf(buf, "%s_bucket{%s,le=\"%.6f\"} %" PRIu64 "\n",
+			name, labels.c_str(), (le / 1e6), h.count_below(le));
+	}
+	evbuffer_add_printf(buf, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels.c_str(), h.count());
+	evbuffer_add_printf(buf, "%s_sum{%s} %.6f\n", name, labels.c_str(), (h.sum() / 1e6));
+	evbuffer_add_printf(buf, "%s_count{%s} %" PRIu64 "\n", name, labels.c_str(), h.count());
+}
+
+static void prometheus_counter(evbuffer *buf, const char *name, const char *help, uint64_t n) {
+	prometheus_help(buf, name, "counter", help);
+	evbuffer_add_printf(buf, "%s %" PRIu64 "\n", name, n);
+}
+
+// prometheus text exposition format
+static void stats_prometheus(server *svr, evbuffer *buf) {
+	auto stats = svr->stats();
+	auto tdb = svr->tdb();
+
+	// route and method labels are of known views and methods, needing no escapes
+	prometheus_help(buf, "httagd_request_duration_seconds", "histogram",
+		"Time to the reply, or to the first chunk of a streamed reply");
+	for (auto& it : stats->latency) {
+		std::string labels("route=\"");
+		labels.append(it.first.first).append("\",method=\"").append(it.first.second).append("\"");
+		prometheus_histogram(buf, "httagd_request_duration_seconds", labels, it.second);
+	}
+
+	prometheus_help(buf, "httagd_responses_total", "counter", "Replies by status code");
+	for (auto& it : stats->statuses)
+		evbuffer_add_printf(buf, "httagd_responses_total{status=\"%d\"} %zu\n", it.first, it.second);
+
+	prometheus_counter(buf, "httagd_response_cache_hits_total",
+		"Replies from the rendered response cache", svr->responses()->hits());
+	prometheus_counter(buf, "httagd_response_cache_misses_total",
+		"Replies not in the rendered response cache", svr->responses()->misses());
+
+	prometheus_help(buf, "tagdb_op_duration_seconds", "histogram", "Time of tagdb operations");
+	for (int op = 0; op < tagdb::STAT_OP_COUNT; op++) {
+		std::string labels("op=\"");
+		labels.append(tagdb::stat_op_str(static_cast<tagdb::stat_op>(op))).append("\"");
+		prometheus_histogram(buf, "tagdb_op_duration_seconds", labels, tdb->ops().latency[op]);
+	}
+
+	auto st = tdb->statement_totals();
+	prometheus_counter(buf, "tagdb_sqlite_vm_steps_total",
+		"SQLite virtual machine steps of prepared statements", st.vm_steps);
+	prometheus_counter(buf, "tagdb_sqlite_fullscan_steps_total",
+		"SQLite full table scan steps of prepared statements", st.fullscan_steps);
+	prometheus_counter(buf, "tagdb_sqlite_statement_prepares_total",
+		"Statements prepared, missing from the statement cache", st.prepares);
+	prometheus_counter(buf, "tagdb_sqlite_statement_uses_total",
+		"Statements handed out, prepared or from the statement cache", st.uses);
+
+	auto& qs = tdb->query_stats();
+	prometheus_counter(buf, "tagdb_query_cache_hits_total", "Query results from the query cache", qs.hits);
+	prometheus_counter(buf, "tagdb_query_cache_misses_total", "Query results not in the query cache", qs.misses);
+	prometheus_counter(buf, "tagdb_query_cache_evictions_total", "Least recently used query results evicted", qs.evictions);
+	prometheus_counter(buf, "tagdb_query_cache_invalidations_total", "Query results invalidated by writes", qs.invalidations);
+}
+
+// count, sum, max and percentiles of a histogram, as members of the current object
+static void json_histogram(json_writer& w, const tagdb::histogram& h) {
+	w.key("count");
+	w.value(h.count());
+	w.key("sum_us");
+	w.value(h.sum());
+	w.key("max_us");
+	w.value(h.max());
+	w.key("p50_us");
+	w.value(h.percentile(0.5));
+	w.key("p90_us");
+	w.value(h.percentile(0.9));
+	w.key("p99_us");
+	w.value(h.percentile(0.99));
+}
+
+static void stats_json(server *svr, evbuffer *buf) {
+	auto stats = svr->stats();
+	auto tdb = svr->tdb();
+	json_writer w(buf);
+
+	w.begin_object();
+	w.key("requests");
+	w.begin_array();
+	for (auto& it : stats->latency) {
+		w.begin_object();
+		w.key("route");
+		w.value(it.first.first);
+		w.key("method");
+		w.value(it.first.second);
+		json_histogram(w, it.second);
+		w.end_object();
+	}
+	w.end_array();
+
+	w.key("statuses");
+	w.begin_object();
+	for (auto& it : stats->statuses) {
+		char status[16];
+		int sz = snprintf(status, sizeof(status), "%d", it.first);
+		w.key(status, sz);
+		w.value(it.second);
+	}
+	w.end_object();
+
+	w.key("response_cache");
+	w.begin_object();
+	w.key("hits");
+	w.value(svr->responses()->hits());
+	w.key("misses");
+	w.value(svr->responses()->misses());
+	w.end_object();
+
+	w.key("ops");
+	w.begin_array();
+	for (int op = 0; op < tagdb::STAT_OP_COUNT; op++) {
+		w.begin_object();
+		w.key("op");
+		w.value(tagdb::stat_op_str(static_cast<tagdb::stat_op>(op)));
+		json_histogram(w, tdb->ops().latency[op]);
+		w.end_object();
+	}
+	w.end_array();
+
+	auto st = tdb->statement_totals();
+	w.key("sqlite");
+	w.begin_object();
+	w.key("vm_steps");
+	w.value(st.vm_steps);
+	w.key("fullscan_steps");
+	w.value(st.fullscan_steps);
+	w.key("statement_prepares");
+	w.value(st.prepares);
+	w.key("statement_uses");
+	w.value(st.uses);
+	w.end_object();
+
+	auto& qs = tdb->query_stats();
+	w.key("query_cache");
+	w.begin_object();
+	w.key("hits");
+	w.value(qs.hits);
+	w.key("misses");
+	w.value(qs.misses);
+	w.key("evictions");
+	w.value(qs.evictions);
+	w.key("invalidations");
+	w.value(qs.invalidations);
+	w.end_object();
+
+	w.end_object();
+	evbuffer_add(buf, "\n", 1);
+}
+
+// request latencies, replies, cache hit counts, tagdb operation latencies and sqlite steps
+// in prometheus text format, or json given v=json
+static void
+stats_cb(evhtp_request_t * evreq, void * arg) {
+	httagd::server *svr = (httagd::server*)arg;
+
+	request req(evreq);
+	response res(evreq);
+	request_timer timer(svr->stats(), req, &res, "/_stats");
+
+	if (req.query_opt_view() == JSON_VIEW) {
+		res.add_header_content_type(JSON_CONTENT_TYPE);
+		stats_json(svr, res.output_buffer());
+	} else {
+		res.add_header_content_type("text/plain; version=0.0.4; charset=utf-8");
+		stats_prometheus(svr, res.output_buffer());
+	}
+
+	res.send_ev_reply(EVHTP_RES_OK);
+}
+
+static void
+reload_templates_cb(evutil_socket_t, short, void *arg) {
+	httagd::server *svr = (httagd::server*)arg;
+	auto vws = svr->vws();
+
+	vws->clear_errors();
+	if (vws->reload_templates() != tagd::TAGD_OK) {
+		// templates that failed to reload keep expanding as they were
+		LOG_ERROR( "reload templates failed" << std::endl )
+		vws->print_errors();
+	}
+
+	// responses rendered by the previous templates are stale
+	svr->new_generation();
+}
+
 tagd::code server::start() {
 
 	if (_args->opt_trace) {
@@ -1046,6 +2424,8 @@ tagd::code server::start() {
 	// evhtp_set_post_accept_cb(_htp, set_my_connection_handlers, nullptr);
 	evhtp_set_cb(_htp, "/_file", file_cb, this);
 	evhtp_set_cb(_htp, "/favicon.ico", favicon_cb, this);
+	evhtp_set_cb(_htp, "/_batch", batch_cb, this);
+	evhtp_set_cb(_htp, "/_stats", stats_cb, this);
 	evhtp_set_gencb(_htp, httagd::main_cb, this);
 
 	const char *bind_addr = ( _bind_addr == "localhost" ? "0.0.0.0" : _bind_addr.c_str() );
@@ -1054,8 +2434,14 @@ tagd::code server::start() {
 				"failed to bind socket(%s): %s:%d", strerror(errno), bind_addr, _bind_port );
 	}
 
+	// SIGHUP reloads changed templates
+	event *ev_hup = evsignal_new(_evbase, SIGHUP, reload_templates_cb, this);
+	event_add(ev_hup, nullptr);
+
     event_base_loop(_evbase, 0);
 
+	event_free(ev_hup);
+
 	return tagd::TAGD_OK;
 }
 
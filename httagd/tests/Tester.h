@@ -1,10 +1,14 @@
 #include <cxxtest/TestSuite.h>
 #include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
 #include "tagl.h"
 #include "tagdb.h"
 #include "httagd.h"
 
 #include <event2/buffer.h>
+#include <zlib.h>
 
 typedef std::map<tagd::id_type, tagd::abstract_tag> tag_map;
 typedef tagdb::flags_t tdb_flags_t;
@@ -187,7 +191,12 @@ bool tagdb_tester::exists(const tagd::id_type& id, tdb_flags_t) {
 	return (db.find(id) != db.end());
 }
 
-tagd::code tagdb_tester::query(tagd::tag_set& T, const tagd::interrogator& q, tdb_sess_t*, tdb_flags_t) {
+tagd::code tagdb_tester::query(tagd::tag_set& T, const tagd::interrogator& q, tdb_sess_t* ssn, tdb_flags_t) {
+	if (q.super_object() == "snarf") {
+		if (ssn == nullptr) return tagd::TS_INTERNAL_ERR;
+		return ssn->ferror(tagd::TS_INTERNAL_ERR, "query failed: %s", q.super_object().c_str());
+	}
+
 	if (q.super_object().empty() &&
 			q.related("legs") &&
 			q.related("tail") ) {
@@ -498,6 +507,46 @@ class Tester : public CxxTest::TestSuite {
 		TS_ASSERT( it->related("tail") )
 	}
 
+	void test_query_stream_error(void) {
+		tagdb_tester tdb;
+		auto ssn = tdb.get_session();
+		httagd::request req(httagd::HTTP_GET, "/snarf/");
+		httagd::response res(nullptr);
+
+		// the body of a failed GET query is the errors of the request session,
+		// as set on the stream's copy of the session
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "snarf");
+		auto tc = httagd::query_stream::start(&req, &res, &tdb, q, &ssn, 0);
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(tc), "TS_INTERNAL_ERR" )
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(ssn.code()), "TS_INTERNAL_ERR" )
+		std::stringstream ss;
+		ssn.print_errors(ss);
+		TS_ASSERT( ss.str().find("query failed: snarf") != std::string::npos )
+	}
+
+	void test_json_query_stream_error(void) {
+		tagdb_tester tdb;
+		auto ssn = tdb.get_session();
+		httagd::request req(httagd::HTTP_GET, "/snarf/");
+		httagd::response res(nullptr);
+
+		// json_cmd_query() renders the errors of the request session
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "snarf");
+		auto tc = httagd::query_stream::start(&req, &res, &tdb, q, &ssn, 0, true);
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(tc), "TS_INTERNAL_ERR" )
+
+		struct evbuffer *buf = evbuffer_new();
+		httagd::json_writer w(buf);
+		w.begin_object();
+		w.key("errors");
+		w.errors(ssn);
+		w.end_object();
+		std::string json(evbuffer_get_length(buf), '\0');
+		evbuffer_remove(buf, &json[0], json.size());
+		TS_ASSERT( json.find("query failed: snarf") != std::string::npos )
+		evbuffer_free(buf);
+	}
+
 	// TODO test request::canonical_url(), abs_url(), abs_url_view_tag()
 
 	void test_file_path(void) {
@@ -506,4 +555,240 @@ class Tester : public CxxTest::TestSuite {
 		auto sub = req.path().substr(pos);
 		TS_ASSERT_EQUALS( sub , "path/to/style.css" )
 	}
+
+	void test_evbuffer_emitter(void) {
+		struct evbuffer *output = evbuffer_new();
+		{
+			httagd::evbuffer_emitter out(output);
+			out.Emit('<');
+			out.Emit("p>");
+			out.Emit(std::string("dog"));
+			out.Emit("</p>", 4);
+			// coalesced until flushed
+			TS_ASSERT_EQUALS( evbuffer_get_length(output), 0 )
+			out.flush();
+			TS_ASSERT_EQUALS( evbuffer_get_length(output), 10 )
+
+			// larger than a chunk is added as is
+			std::string big(httagd::evbuffer_emitter::CHUNK_SIZE, 'x');
+			out.Emit('y');
+			out.Emit(big);
+			TS_ASSERT_EQUALS( evbuffer_get_length(output), 11 + big.size() )
+			out.Emit('z');
+		}
+		// flushed when destroyed
+		TS_ASSERT_EQUALS( evbuffer_get_length(output), 12 + httagd::evbuffer_emitter::CHUNK_SIZE )
+
+		std::string s(evbuffer_get_length(output), '\0');
+		evbuffer_remove(output, &s[0], s.size());
+		TS_ASSERT_EQUALS( s.substr(0, 11), "<p>dog</p>y" )
+		TS_ASSERT_EQUALS( s.back(), 'z' )
+		evbuffer_free(output);
+	}
+
+	void test_response_cache(void) {
+		httagd::response_cache cache(2);
+		TS_ASSERT( cache.get("/dog", "\"1-1\"") == nullptr )
+
+		cache.put("/dog", httagd::cached_response{"\"1-1\"", "text/html", "<p>dog</p>"});
+		cache.put("/cat?v=tag.html", httagd::cached_response{"\"1-1\"", "text/html", "<p>cat</p>"});
+		auto cr = cache.get("/dog", "\"1-1\"");
+		TS_ASSERT( cr != nullptr )
+		TS_ASSERT_EQUALS( cr->body, "<p>dog</p>" )
+		TS_ASSERT_EQUALS( cr->content_type, "text/html" )
+
+		// least recently used (/cat) is evicted
+		cache.put("/bat", httagd::cached_response{"\"1-1\"", "text/html", "<p>bat</p>"});
+		TS_ASSERT_EQUALS( cache.size(), 2 )
+		TS_ASSERT( cache.get("/cat?v=tag.html", "\"1-1\"") == nullptr )
+
+		// rendered under a previous tagspace version
+		TS_ASSERT( cache.get("/dog", "\"1-2\"") == nullptr )
+		TS_ASSERT_EQUALS( cache.size(), 1 )
+		TS_ASSERT_EQUALS( cache.hits(), 1 )
+		TS_ASSERT_EQUALS( cache.misses(), 3 )
+
+		httagd::response_cache disabled;
+		disabled.put("/dog", httagd::cached_response{"\"1-1\"", "text/html", "<p>dog</p>"});
+		TS_ASSERT_EQUALS( disabled.size(), 0 )
+	}
+
+	void test_etag_match(void) {
+		TS_ASSERT( httagd::etag_match("\"1-1\"", "\"1-1\"") )
+		TS_ASSERT( httagd::etag_match("\"1-0\", W/\"1-1\"", "\"1-1\"") )
+		TS_ASSERT( httagd::etag_match(" *", "\"1-1\"") )
+		TS_ASSERT( !httagd::etag_match("\"1-11\"", "\"1-1\"") )
+		TS_ASSERT( !httagd::etag_match(nullptr, "\"1-1\"") )
+	}
+
+	void test_file_cache(void) {
+		char path[] = "/tmp/httagd_file_cache_XXXXXX";
+		int fd = mkstemp(path);
+		TS_ASSERT( fd >= 0 )
+		TS_ASSERT_EQUALS( write(fd, "body { }", 8), 8 )
+		close(fd);
+
+		httagd::file_cache files;
+		tagd::errorable err(tagd::TAGD_OK);
+		auto f = files.get(path, &err);
+		TS_ASSERT( f != nullptr )
+		TS_ASSERT_EQUALS( f->data, "body { }" )  // preloaded
+		TS_ASSERT( f->seg == nullptr )
+		TS_ASSERT_EQUALS( f->content_length, "8" )
+		TS_ASSERT_EQUALS( f->etag.front(), '"' )
+		TS_ASSERT( !f->last_modified.empty() )
+
+		// opened once
+		TS_ASSERT_EQUALS( files.get(path, &err), f )
+		TS_ASSERT_EQUALS( files.size(), 1 )
+
+		// a full cache doesn't evict the file while getting its gzip sibling
+		httagd::file_cache full(1);
+		std::string gz_path(path);
+		gz_path.append(".gz");
+		fd = open(gz_path.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0600);
+		TS_ASSERT( fd >= 0 )
+		TS_ASSERT_EQUALS( write(fd, "gz", 2), 2 )
+		close(fd);
+		full.trim();
+		f = full.get(path, &err);
+		TS_ASSERT( f != nullptr )
+		auto gz = full.get_gzip(path, *f);
+		TS_ASSERT( gz != nullptr )
+		TS_ASSERT_EQUALS( f->data, "body { }" )
+		TS_ASSERT_EQUALS( full.size(), 2 )
+		full.trim();
+		TS_ASSERT_EQUALS( full.size(), 0 )
+		unlink(gz_path.c_str());
+
+		unlink(path);
+		TS_ASSERT( files.get("/tmp/httagd_file_cache_not_a_file", &err) == nullptr )
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(err.code()), "TS_NOT_FOUND" )
+	}
+
+	void test_gzip(void) {
+		TS_ASSERT( httagd::gzip::accepted("gzip, deflate, br") )
+		TS_ASSERT( httagd::gzip::accepted("deflate, gzip;q=1.0, *;q=0.5") )
+		TS_ASSERT( !httagd::gzip::accepted("gzip;q=0, deflate") )
+		TS_ASSERT( !httagd::gzip::accepted("deflate, br") )
+		TS_ASSERT( !httagd::gzip::accepted(nullptr) )
+
+		struct evbuffer *buf = evbuffer_new();
+		std::string html;
+		for (int i = 0; i < 1000; i++) {
+			std::string li = "<li>dog " + std::to_string(i) + "</li>\n";
+			html.append(li);
+			evbuffer_add(buf, li.c_str(), li.size());
+		}
+		TS_ASSERT( httagd::gzip::compress(buf) )
+		TS_ASSERT( evbuffer_get_length(buf) < html.size() )
+
+		std::string z(evbuffer_get_length(buf), '\0');
+		evbuffer_remove(buf, &z[0], z.size());
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		TS_ASSERT_EQUALS( inflateInit2(&zs, 15 + 16), Z_OK )
+		std::string out(html.size(), '\0');
+		zs.next_in = (Bytef*)&z[0];
+		zs.avail_in = z.size();
+		zs.next_out = (Bytef*)&out[0];
+		zs.avail_out = out.size();
+		TS_ASSERT_EQUALS( inflate(&zs, Z_FINISH), Z_STREAM_END )
+		inflateEnd(&zs);
+		TS_ASSERT_EQUALS( out, html )
+
+		// not compressed when it wouldn't be smaller
+		evbuffer_add(buf, "x", 1);
+		TS_ASSERT( !httagd::gzip::compress(buf) )
+		TS_ASSERT_EQUALS( evbuffer_get_length(buf), 1 )
+		evbuffer_free(buf);
+	}
+
+	void test_gzip_stream(void) {
+		// the chunks of a streamed query, as query_stream sends them
+		httagd::gzip_stream gz;
+		TS_ASSERT( gz.ok() )
+		struct evbuffer *chunk = evbuffer_new();
+		struct evbuffer *body = evbuffer_new();
+		std::string ids;
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		TS_ASSERT_EQUALS( inflateInit2(&zs, 15 + 16), Z_OK )
+		std::string out(1 << 20, '\0');
+		zs.next_out = (Bytef*)&out[0];
+		zs.avail_out = out.size();
+		for (int i = 0; i < 20000; i++) {
+			std::string id = (i == 0 ? "" : ", ") + ("dog_" + std::to_string(i));
+			ids.append(id);
+			evbuffer_add(chunk, id.c_str(), id.size());
+			if (evbuffer_get_length(chunk) >= httagd::query_stream::CHUNK_SIZE || i == 19999) {
+				TS_ASSERT( gz.compress(chunk, body, (i == 19999)) )
+				evbuffer_drain(chunk, evbuffer_get_length(chunk));
+
+				// each chunk is flushed, so what was received inflates to the ids so far
+				std::string z(evbuffer_get_length(body), '\0');
+				evbuffer_remove(body, &z[0], z.size());
+				zs.next_in = (Bytef*)&z[0];
+				zs.avail_in = z.size();
+				int rc = inflate(&zs, Z_SYNC_FLUSH);
+				TS_ASSERT_EQUALS( rc, (i == 19999 ? Z_STREAM_END : Z_OK) )
+				TS_ASSERT_EQUALS( zs.avail_in, 0 )
+				TS_ASSERT_EQUALS( out.substr(0, zs.total_out), ids )
+			}
+		}
+		inflateEnd(&zs);
+		TS_ASSERT( zs.total_out < out.size() )
+		evbuffer_free(chunk);
+		evbuffer_free(body);
+	}
+
+	void test_json_writer(void) {
+		auto f_str = [](evbuffer *buf) {
+			std::string str(evbuffer_get_length(buf), '\0');
+			evbuffer_remove(buf, &str[0], str.size());
+			return str;
+		};
+
+		struct evbuffer *buf = evbuffer_new();
+		httagd::json_writer::escape(buf, "say \"hi\"\\\n\t\x01 caf\xc3\xa9", 18);
+		TS_ASSERT_EQUALS( f_str(buf), "say \\\"hi\\\"\\\\\\n\\t\\u0001 caf\xc3\xa9" )
+
+		tagd::abstract_tag dog("dog", "_is_a", "animal", tagd::POS_TAG);
+		TS_ASSERT_EQUALS( dog.relation("has", "legs", "4"), tagd::TAGD_OK )
+		TS_ASSERT_EQUALS( dog.relation("weight", "kg", "30", tagd::OP_GT, tagd::TYPE_INTEGER), tagd::TAGD_OK )
+		TS_ASSERT_EQUALS( dog.rank("\x01\xc3\xa9\xe2\x82\xac"), tagd::TAGD_OK )
+
+		httagd::json_writer w(buf);
+		w.begin_object();
+		w.key("tags");
+		w.begin_array();
+		w.tag(dog);
+		w.tag(tagd::abstract_tag("cat"));
+		w.end_array();
+		w.key("n");
+		w.value(2);
+		w.end_object();
+		TS_ASSERT_EQUALS( f_str(buf),
+			"{\"tags\":["
+				"{\"id\":\"dog\",\"sub_relator\":\"_is_a\",\"super_object\":\"animal\",\"pos\":\"POS_TAG\","
+				"\"rank\":\"1.233.8364\",\"relations\":["
+					"{\"relator\":\"has\",\"object\":\"legs\",\"modifier\":\"4\"},"
+					"{\"relator\":\"weight\",\"object\":\"kg\",\"operator\":\">\",\"modifier\":\"30\"}]},"
+				"{\"id\":\"cat\",\"sub_relator\":\"_sub\",\"pos\":\"POS_UNKNOWN\"}],"
+			"\"n\":2}" )
+
+		tagd::errorable err;
+		httagd::json_writer w_code(buf);
+		err.code(tagd::TS_ERR);
+		w_code.errors(err);
+		TS_ASSERT_EQUALS( f_str(buf), "[{\"id\":\"TS_ERR\"}]" )
+
+		httagd::json_writer w_err(buf);
+		err.ferror(tagd::TS_NOT_FOUND, "no such tag: %s", "dog");
+		w_err.errors(err);
+		TS_ASSERT_EQUALS( f_str(buf),
+			"[{\"id\":\"TS_NOT_FOUND\",\"sub_relator\":\"_type_of\",\"super_object\":\"_error\",\"pos\":\"POS_ERROR\","
+			"\"relations\":[{\"relator\":\"_has\",\"object\":\"_message\",\"modifier\":\"no such tag: dog\"}]}]" )
+		evbuffer_free(buf);
+	}
 };
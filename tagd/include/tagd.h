@@ -278,6 +278,26 @@ class interrogator : public abstract_tag {
 
         interrogator(const id_type& id, const id_type& sub_rel, const id_type& sub_obj) :
 			abstract_tag(id, sub_rel, sub_obj, POS_INTERROGATOR) {};
+
+		// query options are held as relations so that they can be expressed in TAGL:
+		//   ?? _what _is_a animal _has _limit = 10, _after = dog
+		static bool is_query_option(const predicate&);
+
+		// max number of results, 0 if not set or not a positive integer
+		size_t limit() const;
+		tagd::code limit(size_t);
+
+		// results begin after this tag id, in rank order (keyset pagination)
+		id_type after() const;
+		tagd::code after(const id_type&);
+
+		// max levels of descendants of the super_object, 0 if not set or not a positive integer
+		// children are depth 1
+		size_t depth() const;
+		tagd::code depth(size_t);
+
+		// removes query options, leaving the relations to be queried
+		void erase_query_options();
 };
 
 class referent : public abstract_tag {
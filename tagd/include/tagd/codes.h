@@ -52,6 +52,8 @@ typedef enum {
     TS_MISUSE,			// caller misusing class interface
     TS_INTERNAL_ERR,	// error not due to caller input
     TS_NOT_IMPLEMENTED,	// functionality not yet implemented
+    TS_TIMEOUT,			// session deadline passed before the operation completed
+    TS_CANCELLED,		// session cancelled before the operation completed
 
     TAGL_ERR,
 
@@ -85,3 +85,16 @@
 #define HARD_TAG_USER		"_user"		//gperf HARD_TAG_URL_PART, tagd::POS_TAG
 #define HARD_TAG_PASS		"_pass"		//gperf HARD_TAG_URL_PART, tagd::POS_TAG
 #define HARD_TAG_SCHEME		"_scheme"	//gperf HARD_TAG_URL_PART, tagd::POS_TAG
+
+/***** query options *****/
+// hard tags are rows in the order defined, so new hard tags are appended below
+// relation objects of an interrogator that are options of a query rather than its predicates
+// max number of results (i.e. "_has _limit = 10")
+#define HARD_TAG_LIMIT		"_limit"		//gperf HARD_TAG_INTERROGATOR, tagd::POS_TAG
+// results begin after this tag id, in rank order (i.e. "_has _after = dog")
+#define HARD_TAG_AFTER		"_after"		//gperf HARD_TAG_INTERROGATOR, tagd::POS_TAG
+
+// resolves the number of tags matching a query
+#define HARD_TAG_HOW_MANY	"_how_many"		//gperf HARD_TAG_INTERROGATOR, tagd::POS_INTERROGATOR
+// max levels of descendants below the super_object (i.e. "_has _depth = 2")
+#define HARD_TAG_DEPTH		"_depth"		//gperf HARD_TAG_INTERROGATOR, tagd::POS_TAG
@@ -5,9 +5,13 @@
 #include <set>
 #include <algorithm>  // reverse_copy
 #include "codes.h"
+#include "utf8.h"
 
 namespace tagd {
 
+// max value of a rank level
+const uint32_t RANK_MAX_CODE_POINT = UTF8_EXT_MAX_CODE_POINT;
+
 class rank;
 typedef std::set<rank> rank_set;
 
@@ -30,6 +34,13 @@ class rank {
 |*|   - as a means to encode numbers as multibyte strings,
 |*|     it was already figured out for us (thanks Dave Prosser and Ken Thompson)
 |*|
+|*|  Wide nodes: levels having more than UTF8_MAX_CODE_POINT (2097151) children
+|*|  are encoded using the five and six byte sequences of the original UTF8 (RFC 2279),
+|*|  so a node can have up to RANK_MAX_CODE_POINT (0x7FFFFFFF) children.
+|*|  The leading bytes (0xF8-0xFD) collate after all other leading bytes and
+|*|  continuation bytes collate in value order, so ranks remain memcmp-orderable
+|*|  and rank substrings still define subtrees.
+|*|
 |*|  Caveat: The 0xFFFD byte sequence is used as a replacement for invalid uft8 sequences.
 |*|          Our UTF8 functions use it to indicate an error state, so it must not be
 |*|          used in valid ranks - it will fail to validate.
@@ -40,6 +51,10 @@ class rank {
         // validates bytes
 		tagd::code validate(const std::string&);
 
+		// bytes of the common prefix ending on a level boundary,
+		// the number of common levels is put in the size_t* if not null
+		size_t common_prefix_size(const rank&, size_t*) const;
+
     public:
         rank() : _data() {}
         rank(const rank& cp) : _data(cp._data) {}
@@ -106,6 +121,16 @@ class rank {
 
         size_t size() const { return _data.size(); }
 
+        // number of levels (code points), _entity (empty) has depth 0
+        size_t depth() const;
+
+        // number of leading levels shared with the other rank
+        size_t common_depth(const rank&) const;
+
+        // longest common prefix of both ranks, which is the rank
+        // of their lowest common ancestor (empty for _entity)
+        rank common_ancestor(const rank&) const;
+
         bool empty() const { return _data.empty(); }
 
         // next rank in a rank set - fills holes
@@ -16,8 +16,16 @@ namespace tagd {
 //   max code_point: 2097151
 const uint32_t UTF8_MAX_CODE_POINT = 2097151;
 
+// the original utf8 (RFC 2279) allowed five and six byte sequences,
+// encoding code points up to 0x7FFFFFFF - they are not valid unicode,
+// but they still collate bytewise in code point order, so we use them
+// where more values are needed than UTF8_MAX_CODE_POINT allows (see rank.h)
+const uint32_t UTF8_EXT_MAX_CODE_POINT = 0x7FFFFFFF;
+
 // append code point as utf8 to string
 // and return number of bytes appended
+// code points above UTF8_MAX_CODE_POINT are appended as
+// five or six byte (RFC 2279) sequences
 size_t utf8_append(std::string&, uint32_t);
 
 // reads one code point from utf8 from input string,
@@ -31,11 +39,12 @@ uint32_t utf8_read(const std::string&, size_t*);
 size_t utf8_pos_back(const std::string&, size_t pos=std::string::npos);
 
 // increments and return code point 
-// returns 0xFFFD if cannot be incremented
-uint32_t utf8_increment(uint32_t);
+// returns 0xFFFD if cannot be incremented past max
+uint32_t utf8_increment(uint32_t, uint32_t max=UTF8_MAX_CODE_POINT);
 
 // returns whether a code point is valid for utf8 encoding
-bool utf8_is_valid(uint32_t);
+// and not greater than max
+bool utf8_is_valid(uint32_t, uint32_t max=UTF8_MAX_CODE_POINT);
 
 } // namespace tagd
 
@@ -18,6 +18,50 @@ bool rank::contains(const rank& other) const {
 	return ( _data.compare(0, _data.size(), other._data.substr(0, _data.size())) == 0 );
 }
 
+size_t rank::common_prefix_size(const rank& other, size_t *levels) const {
+	size_t pos = 0, n = 0;
+	while (pos < _data.size() && pos < other._data.size()) {
+		size_t next = pos;
+		if (utf8_read(_data, &next) == 0xFFFD)  // malformed
+			break;
+
+		// utf8 is prefix free, so equal bytes are an equal code point in both
+		if (other._data.compare(pos, (next - pos), _data, pos, (next - pos)) != 0)
+			break;
+
+		pos = next;
+		n++;
+	}
+
+	if (levels != nullptr)
+		*levels = n;
+
+	return pos;
+}
+
+size_t rank::depth() const {
+	size_t pos = 0, n = 0;
+	while (pos < _data.size()) {
+		if (utf8_read(_data, &pos) == 0xFFFD)  // malformed
+			break;
+		n++;
+	}
+
+	return n;
+}
+
+size_t rank::common_depth(const rank& other) const {
+	size_t n;
+	(void)this->common_prefix_size(other, &n);
+	return n;
+}
+
+rank rank::common_ancestor(const rank& other) const {
+	rank r;
+	r._data = _data.substr(0, this->common_prefix_size(other, nullptr));
+	return r;
+}
+
 tagd::code rank::validate(const std::string& bytes) {
 	if (bytes.size() > RANK_MAX_LEN)
 		return RANK_MAX_LEN;
@@ -115,8 +159,8 @@ uint32_t rank::pop_back() {
 
 tagd::code rank::push_back(uint32_t cp) {
 	if (cp == 0) return RANK_EMPTY;
-	if (cp > UTF8_MAX_CODE_POINT) return RANK_MAX_VALUE;
-	if (!utf8_is_valid(cp)) return RANK_ERR;
+	if (cp > RANK_MAX_CODE_POINT) return RANK_MAX_VALUE;
+	if (!utf8_is_valid(cp, RANK_MAX_CODE_POINT)) return RANK_ERR;
 
 	std::string utf8;
 	size_t sz = utf8_append(utf8, cp);
@@ -138,9 +182,9 @@ tagd::code rank::increment() {
 	size_t tmp = pos;
 	uint32_t cp = utf8_read(_data, &tmp);
 	if (cp == 0xFFFD) return RANK_ERR;  // malformed data
-	if (cp > UTF8_MAX_CODE_POINT) return RANK_MAX_VALUE;
+	if (cp > RANK_MAX_CODE_POINT) return RANK_MAX_VALUE;
 
-	cp = utf8_increment(cp);
+	cp = utf8_increment(cp, RANK_MAX_CODE_POINT);
 	// returns replacement if no room for value
 	if (cp == 0xFFFD) return RANK_MAX_VALUE;
 
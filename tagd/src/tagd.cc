@@ -4,6 +4,7 @@
 #include <cstring>
 #include <cassert>
 #include <cstdio>
+#include <cstdlib> // strtoll
 
 #include "tagd.h"
 
@@ -508,6 +509,90 @@ const id_type& referent::context() const {
 	return EMPTY_ID;
 }
 
+// interrogators
+bool interrogator::is_query_option(const predicate& p) {
+	return (p.object == HARD_TAG_LIMIT || p.object == HARD_TAG_AFTER || p.object == HARD_TAG_DEPTH);
+}
+
+// value of a positive integer query option, 0 if not set or invalid
+static size_t positive_query_option(const predicate_set& relations, const id_type& option) {
+	for (auto it = relations.begin(); it != relations.end(); ++it) {
+		if (it->object != option)
+			continue;
+
+		char *end = nullptr;
+		long long n = std::strtoll(it->modifier.c_str(), &end, 10);
+		if (end == it->modifier.c_str() || *end != '\0' || n <= 0)
+			return 0;
+
+		return (size_t) n;
+	}
+
+	return 0;
+}
+
+static tagd::code set_positive_query_option(interrogator& q, const id_type& option, size_t n) {
+	for (auto it = q.relations.begin(); it != q.relations.end(); ) {
+		if (it->object == option)
+			it = q.relations.erase(it);
+		else
+			++it;
+	}
+
+	if (n == 0)
+		return TAGD_OK;
+
+	return q.relation(HARD_TAG_HAS, option, std::to_string(n), OP_EQ, TYPE_INTEGER);
+}
+
+size_t interrogator::limit() const {
+	return positive_query_option(relations, HARD_TAG_LIMIT);
+}
+
+tagd::code interrogator::limit(size_t n) {
+	return set_positive_query_option(*this, HARD_TAG_LIMIT, n);
+}
+
+size_t interrogator::depth() const {
+	return positive_query_option(relations, HARD_TAG_DEPTH);
+}
+
+tagd::code interrogator::depth(size_t n) {
+	return set_positive_query_option(*this, HARD_TAG_DEPTH, n);
+}
+
+id_type interrogator::after() const {
+	for (auto it = relations.begin(); it != relations.end(); ++it) {
+		if (it->object == HARD_TAG_AFTER)
+			return it->modifier;
+	}
+
+	return EMPTY_ID;
+}
+
+tagd::code interrogator::after(const id_type& id) {
+	for (auto it = relations.begin(); it != relations.end(); ) {
+		if (it->object == HARD_TAG_AFTER)
+			it = relations.erase(it);
+		else
+			++it;
+	}
+
+	if (id.empty())
+		return TAGD_OK;
+
+	return this->relation(HARD_TAG_HAS, HARD_TAG_AFTER, id);
+}
+
+void interrogator::erase_query_options() {
+	for (auto it = relations.begin(); it != relations.end(); ) {
+		if (is_query_option(*it))
+			it = relations.erase(it);
+		else
+			++it;
+	}
+}
+
 // tag output functions
 
 // whether a label should be quoted
@@ -32,7 +32,7 @@ size_t utf8_append(std::string &s, uint32_t c) {
 	if (c == 0)
 		return 0;
 
-	char utf8[5] = {'\0','\0','\0','\0','\0'};
+	char utf8[7] = {'\0','\0','\0','\0','\0','\0','\0'};
 	size_t sz = 0;
 
 	if ( c<0x00080 ) {
@@ -46,12 +46,28 @@ size_t utf8_append(std::string &s, uint32_t c) {
 		utf8[sz++] = 0xE0 + ((c>>12)&0x0F);
 		utf8[sz++] = 0x80 + ((c>>6) & 0x3F);
 		utf8[sz++] = 0x80 + (c & 0x3F);
-	} else {
+	}
+	else if ( c<0x200000 ) {
 		utf8[sz++] = 0xF0 + ((c>>18) & 0x07);
 		utf8[sz++] = 0x80 + ((c>>12) & 0x3F);
 		utf8[sz++] = 0x80 + ((c>>6) & 0x3F);
 		utf8[sz++] = 0x80 + (c & 0x3F);
 	}
+	// RFC 2279 five and six byte sequences
+	else if ( c<0x4000000 ) {
+		utf8[sz++] = 0xF8 + ((c>>24) & 0x03);
+		utf8[sz++] = 0x80 + ((c>>18) & 0x3F);
+		utf8[sz++] = 0x80 + ((c>>12) & 0x3F);
+		utf8[sz++] = 0x80 + ((c>>6) & 0x3F);
+		utf8[sz++] = 0x80 + (c & 0x3F);
+	} else {
+		utf8[sz++] = 0xFC + ((c>>30) & 0x01);
+		utf8[sz++] = 0x80 + ((c>>24) & 0x3F);
+		utf8[sz++] = 0x80 + ((c>>18) & 0x3F);
+		utf8[sz++] = 0x80 + ((c>>12) & 0x3F);
+		utf8[sz++] = 0x80 + ((c>>6) & 0x3F);
+		utf8[sz++] = 0x80 + (c & 0x3F);
+	}
 
 	s.append(utf8);
 	return sz;
@@ -96,27 +112,27 @@ size_t utf8_pos_back(const std::string &s, size_t pos) {
 	return std::string::npos;
 }
 
-uint32_t utf8_increment(uint32_t cp) {
-	if (cp >= UTF8_MAX_CODE_POINT)
+uint32_t utf8_increment(uint32_t cp, uint32_t max) {
+	if (cp >= max)
 		return 0xFFFD;
 
 	cp++;
 
-	if ( cp == 0xFFFD )
-		return (cp + 1);  // advance past replacement sequence
-
 	if ( (cp>=0xD800 && cp<=0xDFFF) )
-		return (0xDFFF + 1);  // advance past UTF16 surrogate
+		cp = (0xDFFF + 1);  // advance past UTF16 surrogate
+
+	if ( cp>=0xFFFD && cp<=0xFFFF )
+		cp = 0x10000;  // advance past replacement sequence and the no room for value code points
 
-	if ( (cp&0xFFFFFFFE)==0xFFFE )
-		return 0xFFFD;   // no room for value
+	if ( cp > max )
+		return 0xFFFD;
 
 	return cp;
 }
 
-bool utf8_is_valid(uint32_t cp) {
+bool utf8_is_valid(uint32_t cp, uint32_t max) {
 	return (
-		cp <= UTF8_MAX_CODE_POINT &&
+		cp <= max &&
 		cp != 0xFFFD &&             // replacement sequence
 		!(cp >= 0xD800 && cp <= 0xDFFF) && // UTF16 surrogate
 		(cp & 0xFFFFFFFE) != 0xFFFE // no room for value
@@ -73,6 +73,15 @@ class Tester : public CxxTest::TestSuite {
 
 		inc = tagd::utf8_increment(0xD801);  // UTF16 surrogate
 		TS_ASSERT_EQUALS( inc , (0xDFFF + 1) )  // advance past UTF16 surrogate
+
+		// advance past the replacement sequence and end of the BMP
+		TS_ASSERT_EQUALS( tagd::utf8_increment(0xFFFB) , 0xFFFC )
+		TS_ASSERT_EQUALS( tagd::utf8_increment(0xFFFC) , 0x10000 )
+		TS_ASSERT_EQUALS( tagd::utf8_increment(0xFFFD) , 0x10000 )
+		TS_ASSERT_EQUALS( tagd::utf8_increment(0xFFFE) , 0x10000 )
+		TS_ASSERT( tagd::utf8_is_valid(0x10000) )
+
+		TS_ASSERT_EQUALS( tagd::utf8_increment(tagd::UTF8_MAX_CODE_POINT) , 0xFFFD )  // no room for value
 	}
 
     void test_rank_nil(void) {
@@ -239,7 +248,7 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT_EQUALS( it , R.end() );
 
 		R.clear();
-		tagd::code rc = next.push_back(tagd::UTF8_MAX_CODE_POINT);
+		tagd::code rc = next.push_back(tagd::RANK_MAX_CODE_POINT);
 		R.insert(next);
         rc = tagd::rank::next(next, R);
         TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "RANK_MAX_VALUE");
@@ -343,6 +352,106 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "RANK_MAX_LEN");
     }
 
+    void test_rank_common_ancestor(void) {
+        tagd::rank a, b, c, nil;
+        a.push_back(1); a.push_back(2); a.push_back(3);
+        b.push_back(1); b.push_back(2); b.push_back(0x800);  // multibyte last level
+        c.push_back(2);
+
+        TS_ASSERT_EQUALS( a.depth() , 3 );
+        TS_ASSERT_EQUALS( b.depth() , 3 );
+        TS_ASSERT_EQUALS( nil.depth() , 0 );
+
+        TS_ASSERT_EQUALS( a.common_depth(b) , 2 );
+        TS_ASSERT_EQUALS( b.common_depth(a) , 2 );
+        TS_ASSERT_EQUALS( a.common_depth(a) , 3 );
+        TS_ASSERT_EQUALS( a.common_depth(c) , 0 );
+        TS_ASSERT_EQUALS( a.common_depth(nil) , 0 );
+
+        TS_ASSERT_EQUALS( a.common_ancestor(b).dotted_str() , "1.2" );
+        TS_ASSERT( a.common_ancestor(b).contains(a) && a.common_ancestor(b).contains(b) )
+        TS_ASSERT( a.common_ancestor(c).empty() )
+
+		// ancestor and descendant
+        tagd::rank d(a);
+        d.push_back(0x10000);
+        TS_ASSERT_EQUALS( d.common_ancestor(a) , a );
+        TS_ASSERT_EQUALS( d.depth() , 4 );
+
+		// levels sharing a leading byte are not a common level
+        tagd::rank e, f;
+        e.push_back(0x800);
+        f.push_back(0x801);
+        TS_ASSERT_EQUALS( e.common_depth(f) , 0 );
+        TS_ASSERT( e.common_ancestor(f).empty() )
+    }
+
+    void test_rank_wide_fanout(void) {
+        tagd::rank r1;
+        r1.push_back(1);
+        tagd::code rc = r1.push_back(tagd::UTF8_MAX_CODE_POINT);
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        TS_ASSERT_EQUALS( r1.size() , 5 );
+
+		// increment past the four byte utf8 maximum into five bytes
+        tagd::rank r2(r1);
+        rc = r2.increment();
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        TS_ASSERT_EQUALS( r2.dotted_str() , "1.2097152" );
+        TS_ASSERT_EQUALS( r2.size() , 6 );
+        TS_ASSERT( r1 < r2 )
+        TS_ASSERT_EQUALS( r2.back() , 2097152 );
+
+		// child of a wide level
+        tagd::rank r3(r2);
+        r3.push_back(1);
+        TS_ASSERT( r2.contains(r3) )
+        TS_ASSERT( !r1.contains(r3) )
+        TS_ASSERT( r2 < r3 )
+
+		// five bytes to six
+        tagd::rank r4;
+        r4.push_back(1);
+        rc = r4.push_back(0x3FFFFFF);
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        TS_ASSERT_EQUALS( r4.size() , 6 );
+        tagd::rank r5(r4);
+        rc = r5.increment();
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        TS_ASSERT_EQUALS( r5.size() , 7 );
+        TS_ASSERT( r3 < r4 )
+        TS_ASSERT( r4 < r5 )
+
+		// wide ranks validate and round trip
+        tagd::rank r6;
+        rc = r6.init(r5.c_str());
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        TS_ASSERT_EQUALS( r6.dotted_str() , "1.67108864" );
+        TS_ASSERT_EQUALS( r6.pop_back() , 0x4000000 );
+        TS_ASSERT_EQUALS( r6.dotted_str() , "1" );
+
+        rc = r6.push_back(tagd::RANK_MAX_CODE_POINT);
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        rc = r6.increment();
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "RANK_MAX_VALUE");
+        rc = r6.push_back(tagd::RANK_MAX_CODE_POINT + 1);
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "RANK_MAX_VALUE");
+
+		// increment across the end of the BMP
+        tagd::rank r7;
+        r7.push_back(1);
+        rc = r7.push_back(0xFFFB);
+        TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+        for (uint32_t cp : {0xFFFC, 0x10000, 0x10001}) {
+            tagd::rank prev(r7);
+            rc = r7.increment();
+            TS_ASSERT_EQUALS (TAGD_CODE_STRING(rc) , "TAGD_OK");
+            TS_ASSERT_EQUALS( r7.back() , cp );
+            TS_ASSERT( prev < r7 )
+        }
+        TS_ASSERT_EQUALS( r7.dotted_str() , "1.65537" );
+    }
+
     void test_tag_rank(void) {
         // tag rank
         char a1[4] = {1, 2, 123, '\0'};
@@ -1024,6 +1133,42 @@ class Tester : public CxxTest::TestSuite {
 
 	}
 
+    void test_interrogator_query_options(void) {
+		tagd::interrogator a("what", "mammal");
+		a.relation("has", "legs");
+		TS_ASSERT_EQUALS( a.limit(), 0 )
+		TS_ASSERT( a.after().empty() )
+
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(a.limit(10)), "TAGD_OK" )
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(a.after("dog")), "TAGD_OK" )
+		TS_ASSERT_EQUALS( a.limit(), 10 )
+		TS_ASSERT_EQUALS( a.after(), "dog" )
+		TS_ASSERT( a.related(HARD_TAG_HAS, HARD_TAG_LIMIT) )
+
+		// replaced, not added
+		a.limit(20);
+		a.after("cat");
+		TS_ASSERT_EQUALS( a.limit(), 20 )
+		TS_ASSERT_EQUALS( a.after(), "cat" )
+		TS_ASSERT_EQUALS( a.relations.size(), 3 )
+
+		TS_ASSERT_EQUALS( a.depth(), 0 )
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(a.depth(2)), "TAGD_OK" )
+		TS_ASSERT_EQUALS( a.depth(), 2 )
+		TS_ASSERT_EQUALS( a.relations.size(), 4 )
+
+		a.erase_query_options();
+		TS_ASSERT_EQUALS( a.relations.size(), 1 )
+		TS_ASSERT( a.related("has", "legs") )
+		TS_ASSERT_EQUALS( a.limit(), 0 )
+
+		// as parsed from TAGL
+		tagd::interrogator b("what");
+		b.relation(HARD_TAG_HAS, HARD_TAG_LIMIT, "-1");
+		TS_ASSERT_EQUALS( b.limit(), 0 )
+		TS_ASSERT( tagd::interrogator::is_query_option(*b.relations.begin()) )
+	}
+
 	void test_referent(void) {
 		tagd::referent a("is_a", "_is_a", "simple_english");
 		TS_ASSERT_EQUALS( a.refers() , "is_a" )
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <memory>
 #include <stdint.h>
+#include <unordered_map>
 #include "tagd.h"
+#include "tagdb/stats.h"
 
 extern bool TAGDB_TRACE_ON;
 inline void TAGDB_SET_TRACE_ON() {
@@ -31,14 +36,20 @@ typedef enum {
 	F_NO_TRANSFORM_REFERENTS = 1 << 1, // don't transform to/from referent to tag when putting/getting
 	F_NO_NOT_FOUND_ERROR     = 1 << 2, // don't set error when get() returns TS_NOT_FOUND
 	F_IGNORE_DUPLICATES      = 1 << 3, // don't set error when TS_DUPLICATE would be set 
-	F_NO_RESET               = 1 << 4  // don't call reset() at the beginning of public tagdb methods
+	F_NO_RESET               = 1 << 4, // don't call reset() at the beginning of public tagdb methods
+	F_HYDRATE_RELATIONS      = 1 << 5, // populate all relations of tags returned by query(), get_children()
+	F_EXISTS_ONLY            = 1 << 6, // query() returns whether any tag matches, without populating the tag set
+	F_INHERITED              = 1 << 7  // query() matches relations inherited from super_objects, not only direct subjects
 	// ...
 	//          	= 1 << 31,
 } ts_flags;
-const int TS_FLAGS_END     = 1 << 5;
+const int TS_FLAGS_END     = 1 << 8;
 
 typedef uint32_t flags_t;
 
+typedef std::pair<tagd::id_type, tagd::id_type> id_pair;
+typedef std::vector<id_pair> id_pair_vec;
+
 struct flag_util {
 	static std::string flag_str(flags_t f) {
 		if (f == 0)
@@ -50,6 +61,9 @@ struct flag_util {
 			case F_NO_NOT_FOUND_ERROR:     return "F_NO_NOT_FOUND_ERROR";
 			case F_IGNORE_DUPLICATES:      return "F_IGNORE_DUPLICATES";
 			case F_NO_RESET:               return "F_NO_RESET";
+			case F_HYDRATE_RELATIONS:      return "F_HYDRATE_RELATIONS";
+			case F_EXISTS_ONLY:            return "F_EXISTS_ONLY";
+			case F_INHERITED:              return "F_INHERITED";
             default:                       return "FLAG_UNKNOWN";
         }
     }
@@ -77,6 +91,21 @@ struct flag_util {
 
 class tagdb;	// forward declare
 
+typedef std::chrono::steady_clock::time_point deadline_t;
+
+// cancels the operations of a session when set true, from any thread
+typedef std::shared_ptr<std::atomic<bool>> cancel_token;
+
+// TS_CANCELLED when the token is set, TS_TIMEOUT when the deadline has passed, otherwise TAGD_OK
+// a deadline_t() is no deadline
+inline tagd::code interrupt_code(const deadline_t& deadline, const cancel_token& cancel) {
+	if (cancel && cancel->load(std::memory_order_relaxed))
+		return tagd::TS_CANCELLED;
+	if (deadline != deadline_t() && std::chrono::steady_clock::now() >= deadline)
+		return tagd::TS_TIMEOUT;
+	return tagd::TAGD_OK;
+}
+
 class session : public tagd::errorable {
 	// no pub cons, only tagdb can access
 	friend tagdb;
@@ -86,15 +115,44 @@ class session : public tagd::errorable {
 		tagd::id_vec _context;
 		tagdb *_tdb;
 
+		// referent resolutions in the context, an empty id when a term has no referent
+		// dropped when the context changes, stale when the tagdb referents_version() changes
+		std::unordered_map<tagd::id_type, tagd::id_type> _refers_cache;
+		std::unordered_map<tagd::id_type, tagd::id_type> _refers_to_cache;
+		uint64_t _referents_version = 0;
+
+		// operations given the session are interrupted after the deadline, or when cancelled
+		deadline_t _deadline;
+		cancel_token _cancel;
+
 		session() = delete;  // *tagdb reqd
 		session(tagdb *tdb) : _tdb{tdb} {}
 
+		bool referent_cache_stale() const;
+
 	public:
 		tagd::code push_context(const tagd::id_type&);
 		tagd::code pop_context();
 		tagd::code clear_context();
 		void print_context();
 		const tagd::id_vec& context() const;
+
+		// cached refers given refers_to, false if not cached
+		bool find_refers(const tagd::id_type&, tagd::id_type&) const;
+		// cached refers_to given refers, false if not cached
+		bool find_refers_to(const tagd::id_type&, tagd::id_type&) const;
+		void cache_refers(const tagd::id_type&, const tagd::id_type&);
+		void cache_refers_to(const tagd::id_type&, const tagd::id_type&);
+		void clear_referent_cache();
+
+		void deadline(const deadline_t& d) { _deadline = d; }
+		const deadline_t& deadline() const { return _deadline; }
+		// deadline the given duration from now, 0 clears the deadline
+		void timeout(std::chrono::milliseconds);
+		// token that cancels the operations of this session, created on first use
+		cancel_token cancellation();
+		void cancel() { this->cancellation()->store(true); }
+		tagd::code interrupted() const { return interrupt_code(_deadline, _cancel); }
 };
 
 // matches sqlite_int64 type defined in sqlite.h
@@ -111,21 +169,146 @@ class hard_tag {
 		static size_t rows_end();
 };
 
+// streams query results one tag at a time, in rank order,
+// rather than materializing them all in a tag_set
+// created by tagdb::query_cursor(), user must delete
+class cursor : public tagd::errorable {
+	public:
+		cursor() : tagd::errorable(tagd::TAGD_OK) {}
+		virtual ~cursor() {}
+
+		// populate tag with the next result, returns TS_NOT_FOUND when exhausted
+		virtual tagd::code next(tagd::abstract_tag&) = 0;
+};
+
+// cursor over a tag set that has already been populated
+class tag_set_cursor : public cursor {
+	private:
+		tagd::tag_set _tags;
+		tagd::tag_set::const_iterator _it;
+
+	public:
+		// takes ownership of the contents of the tag set (T will be empty)
+		tag_set_cursor(tagd::tag_set& T) {
+			_tags.swap(T);
+			_it = _tags.begin();
+		}
+
+		tagd::code next(tagd::abstract_tag& t) {
+			if (_it == _tags.end())
+				return tagd::TS_NOT_FOUND;
+
+			t = *_it++;
+			return tagd::TAGD_OK;
+		}
+};
+
+// the tag tree around a tag, populated by tagdb::tree()
+struct tree_set {
+	tagd::tag_set ancestors;  // _entity down to the super_object of the tag
+	tagd::tag_set siblings;   // children of the super_object, including the tag
+	tagd::tag_set children;   // children of the tag
+
+	void clear() {
+		ancestors.clear();
+		siblings.clear();
+		children.clear();
+	}
+};
+
+// what a tag page shows about a tag, populated by tagdb::neighborhood()
+struct neighborhood_set {
+	tagd::tag_set refers_to;  // referents referring to the tag
+	tagd::tag_set refers;     // referents the tag is the term of
+	tagd::tag_set related;    // tags related to the tag (or by it, when it is a relator)
+	tree_set tree;
+
+	void clear() {
+		refers_to.clear();
+		refers.clear();
+		related.clear();
+		tree.clear();
+	}
+};
+
+// counts the writes in progress for its lifetime, so the operations
+// nested in a write are not interrupted by the session given to reset()
+class write_scope {
+	private:
+		size_t *_depth;
+
+	public:
+		write_scope(size_t *depth) : _depth{depth} { (*_depth)++; }
+		write_scope(const write_scope&) = delete;
+		~write_scope() { (*_depth)--; }
+};
+
 // pure virtual interface
 class tagdb : public tagd::errorable {
 	protected:
 		bool _trace_on = TAGDB_TRACE_ON;
 
+		// incremented by referent_change()
+		uint64_t _referents_version = 0;
+		// referents were put or deleted, or context tags moved, so
+		// the referent resolutions cached by sessions are stale
+		void referent_change() {
+			_referents_version++;
+			_version++;
+		}
+
+		// incremented by tagspace_change()
+		uint64_t _version = 0;
+		// a put or del changed the tagspace
+		void tagspace_change() { _version++; }
+
+		// deadline and cancellation of the current operation, from the session given to reset()
+		deadline_t _deadline;
+		cancel_token _cancel;
+
+		// latencies of get, put, del, query and search, recorded by op_timer
+		op_stats _op_stats;
+		size_t _op_depth = 0;  // timed operations in progress
+		size_t _write_depth = 0;  // writes in progress, counted by write_scope
+
 		// rest tagdb and session to OK state
 		void reset(session *ssn) {
 			_code = tagd::TAGD_OK;
 			if (ssn) ssn->code(tagd::TAGD_OK);
+			this->interrupt_by(ssn);
+		}
+
+		// the current operation is interrupted by the deadline and cancellation of the session
+		// (i.e. a cursor being stepped after operations of other sessions),
+		// unless a write is in progress, which runs to completion
+		void interrupt_by(session *ssn) {
+			if (ssn && _write_depth == 0) {
+				_deadline = ssn->_deadline;
+				_cancel = ssn->_cancel;
+			} else {
+				_deadline = deadline_t();
+				_cancel.reset();
+			}
+		}
+
+		// TS_TIMEOUT or TS_CANCELLED when the current operation should stop
+		tagd::code interrupted() const { return interrupt_code(_deadline, _cancel); }
+		// the rest of the current operation runs to completion
+		void uninterruptible() {
+			_deadline = deadline_t();
+			_cancel.reset();
 		}
 
 	public:
 		tagdb() : tagd::errorable(tagd::TS_INIT) {}
 		virtual ~tagdb() {}
 
+		uint64_t referents_version() const { return _referents_version; }
+		// changes whenever the tagspace does, so results derived from it can be validated
+		uint64_t version() const { return _version; }
+
+		const op_stats& ops() const { return _op_stats; }
+
 		virtual void trace_on() { _trace_on = true; }
 		virtual void trace_off() { _trace_on = false; }
 
@@ -148,15 +331,56 @@ class tagdb : public tagd::errorable {
 		// get into tag from db, given id
 		virtual tagd::code get(tagd::abstract_tag&, const tagd::id_type&, session*, flags_t = 0) = 0;
 
+		// get tags (with relations) into tag set, given tag ids
+		// ids not found are not an error, returns TS_NOT_FOUND if none were found
+		// this implementation calls get() for each id, derived classes should override
+		virtual tagd::code get_many(tagd::tag_set&, const tagd::id_vec&, session*, flags_t = 0);
+
 		// put into db given tag
 		virtual tagd::code put(const tagd::abstract_tag&, session*, flags_t = 0) = 0;
 
 		// delete from db given tag
 		virtual tagd::code del(const tagd::abstract_tag&, session*, flags_t = 0) = 0;
 
+		// puts and dels from batch_begin() to batch_end() are committed as one, rather than each on its own
+		// batch_end() commits them when true, otherwise rolls them back
+		virtual tagd::code batch_begin(session*, flags_t = 0) { return tagd::TS_NOT_IMPLEMENTED; }
+		virtual tagd::code batch_end(bool, session*, flags_t = 0) { return tagd::TS_NOT_IMPLEMENTED; }
+		// writes of a statement in a batch, kept when statement_end() is given true, otherwise rolled back
+		// leaving the other writes of the batch as they were
+		virtual tagd::code statement_begin(session*, flags_t = 0) { return tagd::TS_NOT_IMPLEMENTED; }
+		virtual tagd::code statement_end(bool, session*, flags_t = 0) { return tagd::TS_NOT_IMPLEMENTED; }
+
 		// query db given interrogator, populate set of tag ids
 		virtual tagd::code query(tagd::tag_set&, const tagd::interrogator&, session*, flags_t = 0) = 0;
 
+		// number of tags matching the interrogator, zero matches is not an error
+		// this implementation counts the tag set populated by query(), derived classes should override
+		virtual tagd::code query_count(size_t&, const tagd::interrogator&, session*, flags_t = 0);
+
+		// query db given interrogator, returns a cursor streaming the results
+		// returns nullptr on error, user must delete the cursor
+		// this implementation populates a tag set using query(), derived classes should override
+		virtual cursor* query_cursor(const tagd::interrogator&, session*, flags_t = 0);
+
+		// lowest common ancestor of two tags, given by the common prefix of their ranks
+		// this implementation walks up super_objects using get(), derived classes should override
+		virtual tagd::code lca(tagd::id_type&, const tagd::id_type&, const tagd::id_type&, session*, flags_t = 0);
+
+		// number of edges between two tags in the tag tree, computed from their ranks
+		virtual tagd::code distance(size_t&, const tagd::id_type&, const tagd::id_type&, session*, flags_t = 0);
+
+		// distances of many pairs, each id is read only once
+		virtual tagd::code distance(std::vector<size_t>&, const id_pair_vec&, session*, flags_t = 0);
+
+		// ancestors, siblings and children of a tag, as needed to render its place in the tree
+		// this implementation walks up super_objects and queries children, derived classes should override
+		virtual tagd::code tree(tree_set&, const tagd::id_type&, session*, flags_t = 0);
+
+		// referents, related tags and tree of a tag, sharing the resolution of its id
+		// this implementation calls query() for each and tree(), derived classes should override
+		virtual tagd::code neighborhood(neighborhood_set&, const tagd::abstract_tag&, session*, flags_t = 0);
+
 		// return a tag::pos given a tag id
 		virtual tagd::part_of_speech pos(const tagd::id_type&, session*, flags_t = 0) = 0; 
 
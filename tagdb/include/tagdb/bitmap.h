@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include "tagd.h"
+
+namespace tagdb {
+
+/*\
+|*|  Compressed bitmap of uint32_t values, as in roaring bitmaps:
+|*|  values are partitioned by their high 16 bits into containers,
+|*|  a container holding the low 16 bits either as a sorted array (sparse)
+|*|  or as a 65536 bit bitmap (dense), whichever is smaller.
+|*|  Dense containers are operated on a 64 bit word at a time.
+\*/
+class bitmap {
+	public:
+		// array containers having more values than this are converted to bitmaps
+		static const size_t ARRAY_MAX = 4096;
+		static const size_t BITMAP_WORDS = 1024;  // 65536 bits
+
+	private:
+		struct container {
+			uint16_t key;                 // high 16 bits
+			uint32_t card;                // number of values
+			std::vector<uint16_t> array;  // sorted low 16 bits, when sparse
+			std::vector<uint64_t> words;  // BITMAP_WORDS, when dense
+
+			container(uint16_t k) : key{k}, card{0} {}
+			bool is_bitmap() const { return !words.empty(); }
+			bool contains(uint16_t) const;
+			void add(uint16_t);
+			void to_bitmap();
+			void to_array();
+			// converts to the smaller representation for the cardinality
+			void optimize();
+		};
+
+		std::vector<container> _containers;  // ordered by key
+
+		container* find(uint16_t);
+		const container* find(uint16_t) const;
+		container& get_or_add(uint16_t);
+
+		static container and_container(const container&, const container&);
+		static void or_container(container&, const container&);
+
+	public:
+		bitmap() {}
+
+		bool empty() const { return _containers.empty(); }
+		size_t cardinality() const;
+		bool contains(uint32_t) const;
+		void add(uint32_t);
+		// adds values in [lo, hi)
+		void add_range(uint32_t, uint32_t);
+		void clear() { _containers.clear(); }
+
+		// in place union
+		bitmap& operator|=(const bitmap&);
+		// in place intersection
+		bitmap& operator&=(const bitmap&);
+		friend bitmap operator&(const bitmap&, const bitmap&);
+
+		bool operator==(const bitmap&) const;
+		bool operator!=(const bitmap& rhs) const { return !(*this == rhs); }
+
+		// calls the function for each value in ascending order, until it returns false
+		void for_each(const std::function<bool(uint32_t)>&) const;
+		std::vector<uint32_t> values() const;
+};
+
+bitmap operator&(const bitmap&, const bitmap&);
+
+/*\
+|*|  In memory index of the subjects of relations, as bitmaps of tag ordinals.
+|*|  Ordinals are assigned in rank order, so the subtree of a tag
+|*|  is the contiguous range of ordinals [ordinal, subtree_end(ordinal)).
+|*|  Relators and objects are matched by subtree, as in sqlite::related().
+\*/
+class bitmap_index {
+	public:
+		typedef uint32_t ordinal;
+
+	private:
+		std::vector<tagd::id_type> _ids;   // by ordinal
+		std::vector<tagd::rank> _ranks;    // by ordinal
+		std::vector<ordinal> _ends;        // end of the subtree range by ordinal
+		std::unordered_map<tagd::id_type, ordinal> _ordinals;
+
+		// subject bitmaps, keyed by ordinal
+		std::map<ordinal, bitmap> _relators;
+		std::map<ordinal, bitmap> _objects;
+		std::map<std::pair<ordinal, ordinal>, bitmap> _pairs;  // (relator, object)
+
+		bool _built = false;
+
+		// subjects of a map keyed by ordinal, in the subtree range
+		static bitmap subtree_union(const std::map<ordinal, bitmap>&, ordinal, ordinal);
+
+	public:
+		bool built() const { return _built; }
+		void clear();
+		size_t size() const { return _ids.size(); }
+
+		// tags must be added in rank order, before their relations
+		void add_tag(const tagd::id_type&, const tagd::rank&);
+		// returns false if a tag is not in the index
+		bool add_relation(const tagd::id_type&, const tagd::id_type&, const tagd::id_type&);
+		// sets the subtree ranges, the index is built
+		void finish();
+
+		bool ordinal_of(const tagd::id_type&, ordinal*) const;
+		const tagd::id_type& id(ordinal o) const { return _ids[o]; }
+		const tagd::rank& rank(ordinal o) const { return _ranks[o]; }
+		ordinal subtree_end(ordinal o) const { return _ends[o]; }
+
+		// subjects related by a relator and object, or any in their subtrees
+		// an empty relator or object matches any
+		bitmap related(const tagd::id_type&, const tagd::id_type&) const;
+		// the members and all tags in their subtrees
+		bitmap closure(const bitmap&) const;
+		// the members within the subtree of a tag, and within a depth below it (0 no limit)
+		bitmap within(const bitmap&, ordinal, size_t = 0) const;
+};
+
+} // namespace tagdb
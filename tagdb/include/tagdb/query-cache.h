@@ -0,0 +1,86 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <set>
+#include "tagd.h"
+
+namespace tagdb {
+
+// relator and object ranks of a predicate, an empty rank matches any
+typedef std::pair<tagd::rank, tagd::rank> rank_pair;
+typedef std::vector<rank_pair> rank_pair_vec;
+
+// what a cached query result depends on, so a write only invalidates the entries it overlaps
+struct query_deps {
+	bool all = false;               // invalidated by any write (i.e. referent and inherited queries)
+	bool has_super = false;         // results are limited to the subtree of super
+	tagd::rank super;               // empty is _entity
+	rank_pair_vec predicates;       // predicates the results are related by
+	std::vector<tagd::rank> ranks;  // ranks of the tags in the result
+	std::set<tagd::id_type> terms;  // ids named by the query
+
+	void clear() {
+		all = has_super = false;
+		super = tagd::rank();
+		predicates.clear();
+		ranks.clear();
+		terms.clear();
+	}
+};
+
+struct query_cache_stats {
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;      // least recently used entries removed when full
+	size_t invalidations = 0;  // entries removed by writes
+};
+
+// bounded LRU cache of query results keyed by a normalized query string
+// a max_size of 0 disables the cache
+class query_cache {
+	private:
+		struct entry {
+			std::string key;
+			tagd::tag_set result;
+			query_deps deps;
+		};
+		typedef std::list<entry> entry_list;
+
+		size_t _max_size;
+		entry_list _entries;  // most recently used first
+		std::unordered_map<std::string, entry_list::iterator> _index;
+		query_cache_stats _stats;
+
+		// removes the entries the predicate returns true for
+		template <typename F>
+		size_t invalidate_if(F);
+
+	public:
+		query_cache(size_t max_size = 0) : _max_size{max_size} {}
+
+		size_t max_size() const { return _max_size; }
+		// evicts least recently used entries down to the new size
+		void max_size(size_t);
+		bool enabled() const { return _max_size > 0; }
+		size_t size() const { return _entries.size(); }
+		bool empty() const { return _entries.empty(); }
+		const query_cache_stats& stats() const { return _stats; }
+
+		// copies the cached result into the tag set, returns false on a miss
+		bool get(tagd::tag_set&, const std::string&);
+		void put(const std::string&, const tagd::tag_set&, const query_deps&);
+
+		// a tag (rank, id) was inserted, moved or deleted
+		// returns the number of entries removed
+		size_t invalidate_tag(const tagd::rank&, const tagd::id_type&);
+		// relations of a subject (rank, id) were inserted or deleted
+		size_t invalidate_relations(const tagd::rank&, const tagd::id_type&, const rank_pair_vec&);
+		void clear();
+
+		// either rank is in the subtree of the other, an empty rank overlaps all
+		static bool overlaps(const tagd::rank&, const tagd::rank&);
+};
+
+} // namespace tagdb
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace tagdb {
+
+/*\
+|*|  HDR style histogram of latencies (or any non-negative values):
+|*|  values below SUB_BUCKETS are counted exactly, larger values are counted
+|*|  in SUB_BUCKETS buckets per power of two, so a bucket is within 1/SUB_BUCKETS
+|*|  of the values counted in it. Recording is an index computation and an increment.
+\*/
+class histogram {
+	public:
+		static const size_t SUB_BITS = 3;
+		static const size_t SUB_BUCKETS = 1 << SUB_BITS;
+		// larger values are counted in the last bucket
+		static const size_t MAX_BITS = 40;
+		static const size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+	private:
+		uint64_t _counts[BUCKETS] = {};
+		uint64_t _count = 0;
+		uint64_t _sum = 0;
+		uint64_t _max = 0;
+
+	public:
+		void record(uint64_t);
+		void clear();
+
+		uint64_t count() const { return _count; }
+		uint64_t sum() const { return _sum; }
+		uint64_t max() const { return _max; }
+
+		// the largest value of the bucket reaching the fraction (0.0 to 1.0) of the values, 0 when empty
+		uint64_t percentile(double) const;
+		// number of values less than the bound, exact when the bound is a power of two
+		uint64_t count_below(uint64_t) const;
+
+		static size_t bucket(uint64_t);
+		// largest value counted in the bucket
+		static uint64_t bucket_max(size_t);
+};
+
+// tagdb operations timed by op_timer
+typedef enum {
+	STAT_GET,
+	STAT_PUT,
+	STAT_DEL,
+	STAT_QUERY,
+	STAT_SEARCH,
+
+	STAT_OP_COUNT
+} stat_op;
+
+const char* stat_op_str(stat_op);
+
+// latencies of tagdb operations, in microseconds
+struct op_stats {
+	histogram latency[STAT_OP_COUNT];
+
+	void clear() {
+		for (auto& h : latency)
+			h.clear();
+	}
+};
+
+// records the latency of an operation when it goes out of scope
+// operations called by other timed operations aren't recorded, only the outermost
+class op_timer {
+	private:
+		op_stats *_stats;
+		size_t *_depth;
+		stat_op _op;
+		std::chrono::steady_clock::time_point _start;
+
+	public:
+		op_timer(op_stats *stats, size_t *depth, stat_op op)
+				: _stats{stats}, _depth{depth}, _op{op} {
+			if ((*_depth)++ == 0)
+				_start = std::chrono::steady_clock::now();
+		}
+		op_timer(const op_timer&) = delete;
+
+		~op_timer() {
+			if (--(*_depth) == 0) {
+				auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - _start);
+				_stats->latency[_op].record(us.count());
+			}
+		}
+};
+
+} // namespace tagdb
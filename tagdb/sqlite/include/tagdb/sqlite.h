@@ -2,8 +2,13 @@
 
 #include "tagd.h"
 #include "tagdb.h"
+#include "tagdb/query-cache.h"
+#include "tagdb/bitmap.h"
 #include "sqlite3.h"
 #include <functional>
+#include <list>
+#include <map>
+#include <unordered_map>
 
 namespace tagdb {
 
@@ -11,7 +16,79 @@ typedef sqlite3_int64 rowid_t;
 
 typedef std::function<tagd::id_type(const tagd::id_type&)> id_transform_func_t;
 
+class sqlite_cursor;  // forward declare
+
+struct stmt_stats {
+	size_t prepares = 0;  // times the sql was prepared, including after eviction
+	size_t uses = 0;      // times a statement was handed out by prepare()
+	// virtual machine steps, and those of full table scans (SQLITE_STMTSTATUS_*)
+	// counted when a statement is handed out again or finalized, see collect()
+	size_t vm_steps = 0;
+	size_t fullscan_steps = 0;
+};
+
+// LRU cache of prepared statements keyed by sql text
+// statements belong to the cache, they are reset and their bindings cleared
+// when handed out, and are only finalized by erase(), clear() or eviction
+// a statement is used until the next prepare() of its sql, so the cache must hold
+// more statements than nested calls have in use at once (see MIN_SIZE)
+class stmt_cache {
+	public:
+		static const size_t MIN_SIZE = 32;
+
+	private:
+		struct entry {
+			std::string sql;
+			sqlite3_stmt *stmt;
+		};
+		typedef std::list<entry> entry_list;
+
+		size_t _max_size;
+		entry_list _entries;  // most recently used first
+		std::unordered_map<std::string, entry_list::iterator> _index;
+		std::map<std::string, stmt_stats> _stats;  // by sql
+		size_t _evictions = 0;
+
+		// finalizes least recently used statements not being stepped, down to the max_size
+		void evict();
+		// adds the step counts of the statement to the stats of its sql, and resets them
+		void count_steps(const std::string&, sqlite3_stmt*);
+
+	public:
+		stmt_cache(size_t max_size = 128) : _max_size{max_size < MIN_SIZE ? MIN_SIZE : max_size} {}
+		stmt_cache(const stmt_cache&) = delete;
+		stmt_cache& operator=(const stmt_cache&) = delete;
+		~stmt_cache() { this->clear(); }
+
+		size_t max_size() const { return _max_size; }
+		// no less than MIN_SIZE
+		void max_size(size_t);
+		size_t size() const { return _entries.size(); }
+		size_t evictions() const { return _evictions; }
+		const std::map<std::string, stmt_stats>& stats() const { return _stats; }
+		// times the sql was prepared
+		size_t prepares(const std::string&) const;
+		// counts the steps of the statements in the cache, so the stats are current
+		void collect();
+		// the stats of all sql summed
+		stmt_stats totals() const;
+
+		// reset statement for the sql, nullptr on a miss
+		sqlite3_stmt* get(const char*);
+		// takes ownership of a newly prepared statement
+		void put(const char*, sqlite3_stmt*);
+		// finalizes a statement, whether or not it is cached
+		void erase(sqlite3_stmt*);
+		void clear();
+};
+
 class sqlite: public tagdb {
+	friend class sqlite_cursor;
+
+	public:
+		// virtual machine instructions between calls to the progress handler
+		static const int PROGRESS_HANDLER_OPS = 1000;
+
     protected:
         sqlite3 *_db = nullptr;   // sqlite connection
         std::string _db_fname;
@@ -20,37 +97,23 @@ class sqlite: public tagdb {
 		// performing init() operations
 		bool _doing_init = false;
 
-        // prepared statement handles, must be sqlite3_finalized in the destructor
-        sqlite3_stmt *_get_stmt = nullptr;
-        sqlite3_stmt *_exists_stmt = nullptr;
-        sqlite3_stmt *_term_pos_stmt = nullptr;
-        sqlite3_stmt *_term_id_pos_stmt = nullptr;
-        sqlite3_stmt *_pos_stmt = nullptr;
-        sqlite3_stmt *_refers_to_stmt = nullptr;
-        sqlite3_stmt *_refers_stmt = nullptr;
-        sqlite3_stmt *_insert_term_stmt = nullptr;
-        sqlite3_stmt *_update_term_stmt = nullptr;
-        sqlite3_stmt *_delete_term_stmt = nullptr;
-        sqlite3_stmt *_insert_fts_tag_stmt = nullptr;
-        sqlite3_stmt *_update_fts_tag_stmt = nullptr;
-        sqlite3_stmt *_delete_fts_tag_stmt = nullptr;
-        sqlite3_stmt *_search_stmt = nullptr;
-        sqlite3_stmt *_insert_stmt = nullptr;
-        sqlite3_stmt *_update_tag_stmt = nullptr;
-        sqlite3_stmt *_update_ranks_stmt = nullptr;
-        sqlite3_stmt *_child_ranks_stmt = nullptr;
-        sqlite3_stmt *_max_child_rank_stmt = nullptr;
-        sqlite3_stmt *_insert_relations_stmt = nullptr;
-        sqlite3_stmt *_insert_referents_stmt = nullptr;
-        sqlite3_stmt *_delete_tag_stmt = nullptr;
-        sqlite3_stmt *_delete_subject_relations_stmt = nullptr;
-        sqlite3_stmt *_delete_relation_stmt = nullptr;
-        sqlite3_stmt *_delete_refers_to_stmt = nullptr;
-        sqlite3_stmt *_term_pos_occurence_stmt = nullptr;
-        sqlite3_stmt *_get_relations_stmt = nullptr;
-        sqlite3_stmt *_related_stmt = nullptr;
-        sqlite3_stmt *_related_modifier_stmt = nullptr;
-		sqlite3_stmt *_get_children_stmt = nullptr;
+		// prepared statements, finalized by finalize()
+		stmt_cache _stmt_cache;
+
+		// query results, invalidated by the writes overlapping them
+		query_cache _query_cache;
+
+		// subjects of relations, built on the first merged query after a write
+		bitmap_index _bitmap_index;
+		bool _use_bitmap_index = false;
+
+		// between batch_begin() and batch_end()
+		bool _in_batch = false;
+
+		// sqlite3_progress_handler() callback, interrupts statements when this->interrupted()
+		static int progress_handler(void*);
+		// TS_INTERNAL_ERR, or the code of an interrupted operation
+		tagd::code internal_err_code() const;
 
 		// wrapped by init(), sets _doing_init
         tagd::code _init(const std::string&);
@@ -83,6 +146,17 @@ class sqlite: public tagdb {
         tagd::code get(tagd::abstract_tag&, const tagd::id_type&, session*, flags_t = 0);
         tagd::code get(tagd::url&, const tagd::id_type&, session*, flags_t = 0);
 
+        // get tags (with relations) given ids, in a constant number of statements
+        tagd::code get_many(tagd::tag_set&, const tagd::id_vec&, session*, flags_t = 0);
+
+        // lowest common ancestor, looked up by the common prefix of the ranks
+        tagd::code lca(tagd::id_type&, const tagd::id_type&, const tagd::id_type&, session*, flags_t = 0);
+
+        // ancestors, siblings and children in one statement over ranges of the rank indexes
+        tagd::code tree(tree_set&, const tagd::id_type&, session*, flags_t = 0);
+        // the tree, referents in one statement, and related tags
+        tagd::code neighborhood(neighborhood_set&, const tagd::abstract_tag&, session*, flags_t = 0);
+
         // put tag, will overrite existing (move + update)
         tagd::code put(const tagd::abstract_tag&, session *, flags_t = 0);
         tagd::code put(const tagd::url&, session *, flags_t = 0);
@@ -93,6 +167,13 @@ class sqlite: public tagdb {
         tagd::code del(const tagd::url&, session *, flags_t = 0);
         tagd::code del(const tagd::referent&, session *, flags_t = 0);
 
+        // one transaction, with a savepoint per statement
+        tagd::code batch_begin(session*, flags_t = 0);
+        tagd::code batch_end(bool, session*, flags_t = 0);
+        tagd::code statement_begin(session*, flags_t = 0);
+        tagd::code statement_end(bool, session*, flags_t = 0);
+        bool in_batch() const { return _in_batch; }
+
 // ### TODO ####
 // all public members not defined as public in tagdb::tagdb
 // base class should be made private or protected
@@ -109,14 +190,39 @@ class sqlite: public tagdb {
 		// get refers given refers_to
 		tagd::code refers(tagd::id_type&, const tagd::id_type&, session*);
 
-        tagd::code related(tagd::tag_set&, const tagd::predicate&, const tagd::id_type&, session *, flags_t = 0);
+        // tags related by predicate under super_object, up to limit (0 no limit) tags after the given tag
+        // optionally limited, after a tag id, and within a depth below the super_object
+        tagd::code related(tagd::tag_set&, const tagd::predicate&, const tagd::id_type&, session *, flags_t = 0,
+			size_t = 0, const tagd::id_type& = tagd::id_type(), size_t = 0);
         tagd::code related(tagd::tag_set &T, const tagd::predicate &p, session *ssn, flags_t f = 0) {
 			return this->related(T, p, tagd::id_type(), ssn, f);
 		}
         tagd::code query(tagd::tag_set&, const tagd::interrogator&, session *, flags_t = 0);
+        // caches up to the given number of query results, 0 (the default) disables the cache
+        void query_cache_size(size_t sz) { _query_cache.max_size(sz); }
+        const query_cache_stats& query_stats() const { return _query_cache.stats(); }
+        // the prepared statement cache holds up to the given number of statements
+        void stmt_cache_size(size_t sz) { _stmt_cache.max_size(sz); }
+        const stmt_cache& statements() const { return _stmt_cache; }
+        // the prepared statement stats summed, with the steps of the cached statements collected
+        stmt_stats statement_totals() {
+			_stmt_cache.collect();
+			return _stmt_cache.totals();
+		}
+        // intersects the subjects of queries having more than one predicate in memory,
+        // instead of merging the tags related by each
+        void use_bitmap_index(bool b) {
+			_use_bitmap_index = b;
+			if (!b) _bitmap_index.clear();
+		}
+        cursor* query_cursor(const tagd::interrogator&, session *, flags_t = 0);
+        // counts in sql without constructing tags, when the query is a single statement
+        tagd::code query_count(size_t&, const tagd::interrogator&, session *, flags_t = 0);
 
         tagd::code search(tagd::tag_set&, const std::string&, flags_t = 0);
-        tagd::code get_children(tagd::tag_set&, const tagd::id_type&, session *, flags_t = 0);
+        // descendants down to a depth, where children are depth 1 (the default)
+        tagd::code get_children(tagd::tag_set&, const tagd::id_type&, session *, flags_t = 0,
+			size_t = 0, const tagd::id_type& = tagd::id_type(), size_t = 0);
         tagd::code query_referents(tagd::tag_set&, const tagd::interrogator&);
 
         tagd::code dump(std::ostream& = std::cout);
@@ -149,6 +255,8 @@ class sqlite: public tagdb {
         // update - updated, new destination
         tagd::code update(const tagd::abstract_tag&, const tagd::abstract_tag&);
 
+		// writes a validated tag put(), within the write savepoint
+		tagd::code write_tag(const tagd::abstract_tag&, session*, flags_t = 0);
         tagd::code insert_relations(const tagd::abstract_tag&, flags_t = 0);
 		tagd::code insert_referent(const tagd::referent&, session *, flags_t = 0);
 
@@ -172,6 +280,38 @@ class sqlite: public tagdb {
 		tagd::part_of_speech term_pos_occurence(const tagd::id_type&, session*, bool);
 		tagd::code update_pos_occurence(const tagd::id_type&);
         tagd::code get_relations(tagd::predicate_set&, const tagd::id_type&, session *, flags_t = 0);
+		// binds the predicate, super_object, after and depth params of the related sql
+		tagd::code bind_related(sqlite3_stmt**, const tagd::predicate&, const tagd::id_type&, const tagd::id_type&, size_t = 0);
+		// binds the super_object, limit and after params of the children sql, and depth of the descendants sql
+		tagd::code bind_children(sqlite3_stmt**, const tagd::id_type&, size_t, const tagd::id_type&, size_t = 0);
+		// sets limit, after and depth from the interrogator and erases them from its relations
+		tagd::code query_options(size_t*, tagd::id_type*, size_t*, tagd::interrogator&, session*);
+		// query() without the query cache
+		tagd::code query_tags(tagd::tag_set&, const tagd::interrogator&, session *, flags_t = 0);
+		// key of a query in the query cache, including the session context
+		std::string query_cache_key(const tagd::interrogator&, session *, flags_t);
+		// ranks and terms the results of a query depend on
+		tagd::code query_cache_deps(query_deps&, const tagd::interrogator&, const tagd::tag_set&, session *, flags_t);
+		// whether a merged query can be answered by the bitmap index, building it if needed
+		bool bitmap_indexed(const tagd::interrogator&, const tagd::id_type&, flags_t);
+		tagd::code build_bitmap_index();
+		// merged query answered by intersecting bitmaps, only the tags in the result are loaded
+		tagd::code query_bitmap_index(tagd::tag_set&, const tagd::interrogator&, session *, flags_t,
+			size_t, const tagd::id_type&, size_t);
+		// removes cached queries overlapping a written tag, or the relations of a subject,
+		// clears the bitmap index, and changes the tagspace version
+		void invalidate_queries(const tagd::id_type&);
+		void invalidate_queries(const tagd::id_type&, const tagd::predicate_set&);
+		// writes were rolled back, so cached queries, the bitmap index and
+		// the referents cached by sessions may be of writes that no longer exist
+		void invalidate_all();
+		// rank of a tag, TS_NOT_FOUND without setting an error when the tag doesn't exist
+		tagd::code rank_of(tagd::rank&, const tagd::id_type&);
+
+		// relations of the tags in the tmp_ids table, keyed by rank
+		tagd::code tmp_id_relations(std::map<std::string, tagd::predicate_set>&, session *, flags_t = 0);
+		// replaces the tags in the tag set with tags having all their relations
+		tagd::code hydrate_relations(tagd::tag_set&, session *, flags_t = 0);
 
         tagd::code next_rank(tagd::rank&, const tagd::abstract_tag&);
         tagd::code child_ranks(tagd::rank_set&, const tagd::id_type&);
@@ -180,9 +320,16 @@ class sqlite: public tagdb {
         // sqlite3 helper funcs
         tagd::code exec(const char*, const char*label=NULL);
 		tagd::code exec_mprintf(const char *, ...);
+        // cached statement for the sql, owned by _stmt_cache, must not be finalized by the caller
         tagd::code prepare(sqlite3_stmt**, const char*, const char*label=NULL);
+        // newly prepared statement, owned and finalized by the caller
+        tagd::code prepare_stmt(sqlite3_stmt**, const char*, const char*label=NULL);
+        // finalizes a statement that failed, removing it from the cache
+        void finalize_stmt(sqlite3_stmt**);
         tagd::code bind_text(sqlite3_stmt**, int, const char*, const char*label=NULL);
         tagd::code bind_int(sqlite3_stmt**, int, int, const char*label=NULL);
+        tagd::code bind_double(sqlite3_stmt**, int, double, const char*label=NULL);
+        tagd::code bind_modifier_value(sqlite3_stmt**, int, const tagd::predicate&, const char*label=NULL);
         tagd::code bind_rowid(sqlite3_stmt**, int, rowid_t, const char*label=NULL);
         tagd::code bind_null(sqlite3_stmt**, int, const char*label=NULL);
         virtual void finalize();
@@ -190,9 +337,12 @@ class sqlite: public tagdb {
         // init db funcs
 		tagd::code create_terms_table();
         tagd::code create_tags_table();
+        tagd::code create_rank_depth_index();
         tagd::code create_relations_table();
         tagd::code create_referents_table();
         tagd::code create_fts_tags_table();
+        tagd::code create_term_occurences_table();
+        tagd::code add_modifier_value_column();
 
     public:
         // statics
@@ -232,4 +382,31 @@ class sqlite: public tagdb {
         }
 };
 
+// steps a statement owned by the cursor, so rows are converted to tags as they are read
+// consecutive rows of the same tag (related by more than one predicate) are merged into one tag
+class sqlite_cursor : public cursor {
+	friend class sqlite;
+
+	private:
+		sqlite *_tdb;
+		sqlite3_stmt *_stmt;  // finalized in the destructor
+		session *_ssn;
+		flags_t _flags;
+		id_transform_func_t _f_transform;
+		int _s_rc = SQLITE_OK;  // SQLITE_OK until first step, then the last step result
+		size_t _limit;  // 0 for no limit
+		size_t _n = 0;  // number of tags returned by next()
+
+		// only sqlite::query_cursor() creates
+		sqlite_cursor(sqlite *tdb, sqlite3_stmt *stmt, session *ssn, flags_t flags, id_transform_func_t f, size_t limit) :
+			_tdb{tdb}, _stmt{stmt}, _ssn{ssn}, _flags{flags}, _f_transform{f}, _limit{limit} {}
+
+		tagd::code step_error();
+
+	public:
+		~sqlite_cursor() { sqlite3_finalize(_stmt); }
+
+		tagd::code next(tagd::abstract_tag&);
+};
+
 } // tagdb
@@ -2,13 +2,16 @@
 #include <sstream>
 #include <iomanip> // setw
 #include <cstring> // strcmp
-#include <cstdlib> // atoi
+#include <cstdlib> // strtoll, strtod
 #include <assert.h>
 #include <vector>
 #include <functional>
 #include <algorithm>
 #include <cstdio>
 #include <cstdarg>
+#include <cerrno>
+#include <cmath>   // isfinite
+#include <climits> // INT_MAX
 
 #include "tagdb/sqlite.h"
 
@@ -60,9 +63,32 @@ ts_sqlite_code sqlite_constraint_type(const char *err) {
 	return TS_SQLITE_UNK;
 }
 
-void finalize_stmt(sqlite3_stmt **stmt) {
-	sqlite3_finalize(*stmt);
-	*stmt = nullptr;
+// parses the numeric value of a modifier as given by its data type
+// TYPE_TEXT modifiers are numeric if they parse as one (TAGL quantifiers are TYPE_TEXT)
+// returns SQLITE_INTEGER, SQLITE_FLOAT, or SQLITE_NULL if not numeric
+int modifier_numeric_value(const std::string& m, tagd::data_t type, sqlite3_int64 *i, double *d) {
+	if (m.empty() || isspace((unsigned char)m[0]))
+		return SQLITE_NULL;
+
+	char *end = nullptr;
+	if (type != tagd::TYPE_FLOAT) {
+		errno = 0;
+		long long ll = strtoll(m.c_str(), &end, 10);
+		if (*end == '\0' && errno == 0) {
+			*i = ll;
+			return SQLITE_INTEGER;
+		}
+	}
+
+	// floats, and integers that don't fit in 64 bits, aren't truncated
+	errno = 0;
+	double val = strtod(m.c_str(), &end);
+	if (*end == '\0' && errno == 0 && std::isfinite(val)) {
+		*d = val;
+		return SQLITE_FLOAT;
+	}
+
+	return SQLITE_NULL;
 }
 
 /*\
@@ -72,9 +98,14 @@ void finalize_stmt(sqlite3_stmt **stmt) {
 #define STMT_OK_OR_RET_ERR() do{if(_code != tagd::TAGD_OK) { sqlite3_finalize(stmt); return _code; }}while(0)
 #define OK_OR_RET_FALSE() if(_code != tagd::TAGD_OK) return false
 
+// writes are within a savepoint rather than BEGIN and COMMIT, so they nest within a batch
+#define BEGIN_WRITE_SQL "SAVEPOINT write"
+#define COMMIT_WRITE_SQL "RELEASE write"
+#define ROLLBACK_WRITE_SQL "ROLLBACK TO write; RELEASE write"
+
 #define OK_OR_ROLLBACK_RET_ERR() if(_code != tagd::TAGD_OK) { \
 		this->finalize(); \
-		this->exec("ROLLBACK"); \
+		this->exec(ROLLBACK_WRITE_SQL); \
 		return _code; \
 	}
 
@@ -95,12 +126,12 @@ void finalize_stmt(sqlite3_stmt **stmt) {
 #define OK_OR_ROLLBACK_RET_SSN_ERR() do{ \
 		if (ssn && ssn->code() != tagd::TAGD_OK) { \
 			this->finalize(); \
-			this->exec("ROLLBACK"); \
+			this->exec(ROLLBACK_WRITE_SQL); \
 			return ssn->code(); \
 		} \
 		if(_code != tagd::TAGD_OK) { \
 			this->finalize(); \
-			this->exec("ROLLBACK"); \
+			this->exec(ROLLBACK_WRITE_SQL); \
 			return _code; \
 		} \
 	}while(0)
@@ -125,7 +156,7 @@ void finalize_stmt(sqlite3_stmt **stmt) {
 // if _code has error, sets/returns a ssn TS_INTERNAL_ERR given action
 #define OK_OR_RET_SSN_INT_ERR_ACTION(A) if (ssn) { \
 		if (_code != tagd::TAGD_OK) \
-			return ssn->error(tagd::TS_INTERNAL_ERR, tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, A)); \
+			return ssn->error(this->internal_err_code(), tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, A)); \
 		else if (ssn->code() != tagd::TAGD_OK) \
 			return ssn->code(); \
 	}
@@ -133,38 +164,54 @@ void finalize_stmt(sqlite3_stmt **stmt) {
 #define OK_OR_ROLLBACK_RET_SSN_INT_ERR_ACTION(A) if (ssn) { \
 		if (_code != tagd::TAGD_OK) { \
 			this->finalize(); \
-			this->exec("ROLLBACK"); \
+			this->exec(ROLLBACK_WRITE_SQL); \
 			return ssn->error(tagd::TS_INTERNAL_ERR, tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, A)); \
 		} else if (ssn->code() != tagd::TAGD_OK) { \
 			this->finalize(); \
-			this->exec("ROLLBACK"); \
+			this->exec(ROLLBACK_WRITE_SQL); \
 			return ssn->code(); \
 		} \
 	}
 
 
 #define OK_OR_RET_UNKNOWN_SSN_INT_ERR_ACTION(A) if (ssn && _code != tagd::TAGD_OK) { \
-		ssn->error(tagd::TS_INTERNAL_ERR, tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, A)); \
+		ssn->error(this->internal_err_code(), tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, A)); \
 		return tagd::POS_UNKNOWN; \
 	}
 
+#define NOT_INTERRUPTED_OR_RET_SSN_ERR(A) do{ \
+		tagd::code itc = this->interrupted(); \
+		if (itc != tagd::TAGD_OK) \
+			RET_SSN_FERROR(itc, "%s interrupted", A); \
+	}while(0)
+
+// writes aren't started once interrupted, and once started aren't interrupted,
+// (nor are the operations nested in them, while write_guard is in scope)
+// so a deadline or cancellation never leaves a tag partially written
+#define BEGIN_WRITE_OR_RET_SSN_ERR(A) write_scope write_guard(&_write_depth); do{ \
+		tagd::code itc = this->interrupted(); \
+		this->uninterruptible(); \
+		if (itc != tagd::TAGD_OK) \
+			RET_SSN_FERROR(itc, "%s interrupted before writing", A); \
+	}while(0)
+
 // creates TS_INTERNAL error object given sqlite3 return code and printf style error msg
 #define SQLITE_FERROR(RC, ...) {\
-			auto sqlite_err = tagd::error::ferror(tagd::TS_INTERNAL_ERR, __VA_ARGS__); \
+			auto sqlite_err = tagd::error::ferror(this->internal_err_code(), __VA_ARGS__); \
 			if (RC == SQLITE_ERROR) \
 				(void)sqlite_err.relation(HARD_TAG_HAS, HARD_TAG_MESSAGE, sqlite3_errmsg(_db)); \
 			this->error(sqlite_err); \
 	}
 
 #define RET_SQLITE_FERROR(RC, ...) {\
-		auto sqlite_err = tagd::error::ferror(tagd::TS_INTERNAL_ERR, __VA_ARGS__); \
+		auto sqlite_err = tagd::error::ferror(this->internal_err_code(), __VA_ARGS__); \
 		if (RC == SQLITE_ERROR) \
 			(void)sqlite_err.relation(HARD_TAG_HAS, HARD_TAG_MESSAGE, sqlite3_errmsg(_db)); \
 		return this->error(sqlite_err); \
 	}
 
 #define RET_SQLITE_SSN_FERROR(RC, ...) {\
-		auto sqlite_err = tagd::error::ferror(tagd::TS_INTERNAL_ERR, __VA_ARGS__); \
+		auto sqlite_err = tagd::error::ferror(this->internal_err_code(), __VA_ARGS__); \
 		if (ssn) ssn->error(sqlite_err); \
 		if (RC == SQLITE_ERROR) \
 			(void)sqlite_err.relation(HARD_TAG_HAS, HARD_TAG_MESSAGE, sqlite3_errmsg(_db)); \
@@ -244,13 +291,17 @@ tagd::code sqlite::_init(const std::string& fname) {
 	if (_code == tagd::TAGD_OK)
 		this->create_fts_tags_table();
 
+	// after the tables it counts, so their triggers can be created
+	if (_code == tagd::TAGD_OK)
+		this->create_term_occurences_table();
+
 	// We have to insert _entity and _sub manually because of the FK on _sub_relator
 	// The rest of the hard tags will be inserted by bootstrap
 	// UNIQUE constraints will be ignored
 	if (_code == tagd::TAGD_OK) {
 
 		sqlite3_stmt *stmt = nullptr; 
-		this->prepare(&stmt,
+		this->prepare_stmt(&stmt,
 			"INSERT OR IGNORE INTO terms (ROWID, term, term_pos) VALUES (?, ?, ?)",
 			"insert term"
 		);
@@ -293,7 +344,7 @@ tagd::code sqlite::_init(const std::string& fname) {
 
 		if ( _code == tagd::TAGD_OK ) {
 			stmt = nullptr;
-			this->prepare(&stmt,
+			this->prepare_stmt(&stmt,
 				"INSERT OR IGNORE INTO tags (tag, sub_relator, super_object, rank, pos) "
 				"VALUES (tid(?), tid(?), tid(?), ?, ?)",
 				"insert hard_tag"
@@ -431,7 +482,7 @@ tagd::code sqlite::create_terms_table() {
 
 	// check db
 	sqlite3_stmt *stmt = nullptr; 
-	this->prepare(&stmt,
+	this->prepare_stmt(&stmt,
 		"SELECT 1 FROM sqlite_master "
 		"WHERE type = 'table' "
 		"AND sql LIKE 'CREATE TABLE terms%'",
@@ -473,7 +524,7 @@ tagd::code sqlite::create_terms_table() {
 tagd::code sqlite::create_tags_table() {
 	// check db
 	sqlite3_stmt *stmt = nullptr; 
-	this->prepare(&stmt,
+	this->prepare_stmt(&stmt,
 		"SELECT 1 FROM sqlite_master "
 		"WHERE type = 'table' "
 		"AND sql LIKE 'CREATE TABLE tags%'",
@@ -493,7 +544,7 @@ tagd::code sqlite::create_tags_table() {
 		OK_OR_RET_ERR();
 
 		if (t.id() == HARD_TAG_ENTITY && t.super_object() == HARD_TAG_ENTITY)
-			return tagd::TAGD_OK; // db already initialized
+			return this->create_rank_depth_index(); // db already initialized
 	
 		return this->error(tagd::TS_INTERNAL_ERR, "tag table exists but has no _entity row; database corrupt");
 	}
@@ -522,13 +573,20 @@ tagd::code sqlite::create_tags_table() {
 	OK_OR_RET_ERR();
 
 	this->exec("CREATE INDEX idx_super_object ON tags(super_object)");
+	OK_OR_RET_ERR();
 
-	return _code;
+	return this->create_rank_depth_index();
+}
+
+// depth bounded descendants, looked up by level then rank range
+// created if not exists, for tags tables created without it
+tagd::code sqlite::create_rank_depth_index() {
+	return this->exec("CREATE INDEX IF NOT EXISTS idx_rank_depth ON tags(length(rank), rank)");
 }
 
 tagd::code sqlite::create_referents_table() {
 	sqlite3_stmt *stmt = nullptr; 
-	this->prepare(&stmt,
+	this->prepare_stmt(&stmt,
 		"SELECT 1 FROM sqlite_master "
 		"WHERE type = 'table' "
 		"AND sql LIKE 'CREATE TABLE referents%'",
@@ -589,7 +647,7 @@ tagd::code sqlite::create_referents_table() {
 
 tagd::code sqlite::create_fts_tags_table() {
 	sqlite3_stmt *stmt = nullptr;
-	this->prepare(&stmt,
+	this->prepare_stmt(&stmt,
 		"SELECT 1 FROM sqlite_master "
 		"WHERE type = 'table' "
 		"AND sql LIKE 'CREATE VIRTUAL TABLE fts_tags %'",
@@ -612,10 +670,129 @@ tagd::code sqlite::create_fts_tags_table() {
 	return _code;
 }
 
+// occurence counts of each term per part of speech (role) in the tags, relations
+// and referents tables, maintained by triggers, so that the pos of a term can be
+// recomputed after deletes without probing every column it could occur in
+tagd::code sqlite::create_term_occurences_table() {
+	sqlite3_stmt *stmt = nullptr;
+	this->prepare_stmt(&stmt,
+		"SELECT 1 FROM sqlite_master "
+		"WHERE type = 'table' "
+		"AND sql LIKE 'CREATE TABLE term_occurences%'",
+		"term_occurences table exists"
+	);
+	STMT_OK_OR_RET_ERR();
+
+	int s_rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (s_rc == SQLITE_ERROR)
+		RET_SQLITE_FERROR(tagd::TS_INTERNAL_ERR, "check table error: %s", "term_occurences");
+
+	// table exists
+	if (s_rc == SQLITE_ROW)
+		return tagd::TAGD_OK;
+
+	//create db
+	this->exec(
+	"CREATE TABLE term_occurences ("
+		"term  INTEGER NOT NULL, "
+		"pos   INTEGER NOT NULL, "  // the tagd::part_of_speech bit of the role
+		"cnt   INTEGER NOT NULL, "
+		"PRIMARY KEY (term, pos)"
+	") WITHOUT ROWID"
+	);
+	OK_OR_RET_ERR();
+
+	typedef std::vector<std::pair<const char*, tagd::part_of_speech>> roles_t;
+
+	auto f_create_triggers = [this](const char *tbl, const roles_t& roles) -> tagd::code {
+		auto f_increment = [&](std::stringstream& ss) {
+			for (auto r : roles) {
+				ss << "INSERT INTO term_occurences (term, pos, cnt) "
+				   << "SELECT NEW." << r.first << ", " << r.second << ", 1 "
+				   << "WHERE NEW." << r.first << " IS NOT NULL "
+				   << "ON CONFLICT (term, pos) DO UPDATE SET cnt = cnt + 1; ";
+			}
+		};
+
+		auto f_decrement = [&](std::stringstream& ss) {
+			for (auto r : roles) {
+				ss << "UPDATE term_occurences SET cnt = cnt - 1 "
+				   << "WHERE term = OLD." << r.first << " AND pos = " << r.second << "; "
+				   << "DELETE FROM term_occurences "
+				   << "WHERE term = OLD." << r.first << " AND pos = " << r.second << " AND cnt <= 0; ";
+			}
+		};
+
+		std::stringstream ss;
+		ss << "CREATE TRIGGER trg_" << tbl << "_occurences_insert "
+		   << "AFTER INSERT ON " << tbl << " BEGIN ";
+		f_increment(ss);
+		ss << "END";
+		this->exec(ss.str().c_str());
+		OK_OR_RET_ERR();
+
+		ss.str("");
+		ss << "CREATE TRIGGER trg_" << tbl << "_occurences_delete "
+		   << "AFTER DELETE ON " << tbl << " BEGIN ";
+		f_decrement(ss);
+		ss << "END";
+		this->exec(ss.str().c_str());
+		OK_OR_RET_ERR();
+
+		ss.str("");
+		ss << "CREATE TRIGGER trg_" << tbl << "_occurences_update "
+		   << "AFTER UPDATE OF ";
+		for (auto it = roles.begin(); it != roles.end(); ++it)
+			ss << (it == roles.begin() ? "" : ", ") << it->first;
+		ss << " ON " << tbl << " BEGIN ";
+		f_decrement(ss);
+		f_increment(ss);
+		ss << "END";
+		this->exec(ss.str().c_str());
+		OK_OR_RET_ERR();
+
+		// count rows already existing (databases created before this table)
+		for (auto r : roles) {
+			ss.str("");
+			ss << "INSERT INTO term_occurences (term, pos, cnt) "
+			   << "SELECT " << r.first << ", " << r.second << ", COUNT(*) FROM " << tbl << ' '
+			   << "WHERE " << r.first << " IS NOT NULL "
+			   << "GROUP BY " << r.first;
+			this->exec(ss.str().c_str());
+			OK_OR_RET_ERR();
+		}
+
+		return _code;
+	};
+
+	f_create_triggers("tags", {
+			{"sub_relator", tagd::POS_SUB_RELATOR},
+			{"super_object", tagd::POS_SUB_OBJECT}
+		});
+	OK_OR_RET_ERR();
+
+	f_create_triggers("relations", {
+			{"subject", tagd::POS_SUBJECT},
+			{"relator", tagd::POS_RELATED},
+			{"object", tagd::POS_OBJECT},
+			{"modifier", tagd::POS_MODIFIER}
+		});
+	OK_OR_RET_ERR();
+
+	f_create_triggers("referents", {
+			{"refers", tagd::POS_REFERS},
+			{"refers_to", tagd::POS_REFERS_TO},
+			{"context", tagd::POS_CONTEXT}
+		});
+
+	return _code;
+}
+
 tagd::code sqlite::create_relations_table() {
 	// check db
 	sqlite3_stmt *stmt = nullptr; 
-	this->prepare(&stmt,
+	this->prepare_stmt(&stmt,
 		"SELECT 1 FROM sqlite_master "
 		"WHERE type = 'table' "
 		"AND sql LIKE 'CREATE TABLE relations%'",
@@ -630,7 +807,7 @@ tagd::code sqlite::create_relations_table() {
 	
 	// table exists
 	if (s_rc == SQLITE_ROW)
-		return tagd::TAGD_OK;
+		return this->add_modifier_value_column();
 
 	//create db
 	this->exec(
@@ -639,6 +816,8 @@ tagd::code sqlite::create_relations_table() {
 		"relator   INTEGER NOT NULL, "
 		"object    INTEGER NOT NULL, "
 		"modifier  INTEGER, "
+		// typed value of the modifier: INTEGER or REAL if numeric, otherwise TEXT
+		"modifier_value NUMERIC, "
 		// whatever statement throws a unique constraint will fail
 		// but the trasaction overall can still succeed
 		"PRIMARY KEY (subject, relator, object) ON CONFLICT FAIL, " // makes unique
@@ -663,6 +842,82 @@ tagd::code sqlite::create_relations_table() {
 	// relator index added because of use in _term_pos_occurence_stmt
 	// TODO look into optimizing
 	this->exec("CREATE INDEX idx_modifier ON relations(modifier)");
+	OK_OR_RET_ERR();
+
+	// range scans of modifier values (i.e. _has legs > 2)
+	this->exec("CREATE INDEX idx_modifier_value ON relations(relator, object, modifier_value)");
+
+	return _code;
+}
+
+// adds and populates the modifier_value column to relations tables created without it
+tagd::code sqlite::add_modifier_value_column() {
+	sqlite3_stmt *stmt = nullptr;
+	this->prepare_stmt(&stmt,
+		"SELECT 1 FROM sqlite_master "
+		"WHERE type = 'table' "
+		"AND name = 'relations' "
+		"AND sql LIKE '%modifier_value%'",
+		"modifier_value column exists"
+	);
+	STMT_OK_OR_RET_ERR();
+
+	int s_rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (s_rc == SQLITE_ERROR)
+		RET_SQLITE_FERROR(tagd::TS_INTERNAL_ERR, "check column error: %s", "modifier_value");
+
+	// column exists
+	if (s_rc == SQLITE_ROW)
+		return tagd::TAGD_OK;
+
+	this->exec("ALTER TABLE relations ADD COLUMN modifier_value NUMERIC");
+	OK_OR_RET_ERR();
+
+	sqlite3_stmt *update_stmt = nullptr;
+	stmt = nullptr;
+	this->prepare_stmt(&stmt,
+		"SELECT ROWID, idt(modifier) FROM relations WHERE modifier IS NOT NULL",
+		"select modifiers"
+	);
+	STMT_OK_OR_RET_ERR();
+
+	this->prepare_stmt(&update_stmt,
+		"UPDATE relations SET modifier_value = ? WHERE ROWID = ?",
+		"update modifier_value"
+	);
+	STMT_OK_OR_RET_ERR();
+
+	const int F_ROWID = 0;
+	const int F_MODIFIER = 1;
+
+	while ((s_rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		tagd::predicate p;
+		p.modifier = (const char*) sqlite3_column_text(stmt, F_MODIFIER);
+
+		this->bind_modifier_value(&update_stmt, 1, p, "update modifier_value");
+		if (_code == tagd::TAGD_OK)
+			this->bind_rowid(&update_stmt, 2, sqlite3_column_int64(stmt, F_ROWID), "update modifier_value rowid");
+		if (_code != tagd::TAGD_OK)
+			break;
+
+		if (sqlite3_step(update_stmt) != SQLITE_DONE) {
+			this->ferror(tagd::TS_INTERNAL_ERR, "update modifier_value failed: %s", sqlite3_errmsg(_db));
+			break;
+		}
+
+		sqlite3_reset(update_stmt);
+		sqlite3_clear_bindings(update_stmt);
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(update_stmt);
+	OK_OR_RET_ERR();
+
+	if (s_rc == SQLITE_ERROR)
+		RET_SQLITE_FERROR(tagd::TS_INTERNAL_ERR, "select modifiers failed: %s", sqlite3_errmsg(_db));
+
+	this->exec("CREATE INDEX idx_modifier_value ON relations(relator, object, modifier_value)");
 
 	return _code;
 }
@@ -678,17 +933,37 @@ tagd::code sqlite::open() {
 	}
 	_code = tagd::TAGD_OK;  // exec() requires _code == TAGD_OK
 
+	// interrupts statements of operations past their session deadline, or cancelled
+	sqlite3_progress_handler(_db, PROGRESS_HANDLER_OPS, sqlite::progress_handler, this);
+
 	if ( this->exec("PRAGMA temp_store = MEMORY") != tagd::TAGD_OK)
 		return this->ferror(tagd::TS_INTERNAL_ERR, "PRAGMA temp_store failed: %s", _db_fname.c_str());
 
+	// ids of tags operated on as a set (see get_many() and hydrate_relations())
+	if ( this->exec("CREATE TEMP TABLE IF NOT EXISTS tmp_ids (tag INTEGER PRIMARY KEY NOT NULL) WITHOUT ROWID") != tagd::TAGD_OK)
+		return this->ferror(tagd::TS_INTERNAL_ERR, "create tmp_ids failed: %s", _db_fname.c_str());
+
 	return this->code(tagd::TAGD_OK);
 }
 
+int sqlite::progress_handler(void *p) {
+	// non-zero interrupts the statement being stepped, which returns SQLITE_INTERRUPT
+	return (static_cast<sqlite*>(p)->interrupted() != tagd::TAGD_OK);
+}
+
+tagd::code sqlite::internal_err_code() const {
+	tagd::code tc = this->interrupted();
+	return (tc == tagd::TAGD_OK ? tagd::TS_INTERNAL_ERR : tc);
+}
+
 void sqlite::close() {
 	if (_db == nullptr)
 		return;
 
 	this->finalize();
+	_query_cache.clear();
+	_bitmap_index.clear();
+	_in_batch = false;
 	auto rc = sqlite3_close(_db);
 	if (rc) {
 		LOG_ERROR( "error: sqlite3_close() returned "
@@ -698,6 +973,7 @@ void sqlite::close() {
 }
 
 tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session* ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_GET);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
 
 	TAGDB_LOG_TRACE( "sqlite::get: " << term << std::endl )
@@ -733,14 +1009,15 @@ tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session
 	}
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:decode_referent");
 
-	this->prepare(&_get_stmt,
+	sqlite3_stmt *get_stmt = nullptr;
+	this->prepare(&get_stmt,
 		"SELECT idt(tag), pos, idt(sub_relator), idt(super_object), rank "
 		"FROM tags WHERE tag = tid(?)",
 		"get_tag"
 	);
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:get_tag");
 
-	this->bind_text(&_get_stmt, 1, id.c_str(), "get_tag_id");
+	this->bind_text(&get_stmt, 1, id.c_str(), "get_tag_id");
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:get_tag_id");
 
 	const int F_ID = 0;
@@ -752,10 +1029,10 @@ tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session
 	id_transform_func_t f_transform =
 		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
 
-	int s_rc = sqlite3_step(_get_stmt);
+	int s_rc = sqlite3_step(get_stmt);
 	if (s_rc == SQLITE_ROW) {
-		const std::string tag_id{(const char*) sqlite3_column_text(_get_stmt, F_ID)};
-		auto pos = (tagd::part_of_speech) sqlite3_column_int(_get_stmt, F_POS);
+		const std::string tag_id{(const char*) sqlite3_column_text(get_stmt, F_ID)};
+		auto pos = (tagd::part_of_speech) sqlite3_column_int(get_stmt, F_POS);
 		if (pos == tagd::POS_URL) {
 			// convert hduri to url
 			tagd::HDURI u(tag_id);
@@ -765,10 +1042,10 @@ tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session
 		} else {
 			t.id(f_transform(tag_id));
 		}
-		t.sub_relator( f_transform((const char*) sqlite3_column_text(_get_stmt, F_SUB_REL)) );
-		t.super_object( f_transform((const char*) sqlite3_column_text(_get_stmt, F_SUB_OBJ)) );
+		t.sub_relator( f_transform((const char*) sqlite3_column_text(get_stmt, F_SUB_REL)) );
+		t.super_object( f_transform((const char*) sqlite3_column_text(get_stmt, F_SUB_OBJ)) );
 		t.pos(pos);
-		t.rank( (const char*) sqlite3_column_text(_get_stmt, F_RANK) );
+		t.rank( (const char*) sqlite3_column_text(get_stmt, F_RANK) );
 
 		this->get_relations(t.relations, id, ssn, flags);
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:get_relations");
@@ -782,9 +1059,9 @@ tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session
 				(void)t.relation(HARD_TAG_REFERS_TO, id);
 		} 
 
-	} else if (s_rc == SQLITE_ERROR) {
-		this->ferror(tagd::TS_INTERNAL_ERR, "tagdb:get:get_tag_step failed: %s", sqlite3_errmsg(_db));
-		RET_SSN_FERROR(tagd::TS_INTERNAL_ERR, "tagdb:get:get_tag_step error for id: %s", id.c_str());
+	} else if (s_rc != SQLITE_DONE) {
+		this->ferror(this->internal_err_code(), "tagdb:get:get_tag_step failed: %s", sqlite3_errmsg(_db));
+		RET_SSN_FERROR(this->internal_err_code(), "tagdb:get:get_tag_step error for id: %s", id.c_str());
 	} else {
 		if (term_pos & tagd::POS_REFERS) {
 			RET_SSN_FERROR(tagd::TS_AMBIGUOUS,
@@ -802,127 +1079,646 @@ tagd::code sqlite::get(tagd::abstract_tag& t, const tagd::id_type& term, session
 	RET_SSN_CODE(tagd::TAGD_OK);
 }
 
-tagd::code sqlite::get(tagd::url& get_url, const tagd::id_type& id, session* ssn, flags_t flags) {
+// terms as a json array, bound as one parameter of a statement selecting from json_each()
+static std::string json_array(const tagd::id_vec& ids) {
+	std::string json{"["};
+	for (const auto& id : ids) {
+		if (json.size() > 1)
+			json.push_back(',');
+		json.push_back('"');
+		for (unsigned char c : id) {
+			if (c == '"' || c == '\\') {
+				json.push_back('\\');
+				json.push_back(c);
+			} else if (c < 0x20) {
+				char u[7];
+				snprintf(u, sizeof(u), "\\u%04x", c);
+				json.append(u);
+			} else {
+				json.push_back(c);
+			}
+		}
+		json.push_back('"');
+	}
+	json.push_back(']');
+	return json;
+}
+
+tagd::code sqlite::get_many(tagd::tag_set& R, const tagd::id_vec& ids, session* ssn, flags_t flags) {
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
 
-	// id should be a canonical url
-	tagd::url u(id);
-	if (!u.ok())
-		RET_SSN_FERROR(u.code(), "url init failed: %s", id.c_str());
+	TAGDB_LOG_TRACE( "sqlite::get_many: " << ids.size() << " ids" << std::endl )
 
-	// we use hduri to identify urls internally
-	auto hduri = u.hduri();
+	this->exec("DELETE FROM tmp_ids");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:delete_tmp_ids");
 
-	get_url = u;
-	assert(get_url.ok());
-	assert(hduri == get_url.hduri());
+	const std::string terms = json_array(ids);
+	const bool decode_referents = (ssn && !(flags & F_NO_TRANSFORM_REFERENTS));
 
-	this->get((tagd::abstract_tag&)get_url, hduri, ssn, flags);
-	OK_OR_RET_SSN_ERR(); // this or ssn errors already set
+	// all the terms are resolved by one join, unknown terms having no row
+	// referents are left to be decoded in the context of the session
+	sqlite3_stmt *insert_tmp_ids_stmt = nullptr;
+	this->prepare(&insert_tmp_ids_stmt,
+		"INSERT OR IGNORE INTO tmp_ids (tag) "
+		"SELECT terms.ROWID FROM json_each(?) j, terms "
+		"WHERE terms.term = j.value "
+		"AND (terms.term_pos & ?) = 0",
+		"insert tmp_ids"
+	);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:insert_tmp_ids");
 
-	if (!get_url.ok())
-		RET_SSN_FERROR(u.code(), "get url failed: %s", get_url.id().c_str());
+	this->bind_text(&insert_tmp_ids_stmt, 1, terms.c_str(), "terms");
+	this->bind_int(&insert_tmp_ids_stmt, 2, (decode_referents ? tagd::POS_REFERS : 0), "referents");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:bind_tmp_ids");
 
-	RET_SSN_CODE(tagd::TAGD_OK);
-}
+	int s_rc = sqlite3_step(insert_tmp_ids_stmt);
+	if (s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "insert tmp_ids failed: %lu ids", ids.size());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:insert_tmp_ids:step");
+	}
 
-tagd::code sqlite::get_relations(tagd::predicate_set& P, const tagd::id_type& id, session *ssn, flags_t flags) {
+	if (decode_referents) {
+		sqlite3_stmt *referent_terms_stmt = nullptr;
+		this->prepare(&referent_terms_stmt,
+			"SELECT terms.term FROM json_each(?) j, terms "
+			"WHERE terms.term = j.value "
+			"AND (terms.term_pos & ?) != 0",
+			"referent terms"
+		);
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:referent_terms");
 
-	this->prepare(&_get_relations_stmt,
-		"SELECT idt(relator), idt(object), idt(modifier) "
-		"FROM relations WHERE subject = tid(?)",
-		"get_relations"
+		this->bind_text(&referent_terms_stmt, 1, terms.c_str(), "terms");
+		this->bind_int(&referent_terms_stmt, 2, tagd::POS_REFERS, "referents");
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:bind_referent_terms");
+
+		tagd::id_vec referents;
+		while ((s_rc = sqlite3_step(referent_terms_stmt)) == SQLITE_ROW)
+			referents.push_back((const char*) sqlite3_column_text(referent_terms_stmt, 0));
+
+		if (s_rc != SQLITE_DONE) {
+			SQLITE_FERROR(s_rc, "referent terms failed: %lu ids", ids.size());
+			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:referent_terms:step");
+		}
+
+		sqlite3_stmt *insert_tmp_id_stmt = nullptr;
+		for (auto term : referents) {
+			tagd::id_type id;
+			this->decode_referent(id, term, ssn);
+			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:decode_referent");
+
+			this->prepare(&insert_tmp_id_stmt,
+				"INSERT OR IGNORE INTO tmp_ids (tag) VALUES (tid(?))",
+				"insert tmp_id"
+			);
+			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:insert_tmp_id");
+
+			this->bind_text(&insert_tmp_id_stmt, 1, id.c_str(), "tmp_id");
+			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:bind_tmp_id");
+
+			// unknown tags are ignored by the NOT NULL constraint
+			s_rc = sqlite3_step(insert_tmp_id_stmt);
+			if (s_rc != SQLITE_DONE) {
+				SQLITE_FERROR(s_rc, "insert tmp_id failed: %s", id.c_str());
+				OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:insert_tmp_id:step");
+			}
+		}
+	}
+
+	std::map<std::string, tagd::predicate_set> P;
+	this->tmp_id_relations(P, ssn, flags);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:tmp_id_relations");
+
+	sqlite3_stmt *get_many_stmt = nullptr;
+	this->prepare(&get_many_stmt,
+		"SELECT idt(tag), pos, idt(sub_relator), idt(super_object), rank "
+		"FROM tags WHERE tag IN (SELECT tag FROM tmp_ids)",
+		"get_many"
 	);
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_relations");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many");
 
-	this->bind_text(&_get_relations_stmt, 1, id.c_str(), "get subject");
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:bind_subject");
+	const int F_ID = 0;
+	const int F_POS = 1;
+	const int F_SUB_REL = 2;
+	const int F_SUB_OBJ = 3;
+	const int F_RANK = 4;
 
-	const int F_RELATOR = 0;
-	const int F_OBJECT = 1;
-	const int F_MODIFIER = 2;
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+
+	size_t n = 0;
+	while ((s_rc = sqlite3_step(get_many_stmt)) == SQLITE_ROW) {
+		const std::string tag_id{(const char*) sqlite3_column_text(get_many_stmt, F_ID)};
+		const char *rank = (const char*) sqlite3_column_text(get_many_stmt, F_RANK);
+		auto pos = (tagd::part_of_speech) sqlite3_column_int(get_many_stmt, F_POS);
+
+		tagd::abstract_tag t;
+		if (pos == tagd::POS_URL) {
+			// convert hduri to url
+			tagd::HDURI u(tag_id);
+			if (!u.ok())
+				RET_SYS_SSN_FERROR(u.code(), "failed to init HDURI: %s", tag_id.c_str());
+			t.id(u.id());
+		} else {
+			t.id(f_transform(tag_id));
+		}
+		t.sub_relator( f_transform((const char*) sqlite3_column_text(get_many_stmt, F_SUB_REL)) );
+		t.super_object( f_transform((const char*) sqlite3_column_text(get_many_stmt, F_SUB_OBJ)) );
+		t.pos(pos);
+		t.rank(rank);
+
+		auto it = P.find(rank == nullptr ? std::string() : std::string(rank));
+		if (it != P.end())
+			t.relations = it->second;
+
+		// id transformed via referent, as in get()
+		if (pos != tagd::POS_URL && !(flags & F_NO_TRANSFORM_REFERENTS)) {
+			if (tag_id != t.id())
+				(void)t.relation(HARD_TAG_REFERS_TO, tag_id);
+		}
+
+		R.insert(t);
+		n++;
+	}
+
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "get_many failed: %lu ids", ids.size());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_many:step");
+	}
+
+	if (n == 0) {
+		if (flags & F_NO_NOT_FOUND_ERROR)
+			return tagd::TS_NOT_FOUND;
+		else
+			RET_SSN_CODE(tagd::TS_NOT_FOUND);
+	}
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::tmp_id_relations(std::map<std::string, tagd::predicate_set>& P, session *ssn, flags_t flags) {
+	sqlite3_stmt *tmp_id_relations_stmt = nullptr;
+	this->prepare(&tmp_id_relations_stmt,
+		"SELECT rank, idt(relator), idt(object), idt(modifier) "
+		"FROM tmp_ids, relations, tags "
+		"WHERE relations.subject = tmp_ids.tag "
+		"AND tags.tag = tmp_ids.tag",
+		"tmp_id relations"
+	);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:tmp_id_relations");
+
+	const int F_RANK = 0;
+	const int F_RELATOR = 1;
+	const int F_OBJECT = 2;
+	const int F_MODIFIER = 3;
 
 	id_transform_func_t f_transform =
 		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
 
 	int s_rc;
-	while ((s_rc = sqlite3_step(_get_relations_stmt)) == SQLITE_ROW) {
+	while ((s_rc = sqlite3_step(tmp_id_relations_stmt)) == SQLITE_ROW) {
+		const char *rank = (const char*) sqlite3_column_text(tmp_id_relations_stmt, F_RANK);
 		auto p = tagd::predicate(
-			f_transform( (const char*) sqlite3_column_text(_get_relations_stmt, F_RELATOR) ),
-			f_transform( (const char*) sqlite3_column_text(_get_relations_stmt, F_OBJECT) )
+			f_transform( (const char*) sqlite3_column_text(tmp_id_relations_stmt, F_RELATOR) ),
+			f_transform( (const char*) sqlite3_column_text(tmp_id_relations_stmt, F_OBJECT) )
 		);
-		if (sqlite3_column_type(_get_relations_stmt, F_MODIFIER) != SQLITE_NULL) {
-			p.modifier = f_transform( (const char*) sqlite3_column_text(_get_relations_stmt, F_MODIFIER) );
+		if (sqlite3_column_type(tmp_id_relations_stmt, F_MODIFIER) != SQLITE_NULL) {
+			p.modifier = f_transform( (const char*) sqlite3_column_text(tmp_id_relations_stmt, F_MODIFIER) );
 		}
-		P.insert(p);
-	} 
-
-	if (s_rc == SQLITE_ERROR) {
-		this->ferror(tagd::TS_INTERNAL_ERR, "tagdb:get_relations:step failed: %s", sqlite3_errmsg(_db));
-		RET_SSN_FERROR(tagd::TS_INTERNAL_ERR, "tagdb:get_relations:step error for id: %s", id.c_str());
+		P[(rank == nullptr ? std::string() : std::string(rank))].insert(p);
 	}
 
-	if (P.empty())
-		return tagd::TS_NOT_FOUND;
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "tmp_id relations failed");
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:tmp_id_relations:step");
+	}
 
 	return tagd::TAGD_OK;  // don't set session code on non-public methods
 }
 
-tagd::part_of_speech sqlite::term_pos(const tagd::id_type& id, rowid_t *term_id) {
+tagd::code sqlite::hydrate_relations(tagd::tag_set& R, session *ssn, flags_t flags) {
+	if (R.empty())
+		return tagd::TAGD_OK;
 
-	tagd::code tc = this->prepare(&_term_pos_stmt,
-		"SELECT ROWID, term_pos FROM terms WHERE term = ?",
-		"term term_pos"
+	this->exec("DELETE FROM tmp_ids");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:hydrate_relations:delete_tmp_ids");
+
+	// tags are loaded by rank, as ids in the set may be transformed (referents, urls)
+	// _entity (NULL rank) has no relations
+	tagd::id_vec ranks;
+	for (auto& t : R) {
+		if (!t.rank().empty())
+			ranks.push_back(t.rank().c_str());
+	}
+
+	sqlite3_stmt *insert_tmp_ranks_stmt = nullptr;
+	this->prepare(&insert_tmp_ranks_stmt,
+		"INSERT OR IGNORE INTO tmp_ids (tag) "
+		"SELECT tags.tag FROM json_each(?) j, tags "
+		"WHERE tags.rank = j.value",
+		"insert tmp_id ranks"
 	);
-	if (tc != tagd::TAGD_OK)
-		this->print_errors();
-	assert(tc == tagd::TAGD_OK);
-	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:hydrate_relations:insert_tmp_ranks");
 
-	tc = this->bind_text(&_term_pos_stmt, 1, id.c_str(), "term");
-	assert(tc == tagd::TAGD_OK);
-	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
+	const std::string json_ranks = json_array(ranks);
+	this->bind_text(&insert_tmp_ranks_stmt, 1, json_ranks.c_str(), "tmp_id ranks");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:hydrate_relations:bind_ranks");
 
-	const int F_TERM_ID = 0;
-	const int F_TERM_POS = 1;
+	int s_rc = sqlite3_step(insert_tmp_ranks_stmt);
+	if (s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "insert tmp_id ranks failed: %lu tags", R.size());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:hydrate_relations:insert_tmp_ranks:step");
+	}
 
-	int s_rc = sqlite3_step(_term_pos_stmt);
-	if (s_rc == SQLITE_ROW) {
-		if (term_id != nullptr)
-			*term_id = sqlite3_column_int64(_term_pos_stmt, F_TERM_ID);
-		return (tagd::part_of_speech) sqlite3_column_int(_term_pos_stmt, F_TERM_POS);
-	} else if (s_rc == SQLITE_ERROR) {
-		SQLITE_FERROR(s_rc, "term_pos failed: %s", id.c_str());
-		return tagd::POS_UNKNOWN;
-	} else {
-		return tagd::POS_UNKNOWN;
+	std::map<std::string, tagd::predicate_set> P;
+	this->tmp_id_relations(P, ssn, flags);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:hydrate_relations:tmp_id_relations");
+
+	// set members are const, so copy into a new set
+	tagd::tag_set H;
+	auto h = H.begin();
+	for (auto t : R) {
+		auto it = P.find(t.rank().c_str());
+		if (it != P.end()) {
+			for (auto p : it->second)
+				(void)t.relation(p);
+		}
+		h = H.insert(h, t);
 	}
+	R.swap(H);
+
+	return tagd::TAGD_OK;
 }
 
-tagd::part_of_speech sqlite::term_id_pos(rowid_t term_id, std::string *term) {
+tagd::code sqlite::lca(tagd::id_type& id, const tagd::id_type& a_id, const tagd::id_type& b_id, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
 
-	tagd::code tc = this->prepare(&_term_id_pos_stmt,
-		"SELECT term, term_pos FROM terms WHERE ROWID = ?",
-		"term term_pos"
-	);
+	tagd::abstract_tag a, b;
+	auto tc = this->get(a, a_id, ssn, (flags|F_NO_RESET));
 	if (tc != tagd::TAGD_OK)
-		this->print_errors();
-	assert(tc == tagd::TAGD_OK);
-	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
-
-	tc = this->bind_rowid(&_term_id_pos_stmt, 1, term_id, "term_id");
-	assert(tc == tagd::TAGD_OK);
+		return tc;
+	tc = this->get(b, b_id, ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	auto r = a.rank().common_ancestor(b.rank());
+
+	// one is an ancestor of the other
+	if (r == a.rank()) {
+		id = a.id();
+		RET_SSN_CODE(tagd::TAGD_OK);
+	}
+	if (r == b.rank()) {
+		id = b.id();
+		RET_SSN_CODE(tagd::TAGD_OK);
+	}
+
+	if (r.empty()) {
+		id = HARD_TAG_ENTITY;
+		RET_SSN_CODE(tagd::TAGD_OK);
+	}
+
+	sqlite3_stmt *tag_by_rank_stmt = nullptr;
+	this->prepare(&tag_by_rank_stmt,
+		"SELECT idt(tag) FROM tags WHERE rank = ?",
+		"tag by rank"
+	);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:lca");
+
+	this->bind_text(&tag_by_rank_stmt, 1, r.c_str(), "lca rank");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:lca:bind_rank");
+
+	int s_rc = sqlite3_step(tag_by_rank_stmt);
+	if (s_rc != SQLITE_ROW) {
+		// every prefix of a rank is the rank of an ancestor
+		SQLITE_FERROR(s_rc, "lca rank not found: %s", r.dotted_str().c_str());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:lca:step");
+		return this->code();
+	}
+
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+	id = f_transform((const char*) sqlite3_column_text(tag_by_rank_stmt, 0));
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+// selects the tag (0), its ancestors (1), siblings (2) and children (3), params: ?1 tag
+// ancestors are the prefixes of its rank, and _entity (rank IS NULL)
+// siblings and children are each one level of the idx_rank_depth index, as in the descendants sql
+// columns: kind, tag, sub_relator, super_object, pos, rank
+const char *TREE_SQL =
+	"WITH this(r) AS (SELECT COALESCE(rank, '') FROM tags WHERE tag = tid(?1)), "
+	"parent(r) AS (SELECT COALESCE(rank, '') FROM tags "
+		"WHERE tag = (SELECT super_object FROM tags WHERE tag = tid(?1))), "
+	"prefixes(n) AS ("
+		"SELECT 1 WHERE length((SELECT r FROM this)) > 1 "
+		"UNION ALL "
+		"SELECT n + 1 FROM prefixes WHERE n < length((SELECT r FROM this)) - 1"
+	") "
+	"SELECT 0, idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	"FROM tags WHERE tag = tid(?1) "
+	"UNION ALL "
+	"SELECT 1, idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	"FROM tags WHERE (rank IS NULL AND length((SELECT r FROM this)) > 0) "
+	"OR rank IN (SELECT substr((SELECT r FROM this), 1, n) FROM prefixes) "
+	"UNION ALL "
+	"SELECT 2, idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	"FROM tags WHERE length(rank) = length((SELECT r FROM this)) "
+	"AND rank > (SELECT r FROM parent) "
+	"AND rank < ((SELECT r FROM parent) || CAST(x'FE' AS TEXT)) "
+	"UNION ALL "
+	"SELECT 3, idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	"FROM tags WHERE length(rank) = length((SELECT r FROM this)) + 1 "
+	"AND rank > (SELECT r FROM this) "
+	"AND rank < ((SELECT r FROM this) || CAST(x'FE' AS TEXT))";
+
+tagd::code sqlite::tree(tree_set& T, const tagd::id_type& tag_id, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	T.clear();
+
+	tagd::id_type id;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
+		id = tag_id;
+	else
+		this->decode_referent(id, tag_id, ssn);
+
+	sqlite3_stmt *tree_stmt = nullptr;
+	this->prepare(&tree_stmt, TREE_SQL, "select tree");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:tree");
+
+	this->bind_text(&tree_stmt, 1, id.c_str(), "tree id");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:tree:bind_id");
+
+	const int F_KIND = 0;
+	const int F_ID = 1;
+	const int F_SUB_REL = 2;
+	const int F_SUB_OBJ = 3;
+	const int F_POS = 4;
+	const int F_RANK = 5;
+
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+
+	bool found = false;
+	int s_rc;
+	while ((s_rc = sqlite3_step(tree_stmt)) == SQLITE_ROW) {
+		tagd::abstract_tag *t;
+		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(tree_stmt, F_POS);
+		if (pos != tagd::POS_URL) {
+			t = new tagd::abstract_tag(
+				f_transform((const char*) sqlite3_column_text(tree_stmt, F_ID))
+			);
+		} else {
+			t = new tagd::HDURI( (const char*) sqlite3_column_text(tree_stmt, F_ID) );
+			if (t->code() != tagd::TAGD_OK) {
+				auto tc = t->code();
+				if (ssn) {
+					ssn->ferror(tc, "failed to init tree url: %s",
+							(const char*) sqlite3_column_text(tree_stmt, F_ID) );
+				}
+				delete t;
+				return tc;
+			}
+		}
+		t->sub_relator( f_transform((const char*) sqlite3_column_text(tree_stmt, F_SUB_REL)) );
+		t->super_object( f_transform((const char*) sqlite3_column_text(tree_stmt, F_SUB_OBJ)) );
+		t->pos(pos);
+		if (sqlite3_column_type(tree_stmt, F_RANK) != SQLITE_NULL)
+			t->rank( (const char*) sqlite3_column_text(tree_stmt, F_RANK) );
+
+		switch (sqlite3_column_int(tree_stmt, F_KIND)) {
+			case 0:
+				// the tag is its own sibling, only _entity has no other row for it
+				found = true;
+				T.siblings.insert(*t);
+				break;
+			case 1:
+				T.ancestors.insert(*t);
+				break;
+			case 2:
+				T.siblings.insert(*t);
+				break;
+			default:
+				T.children.insert(*t);
+		}
+		delete t;
+	}
+
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "tree failed: %s", id.c_str());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:tree:step");
+	}
+
+	if (!found) {
+		T.clear();
+		if (flags & F_NO_NOT_FOUND_ERROR)
+			return tagd::TS_NOT_FOUND;
+		RET_SSN_ERROR(tagd::TS_NOT_FOUND,
+			tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_UNKNOWN_TAG, tag_id) );
+	}
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+// selects the referents a term refers to (?1) and those referring to a tag (?2)
+// columns: refers, refers_to, context, whether refers is ?1, whether refers_to is ?2
+const char *NEIGHBORHOOD_REFERENTS_SQL =
+	"SELECT idt(refers), idt(refers_to), idt(context), refers = tid(?1), refers_to = tid(?2) "
+	"FROM referents "
+	"WHERE refers = tid(?1) OR refers_to = tid(?2)";
+
+tagd::code sqlite::neighborhood(neighborhood_set& N, const tagd::abstract_tag& t, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	NOT_INTERRUPTED_OR_RET_SSN_ERR("tagdb:neighborhood");
+
+	N.clear();
+
+	// fails when the tag doesn't exist, so the rest can't be not found errors
+	auto tc = this->tree(N.tree, t.id(), ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	// the term is the id as given, referents refer to the id it resolves to
+	tagd::id_type id;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
+		id = t.id();
+	else
+		this->decode_referent(id, t.id(), ssn);
+
+	sqlite3_stmt *referents_stmt = nullptr;
+	this->prepare(&referents_stmt, NEIGHBORHOOD_REFERENTS_SQL, "select neighborhood referents");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:neighborhood");
+
+	this->bind_text(&referents_stmt, 1, t.id().c_str(), "neighborhood refers");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:neighborhood:bind_refers");
+
+	this->bind_text(&referents_stmt, 2, id.c_str(), "neighborhood refers_to");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:neighborhood:bind_refers_to");
+
+	const int F_REFERS = 0;
+	const int F_REFERS_TO = 1;
+	const int F_CONTEXT = 2;
+	const int F_IS_REFERS = 3;
+	const int F_IS_REFERS_TO = 4;
+
+	int s_rc;
+	while ((s_rc = sqlite3_step(referents_stmt)) == SQLITE_ROW) {
+		tagd::referent r(
+			(const char*) sqlite3_column_text(referents_stmt, F_REFERS),
+			(const char*) sqlite3_column_text(referents_stmt, F_REFERS_TO),
+			(const char*) sqlite3_column_text(referents_stmt, F_CONTEXT)
+		);
+
+		if (sqlite3_column_int(referents_stmt, F_IS_REFERS))
+			N.refers.insert(r);
+		if (sqlite3_column_int(referents_stmt, F_IS_REFERS_TO))
+			N.refers_to.insert(r);
+	}
+
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "neighborhood referents failed: %s", t.id().c_str());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:neighborhood:step");
+	}
+
+	tagd::predicate p;
+	if (t.pos() == tagd::POS_RELATOR)
+		p.relator = t.id();
+	else
+		p.object = t.id();
+
+	tc = this->related(N.related, p, tagd::id_type(), ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+		return tc;
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::get(tagd::url& get_url, const tagd::id_type& id, session* ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_GET);
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	// id should be a canonical url
+	tagd::url u(id);
+	if (!u.ok())
+		RET_SSN_FERROR(u.code(), "url init failed: %s", id.c_str());
+
+	// we use hduri to identify urls internally
+	auto hduri = u.hduri();
+
+	get_url = u;
+	assert(get_url.ok());
+	assert(hduri == get_url.hduri());
+
+	this->get((tagd::abstract_tag&)get_url, hduri, ssn, flags);
+	OK_OR_RET_SSN_ERR(); // this or ssn errors already set
+
+	if (!get_url.ok())
+		RET_SSN_FERROR(u.code(), "get url failed: %s", get_url.id().c_str());
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::get_relations(tagd::predicate_set& P, const tagd::id_type& id, session *ssn, flags_t flags) {
+
+	sqlite3_stmt *get_relations_stmt = nullptr;
+	this->prepare(&get_relations_stmt,
+		"SELECT idt(relator), idt(object), idt(modifier) "
+		"FROM relations WHERE subject = tid(?)",
+		"get_relations"
+	);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_relations");
+
+	this->bind_text(&get_relations_stmt, 1, id.c_str(), "get subject");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get:bind_subject");
+
+	const int F_RELATOR = 0;
+	const int F_OBJECT = 1;
+	const int F_MODIFIER = 2;
+
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+
+	int s_rc;
+	while ((s_rc = sqlite3_step(get_relations_stmt)) == SQLITE_ROW) {
+		auto p = tagd::predicate(
+			f_transform( (const char*) sqlite3_column_text(get_relations_stmt, F_RELATOR) ),
+			f_transform( (const char*) sqlite3_column_text(get_relations_stmt, F_OBJECT) )
+		);
+		if (sqlite3_column_type(get_relations_stmt, F_MODIFIER) != SQLITE_NULL) {
+			p.modifier = f_transform( (const char*) sqlite3_column_text(get_relations_stmt, F_MODIFIER) );
+		}
+		P.insert(p);
+	} 
+
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
+		this->ferror(this->internal_err_code(), "tagdb:get_relations:step failed: %s", sqlite3_errmsg(_db));
+		RET_SSN_FERROR(this->internal_err_code(), "tagdb:get_relations:step error for id: %s", id.c_str());
+	}
+
+	if (P.empty())
+		return tagd::TS_NOT_FOUND;
+
+	return tagd::TAGD_OK;  // don't set session code on non-public methods
+}
+
+tagd::part_of_speech sqlite::term_pos(const tagd::id_type& id, rowid_t *term_id) {
+
+	sqlite3_stmt *term_pos_stmt = nullptr;
+	tagd::code tc = this->prepare(&term_pos_stmt,
+		"SELECT ROWID, term_pos FROM terms WHERE term = ?",
+		"term term_pos"
+	);
+	if (tc != tagd::TAGD_OK)
+		this->print_errors();
+	assert(tc == tagd::TAGD_OK);
+	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
+
+	tc = this->bind_text(&term_pos_stmt, 1, id.c_str(), "term");
+	assert(tc == tagd::TAGD_OK);
+	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
+
+	const int F_TERM_ID = 0;
+	const int F_TERM_POS = 1;
+
+	int s_rc = sqlite3_step(term_pos_stmt);
+	if (s_rc == SQLITE_ROW) {
+		if (term_id != nullptr)
+			*term_id = sqlite3_column_int64(term_pos_stmt, F_TERM_ID);
+		return (tagd::part_of_speech) sqlite3_column_int(term_pos_stmt, F_TERM_POS);
+	} else if (s_rc != SQLITE_DONE) {
+		SQLITE_FERROR(s_rc, "term_pos failed: %s", id.c_str());
+		return tagd::POS_UNKNOWN;
+	} else {
+		return tagd::POS_UNKNOWN;
+	}
+}
+
+tagd::part_of_speech sqlite::term_id_pos(rowid_t term_id, std::string *term) {
+
+	sqlite3_stmt *term_id_pos_stmt = nullptr;
+	tagd::code tc = this->prepare(&term_id_pos_stmt,
+		"SELECT term, term_pos FROM terms WHERE ROWID = ?",
+		"term term_pos"
+	);
+	if (tc != tagd::TAGD_OK)
+		this->print_errors();
+	assert(tc == tagd::TAGD_OK);
+	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
+
+	tc = this->bind_rowid(&term_id_pos_stmt, 1, term_id, "term_id");
+	assert(tc == tagd::TAGD_OK);
 	if (tc != tagd::TAGD_OK) return tagd::POS_UNKNOWN;
 
 	const int F_TERM = 0;
 	const int F_TERM_POS = 1;
 
-	int s_rc = sqlite3_step(_term_id_pos_stmt);
+	int s_rc = sqlite3_step(term_id_pos_stmt);
 	if (s_rc == SQLITE_ROW) {
 		if (term != nullptr)
-			*term = (const char*)sqlite3_column_text(_term_id_pos_stmt, F_TERM);
-		return (tagd::part_of_speech) sqlite3_column_int(_term_id_pos_stmt, F_TERM_POS);
-	} else if (s_rc == SQLITE_ERROR) {
+			*term = (const char*)sqlite3_column_text(term_id_pos_stmt, F_TERM);
+		return (tagd::part_of_speech) sqlite3_column_int(term_id_pos_stmt, F_TERM_POS);
+	} else if (s_rc != SQLITE_DONE) {
 		SQLITE_FERROR(s_rc, "term_id_pos failed: %ld", term_id);
 		return tagd::POS_UNKNOWN;
 	} else {
@@ -945,24 +1741,25 @@ tagd::part_of_speech sqlite::pos(const tagd::id_type& id, session *ssn, flags_t
 	if (refers_to[0] == '_')
 		return hard_tag::pos(refers_to);
 
-	this->prepare(&_pos_stmt,
+	sqlite3_stmt *pos_stmt = nullptr;
+	this->prepare(&pos_stmt,
 		"SELECT pos FROM tags WHERE tag = tid(?)",
 		"tag pos"
 	);
 	assert(_code == tagd::TAGD_OK);
 	OK_OR_RET_UNKNOWN_SSN_INT_ERR_ACTION("tagdb:pos");
 
-	this->bind_text(&_pos_stmt, 1, (refers_to.empty() ? id.c_str() : refers_to.c_str()), "pos id");
+	this->bind_text(&pos_stmt, 1, (refers_to.empty() ? id.c_str() : refers_to.c_str()), "pos id");
 	assert(_code == tagd::TAGD_OK);
 	OK_OR_RET_UNKNOWN_SSN_INT_ERR_ACTION("tagdb:pos:bind");
 
 	const int F_POS = 0;
 
-	int s_rc = sqlite3_step(_pos_stmt);
+	int s_rc = sqlite3_step(pos_stmt);
 	if (s_rc == SQLITE_ROW) {
-		return (tagd::part_of_speech) sqlite3_column_int(_pos_stmt, F_POS);
-	} else if (s_rc == SQLITE_ERROR) {
-		auto e = tagd::error::ferror(tagd::TS_INTERNAL_ERR,
+		return (tagd::part_of_speech) sqlite3_column_int(pos_stmt, F_POS);
+	} else if (s_rc != SQLITE_DONE) {
+		auto e = tagd::error::ferror(this->internal_err_code(),
 			"tagdb:pos:step failed: %s", (refers_to.empty() ? id.c_str() : refers_to.c_str()));
 		if (ssn)
 			ssn->error(e);
@@ -975,11 +1772,20 @@ tagd::part_of_speech sqlite::pos(const tagd::id_type& id, session *ssn, flags_t
 }
 
 tagd::code sqlite::refers(tagd::id_type &refers, const tagd::id_type& refers_to, session* ssn) {
+	sqlite3_stmt *refers_stmt = nullptr;
 	assert(!refers_to.empty());
 	if(!ssn || ssn->context().empty()) return tagd::TS_NOT_FOUND;
 
+	tagd::id_type cached;
+	if (ssn->find_refers(refers_to, cached)) {
+		if (cached.empty())
+			return tagd::TS_NOT_FOUND;
+		refers = cached;
+		return tagd::TAGD_OK;
+	}
+
 	for (auto it = ssn->context().rbegin(); it != ssn->context().rend(); ++it) {
-		this->prepare(&_refers_stmt,
+		this->prepare(&refers_stmt,
 			"SELECT idt(refers) "
 			"FROM referents, tags "
 			"WHERE refers_to = tid(?) "
@@ -993,33 +1799,44 @@ tagd::code sqlite::refers(tagd::id_type &refers, const tagd::id_type& refers_to,
 		);
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb::refers");
 
-		this->bind_text(&_refers_stmt, 1, refers_to.c_str(), "refers_to");
+		this->bind_text(&refers_stmt, 1, refers_to.c_str(), "refers_to");
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb::refers:bind_refers_to");
 
-		this->bind_text(&_refers_stmt, 2, it->c_str(), "tag in context");
+		this->bind_text(&refers_stmt, 2, it->c_str(), "tag in context");
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb::refers:bind_context");
 
 		const int F_REFERS = 0;
 
-		int s_rc = sqlite3_step(_refers_stmt);
+		int s_rc = sqlite3_step(refers_stmt);
 		if (s_rc == SQLITE_ROW) {
-			refers = (const char *) sqlite3_column_text(_refers_stmt, F_REFERS);
+			refers = (const char *) sqlite3_column_text(refers_stmt, F_REFERS);
+			ssn->cache_refers(refers_to, refers);
 			return tagd::TAGD_OK;
-		} else if (s_rc == SQLITE_ERROR) {
-			return this->ferror(tagd::TS_INTERNAL_ERR, "refers failed: %s", sqlite3_errmsg(_db));
+		} else if (s_rc != SQLITE_DONE) {
+			return this->ferror(this->internal_err_code(), "refers failed: %s", sqlite3_errmsg(_db));
 			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:refers:step");
 		}
 	}
 
+	ssn->cache_refers(refers_to, tagd::id_type());
 	return tagd::TS_NOT_FOUND;
 }
 
 tagd::code sqlite::refers_to(tagd::id_type &refers_to, const tagd::id_type& refers, session* ssn) {
+	sqlite3_stmt *refers_to_stmt = nullptr;
 	assert(!refers.empty());
-	if(!ssn) return tagd::TS_NOT_FOUND;
+	if(!ssn || ssn->context().empty()) return tagd::TS_NOT_FOUND;
+
+	tagd::id_type cached;
+	if (ssn->find_refers_to(refers, cached)) {
+		if (cached.empty())
+			return tagd::TS_NOT_FOUND;
+		refers_to = cached;
+		return tagd::TAGD_OK;
+	}
 
 	for (auto it = ssn->context().rbegin(); it != ssn->context().rend(); ++it) {
-		this->prepare(&_refers_to_stmt,
+		this->prepare(&refers_to_stmt,
 			"SELECT idt(refers_to) "
 			"FROM referents, tags "
 			"WHERE refers = tid(?) "
@@ -1033,24 +1850,26 @@ tagd::code sqlite::refers_to(tagd::id_type &refers_to, const tagd::id_type& refe
 		);
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:refers_to");
 
-		this->bind_text(&_refers_to_stmt, 1, refers.c_str(), "tagdb:refers_to:bind_refers");
+		this->bind_text(&refers_to_stmt, 1, refers.c_str(), "tagdb:refers_to:bind_refers");
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:refers_to:bind_refers");
 
-		this->bind_text(&_refers_to_stmt, 2, it->c_str(), "tagdb:refers_to:bind_context");
+		this->bind_text(&refers_to_stmt, 2, it->c_str(), "tagdb:refers_to:bind_context");
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:refers_to:bind_context");
 
 		const int F_REFERS_TO = 0;
 
-		int s_rc = sqlite3_step(_refers_to_stmt);
+		int s_rc = sqlite3_step(refers_to_stmt);
 		if (s_rc == SQLITE_ROW) {
-			refers_to = (const char *) sqlite3_column_text(_refers_to_stmt, F_REFERS_TO);
+			refers_to = (const char *) sqlite3_column_text(refers_to_stmt, F_REFERS_TO);
+			ssn->cache_refers_to(refers, refers_to);
 			return tagd::TAGD_OK;
-		} else if (s_rc == SQLITE_ERROR) {
-			this->ferror(tagd::TS_INTERNAL_ERR, "tagdb:refers_to failed: %s", sqlite3_errmsg(_db));
+		} else if (s_rc != SQLITE_DONE) {
+			this->ferror(this->internal_err_code(), "tagdb:refers_to failed: %s", sqlite3_errmsg(_db));
 			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:refers_to:step");
 		}
 	}
 
+	ssn->cache_refers_to(refers, tagd::id_type());
 	return tagd::TS_NOT_FOUND;
 }
 
@@ -1059,19 +1878,20 @@ tagd::code sqlite::refers_to(tagd::id_type &refers_to, const tagd::id_type& refe
 bool sqlite::exists(const tagd::id_type& id, flags_t flags) {
 	if (!(flags & F_NO_RESET)) this->reset(nullptr);
 
-	this->prepare(&_exists_stmt,
+	sqlite3_stmt *exists_stmt = nullptr;
+	this->prepare(&exists_stmt,
 		"SELECT 1 FROM tags WHERE tag = tid(?)",
 		"tag exists"
 	);
 	OK_OR_RET_FALSE();
 
-	this->bind_text(&_exists_stmt, 1, id.c_str(), "exists statement id");
+	this->bind_text(&exists_stmt, 1, id.c_str(), "exists statement id");
 	OK_OR_RET_FALSE();
 
-	int s_rc = sqlite3_step(_exists_stmt);
+	int s_rc = sqlite3_step(exists_stmt);
 	if (s_rc == SQLITE_ROW) {
 		return true;
-	} else if (s_rc == SQLITE_ERROR) {
+	} else if (s_rc != SQLITE_DONE) {
 		SQLITE_FERROR(s_rc, "exists failed: %", id.c_str());
 		return false;
 	} 
@@ -1081,7 +1901,9 @@ bool sqlite::exists(const tagd::id_type& id, flags_t flags) {
 
 // tagd::TS_NOT_FOUND returned if destination undefined
 tagd::code sqlite::put(const tagd::abstract_tag& put_tag, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_PUT);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	BEGIN_WRITE_OR_RET_SSN_ERR("tagdb:put");
 
 	TAGDB_LOG_TRACE( "sqlite::put: " << put_tag << " -- " << flag_util::flag_list_str(flags) << std::endl )
 
@@ -1105,6 +1927,23 @@ tagd::code sqlite::put(const tagd::abstract_tag& put_tag, session *ssn, flags_t
 		}
 	}
 
+	// the tag, its relations and fts entry are written entirely or not at all
+	this->exec(BEGIN_WRITE_SQL);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:put:begin");
+
+	tagd::code tc = this->write_tag(put_tag, ssn, flags);
+	if (tc != tagd::TAGD_OK) {
+		this->exec(ROLLBACK_WRITE_SQL);
+		return tc;  // err set by write_tag
+	}
+
+	this->exec(COMMIT_WRITE_SQL);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:put:commit");
+
+	return tagd::TAGD_OK;
+}
+
+tagd::code sqlite::write_tag(const tagd::abstract_tag& put_tag, session *ssn, flags_t flags) {
 	tagd::abstract_tag t;
 	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
 		t = put_tag;
@@ -1197,6 +2036,7 @@ tagd::code sqlite::put(const tagd::abstract_tag& put_tag, session *ssn, flags_t
 }
 
 tagd::code sqlite::put(const tagd::url& u, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_PUT);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
 
 	if (!u.ok())
@@ -1211,7 +2051,9 @@ tagd::code sqlite::put(const tagd::url& u, session *ssn, flags_t flags) {
 }
 
 tagd::code sqlite::put(const tagd::referent& r, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_PUT);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	BEGIN_WRITE_OR_RET_SSN_ERR("tagdb:put:referent");
 
 	RET_SSN_CODE(this->insert_referent(r, ssn, flags));
 }
@@ -1234,7 +2076,9 @@ void tag_affected(std::set<tagd::id_type>& terms_affected, const tagd::abstract_
 }
 
 tagd::code sqlite::del(const tagd::abstract_tag& t, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_DEL);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	BEGIN_WRITE_OR_RET_SSN_ERR("tagdb:del");
 
 	TAGDB_LOG_TRACE( "sqlite::del: " << t << std::endl )
 
@@ -1284,7 +2128,7 @@ tagd::code sqlite::del(const tagd::abstract_tag& t, session *ssn, flags_t flags)
 	// make a set of all terms affected, so we can update the term pos after deleting tag
 	std::set<tagd::id_type> terms_affected;
 
-	this->exec("BEGIN");
+	this->exec(BEGIN_WRITE_SQL);
 
 	// empty del_tag relations means delete entire tag for given id
 	if (del_tag.relations.empty()) {
@@ -1366,12 +2210,13 @@ tagd::code sqlite::del(const tagd::abstract_tag& t, session *ssn, flags_t flags)
 		OK_OR_ROLLBACK_RET_SSN_INT_ERR_ACTION("tagdb:del:update_pos_occurence");
 	}
 
-	this->exec("COMMIT");
+	this->exec(COMMIT_WRITE_SQL);
 
 	return tagd::TAGD_OK;
 }
 
 tagd::code sqlite::del(const tagd::url& u, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_DEL);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
 
 	if (!u.ok())
@@ -1388,7 +2233,9 @@ tagd::code sqlite::del(const tagd::url& u, session *ssn, flags_t flags) {
 }
 
 tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_DEL);
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	BEGIN_WRITE_OR_RET_SSN_ERR("tagdb:del:referent");
 
 	sqlite3_stmt *stmt = nullptr;
 
@@ -1411,10 +2258,10 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					*/
 					"delete referent context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.context().c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		} else {  // !refers_to.empty()
 			if (r.context().empty()) {
@@ -1423,10 +2270,10 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					"WHERE refers_to = tid(?)",
 					"delete referent refers_to"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers_to().c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"DELETE FROM referents "
@@ -1442,13 +2289,13 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					*/
 					"delete referent refers_to, context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers_to().c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, r.context().c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		}
 	} else {  // !refers.empty()
@@ -1459,10 +2306,10 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					"WHERE refers = tid(?)",
 					"delete referent refers"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers().c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"DELETE FROM referents "
@@ -1478,13 +2325,13 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					*/
 					"delete referent refers context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers().c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, r.context().c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		} else {  // !refers_to.empty()
 			if (r.context().empty()) {
@@ -1494,13 +2341,13 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					"AND refers_to = tid(?)",
 					"delete referent refers, refers_to"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers().c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, r.refers_to().c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"DELETE FROM referents "
@@ -1517,22 +2364,21 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 					*/
 					"delete referent refers, refers_to, context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, r.refers().c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, r.refers_to().c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 3, r.context().c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		}
 	}
 
 	int s_rc = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
 	
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "delete referent failed: %s", r.str().c_str());
@@ -1540,6 +2386,10 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 	if (sqlite3_changes(_db) == 0)
 		RET_SSN_FERROR(tagd::TS_NOT_FOUND, "delete referent not found: %s", r.str().c_str());
 
+	// queries are keyed by the referents before decoding
+	_query_cache.clear();
+	this->referent_change();
+
 	// make a set off all terms affected, so we can update the term pos after deleting tag
 	std::set<tagd::id_type> terms_affected;
 	tag_affected(terms_affected, r);
@@ -1551,69 +2401,94 @@ tagd::code sqlite::del(const tagd::referent& r, session *ssn, flags_t flags) {
 	return tagd::TAGD_OK;
 }
 
-tagd::part_of_speech sqlite::term_pos_occurence(const tagd::id_type& id, session *ssn, bool set_fk_err) {
-	if (_term_pos_occurence_stmt == nullptr) {
-		// TODO there is probably a more optimal way of doing this
-		// I know, WTF, but when in doubt, use brute force
-		// TODO this might not even be needed
-		// if we are to do it, remove the dynamic SQL and embedded tagd::POS_* values not needed 
-		// next, accomodate all tagd::part_of_speech types
-		std::stringstream ss;
-		ss << "SELECT pos FROM tags WHERE tag = tid(?) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_SUB_RELATOR << " FROM tags WHERE sub_relator = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_SUB_OBJECT << " FROM tags WHERE super_object = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_SUBJECT << " FROM relations WHERE subject = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_RELATED << " FROM relations WHERE relator = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_OBJECT << " FROM relations WHERE object = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_MODIFIER << " FROM relations WHERE modifier = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_REFERS << " FROM referents WHERE refers = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_REFERS_TO << " FROM referents WHERE refers_to = tid(?) LIMIT 1) "
-		   << "UNION "
-		   << "SELECT * FROM (SELECT " << tagd::POS_CONTEXT << " FROM referents WHERE context = tid(?) LIMIT 1)";
-		this->prepare(&_term_pos_occurence_stmt, ss.str().c_str(), "pos occurence statement");
+tagd::code sqlite::batch_begin(session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	if (_in_batch)
+		RET_SSN_ERROR(tagd::TS_MISUSE, "batch already begun");
+
+	this->exec("BEGIN", "batch begin");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:batch_begin");
+	OK_OR_RET_ERR();
+
+	_in_batch = true;
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::batch_end(bool commit, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	if (!_in_batch)
+		RET_SSN_ERROR(tagd::TS_MISUSE, "batch not begun");
+	_in_batch = false;
+
+	// the writes have been made, so ending the batch isn't interrupted
+	this->uninterruptible();
+
+	if (commit && this->exec("COMMIT", "batch commit") == tagd::TAGD_OK)
+		RET_SSN_CODE(tagd::TAGD_OK);
+
+	// not committed, or the commit failed and left the transaction open
+	if (!sqlite3_get_autocommit(_db))
+		this->exec("ROLLBACK", "batch rollback");
+	this->invalidate_all();
+
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:batch_end");
+	RET_SSN_CODE(_code);
+}
+
+tagd::code sqlite::statement_begin(session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	if (!_in_batch)
+		RET_SSN_ERROR(tagd::TS_MISUSE, "statement not in a batch");
+
+	this->exec("SAVEPOINT batch_statement", "statement begin");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:statement_begin");
+	RET_SSN_CODE(_code);
+}
+
+tagd::code sqlite::statement_end(bool keep, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	if (!_in_batch)
+		RET_SSN_ERROR(tagd::TS_MISUSE, "statement not in a batch");
+
+	this->uninterruptible();
+	if (keep) {
+		this->exec("RELEASE batch_statement", "statement release");
 	} else {
-		sqlite3_reset(_term_pos_occurence_stmt);
-		sqlite3_clear_bindings(_term_pos_occurence_stmt);
+		this->exec("ROLLBACK TO batch_statement; RELEASE batch_statement", "statement rollback");
+		this->invalidate_all();
 	}
-	OK_OR_RET_POS_UNKNOWN();
 
-	int i = 1;
-	this->bind_text(&_term_pos_occurence_stmt, i, id.c_str(), "tag pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "sub_relator pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "super_object pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "subject pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "relator pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "object pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "modifier pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "refers pos occurence");
-	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "refers_to pos occurence");
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:statement_end");
+	RET_SSN_CODE(_code);
+}
+
+tagd::part_of_speech sqlite::term_pos_occurence(const tagd::id_type& id, session *ssn, bool set_fk_err) {
+	// the pos of the tag itself, and the role of each column the
+	// term occurs in, as counted by the term_occurences triggers
+	// (UNION, so a role that is also the pos of the tag is an error once)
+	sqlite3_stmt *term_pos_occurence_stmt = nullptr;
+	this->prepare(&term_pos_occurence_stmt,
+		"SELECT pos FROM tags WHERE tag = tid(?1) "
+		"UNION "
+		"SELECT pos FROM term_occurences WHERE term = tid(?1)",
+		"pos occurence statement"
+	);
 	OK_OR_RET_POS_UNKNOWN();
-	this->bind_text(&_term_pos_occurence_stmt, ++i, id.c_str(), "context pos occurence");
+
+	this->bind_text(&term_pos_occurence_stmt, 1, id.c_str(), "term pos occurence");
 	OK_OR_RET_POS_UNKNOWN();
 
 	const int F_POS = 0;
 
 	int s_rc;
 	tagd::part_of_speech occurence_pos = tagd::POS_UNKNOWN;
-	while ((s_rc = sqlite3_step(this->_term_pos_occurence_stmt)) == SQLITE_ROW) {
+	while ((s_rc = sqlite3_step(term_pos_occurence_stmt)) == SQLITE_ROW) {
 		// occurence_pos |= pos is prettier, but give invalid conversion error
-		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(this->_term_pos_occurence_stmt, F_POS);
+		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(term_pos_occurence_stmt, F_POS);
 		TAGDB_LOG_TRACE( id << ": " << pos_list_str(occurence_pos) << " |= " << pos_str(pos) << std::endl )
 		occurence_pos = ((tagd::part_of_speech)(occurence_pos | pos));
 
@@ -1682,35 +2557,45 @@ tagd::code sqlite::update_pos_occurence(const tagd::id_type& id) {
 tagd::code sqlite::delete_refers_to(const tagd::id_type& id) {
 	assert( !id.empty() );
 
-	this->prepare(&_delete_refers_to_stmt,
+	sqlite3_stmt *delete_refers_to_stmt = nullptr;
+	this->prepare(&delete_refers_to_stmt,
 		"DELETE FROM referents WHERE refers_to = tid(?)",
 		"delete refers_to"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_delete_refers_to_stmt, 1, id.c_str(), "delete refers_to");
+	this->bind_text(&delete_refers_to_stmt, 1, id.c_str(), "delete refers_to");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_delete_refers_to_stmt);
+	int s_rc = sqlite3_step(delete_refers_to_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "delete refers_to failed: %s", id.c_str());
 
+	if (sqlite3_changes(_db) > 0) {
+		_query_cache.clear();
+		this->referent_change();
+	}
+
 	return tagd::TAGD_OK;
 }
 
 tagd::code sqlite::delete_relations(const tagd::id_type& subject) {
 	assert( !subject.empty() );
 
-	this->prepare(&_delete_subject_relations_stmt,
+	sqlite3_stmt *delete_subject_relations_stmt = nullptr;
+	this->prepare(&delete_subject_relations_stmt,
 		"DELETE FROM relations WHERE subject = tid(?)",
 		"delete relations"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_delete_subject_relations_stmt, 1, subject.c_str(), "delete subject relations");
+	this->bind_text(&delete_subject_relations_stmt, 1, subject.c_str(), "delete subject relations");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_delete_subject_relations_stmt);
+	this->invalidate_queries(subject);
+	OK_OR_RET_ERR();
+
+	int s_rc = sqlite3_step(delete_subject_relations_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "delete subject relations failed: %s", subject.c_str());
 
@@ -1718,11 +2603,15 @@ tagd::code sqlite::delete_relations(const tagd::id_type& subject) {
 }
 
 tagd::code sqlite::delete_relations(const tagd::id_type& subject, const tagd::predicate_set& P) {
+	sqlite3_stmt *delete_relation_stmt = nullptr;
 	assert( !subject.empty() );
 	assert( !P.empty() );
 
+	this->invalidate_queries(subject, P);
+	OK_OR_RET_ERR();
+
 	for (auto p : P) {
-		this->prepare(&_delete_relation_stmt,
+		this->prepare(&delete_relation_stmt,
 			"DELETE FROM relations "
 			"WHERE subject = tid(?) "
 			"AND relator = tid(?) "
@@ -1731,16 +2620,16 @@ tagd::code sqlite::delete_relations(const tagd::id_type& subject, const tagd::pr
 		);
 		OK_OR_RET_ERR();
 
-		this->bind_text(&_delete_relation_stmt, 1, subject.c_str(), "delete relation subject");
+		this->bind_text(&delete_relation_stmt, 1, subject.c_str(), "delete relation subject");
 		OK_OR_RET_ERR();
 
-		this->bind_text(&_delete_relation_stmt, 2, p.relator.c_str(), "delete relation relator");
+		this->bind_text(&delete_relation_stmt, 2, p.relator.c_str(), "delete relation relator");
 		OK_OR_RET_ERR();
 		
-		this->bind_text(&_delete_relation_stmt, 3, p.object.c_str(), "delete relation object");
+		this->bind_text(&delete_relation_stmt, 3, p.object.c_str(), "delete relation object");
 		OK_OR_RET_ERR();
 
-		int s_rc = sqlite3_step(_delete_relation_stmt);
+		int s_rc = sqlite3_step(delete_relation_stmt);
 		if (s_rc != SQLITE_DONE) {
 			RET_SQLITE_FERROR(s_rc, "delete relation failed: %s %s %s",
 					subject.c_str(), p.relator.c_str(), p.object.c_str()); 
@@ -1753,16 +2642,20 @@ tagd::code sqlite::delete_relations(const tagd::id_type& subject, const tagd::pr
 tagd::code sqlite::delete_tag(const tagd::id_type& id, session *ssn) {
 	assert( !id.empty() );
 
-	this->prepare(&_delete_tag_stmt,
+	sqlite3_stmt *delete_tag_stmt = nullptr;
+	this->prepare(&delete_tag_stmt,
 		"DELETE FROM tags WHERE tag = tid(?)",
 		"delete tag"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_delete_tag_stmt, 1, id.c_str(), "delete tag id");
+	this->bind_text(&delete_tag_stmt, 1, id.c_str(), "delete tag id");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_delete_tag_stmt);
+	this->invalidate_queries(id);
+	OK_OR_RET_ERR();
+
+	int s_rc = sqlite3_step(delete_tag_stmt);
 	if (s_rc == SQLITE_DONE) {
 		return tagd::TAGD_OK;
 	} else if (s_rc == SQLITE_CONSTRAINT) {
@@ -1925,19 +2818,20 @@ tagd::code sqlite::insert_fts_tag(const tagd::id_type& id, flags_t flags) {
 
 	TAGDB_LOG_TRACE( "insert_fts_tag( " << id << " ): " << format_fts(t) << std::endl )
 
-	this->prepare(&_insert_fts_tag_stmt,
+	sqlite3_stmt *insert_fts_tag_stmt = nullptr;
+	this->prepare(&insert_fts_tag_stmt,
 		"INSERT INTO fts_tags (docid, content) VALUES (tid(?), ?)",
 		"insert fts_tag"
 	);
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_insert_fts_tag_stmt, 1, id.c_str(), "insert fts_tag docid");
+	this->bind_text(&insert_fts_tag_stmt, 1, id.c_str(), "insert fts_tag docid");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_insert_fts_tag_stmt, 2, format_fts(t).c_str(), "insert fts_tag content");
+	this->bind_text(&insert_fts_tag_stmt, 2, format_fts(t).c_str(), "insert fts_tag content");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_insert_fts_tag_stmt);
+	int s_rc = sqlite3_step(insert_fts_tag_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "insert fts_tag failed: %s", id.c_str());
 
@@ -1953,19 +2847,20 @@ tagd::code sqlite::update_fts_tag(const tagd::id_type& id, flags_t flags) {
 
 	TAGDB_LOG_TRACE( "update_fts_tag( " << id << " ): " << format_fts(t) << std::endl )
 
-	this->prepare(&_update_fts_tag_stmt,
+	sqlite3_stmt *update_fts_tag_stmt = nullptr;
+	this->prepare(&update_fts_tag_stmt,
 		"UPDATE fts_tags SET content = ? WHERE docid = tid(?)",
 		"update fts_tag"
 	);
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_fts_tag_stmt, 1, format_fts(t).c_str(), "update fts_tag content");
+	this->bind_text(&update_fts_tag_stmt, 1, format_fts(t).c_str(), "update fts_tag content");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_fts_tag_stmt, 2, id.c_str(), "update fts_tag docid");
+	this->bind_text(&update_fts_tag_stmt, 2, id.c_str(), "update fts_tag docid");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_update_fts_tag_stmt);
+	int s_rc = sqlite3_step(update_fts_tag_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "update fts_tag failed: %s", id.c_str());
 
@@ -1973,16 +2868,17 @@ tagd::code sqlite::update_fts_tag(const tagd::id_type& id, flags_t flags) {
 }
 
 tagd::code sqlite::delete_fts_tag(const tagd::id_type& id) {
-	assert( !id.empty() ); this->prepare(&_delete_fts_tag_stmt,
+	sqlite3_stmt *delete_fts_tag_stmt = nullptr;
+	assert( !id.empty() ); this->prepare(&delete_fts_tag_stmt,
 		"DELETE FROM fts_tags WHERE docid = tid(?)",
 		"delete fts_tag"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_delete_fts_tag_stmt, 1, id.c_str(), "delete fts_tag docid");
+	this->bind_text(&delete_fts_tag_stmt, 1, id.c_str(), "delete fts_tag docid");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_delete_fts_tag_stmt);
+	int s_rc = sqlite3_step(delete_fts_tag_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "delete fts_tag failed: %s", id.c_str());
 
@@ -1992,19 +2888,20 @@ tagd::code sqlite::delete_fts_tag(const tagd::id_type& id) {
 tagd::code sqlite::insert_term(const tagd::id_type& t, const tagd::part_of_speech pos) {
 	assert( !t.empty() );
 
-	this->prepare(&_insert_term_stmt,
+	sqlite3_stmt *insert_term_stmt = nullptr;
+	this->prepare(&insert_term_stmt,
 		"INSERT INTO terms (term, term_pos) VALUES (?, ?)",
 		"insert term"
 	);
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_insert_term_stmt, 1, t.c_str(), "insert term");
+	this->bind_text(&insert_term_stmt, 1, t.c_str(), "insert term");
 	OK_OR_RET_ERR(); 
  
-	this->bind_int(&_insert_term_stmt, 2, pos, "insert term_pos");
+	this->bind_int(&insert_term_stmt, 2, pos, "insert term_pos");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_insert_term_stmt);
+	int s_rc = sqlite3_step(insert_term_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "insert term failed: %s", t.c_str());
 
@@ -2014,22 +2911,23 @@ tagd::code sqlite::insert_term(const tagd::id_type& t, const tagd::part_of_speec
 tagd::code sqlite::update_term(const tagd::id_type& t, const tagd::part_of_speech pos) {
 	assert( !t.empty() );
 
-	this->prepare(&_update_term_stmt,
+	sqlite3_stmt *update_term_stmt = nullptr;
+	this->prepare(&update_term_stmt,
 		"UPDATE terms SET term_pos = ? WHERE term = ? AND term_pos <> ?",
 		"update term"
 	);
 	OK_OR_RET_ERR(); 
 
-	this->bind_int(&_update_term_stmt, 1, pos, "update term_pos");
+	this->bind_int(&update_term_stmt, 1, pos, "update term_pos");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_term_stmt, 2, t.c_str(), "update term");
+	this->bind_text(&update_term_stmt, 2, t.c_str(), "update term");
 	OK_OR_RET_ERR(); 
 
-	this->bind_int(&_update_term_stmt, 3, pos, "update <> term_pos");
+	this->bind_int(&update_term_stmt, 3, pos, "update <> term_pos");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_update_term_stmt);
+	int s_rc = sqlite3_step(update_term_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "update term failed: %s", t.c_str());
 
@@ -2039,16 +2937,17 @@ tagd::code sqlite::update_term(const tagd::id_type& t, const tagd::part_of_speec
 tagd::code sqlite::delete_term(const tagd::id_type& id) {
 	assert( !id.empty() );
 
-	this->prepare(&_delete_term_stmt,
+	sqlite3_stmt *delete_term_stmt = nullptr;
+	this->prepare(&delete_term_stmt,
 		"DELETE FROM terms WHERE term = ?",
 		"delete term"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_delete_term_stmt, 1, id.c_str(), "delete term");
+	this->bind_text(&delete_term_stmt, 1, id.c_str(), "delete term");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_delete_term_stmt);
+	int s_rc = sqlite3_step(delete_term_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "delete term failed: %s", id.c_str());
 
@@ -2067,7 +2966,8 @@ tagd::code sqlite::insert(const tagd::abstract_tag& t, const tagd::abstract_tag&
 	next_rank(rank, destination);
 	OK_OR_RET_ERR(); 
 
-	this->prepare(&_insert_stmt,
+	sqlite3_stmt *insert_stmt = nullptr;
+	this->prepare(&insert_stmt,
 		"INSERT INTO tags (tag, sub_relator, super_object, rank, pos) "
 		"VALUES (tid(?), tid(?), tid(?), ?, ?)",
 		"insert tag"
@@ -2089,44 +2989,50 @@ tagd::code sqlite::insert(const tagd::abstract_tag& t, const tagd::abstract_tag&
 
 	int i = 0;
 	this->put_term(t.id(), pos);
-	this->bind_text(&_insert_stmt, ++i, t.id().c_str(), "insert id");
+	this->bind_text(&insert_stmt, ++i, t.id().c_str(), "insert id");
 	OK_OR_RET_ERR(); 
 
 	this->put_term(t.sub_relator(), tagd::POS_SUB_RELATOR);
-	this->bind_text(&_insert_stmt, ++i, t.sub_relator().c_str(), "insert sub_relator");
+	this->bind_text(&insert_stmt, ++i, t.sub_relator().c_str(), "insert sub_relator");
 	OK_OR_RET_ERR(); 
 
 	this->put_term(t.super_object(), tagd::POS_SUB_OBJECT);
-	this->bind_text(&_insert_stmt, ++i, t.super_object().c_str(), "insert super_object");
+	this->bind_text(&insert_stmt, ++i, t.super_object().c_str(), "insert super_object");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_insert_stmt, ++i, rank.c_str(), "insert rank");
+	this->bind_text(&insert_stmt, ++i, rank.c_str(), "insert rank");
 	OK_OR_RET_ERR(); 
 
-	this->bind_int(&_insert_stmt, ++i, pos, "insert pos");
+	this->bind_int(&insert_stmt, ++i, pos, "insert pos");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_insert_stmt);
+	int s_rc = sqlite3_step(insert_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "insert tag failed: %s", t.id().c_str());
 
-	return tagd::TAGD_OK;
+	this->invalidate_queries(t.id());
+	return this->code();
 }
 
 // update existing with new tag
 tagd::code sqlite::update(const tagd::abstract_tag& t, const tagd::abstract_tag& destination) {
+	sqlite3_stmt *update_ranks_stmt = nullptr;
 	assert( !t.id().empty() );
 	assert( !t.sub_relator().empty() );
 	assert( !t.super_object().empty() );
 	assert( !destination.super_object().empty() );
 
+	// the rank before moving
+	this->invalidate_queries(t.id());
+	OK_OR_RET_ERR();
+
 	if (t.rank() != destination.rank()) {
 		tagd::rank rank;
 		next_rank(rank, destination);
 		OK_OR_RET_ERR(); 
 
 		// update the ranks
-		this->prepare(&_update_ranks_stmt, 
+		this->prepare(&update_ranks_stmt, 
 			"UPDATE tags "
 			"SET rank = (? || substr(rank, ?)) "
 			"WHERE rank GLOB (? || '*')",
@@ -2134,50 +3040,56 @@ tagd::code sqlite::update(const tagd::abstract_tag& t, const tagd::abstract_tag&
 		);
 		OK_OR_RET_ERR(); 
 
-		this->bind_text(&_update_ranks_stmt, 1, rank.c_str(), "new rank");
+		this->bind_text(&update_ranks_stmt, 1, rank.c_str(), "new rank");
 		OK_OR_RET_ERR(); 
 
-		this->bind_int(&_update_ranks_stmt, 2, (t.rank().size()+1), "rank size");
+		this->bind_int(&update_ranks_stmt, 2, (t.rank().size()+1), "rank size");
 		OK_OR_RET_ERR(); 
 
-		this->bind_text(&_update_ranks_stmt, 3, t.rank().c_str(), "sub rank");
+		this->bind_text(&update_ranks_stmt, 3, t.rank().c_str(), "sub rank");
 		OK_OR_RET_ERR(); 
 
-		int s_rc = sqlite3_step(_update_ranks_stmt);
+		int s_rc = sqlite3_step(update_ranks_stmt);
 		if (s_rc != SQLITE_DONE)
 			RET_SQLITE_FERROR(s_rc, "update rank failed: %s", t.id().c_str());
+
+		// referents resolve by the ranks of their contexts
+		this->referent_change();
 	}
 
 	//update tag
-	this->prepare(&_update_tag_stmt, 
+	sqlite3_stmt *update_tag_stmt = nullptr;
+	this->prepare(&update_tag_stmt, 
 			"UPDATE tags SET sub_relator = tid(?), super_object = tid(?) WHERE tag = tid(?)",
 			"update tag"
 	);
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_tag_stmt, 1, t.sub_relator().c_str(), "update sub_relator");
+	this->bind_text(&update_tag_stmt, 1, t.sub_relator().c_str(), "update sub_relator");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_tag_stmt, 2, destination.id().c_str(), "update super_object");
+	this->bind_text(&update_tag_stmt, 2, destination.id().c_str(), "update super_object");
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_update_tag_stmt, 3, t.id().c_str(), "update tag id");
+	this->bind_text(&update_tag_stmt, 3, t.id().c_str(), "update tag id");
 	OK_OR_RET_ERR(); 
 
-	int s_rc = sqlite3_step(_update_tag_stmt);
+	int s_rc = sqlite3_step(update_tag_stmt);
 	if (s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "update tag failed: %s", t.id().c_str());
 
-	return tagd::TAGD_OK;
+	this->invalidate_queries(t.id());
+	return this->code();
 }
 
 tagd::code sqlite::insert_relations(const tagd::abstract_tag& t, flags_t flags) {
 	assert( !t.id().empty() );
 	assert( !t.relations.empty() );
 
-	this->prepare(&_insert_relations_stmt,
-		"INSERT INTO relations (subject, relator, object, modifier) "
-		"VALUES (tid(?), tid(?), tid(?), tid(?))",
+	sqlite3_stmt *insert_relations_stmt = nullptr;
+	this->prepare(&insert_relations_stmt,
+		"INSERT INTO relations (subject, relator, object, modifier, modifier_value) "
+		"VALUES (tid(?), tid(?), tid(?), tid(?), ?)",
 		"insert relations"
 	);
 	OK_OR_RET_ERR(); 
@@ -2191,27 +3103,31 @@ tagd::code sqlite::insert_relations(const tagd::abstract_tag& t, flags_t flags)
 
 	do {
 		this->put_term(t.id(), tagd::POS_SUBJECT);
-		this->bind_text(&_insert_relations_stmt, 1, t.id().c_str(), "insert subject");
+		this->bind_text(&insert_relations_stmt, 1, t.id().c_str(), "insert subject");
 		OK_OR_RET_ERR(); 
 
 		this->put_term(it->relator, tagd::POS_RELATED);
-		this->bind_text(&_insert_relations_stmt, 2, it->relator.c_str(), "insert relator");
+		this->bind_text(&insert_relations_stmt, 2, it->relator.c_str(), "insert relator");
 		OK_OR_RET_ERR(); 
 
 		this->put_term(it->object, tagd::POS_OBJECT);
-		this->bind_text(&_insert_relations_stmt, 3, it->object.c_str(), "insert object");
+		this->bind_text(&insert_relations_stmt, 3, it->object.c_str(), "insert object");
 		OK_OR_RET_ERR(); 
 
 		if (it->modifier.empty()) {
-			this->bind_null(&_insert_relations_stmt, 4, "insert NULL modifier");
+			this->bind_null(&insert_relations_stmt, 4, "insert NULL modifier");
+			if (_code == tagd::TAGD_OK)
+				this->bind_null(&insert_relations_stmt, 5, "insert NULL modifier_value");
 		} else {
 			this->put_term(it->modifier, tagd::POS_MODIFIER);
-			this->bind_text(&_insert_relations_stmt, 4, it->modifier.c_str(), "insert modifier");
+			this->bind_text(&insert_relations_stmt, 4, it->modifier.c_str(), "insert modifier");
+			if (_code == tagd::TAGD_OK)
+				this->bind_modifier_value(&insert_relations_stmt, 5, *it, "insert modifier_value");
 		}
 		OK_OR_RET_ERR(); 
 
 
-		int s_rc = sqlite3_step(_insert_relations_stmt);
+		int s_rc = sqlite3_step(insert_relations_stmt);
 
 		if (s_rc == SQLITE_DONE) {
 			num_inserted++;
@@ -2242,10 +3158,15 @@ tagd::code sqlite::insert_relations(const tagd::abstract_tag& t, flags_t flags)
 			}
 		}
 
-		sqlite3_reset(_insert_relations_stmt);
-		sqlite3_clear_bindings(_insert_relations_stmt);
+		sqlite3_reset(insert_relations_stmt);
+		sqlite3_clear_bindings(insert_relations_stmt);
 	} while(++it != t.relations.end());
 
+	if (num_inserted > 0) {
+		this->invalidate_queries(t.id(), t.relations);
+		OK_OR_RET_ERR();
+	}
+
 	if (num_inserted == 0) {
 		if (flags & F_IGNORE_DUPLICATES)
 			return tagd::TAGD_OK;
@@ -2295,7 +3216,8 @@ tagd::code sqlite::insert_referent(const tagd::referent& put_ref, session *ssn,
 		return tagd::TS_MISUSE;
 	}
 
-	this->prepare(&_insert_referents_stmt,
+	sqlite3_stmt *insert_referents_stmt = nullptr;
+	this->prepare(&insert_referents_stmt,
 		"INSERT INTO referents (refers, refers_to, context) "
 		"VALUES (tid(?), tid(?), tid(?))",
 		"insert_referent"
@@ -2303,25 +3225,28 @@ tagd::code sqlite::insert_referent(const tagd::referent& put_ref, session *ssn,
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:insert_referent");
 
 	this->put_term(t.refers(), tagd::POS_REFERS);
-	this->bind_text(&_insert_referents_stmt, 1, t.refers().c_str(), "insert refers");
+	this->bind_text(&insert_referents_stmt, 1, t.refers().c_str(), "insert refers");
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:insert_referent:bind_refers");
 
 	this->put_term(t.refers_to(), tagd::POS_REFERS_TO);
-	this->bind_text(&_insert_referents_stmt, 2, t.refers_to().c_str(), "insert refers_to");
+	this->bind_text(&insert_referents_stmt, 2, t.refers_to().c_str(), "insert refers_to");
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:insert_referent:bind_refers_to");
 
 	if (t.context().empty())
-		this->bind_null(&_insert_referents_stmt, 3, "insert NULL context");
+		this->bind_null(&insert_referents_stmt, 3, "insert NULL context");
 	else {
 		this->put_term(t.context(), tagd::POS_CONTEXT);
-		this->bind_text(&_insert_referents_stmt, 3, t.context().c_str(), "insert context");
+		this->bind_text(&insert_referents_stmt, 3, t.context().c_str(), "insert context");
 	}
 	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:insert_referent:bind_context");
 
-	int s_rc = sqlite3_step(_insert_referents_stmt);
+	int s_rc = sqlite3_step(insert_referents_stmt);
 	
 	if (s_rc == SQLITE_DONE) {
 		// TODO update fts_tags with referent
+		// queries are keyed by the referents before decoding
+		_query_cache.clear();
+		this->referent_change();
 		return tagd::TAGD_OK;
 	}
 
@@ -2453,99 +3378,333 @@ void sqlite::decode_referents(tagd::abstract_tag& to, const tagd::abstract_tag&
 		this->decode_referents(to.relations, from.relations, ssn);
 }
 
-tagd::code sqlite::related(tagd::tag_set& R, const tagd::predicate& rel, const tagd::id_type& sup, session* ssn, flags_t flags) {
-	tagd::predicate p;
-	tagd::id_type super_object;
-	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) {
-		p = rel;
-		super_object = sup;
-	} else {
-		this->decode_referent(super_object, sup, ssn);
-		this->decode_referent(p.relator, rel.relator, ssn);
-		this->decode_referent(p.object, rel.object, ssn);
-		this->decode_referent(p.modifier, rel.modifier, ssn);
-		p.opr8r = rel.opr8r;
-	}
-
+tagd::code sqlite::bind_related(sqlite3_stmt **stmt, const tagd::predicate& p, const tagd::id_type& super_object, const tagd::id_type& after, size_t depth) {
 	int pos_i = 0;  // binding position
 
-	auto f_bind_null_text = [this, &pos_i](bool not_null, const tagd::id_type &id) {
+	auto f_bind_null_text = [this, stmt, &pos_i](bool not_null, const tagd::id_type &id) {
 			if (not_null) {
-				this->bind_text(&_related_stmt, ++pos_i, id.c_str(), "test");
-				this->bind_text(&_related_stmt, ++pos_i, id.c_str(), "value");
+				this->bind_text(stmt, ++pos_i, id.c_str(), "test");
+				this->bind_text(stmt, ++pos_i, id.c_str(), "value");
 			} else {
-				this->bind_null(&_related_stmt, ++pos_i, "null test");
-				this->bind_null(&_related_stmt, ++pos_i, "null");
+				this->bind_null(stmt, ++pos_i, "null test");
+				this->bind_null(stmt, ++pos_i, "null");
 			}
 	};
 
-	auto f_bind_null_int_text = [this, &pos_i](bool not_null, const tagd::predicate &p) {
+	auto f_bind_null_modifier_value = [this, stmt, &pos_i](bool not_null, const tagd::predicate &p) {
 			if (not_null) {
-				if (p.modifier_type == tagd::TYPE_TEXT) {
-					this->bind_text(&_related_stmt, ++pos_i, p.modifier.c_str(), "test");
-					this->bind_text(&_related_stmt, ++pos_i, p.modifier.c_str(), "value");
-				} else {
-					this->bind_int(&_related_stmt, ++pos_i, atoi(p.modifier.c_str()), "test");
-					this->bind_int(&_related_stmt, ++pos_i, atoi(p.modifier.c_str()), "value");
-				}
+				this->bind_text(stmt, ++pos_i, p.modifier.c_str(), "test");
+				this->bind_modifier_value(stmt, ++pos_i, p, "value");
 			} else {
-				this->bind_null(&_related_stmt, ++pos_i, "null test");
-				this->bind_null(&_related_stmt, ++pos_i, "null");
+				this->bind_null(stmt, ++pos_i, "null test");
+				this->bind_null(stmt, ++pos_i, "null");
 			}
 	};
 
-	this->prepare(&_related_stmt, 
-		"SELECT idt(subject), idt(sub_relator), idt(super_object), pos, rank, "
-		"idt(relator), idt(object), idt(modifier) "
-		"FROM tags, relations "
-		"WHERE tag = subject "
-		"AND ("
-			"? IS NULL OR subject IN ( "
-			"SELECT tag FROM tags WHERE rank GLOB ( "
-			"SELECT rank FROM tags WHERE tag = tid(?) "
-			") || '*'"
-			") "
-		") "
-		"AND ("
-			"? IS NULL OR relator IN ( "
-			"SELECT tag FROM tags WHERE rank GLOB ( "
-			"SELECT rank FROM tags WHERE tag = tid(?) "
-			") || '*'"
-			") "
-		") "
-		"AND ("
-			"? IS NULL OR object IN ( "
-			"SELECT tag FROM tags WHERE rank GLOB ( "
-			"SELECT rank FROM tags WHERE tag = tid(?) "
-			") || '*'"
-			") "
-		") "
-		"AND (? IS NULL OR modifier = tid(?)) "
-		"AND (? IS NULL OR modifier IN(SELECT ROWID FROM terms WHERE CAST(term AS INTEGER) > ?)) "
-		"AND (? IS NULL OR modifier IN(SELECT ROWID FROM terms WHERE CAST(term AS INTEGER) >= ?)) "
-		"AND (? IS NULL OR modifier IN(SELECT ROWID FROM terms WHERE CAST(term AS INTEGER) < ?)) "
-		"AND (? IS NULL OR modifier IN(SELECT ROWID FROM terms WHERE CAST(term AS INTEGER) <= ?)) "
-		"ORDER BY rank",
-		"select related"
-	);
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related");
-
 	f_bind_null_text(!super_object.empty(), super_object);
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:super_object");
+	OK_OR_RET_ERR();
 	f_bind_null_text(!p.relator.empty(), p.relator); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:relator");
+	OK_OR_RET_ERR();
 	f_bind_null_text(!p.object.empty(), p.object); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:object");
+	OK_OR_RET_ERR();
 	f_bind_null_text((!p.modifier.empty() && p.opr8r == tagd::OP_EQ), p.modifier); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:modifier:OP_EQ");
-	f_bind_null_int_text((!p.modifier.empty() && p.opr8r == tagd::OP_GT), p); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:modifier:OP_GT");
-	f_bind_null_int_text((!p.modifier.empty() && p.opr8r == tagd::OP_GT_EQ), p); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:modifier:OP_GT_EQ");
-	f_bind_null_int_text((!p.modifier.empty() && p.opr8r == tagd::OP_LT), p); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:modifier:OP_LT");
-	f_bind_null_int_text((!p.modifier.empty() && p.opr8r == tagd::OP_LT_EQ), p); 
-	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind:modifier:OP_LT_EQ");
+	OK_OR_RET_ERR();
+	f_bind_null_modifier_value((!p.modifier.empty() && p.opr8r == tagd::OP_GT), p); 
+	OK_OR_RET_ERR();
+	f_bind_null_modifier_value((!p.modifier.empty() && p.opr8r == tagd::OP_GT_EQ), p); 
+	OK_OR_RET_ERR();
+	f_bind_null_modifier_value((!p.modifier.empty() && p.opr8r == tagd::OP_LT), p); 
+	OK_OR_RET_ERR();
+	f_bind_null_modifier_value((!p.modifier.empty() && p.opr8r == tagd::OP_LT_EQ), p); 
+	OK_OR_RET_ERR();
+	f_bind_null_text(!after.empty(), after);
+	OK_OR_RET_ERR();
+
+	// depth below the super_object
+	if (depth && !super_object.empty()) {
+		this->bind_int(stmt, ++pos_i, 1, "depth test");
+		OK_OR_RET_ERR();
+		this->bind_text(stmt, ++pos_i, super_object.c_str(), "depth super_object");
+		OK_OR_RET_ERR();
+		this->bind_int(stmt, ++pos_i, (depth <= INT_MAX ? (int) depth : INT_MAX), "depth");
+		OK_OR_RET_ERR();
+	} else {
+		this->bind_null(stmt, ++pos_i, "null depth test");
+		OK_OR_RET_ERR();
+		this->bind_null(stmt, ++pos_i, "null depth super_object");
+		OK_OR_RET_ERR();
+		this->bind_null(stmt, ++pos_i, "null depth");
+		OK_OR_RET_ERR();
+	}
+
+	return tagd::TAGD_OK;
+}
+
+tagd::code sqlite::bind_children(sqlite3_stmt **stmt, const tagd::id_type& super_object, size_t limit, const tagd::id_type& after, size_t depth) {
+	this->bind_text(stmt, 1, super_object.c_str(), "children super_object");
+	OK_OR_RET_ERR();
+
+	if (after.empty())
+		this->bind_null(stmt, 2, "children after null");
+	else
+		this->bind_text(stmt, 2, after.c_str(), "children after");
+	OK_OR_RET_ERR();
+
+	// negative LIMIT is no limit
+	this->bind_int(stmt, 3, ((limit && limit <= INT_MAX) ? (int) limit : -1), "children limit");
+	OK_OR_RET_ERR();
+
+	// descendants sql
+	if (sqlite3_bind_parameter_count(*stmt) >= 4)
+		return this->bind_int(stmt, 4, ((depth && depth <= INT_MAX) ? (int) depth : 1), "descendants depth");
+
+	return tagd::TAGD_OK;
+}
+
+// relator or object of the related sql in the subtree of a tag, or any when the tag is NULL
+#define OPTIONAL_SUBTREE_SQL(COL) \
+	"AND (" \
+		"? IS NULL OR " COL " IN ( " \
+		"SELECT tag FROM tags WHERE rank GLOB ( " \
+		"SELECT rank FROM tags WHERE tag = tid(?) " \
+		") || '*'" \
+		") " \
+	") "
+
+// as the optional subtree sql, binding the same parameters, but without the OR,
+// so the planner can look up the relations by idx_modifier_value
+#define REQUIRED_SUBTREE_SQL(COL) \
+	"AND " COL " IN ( " \
+		"SELECT tag FROM tags WHERE ? IS NOT NULL AND rank GLOB ( " \
+		"SELECT rank FROM tags WHERE tag = tid(?) " \
+		") || '*'" \
+	") "
+
+#define OPTIONAL_RANGE_SQL(OP) "AND (? IS NULL OR modifier_value " OP " ?) "
+#define REQUIRED_RANGE_SQL(OP) "AND ? IS NOT NULL AND modifier_value " OP " ? "
+
+// predicate conditions of the related sql, on the relations table
+// parameters: relator, object, modifier, and the range of each operator (>, >=, <, <=)
+#define PREDICATE_SQL(SUBTREE, GT, GT_EQ, LT, LT_EQ) \
+	SUBTREE("relator") \
+	SUBTREE("object") \
+	"AND (? IS NULL OR modifier = tid(?)) " \
+	GT GT_EQ LT LT_EQ
+
+#define RELATED_PREDICATE_SQL \
+	PREDICATE_SQL(OPTIONAL_SUBTREE_SQL, OPTIONAL_RANGE_SQL(">"), OPTIONAL_RANGE_SQL(">="), \
+		OPTIONAL_RANGE_SQL("<"), OPTIONAL_RANGE_SQL("<="))
+
+// predicates of a relator, object and range of modifier values, one for each operator
+#define GT_PREDICATE_SQL \
+	PREDICATE_SQL(REQUIRED_SUBTREE_SQL, REQUIRED_RANGE_SQL(">"), OPTIONAL_RANGE_SQL(">="), \
+		OPTIONAL_RANGE_SQL("<"), OPTIONAL_RANGE_SQL("<="))
+#define GT_EQ_PREDICATE_SQL \
+	PREDICATE_SQL(REQUIRED_SUBTREE_SQL, OPTIONAL_RANGE_SQL(">"), REQUIRED_RANGE_SQL(">="), \
+		OPTIONAL_RANGE_SQL("<"), OPTIONAL_RANGE_SQL("<="))
+#define LT_PREDICATE_SQL \
+	PREDICATE_SQL(REQUIRED_SUBTREE_SQL, OPTIONAL_RANGE_SQL(">"), OPTIONAL_RANGE_SQL(">="), \
+		REQUIRED_RANGE_SQL("<"), OPTIONAL_RANGE_SQL("<="))
+#define LT_EQ_PREDICATE_SQL \
+	PREDICATE_SQL(REQUIRED_SUBTREE_SQL, OPTIONAL_RANGE_SQL(">"), OPTIONAL_RANGE_SQL(">="), \
+		OPTIONAL_RANGE_SQL("<"), REQUIRED_RANGE_SQL("<="))
+
+// from and where clauses of the related sql, params are bound by sqlite::bind_related()
+#define RELATED_FROM_WHERE_SQL(PREDICATE) \
+	"FROM tags, relations " \
+	"WHERE tag = subject " \
+	"AND (" \
+		"? IS NULL OR subject IN ( " \
+		"SELECT tag FROM tags WHERE rank GLOB ( " \
+		"SELECT rank FROM tags WHERE tag = tid(?) " \
+		") || '*'" \
+		") " \
+	") " \
+	PREDICATE \
+	"AND (? IS NULL OR rank > (SELECT rank FROM tags WHERE tag = tid(?))) " \
+	"AND (? IS NULL OR length(rank) <= (SELECT length(COALESCE(rank, '')) FROM tags WHERE tag = tid(?)) + ?) "
+
+// from and where clauses of the inherited sql, params are bound by sqlite::bind_related()
+// every ancestor rank is a prefix of its descendant ranks, and no valid utf8 byte is 0xFE,
+// so the descendants of a subject (a) are the rank range [a.rank, a.rank || 0xFE)
+#define INHERITED_FROM_WHERE_SQL(PREDICATE) \
+	"FROM tags t, relations, tags a " \
+	"WHERE a.tag = subject " \
+	"AND t.rank >= a.rank AND t.rank < (a.rank || CAST(x'FE' AS TEXT)) " \
+	"AND (" \
+		"? IS NULL OR t.rank GLOB ( " \
+		"SELECT rank FROM tags WHERE tag = tid(?) " \
+		") || '*'" \
+	") " \
+	PREDICATE \
+	"AND (? IS NULL OR t.rank > (SELECT rank FROM tags WHERE tag = tid(?))) " \
+	"AND (? IS NULL OR length(t.rank) <= (SELECT length(COALESCE(rank, '')) FROM tags WHERE tag = tid(?)) + ?) "
+
+// selects subjects related by a predicate, under an optional super_object
+// columns: subject, sub_relator, super_object, pos, rank, relator, object, modifier
+#define RELATED_SELECT_SQL(PREDICATE) \
+	"SELECT idt(subject), idt(sub_relator), idt(super_object), pos, rank, " \
+	"idt(relator), idt(object), idt(modifier) " \
+	RELATED_FROM_WHERE_SQL(PREDICATE) \
+	"ORDER BY rank"
+
+// counts distinct subjects of the related sql, up to a limit (-1 no limit)
+#define RELATED_COUNT_SELECT_SQL(PREDICATE) \
+	"SELECT COUNT(*) FROM (" \
+	"SELECT DISTINCT subject " \
+	RELATED_FROM_WHERE_SQL(PREDICATE) \
+	"LIMIT ?)"
+
+// selects tags related by a predicate directly or through any of their super_objects
+// columns: same as the related sql, the relation being the one inherited
+#define INHERITED_SELECT_SQL(PREDICATE) \
+	"SELECT idt(t.tag), idt(t.sub_relator), idt(t.super_object), t.pos, t.rank, " \
+	"idt(relator), idt(object), idt(modifier) " \
+	INHERITED_FROM_WHERE_SQL(PREDICATE) \
+	"ORDER BY t.rank"
+
+// counts distinct tags of the inherited sql, up to a limit (-1 no limit)
+#define INHERITED_COUNT_SELECT_SQL(PREDICATE) \
+	"SELECT COUNT(*) FROM (" \
+	"SELECT DISTINCT t.tag " \
+	INHERITED_FROM_WHERE_SQL(PREDICATE) \
+	"LIMIT ?)"
+
+const char *RELATED_SQL = RELATED_SELECT_SQL(RELATED_PREDICATE_SQL);
+const char *RELATED_COUNT_SQL = RELATED_COUNT_SELECT_SQL(RELATED_PREDICATE_SQL);
+const char *INHERITED_SQL = INHERITED_SELECT_SQL(RELATED_PREDICATE_SQL);
+const char *INHERITED_COUNT_SQL = INHERITED_COUNT_SELECT_SQL(RELATED_PREDICATE_SQL);
+
+// the related sql of ranged predicates, indexed by range_sql_index()
+const char *RELATED_RANGE_SQL[] = {
+	RELATED_SELECT_SQL(GT_PREDICATE_SQL),
+	RELATED_SELECT_SQL(GT_EQ_PREDICATE_SQL),
+	RELATED_SELECT_SQL(LT_PREDICATE_SQL),
+	RELATED_SELECT_SQL(LT_EQ_PREDICATE_SQL)
+};
+const char *RELATED_COUNT_RANGE_SQL[] = {
+	RELATED_COUNT_SELECT_SQL(GT_PREDICATE_SQL),
+	RELATED_COUNT_SELECT_SQL(GT_EQ_PREDICATE_SQL),
+	RELATED_COUNT_SELECT_SQL(LT_PREDICATE_SQL),
+	RELATED_COUNT_SELECT_SQL(LT_EQ_PREDICATE_SQL)
+};
+const char *INHERITED_RANGE_SQL[] = {
+	INHERITED_SELECT_SQL(GT_PREDICATE_SQL),
+	INHERITED_SELECT_SQL(GT_EQ_PREDICATE_SQL),
+	INHERITED_SELECT_SQL(LT_PREDICATE_SQL),
+	INHERITED_SELECT_SQL(LT_EQ_PREDICATE_SQL)
+};
+const char *INHERITED_COUNT_RANGE_SQL[] = {
+	INHERITED_COUNT_SELECT_SQL(GT_PREDICATE_SQL),
+	INHERITED_COUNT_SELECT_SQL(GT_EQ_PREDICATE_SQL),
+	INHERITED_COUNT_SELECT_SQL(LT_PREDICATE_SQL),
+	INHERITED_COUNT_SELECT_SQL(LT_EQ_PREDICATE_SQL)
+};
+
+// index of a predicate of a relator, object and range of modifier values
+// into the range sql arrays, or -1 for the related sql
+static int range_sql_index(const tagd::predicate& p) {
+	if (p.relator.empty() || p.object.empty() || p.modifier.empty())
+		return -1;
+
+	switch (p.opr8r) {
+		case tagd::OP_GT:    return 0;
+		case tagd::OP_GT_EQ: return 1;
+		case tagd::OP_LT:    return 2;
+		case tagd::OP_LT_EQ: return 3;
+		default:             return -1;
+	}
+}
+
+// the sql for the predicate, of the related sql or its range sql
+static const char* related_sql(const char *sql, const char **range_sql, const tagd::predicate& p) {
+	int i = range_sql_index(p);
+	return (i < 0 ? sql : range_sql[i]);
+}
+
+// from and where clauses of the children sql, params are bound by sqlite::bind_children()
+// ?1 super_object, ?2 after, ?3 limit
+#define CHILDREN_FROM_WHERE_SQL \
+	"FROM tags WHERE super_object = tid(?1) " \
+	"AND (?2 IS NULL OR rank > (SELECT rank FROM tags WHERE tag = tid(?2))) "
+
+// from and where clauses of the descendants sql, params as the children sql, and ?4 depth
+// sqlite length() counts utf8 characters, so length(rank) is the number of rank levels
+// each level between the super_object and depth is a range of the idx_rank_depth index
+#define DESCENDANTS_FROM_WHERE_SQL \
+	"FROM tags WHERE length(rank) IN (" \
+		"WITH RECURSIVE levels(n) AS (" \
+			"SELECT (SELECT length(COALESCE(rank, '')) FROM tags WHERE tag = tid(?1)) + 1 " \
+			"UNION ALL " \
+			"SELECT n + 1 FROM levels " \
+			"WHERE n < (SELECT length(COALESCE(rank, '')) FROM tags WHERE tag = tid(?1)) + ?4" \
+		") SELECT n FROM levels" \
+	") " \
+	"AND rank > COALESCE((SELECT rank FROM tags WHERE tag = tid(?1)), '') " \
+	"AND rank < (COALESCE((SELECT rank FROM tags WHERE tag = tid(?1)), '') || CAST(x'FE' AS TEXT)) " \
+	"AND (?2 IS NULL OR rank > (SELECT rank FROM tags WHERE tag = tid(?2))) "
+
+// selects the children of a super_object, after an optional tag, up to a limit (-1 no limit)
+// columns: tag, sub_relator, super_object, pos, rank
+const char *CHILDREN_SQL =
+	"SELECT idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	CHILDREN_FROM_WHERE_SQL
+	"ORDER BY rank "
+	"LIMIT ?3";
+
+// counts the children of the children sql, up to a limit (-1 no limit)
+const char *CHILDREN_COUNT_SQL =
+	"SELECT COUNT(*) FROM ("
+	"SELECT tag "
+	CHILDREN_FROM_WHERE_SQL
+	"LIMIT ?3)";
+
+// selects the descendants of a super_object down to a depth, in rank order
+// columns: same as the children sql
+const char *DESCENDANTS_SQL =
+	"SELECT idt(tag), idt(sub_relator), idt(super_object), pos, rank "
+	DESCENDANTS_FROM_WHERE_SQL
+	"ORDER BY rank "
+	"LIMIT ?3";
+
+// counts the descendants of the descendants sql, up to a limit (-1 no limit)
+const char *DESCENDANTS_COUNT_SQL =
+	"SELECT COUNT(*) FROM ("
+	"SELECT tag "
+	DESCENDANTS_FROM_WHERE_SQL
+	"LIMIT ?3)";
+
+tagd::code sqlite::related(tagd::tag_set& R, const tagd::predicate& rel, const tagd::id_type& sup, session* ssn, flags_t flags, size_t limit, const tagd::id_type& aft, size_t depth) {
+	sqlite3_stmt *inherited_stmt = nullptr;
+	sqlite3_stmt *related_stmt = nullptr;
+	tagd::predicate p;
+	tagd::id_type super_object, after;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) {
+		p = rel;
+		super_object = sup;
+		after = aft;
+	} else {
+		this->decode_referent(super_object, sup, ssn);
+		this->decode_referent(after, aft, ssn);
+		this->decode_referent(p.relator, rel.relator, ssn);
+		this->decode_referent(p.object, rel.object, ssn);
+		this->decode_referent(p.modifier, rel.modifier, ssn);
+		p.opr8r = rel.opr8r;
+		p.modifier_type = rel.modifier_type;
+	}
+
+	sqlite3_stmt **stmt;
+	if (flags & F_INHERITED) {
+		stmt = &inherited_stmt;
+		this->prepare(stmt, related_sql(INHERITED_SQL, INHERITED_RANGE_SQL, p), "select inherited");
+	} else {
+		stmt = &related_stmt;
+		this->prepare(stmt, related_sql(RELATED_SQL, RELATED_RANGE_SQL, p), "select related");
+	}
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related");
+
+	this->bind_related(stmt, p, super_object, after, depth);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:related:bind");
 
 	const int F_SUBJECT = 0;
 	const int F_SUB_REL = 1;
@@ -2564,38 +3723,42 @@ tagd::code sqlite::related(tagd::tag_set& R, const tagd::predicate& rel, const t
 	tagd::rank rank;
 	int s_rc;
 
-	while ((s_rc = sqlite3_step(_related_stmt)) == SQLITE_ROW) {
-		rank.init( (const char*) sqlite3_column_text(_related_stmt, F_RANK));
-		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(_related_stmt, F_POS);
+	while ((s_rc = sqlite3_step(*stmt)) == SQLITE_ROW) {
+		// rows of tags already in R are ignored, so stop stepping at the limit
+		if (limit && R.size() >= limit)
+			break;
+
+		rank.init( (const char*) sqlite3_column_text(*stmt, F_RANK));
+		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(*stmt, F_POS);
 
 		tagd::abstract_tag *t;
 		if (pos != tagd::POS_URL) {
-			t = new tagd::abstract_tag( f_transform((const char*) sqlite3_column_text(_related_stmt, F_SUBJECT)) );
+			t = new tagd::abstract_tag( f_transform((const char*) sqlite3_column_text(*stmt, F_SUBJECT)) );
 		} else {
-			t = new tagd::HDURI( (const char*) sqlite3_column_text(_related_stmt, F_SUBJECT) );
+			t = new tagd::HDURI( (const char*) sqlite3_column_text(*stmt, F_SUBJECT) );
 			if (t->code() != tagd::TAGD_OK) {
 				auto tc = t->code();
 				if (ssn) {
 					ssn->ferror(tc, "failed to init related url: %s",
-							(const char*) sqlite3_column_text(_related_stmt, F_SUBJECT) );
+							(const char*) sqlite3_column_text(*stmt, F_SUBJECT) );
 				}
 				delete t;
 				return tc;
 			}
 		}
 
-		t->sub_relator( f_transform((const char*) sqlite3_column_text(_related_stmt, F_SUB_REL)) );
-		t->super_object( f_transform((const char*) sqlite3_column_text(_related_stmt, F_SUB_OBJ)) );
+		t->sub_relator( f_transform((const char*) sqlite3_column_text(*stmt, F_SUB_REL)) );
+		t->super_object( f_transform((const char*) sqlite3_column_text(*stmt, F_SUB_OBJ)) );
 		t->pos(pos);
 		t->rank(rank);
 
 		auto pred = tagd::predicate(
-			f_transform( (const char*) sqlite3_column_text(_related_stmt, F_RELATOR) ),
-			f_transform( (const char*) sqlite3_column_text(_related_stmt, F_OBJECT) )
+			f_transform( (const char*) sqlite3_column_text(*stmt, F_RELATOR) ),
+			f_transform( (const char*) sqlite3_column_text(*stmt, F_OBJECT) )
 		);
 
-		if (sqlite3_column_type(_related_stmt, F_MODIFIER) != SQLITE_NULL) {
-			pred.modifier = f_transform( (const char*) sqlite3_column_text(_related_stmt, F_MODIFIER) );
+		if (sqlite3_column_type(*stmt, F_MODIFIER) != SQLITE_NULL) {
+			pred.modifier = f_transform( (const char*) sqlite3_column_text(*stmt, F_MODIFIER) );
 		}
 		(void)t->relation(pred);
 
@@ -2605,7 +3768,7 @@ tagd::code sqlite::related(tagd::tag_set& R, const tagd::predicate& rel, const t
 		delete t;
 	}
 
-	if (s_rc == SQLITE_ERROR) {
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
 		SQLITE_FERROR(s_rc,
 			"related failed(super_object, relator, object, modifier, opr8r): %s, %s, %s, %s, %s",
 			super_object.c_str(), p.relator.c_str(), p.object.c_str(), p.modifier.c_str(), p.op_c_str());
@@ -2615,16 +3778,20 @@ tagd::code sqlite::related(tagd::tag_set& R, const tagd::predicate& rel, const t
 	return (R.size() == 0 ?  tagd::TS_NOT_FOUND : tagd::TAGD_OK);
 }
 
-tagd::code sqlite::get_children(tagd::tag_set& R, const tagd::id_type& super_object, session *ssn, flags_t flags) {
-	this->prepare(&_get_children_stmt,
-		"SELECT idt(tag), idt(sub_relator), idt(super_object), pos, rank "
-		"FROM tags WHERE super_object = tid(?) "
-		"ORDER BY rank",
-		"select children"
-	);
+tagd::code sqlite::get_children(tagd::tag_set& R, const tagd::id_type& super_object, session *ssn, flags_t flags, size_t limit, const tagd::id_type& after, size_t depth) {
+	sqlite3_stmt *get_descendants_stmt = nullptr;
+	sqlite3_stmt *get_children_stmt = nullptr;
+	sqlite3_stmt **stmt;
+	if (depth > 1) {
+		stmt = &get_descendants_stmt;
+		this->prepare(stmt, DESCENDANTS_SQL, "select descendants");
+	} else {
+		stmt = &get_children_stmt;
+		this->prepare(stmt, CHILDREN_SQL, "select children");
+	}
 	OK_OR_RET_ERR(); 
 
-	this->bind_text(&_get_children_stmt, 1, super_object.c_str(), "get children super_object");
+	this->bind_children(stmt, super_object, limit, after, depth);
 	OK_OR_RET_ERR(); 
 
 	const int F_ID = 0;
@@ -2640,36 +3807,41 @@ tagd::code sqlite::get_children(tagd::tag_set& R, const tagd::id_type& super_obj
 	tagd::tag_set::iterator it = R.begin();
 	int s_rc;
 
-	while ((s_rc = sqlite3_step(_get_children_stmt)) == SQLITE_ROW) {
+	while ((s_rc = sqlite3_step(*stmt)) == SQLITE_ROW) {
 		tagd::abstract_tag *t;
-		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(_get_children_stmt, F_POS);
+		tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(*stmt, F_POS);
 		if (pos != tagd::POS_URL) {
 			t = new tagd::abstract_tag(
-				f_transform((const char*) sqlite3_column_text(_get_children_stmt, F_ID))
+				f_transform((const char*) sqlite3_column_text(*stmt, F_ID))
 			);
 		} else {
-			t = new tagd::HDURI( (const char*) sqlite3_column_text(_get_children_stmt, F_ID) );
+			t = new tagd::HDURI( (const char*) sqlite3_column_text(*stmt, F_ID) );
 			if (t->code() != tagd::TAGD_OK) {
 				this->ferror( t->code(), "failed to init related url: %s",
-						(const char*) sqlite3_column_text(_get_children_stmt, F_ID) );
+						(const char*) sqlite3_column_text(*stmt, F_ID) );
 				delete t;
 				return this->code();
 			}
 		}
-		t->sub_relator( f_transform((const char*) sqlite3_column_text(_get_children_stmt, F_SUB_REL)) );
-		t->super_object( f_transform((const char*) sqlite3_column_text(_get_children_stmt, F_SUB_OBJ)) );
+		t->sub_relator( f_transform((const char*) sqlite3_column_text(*stmt, F_SUB_REL)) );
+		t->super_object( f_transform((const char*) sqlite3_column_text(*stmt, F_SUB_OBJ)) );
 		t->pos(pos);
-		t->rank( (const char*) sqlite3_column_text(_get_children_stmt, F_RANK) );
+		t->rank( (const char*) sqlite3_column_text(*stmt, F_RANK) );
 
 		it = R.insert(it, *t);
 		delete t;
 	}
 
-	if (s_rc == SQLITE_ERROR) {
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
 		SQLITE_FERROR(s_rc, "get_children failed: %s", super_object.c_str());
 		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_children:step");
 	}
 
+	if (flags & F_HYDRATE_RELATIONS) {
+		this->hydrate_relations(R, ssn, flags);
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:get_children:hydrate_relations");
+	}
+
 	return (R.size() == 0 ?  tagd::TS_NOT_FOUND : tagd::TAGD_OK);
 }
 
@@ -2697,7 +3869,7 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					"FROM referents",
 					"query referent context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"SELECT idt(refers), idt(refers_to), idt(context) "
@@ -2711,10 +3883,10 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 
 					"query referent context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, context.c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		} else {  // !refers_to.empty()
 			if (context.empty()) {
@@ -2724,10 +3896,10 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					"WHERE refers_to = tid(?)",
 					"query referent refers_to"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers_to.c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"SELECT idt(refers), idt(refers_to), idt(context) "
@@ -2741,13 +3913,13 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					")",
 					"query referent refers_to, context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers_to.c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, context.c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		}
 	} else {  // !refers.empty()
@@ -2759,10 +3931,10 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					"WHERE refers = tid(?)",
 					"query referent refers"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers.c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"SELECT idt(refers), idt(refers_to), idt(context) "
@@ -2776,13 +3948,13 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					")",
 					"query referent refers context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers.c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, context.c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		} else {  // !refers_to.empty()
 			if (context.empty()) {
@@ -2793,13 +3965,13 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					"AND refers_to = tid(?)",
 					"query referent refers, refers_to"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers.c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, refers_to.c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			} else {
 				this->prepare(&stmt,
 					"SELECT idt(refers), idt(refers_to), idt(context) "
@@ -2814,16 +3986,16 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 					")",
 					"query referent refers, refers_to, context"
 				);
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 1, refers.c_str(), "refers");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 2, refers_to.c_str(), "refers_to");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 
 				this->bind_text(&stmt, 3, context.c_str(), "context");
-				STMT_OK_OR_RET_ERR();
+				OK_OR_RET_ERR();
 			}
 		}
 	}
@@ -2847,9 +4019,7 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 		assert( pr.second );
 	}
 
-	sqlite3_finalize(stmt);
-
-	if (s_rc == SQLITE_ERROR) {
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE) {
 		RET_SQLITE_FERROR(s_rc, "query referents failed(refers, refers_to, context): %s, %s, %s",
 							refers.c_str(), refers_to.c_str(), context.c_str());
 	}
@@ -2857,13 +4027,362 @@ tagd::code sqlite::query_referents(tagd::tag_set& R, const tagd::interrogator& i
 	return (R.size() == 0 ? tagd::TS_NOT_FOUND : tagd::TAGD_OK);
 }
 
+tagd::code sqlite::rank_of(tagd::rank& r, const tagd::id_type& id) {
+	sqlite3_stmt *rank_stmt = nullptr;
+	this->prepare(&rank_stmt,
+		"SELECT rank FROM tags WHERE tag = tid(?)",
+		"rank of"
+	);
+	OK_OR_RET_ERR();
+
+	this->bind_text(&rank_stmt, 1, id.c_str(), "rank of id");
+	OK_OR_RET_ERR();
+
+	r.clear();
+	int s_rc = sqlite3_step(rank_stmt);
+	if (s_rc == SQLITE_DONE)
+		return tagd::TS_NOT_FOUND;
+	if (s_rc != SQLITE_ROW)
+		RET_SQLITE_FERROR(s_rc, "rank of failed: %s", id.c_str());
+
+	const int F_RANK = 0;
+	const char *data = (const char*) sqlite3_column_text(rank_stmt, F_RANK);
+	if (data == nullptr)  // _entity
+		return tagd::TAGD_OK;
+
+	auto rc = r.init(data);
+	if (rc != tagd::TAGD_OK)
+		return this->ferror(tagd::TS_INTERNAL_ERR, "rank_of rank.init() error: %s", tagd::code_str(rc));
+
+	return tagd::TAGD_OK;
+}
+
+// the interrogator as tagl, the flags affecting results and the context referents are decoded in
+std::string sqlite::query_cache_key(const tagd::interrogator& q, session *ssn, flags_t flags) {
+	std::stringstream ss;
+	ss << (flags & ~F_NO_RESET) << '\n';
+	if (ssn && !(flags & F_NO_TRANSFORM_REFERENTS)) {
+		for (auto& c : ssn->context())
+			ss << c << ',';
+	}
+	ss << '\n' << q;
+	return ss.str();
+}
+
+tagd::code sqlite::query_cache_deps(query_deps& deps, const tagd::interrogator& q, const tagd::tag_set& R, session *ssn, flags_t flags) {
+	deps.clear();
+
+	tagd::interrogator intr;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
+		intr = q;
+	else
+		this->decode_referents(intr, q, ssn);
+	OK_OR_RET_ERR();
+
+	// referent, inherited and search results depend on more than ranks of the terms named
+	if (intr.super_object() == HARD_TAG_REFERENT || (flags & F_INHERITED)) {
+		deps.all = true;
+		return tagd::TAGD_OK;
+	}
+
+	tagd::rank r;
+	if (!intr.super_object().empty()) {
+		deps.terms.insert(intr.super_object());
+		if (this->rank_of(deps.super, intr.super_object()) != tagd::TAGD_OK)
+			return tagd::TS_NOT_FOUND;
+		deps.has_super = true;
+	}
+
+	for (auto& p : intr.relations) {
+		if (p.object == HARD_TAG_TERMS) {
+			deps.all = true;
+			return tagd::TAGD_OK;
+		}
+
+		for (auto id : {&p.relator, &p.object, &p.modifier}) {
+			if (!id->empty())
+				deps.terms.insert(*id);
+		}
+
+		// _limit, _after and _depth depend only on their objects
+		if (tagd::interrogator::is_query_option(p))
+			continue;
+
+		rank_pair rp;
+		if (!p.relator.empty() && this->rank_of(rp.first, p.relator) != tagd::TAGD_OK)
+			return tagd::TS_NOT_FOUND;
+		if (!p.object.empty() && this->rank_of(rp.second, p.object) != tagd::TAGD_OK)
+			return tagd::TS_NOT_FOUND;
+		deps.predicates.push_back(rp);
+	}
+
+	for (auto& t : R) {
+		// a result we can't place is invalidated by any write
+		if (t.rank().empty()) {
+			deps.all = true;
+			return tagd::TAGD_OK;
+		}
+		deps.ranks.push_back(t.rank());
+	}
+
+	return tagd::TAGD_OK;
+}
+
+void sqlite::invalidate_queries(const tagd::id_type& id) {
+	this->tagspace_change();
+	_bitmap_index.clear();
+	if (_query_cache.empty())
+		return;
+
+	tagd::rank r;
+	if (this->rank_of(r, id) == tagd::TAGD_OK)
+		_query_cache.invalidate_tag(r, id);
+	else
+		_query_cache.clear();
+}
+
+void sqlite::invalidate_all() {
+	_query_cache.clear();
+	_bitmap_index.clear();
+	this->referent_change();
+}
+
+void sqlite::invalidate_queries(const tagd::id_type& subject, const tagd::predicate_set& P) {
+	this->tagspace_change();
+	_bitmap_index.clear();
+	if (_query_cache.empty())
+		return;
+
+	tagd::rank s;
+	rank_pair_vec pairs;
+	bool placed = (this->rank_of(s, subject) == tagd::TAGD_OK);
+	for (auto it = P.begin(); placed && it != P.end(); ++it) {
+		rank_pair rp;
+		placed = (this->rank_of(rp.first, it->relator) == tagd::TAGD_OK
+				&& this->rank_of(rp.second, it->object) == tagd::TAGD_OK);
+		pairs.push_back(rp);
+	}
+
+	if (placed)
+		_query_cache.invalidate_relations(s, subject, pairs);
+	else
+		_query_cache.clear();
+}
+
+tagd::code sqlite::build_bitmap_index() {
+	_bitmap_index.clear();
+
+	sqlite3_stmt *stmt = nullptr;
+	this->prepare(&stmt,
+		"SELECT idt(tag), rank FROM tags ORDER BY rank",
+		"bitmap index tags"
+	);
+	OK_OR_RET_ERR();
+
+	const int F_ID = 0;
+	const int F_RANK = 1;
+
+	tagd::rank rank;
+	int s_rc;
+	while ((s_rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *data = (const char*) sqlite3_column_text(stmt, F_RANK);
+		if (data == nullptr) {  // _entity
+			rank.clear();
+		} else {
+			auto rc = rank.init(data);
+			if (rc != tagd::TAGD_OK) {
+				return this->ferror(tagd::TS_INTERNAL_ERR, "bitmap index rank.init() error: %s", tagd::code_str(rc));
+			}
+		}
+		_bitmap_index.add_tag((const char*) sqlite3_column_text(stmt, F_ID), rank);
+	}
+	if (s_rc != SQLITE_DONE)
+		RET_SQLITE_FERROR(s_rc, "bitmap index tags failed");
+
+	stmt = nullptr;
+	this->prepare(&stmt,
+		"SELECT idt(subject), idt(relator), idt(object) FROM relations",
+		"bitmap index relations"
+	);
+	OK_OR_RET_ERR();
+
+	const int F_SUBJECT = 0;
+	const int F_RELATOR = 1;
+	const int F_OBJECT = 2;
+
+	while ((s_rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		(void)_bitmap_index.add_relation(
+			(const char*) sqlite3_column_text(stmt, F_SUBJECT),
+			(const char*) sqlite3_column_text(stmt, F_RELATOR),
+			(const char*) sqlite3_column_text(stmt, F_OBJECT)
+		);
+	}
+	if (s_rc != SQLITE_DONE)
+		RET_SQLITE_FERROR(s_rc, "bitmap index relations failed");
+
+	_bitmap_index.finish();
+	TAGDB_LOG_TRACE( "built bitmap index: " << _bitmap_index.size() << " tags" << std::endl )
+
+	return tagd::TAGD_OK;
+}
+
+bool sqlite::bitmap_indexed(const tagd::interrogator& intr, const tagd::id_type& after, flags_t flags) {
+	if (!_use_bitmap_index || (flags & F_INHERITED))
+		return false;
+
+	// modifiers are compared in sql
+	for (auto& p : intr.relations) {
+		if (p.object == HARD_TAG_TERMS || !p.modifier.empty())
+			return false;
+	}
+
+	if (!_bitmap_index.built() && this->build_bitmap_index() != tagd::TAGD_OK)
+		return false;
+
+	// unknown after tags are an error of the sql query
+	bitmap_index::ordinal o;
+	return (after.empty() || _bitmap_index.ordinal_of(after, &o));
+}
+
+tagd::code sqlite::query_bitmap_index(tagd::tag_set& R, const tagd::interrogator& intr, session *ssn, flags_t flags,
+		size_t limit, const tagd::id_type& after, size_t depth) {
+	bitmap_index::ordinal super = 0;
+	const bool has_super = !intr.super_object().empty();
+	if (has_super && !_bitmap_index.ordinal_of(intr.super_object(), &super))
+		return tagd::TS_NOT_FOUND;
+
+	// as merge_containing_tags(), each predicate keeps the merged tags that are
+	// within the subtrees of its subjects, and adds its subjects that are within
+	// the subtrees of the merged tags
+	bitmap M;  // merged
+	bitmap C;  // subtrees of the merged
+	bool first = true;
+	for (auto& p : intr.relations) {
+		bitmap S = _bitmap_index.related(p.relator, p.object);
+		if (has_super)
+			S = _bitmap_index.within(S, super, depth);
+
+		if (first) {
+			C = _bitmap_index.closure(S);
+			M = std::move(S);
+			first = false;
+			continue;
+		}
+
+		bitmap CS = _bitmap_index.closure(S);
+		M |= S;
+		M &= C;
+		M &= CS;
+		C &= CS;
+	}
+
+	bitmap_index::ordinal a = 0;
+	if (!after.empty())
+		(void)_bitmap_index.ordinal_of(after, &a);
+
+	// ordinals are in rank order, as the tag set is
+	tagd::id_vec ids;
+	M.for_each([this, &ids, &after, a, limit](uint32_t o) {
+		if (!after.empty() && o <= a)
+			return true;
+		ids.push_back(_bitmap_index.id(o));
+		return !(limit && ids.size() >= limit);
+	});
+
+	if (ids.empty())
+		return tagd::TS_NOT_FOUND;
+
+	tagd::tag_set H;
+	auto tc = this->get_many(H, ids, ssn, (flags|F_NO_RESET|F_NO_TRANSFORM_REFERENTS|F_NO_NOT_FOUND_ERROR));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	// whether the relation has the relator and object of a predicate, or one in their subtrees
+	auto f_in_subtree = [this](const tagd::id_type& pred_id, const tagd::id_type& id) {
+		if (pred_id.empty())
+			return true;
+		bitmap_index::ordinal p, o;
+		if (!_bitmap_index.ordinal_of(pred_id, &p) || !_bitmap_index.ordinal_of(id, &o))
+			return false;
+		return (o >= p && o < _bitmap_index.subtree_end(p));
+	};
+
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+
+	// as related(), tags have only the relations matching the query
+	for (auto t : H) {
+		tagd::predicate_set P;
+		P.swap(t.relations);
+		t.id(f_transform(t.id()));
+		t.sub_relator(f_transform(t.sub_relator()));
+		t.super_object(f_transform(t.super_object()));
+		for (auto& r : P) {
+			for (auto& p : intr.relations) {
+				if (f_in_subtree(p.relator, r.relator) && f_in_subtree(p.object, r.object)) {
+					(void)t.relation(f_transform(r.relator), f_transform(r.object), f_transform(r.modifier));
+					break;
+				}
+			}
+		}
+		R.insert(t);
+	}
+
+	return tagd::TAGD_OK;
+}
+
 tagd::code sqlite::query(tagd::tag_set& R, const tagd::interrogator& q, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_QUERY);
+	// cached results replace the tag set, so results aren't cached when merging into one
+	if (!_query_cache.enabled() || (flags & F_EXISTS_ONLY) || !R.empty())
+		return this->query_tags(R, q, ssn, flags);
+
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	auto key = this->query_cache_key(q, ssn, flags);
+	if (_query_cache.get(R, key))
+		RET_SSN_CODE(tagd::TAGD_OK);
+
+	auto tc = this->query_tags(R, q, ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	query_deps deps;
+	if (this->query_cache_deps(deps, q, R, ssn, flags) == tagd::TAGD_OK)
+		_query_cache.put(key, R, deps);
+	else
+		this->reset(nullptr);  // not cached, the results are still valid
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::query_tags(tagd::tag_set& R, const tagd::interrogator& q, session *ssn, flags_t flags) {
 	if (!(flags & F_NO_RESET)) this->reset(ssn);
+	NOT_INTERRUPTED_OR_RET_SSN_ERR("tagdb:query");
 
 	//TODO use the id (who, what, when, where, why, how_many...)
 	// to distinguish types of queries
 	assert(!q.empty());
 
+	if (flags & F_EXISTS_ONLY) {
+		// count no more than one, leaving R empty
+		tagd::interrogator q_one(q);
+		(void)q_one.limit(1);
+		size_t n;
+		auto tc = this->query_count(n, q_one, ssn, ((flags & ~F_EXISTS_ONLY)|F_NO_RESET));
+		if (tc != tagd::TAGD_OK)
+			return tc;
+
+		if (n == 0) {
+			if (flags & F_NO_NOT_FOUND_ERROR)
+				return tagd::TS_NOT_FOUND;
+			else
+				RET_SSN_CODE(tagd::TS_NOT_FOUND);
+		}
+
+		RET_SSN_CODE(tagd::TAGD_OK);
+	}
+
 	tagd::interrogator intr;
 	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
 		intr = q;
@@ -2874,11 +4393,17 @@ tagd::code sqlite::query(tagd::tag_set& R, const tagd::interrogator& q, session
 	if (intr.super_object() == HARD_TAG_REFERENT)
 		RET_SSN_CODE(this->query_referents(R, intr));
 
+	size_t limit, depth;
+	tagd::id_type after;
+	auto tc = this->query_options(&limit, &after, &depth, intr, ssn);
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
 	if (intr.relations.empty()) {
 		if (intr.super_object().empty()) {
 			RET_SSN_ERROR(tagd::TS_MISUSE, "interrogator with empty relations and empty super_object");
 		} else {
-			auto tc = this->get_children(R, intr.super_object(), ssn, flags);
+			tc = this->get_children(R, intr.super_object(), ssn, flags, limit, after, depth);
 			if (tc == tagd::TS_NOT_FOUND && (flags & F_NO_NOT_FOUND_ERROR))
 				return tagd::TS_NOT_FOUND;
 			else
@@ -2886,32 +4411,78 @@ tagd::code sqlite::query(tagd::tag_set& R, const tagd::interrogator& q, session
 		}
 	}
 
+	// query options can only be applied in sql to a single related query,
+	// results of more than one are merged first
+	const bool merged = (intr.relations.size() > 1 || intr.relations.begin()->object == HARD_TAG_TERMS);
+
 	size_t n = 0;
-	tagd::tag_set S;  // related per predicate
-	for (auto p : intr.relations) {
-		S.clear();
+	if (merged && this->bitmap_indexed(intr, after, flags)) {
+		// after and limit are applied to the intersection
+		tc = this->query_bitmap_index(R, intr, ssn, flags, limit, after, depth);
+		if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+			return tc;
+		n = R.size();
+	} else {
+		tagd::tag_set S;  // related per predicate
+		for (auto p : intr.relations) {
+			// statements are interrupted by the progress handler, merging between them here
+			NOT_INTERRUPTED_OR_RET_SSN_ERR("tagdb:query:merge");
 
-		if (p.object == HARD_TAG_TERMS) {
-			this->search(S, p.modifier, flags);
-			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:search");
-		} else {
-			// only super_object is advantagious in related query (sub_relator not needed) 
-			this->related(S, p, intr.super_object(), ssn, flags);
-			OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:related");
-		}
+			S.clear();
 
-		if (_trace_on) {
 			if (p.object == HARD_TAG_TERMS) {
-				TAGDB_LOG_TRACE( "search: " << p.modifier << std::endl )
-			} else {  // TODO predicate iostream op
-				TAGDB_LOG_TRACE( "related: " << p << std::endl )
+				this->search(S, p.modifier, flags);
+				OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:search");
+			} else if (merged) {
+				// only super_object is advantagious in related query (sub_relator not needed) 
+				this->related(S, p, intr.super_object(), ssn, flags, 0, tagd::id_type(), depth);
+				OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:related");
+			} else {
+				this->related(S, p, intr.super_object(), ssn, flags, limit, after, depth);
+				OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:related");
+			}
+
+			if (_trace_on) {
+				if (p.object == HARD_TAG_TERMS) {
+					TAGDB_LOG_TRACE( "search: " << p.modifier << std::endl )
+				} else {  // TODO predicate iostream op
+					TAGDB_LOG_TRACE( "related: " << p << std::endl )
+				}
+				tagd::print_tag_ids(S, std::cerr);
+				TAGDB_LOG_TRACE( std::endl )
 			}
-			tagd::print_tag_ids(S, std::cerr);
-			TAGDB_LOG_TRACE( std::endl )
+
+			OK_OR_RET_ERR();
+
+			// merge_containing_tags() ignores an empty set, but no tag is related by every predicate
+			if (merged && S.empty()) {
+				R.clear();
+				n = 0;
+				break;
+			}
+			n += merge_containing_tags(R, S);
 		}
 
-		OK_OR_RET_ERR();
-		n += merge_containing_tags(R, S);
+		if (merged && (limit || !after.empty())) {
+			if (!after.empty()) {
+				tagd::abstract_tag a;
+				this->get(a, after, nullptr, (F_NO_RESET|F_NO_TRANSFORM_REFERENTS|F_NO_POS_CAST));
+				OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:get_after");
+
+				// tag sets are ordered by rank
+				auto it = R.begin();
+				while (it != R.end() && !(a.rank() < it->rank()))
+					it = R.erase(it);
+			}
+
+			if (limit && R.size() > limit) {
+				auto it = R.begin();
+				std::advance(it, limit);
+				R.erase(it, R.end());
+			}
+
+			n = R.size();
+		}
 	}
 
 	if (n == 0) {
@@ -2921,24 +4492,292 @@ tagd::code sqlite::query(tagd::tag_set& R, const tagd::interrogator& q, session
 			RET_SSN_CODE(tagd::TS_NOT_FOUND);
 	}
 
+	if (flags & F_HYDRATE_RELATIONS) {
+		this->hydrate_relations(R, ssn, flags);
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query:hydrate_relations");
+	}
+
+	RET_SSN_CODE(tagd::TAGD_OK);
+}
+
+tagd::code sqlite::query_count(size_t& n, const tagd::interrogator& q, session *ssn, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_QUERY);
+	sqlite3_stmt *inherited_count_stmt = nullptr;
+	sqlite3_stmt *children_count_stmt = nullptr;
+	sqlite3_stmt *related_count_stmt = nullptr;
+	sqlite3_stmt *descendants_count_stmt = nullptr;
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	n = 0;
+	assert(!q.empty());
+
+	tagd::interrogator intr;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
+		intr = q;
+	else
+		this->decode_referents(intr, q, ssn);
+	OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:decode_referents");
+
+	if (intr.super_object() == HARD_TAG_REFERENT)
+		return tagdb::query_count(n, q, ssn, (flags|F_NO_RESET));
+
+	size_t limit, depth;
+	tagd::id_type after;
+	auto tc = this->query_options(&limit, &after, &depth, intr, ssn);
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	// searches and intersections of predicates are counted after merging
+	if (intr.relations.size() > 1
+			|| (intr.relations.size() == 1 && intr.relations.begin()->object == HARD_TAG_TERMS))
+		return tagdb::query_count(n, q, ssn, (flags|F_NO_RESET));
+
+	if (intr.relations.empty() && intr.super_object().empty())
+		RET_SSN_ERROR(tagd::TS_MISUSE, "interrogator with empty relations and empty super_object");
+
+	sqlite3_stmt **stmt;
+	if (intr.relations.empty()) {
+		if (depth > 1) {
+			stmt = &descendants_count_stmt;
+			this->prepare(stmt, DESCENDANTS_COUNT_SQL, "count descendants");
+		} else {
+			stmt = &children_count_stmt;
+			this->prepare(stmt, CHILDREN_COUNT_SQL, "count children");
+		}
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:children");
+
+		this->bind_children(stmt, intr.super_object(), limit, after, depth);
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:bind_children");
+	} else {
+		if (flags & F_INHERITED) {
+			stmt = &inherited_count_stmt;
+			this->prepare(stmt, related_sql(INHERITED_COUNT_SQL, INHERITED_COUNT_RANGE_SQL,
+				*intr.relations.begin()), "count inherited");
+		} else {
+			stmt = &related_count_stmt;
+			this->prepare(stmt, related_sql(RELATED_COUNT_SQL, RELATED_COUNT_RANGE_SQL,
+				*intr.relations.begin()), "count related");
+		}
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:related");
+
+		this->bind_related(stmt, *intr.relations.begin(), intr.super_object(), after, depth);
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:bind_related");
+
+		// LIMIT is the last param
+		this->bind_int(stmt, sqlite3_bind_parameter_count(*stmt),
+			((limit && limit <= INT_MAX) ? (int) limit : -1), "count related limit");
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:bind_limit");
+	}
+
+	int s_rc = sqlite3_step(*stmt);
+	if (s_rc != SQLITE_ROW) {
+		SQLITE_FERROR(s_rc, "query_count failed: %s", intr.super_object().c_str());
+		OK_OR_RET_SSN_INT_ERR_ACTION("tagdb:query_count:step");
+		return this->code();
+	}
+
+	n = (size_t) sqlite3_column_int64(*stmt, 0);
+
 	RET_SSN_CODE(tagd::TAGD_OK);
 }
 
+// moves the query options out of the (decoded) interrogator
+tagd::code sqlite::query_options(size_t *limit, tagd::id_type *after, size_t *depth, tagd::interrogator& intr, session *ssn) {
+	*limit = intr.limit();
+	*after = intr.after();
+	*depth = intr.depth();
+
+	if (*limit == 0 && intr.related(HARD_TAG_LIMIT)) {
+		tagd::predicate_set how;
+		intr.related(HARD_TAG_LIMIT, how);
+		RET_SSN_FERROR(tagd::TS_MISUSE, "%s must be a positive integer: %s",
+			HARD_TAG_LIMIT, how.begin()->modifier.c_str());
+	}
+
+	if (*depth == 0 && intr.related(HARD_TAG_DEPTH)) {
+		tagd::predicate_set how;
+		intr.related(HARD_TAG_DEPTH, how);
+		RET_SSN_FERROR(tagd::TS_MISUSE, "%s must be a positive integer: %s",
+			HARD_TAG_DEPTH, how.begin()->modifier.c_str());
+	}
+
+	// depth is below the super_object
+	if (*depth && intr.super_object().empty())
+		RET_SSN_FERROR(tagd::TS_MISUSE, "%s requires a super_object", HARD_TAG_DEPTH);
+
+	if (!after->empty() && !this->exists(*after)) {
+		RET_SSN_ERROR(tagd::TS_NOT_FOUND, tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_UNKNOWN_TAG, *after));
+	}
+
+	intr.erase_query_options();
+
+	return tagd::TAGD_OK;
+}
+
+cursor* sqlite::query_cursor(const tagd::interrogator& q, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	assert(!q.empty());
+
+	tagd::interrogator intr;
+	if (!ssn || (flags & F_NO_TRANSFORM_REFERENTS))
+		intr = q;
+	else
+		this->decode_referents(intr, q, ssn);
+	if (_code != tagd::TAGD_OK || (ssn && ssn->code() != tagd::TAGD_OK))
+		return nullptr;
+
+	if (intr.super_object() == HARD_TAG_REFERENT)
+		return tagdb::query_cursor(q, ssn, (flags|F_NO_RESET));
+
+	size_t limit, depth;
+	tagd::id_type after;
+	if (this->query_options(&limit, &after, &depth, intr, ssn) != tagd::TAGD_OK)
+		return nullptr;
+
+	// searches and intersections of predicates
+	// are merged in memory, so they can't be streamed
+	if (intr.relations.size() > 1
+			|| (intr.relations.size() == 1 && intr.relations.begin()->object == HARD_TAG_TERMS))
+		return tagdb::query_cursor(q, ssn, (flags|F_NO_RESET));
+
+	if (intr.relations.empty() && intr.super_object().empty()) {
+		if (ssn) ssn->error(tagd::TS_MISUSE, "interrogator with empty relations and empty super_object");
+		return nullptr;
+	}
+
+	// each cursor owns its statement, so cursors can be stepped independently
+	sqlite3_stmt *stmt = nullptr;
+	if (intr.relations.empty()) {
+		this->prepare_stmt(&stmt, (depth > 1 ? DESCENDANTS_SQL : CHILDREN_SQL), "children cursor");
+		if (_code == tagd::TAGD_OK)
+			this->bind_children(&stmt, intr.super_object(), limit, after, depth);
+	} else {
+		this->prepare_stmt(&stmt, ((flags & F_INHERITED)
+			? related_sql(INHERITED_SQL, INHERITED_RANGE_SQL, *intr.relations.begin())
+			: related_sql(RELATED_SQL, RELATED_RANGE_SQL, *intr.relations.begin())), "related cursor");
+		if (_code == tagd::TAGD_OK)
+			this->bind_related(&stmt, *intr.relations.begin(), intr.super_object(), after, depth);
+	}
+
+	if (_code != tagd::TAGD_OK) {
+		sqlite3_finalize(stmt);
+		if (ssn) ssn->error(tagd::TS_INTERNAL_ERR, tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION, "tagdb:query_cursor"));
+		return nullptr;
+	}
+
+	id_transform_func_t f_transform =
+		(!ssn || (flags & F_NO_TRANSFORM_REFERENTS)) ?  f_passthrough : this->f_encode_referent(ssn);
+
+	return new sqlite_cursor(this, stmt, ssn, flags, f_transform, limit);
+}
+
+tagd::code sqlite_cursor::step_error() {
+	auto err = tagd::error::ferror(tagd::TS_INTERNAL_ERR, "query cursor step failed: %s",
+		sqlite::sqlite_err_code_str(_s_rc));
+	(void)err.relation(HARD_TAG_HAS, HARD_TAG_MESSAGE, sqlite3_errmsg(_tdb->_db));
+	if (_ssn) _ssn->error(err);
+	return this->error(err);
+}
+
+tagd::code sqlite_cursor::next(tagd::abstract_tag& t) {
+	if (_limit && _n >= _limit)
+		return tagd::TS_NOT_FOUND;
+
+	// operations of other sessions may have run since the last step
+	_tdb->interrupt_by(_ssn);
+
+	if (_s_rc == SQLITE_OK)  // first row
+		_s_rc = sqlite3_step(_stmt);
+
+	if (_s_rc == SQLITE_DONE)
+		return tagd::TS_NOT_FOUND;
+
+	if (_s_rc != SQLITE_ROW)
+		return this->step_error();
+
+	// CHILDREN_SQL columns, or RELATED_SQL which adds relation columns
+	const int F_ID = 0;
+	const int F_SUB_REL = 1;
+	const int F_SUB_OBJ = 2;
+	const int F_POS = 3;
+	const int F_RANK = 4;
+	const int F_RELATOR = 5;
+	const int F_OBJECT = 6;
+	const int F_MODIFIER = 7;
+
+	const bool has_relations = (sqlite3_column_count(_stmt) > F_RELATOR);
+
+	// copy before stepping, as column text is invalidated by sqlite3_step
+	tagd::id_type id{(const char*) sqlite3_column_text(_stmt, F_ID)};
+	std::string rank{ sqlite3_column_type(_stmt, F_RANK) == SQLITE_NULL ?
+		"" : (const char*) sqlite3_column_text(_stmt, F_RANK) };
+	tagd::part_of_speech pos = (tagd::part_of_speech) sqlite3_column_int(_stmt, F_POS);
+
+	if (pos != tagd::POS_URL) {
+		t = tagd::abstract_tag(_f_transform(id));
+	} else {
+		tagd::HDURI u(id);
+		if (u.code() != tagd::TAGD_OK) {
+			if (_ssn) _ssn->ferror(u.code(), "failed to init cursor url: %s", id.c_str());
+			return this->ferror(u.code(), "failed to init cursor url: %s", id.c_str());
+		}
+		t = u;
+	}
+
+	t.sub_relator( _f_transform((const char*) sqlite3_column_text(_stmt, F_SUB_REL)) );
+	t.super_object( _f_transform((const char*) sqlite3_column_text(_stmt, F_SUB_OBJ)) );
+	t.pos(pos);
+	t.rank(rank.c_str());
+
+	// rows are ordered by rank, so all rows of a tag are consecutive
+	do {
+		if (has_relations) {
+			auto pred = tagd::predicate(
+				_f_transform( (const char*) sqlite3_column_text(_stmt, F_RELATOR) ),
+				_f_transform( (const char*) sqlite3_column_text(_stmt, F_OBJECT) )
+			);
+			if (sqlite3_column_type(_stmt, F_MODIFIER) != SQLITE_NULL)
+				pred.modifier = _f_transform( (const char*) sqlite3_column_text(_stmt, F_MODIFIER) );
+			(void)t.relation(pred);
+		}
+	} while ((_s_rc = sqlite3_step(_stmt)) == SQLITE_ROW
+				&& sqlite3_column_type(_stmt, F_RANK) != SQLITE_NULL
+				&& rank == (const char*) sqlite3_column_text(_stmt, F_RANK));
+
+	if (_s_rc != SQLITE_ROW && _s_rc != SQLITE_DONE)
+		return this->step_error();
+
+	if (_flags & F_HYDRATE_RELATIONS) {
+		tagd::predicate_set P;
+		auto tc = _tdb->get_relations(P, id, _ssn, _flags);
+		if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+			return this->ferror(tc, "cursor get_relations failed: %s", id.c_str());
+		for (auto p : P)
+			(void)t.relation(p);
+	}
+
+	_n++;
+	return tagd::TAGD_OK;
+}
+
 tagd::code sqlite::search(tagd::tag_set& R, const std::string &terms, flags_t flags) {
+	op_timer timer(&_op_stats, &_op_depth, STAT_SEARCH);
 	//TODO use the id (who, what, when, where, why, how_many...)
 	// to distinguish types of queries
 
 	if (terms.empty())
 		return tagd::TS_NOT_FOUND;
 
-	this->prepare(&_search_stmt,
+	sqlite3_stmt *search_stmt = nullptr;
+	this->prepare(&search_stmt,
 		"SELECT idt(docid) FROM fts_tags "
 		"WHERE content MATCH ?",
 		"search"
 	);
 	OK_OR_RET_ERR();
 
-	this->bind_text(&_search_stmt, 1, terms.c_str(), "search terms");
+	this->bind_text(&search_stmt, 1, terms.c_str(), "search terms");
 	OK_OR_RET_ERR();
 
 	const int F_TAG_ID = 0;
@@ -2946,25 +4785,22 @@ tagd::code sqlite::search(tagd::tag_set& R, const std::string &terms, flags_t fl
 	TAGDB_LOG_TRACE( "search: " << terms << std::endl )
 
 	int s_rc;
-	size_t n = 0;
-	while ((s_rc = sqlite3_step(_search_stmt)) == SQLITE_ROW) {
-			std::string tag_id( (const char*) sqlite3_column_text(_search_stmt, F_TAG_ID) );
-			tagd::abstract_tag t;
-			if ( this->get(t, tag_id, nullptr, flags) == tagd::TAGD_OK ) {
-				R.insert(t);
-				n++;
-			} else {
-				return this->ferror( tagd::TAGD_ERR, "search result failed(%s): %s", tag_id.c_str(), terms.c_str() );
-			}
+	tagd::id_vec ids;
+	while ((s_rc = sqlite3_step(search_stmt)) == SQLITE_ROW) {
+		ids.push_back( (const char*) sqlite3_column_text(search_stmt, F_TAG_ID) );
 	}
 
-	if (s_rc == SQLITE_ERROR)
+	if (s_rc != SQLITE_ROW && s_rc != SQLITE_DONE)
 		RET_SQLITE_FERROR(s_rc, "search failed: %s", terms.c_str());
 
-	if (n == 0)
+	if (ids.empty())
 		return tagd::TS_NOT_FOUND;
 
-	return tagd::TAGD_OK;
+	auto tc = this->get_many(R, ids, nullptr, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+		return this->ferror( tagd::TAGD_ERR, "search results failed: %s", terms.c_str() );
+
+	return tc;
 }
 
 
@@ -2976,10 +4812,8 @@ tagd::code sqlite::dump_grid(std::ostream& os) {
 		"SELECT idt(tag), idt(sub_relator), idt(super_object), rank, pos FROM tags ORDER BY rank",
 		"dump grid"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_ID = 0;
 	const int F_SUB_REL = 1;
@@ -3013,8 +4847,6 @@ tagd::code sqlite::dump_grid(std::ostream& os) {
 		   << std::endl; 
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump grid failed");
 
@@ -3025,10 +4857,8 @@ tagd::code sqlite::dump_grid(std::ostream& os) {
 		"ORDER BY context",
 		"dump referent grid"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_REFERS = 0;
 	const int F_REFERS_TO = 1;
@@ -3059,8 +4889,6 @@ tagd::code sqlite::dump_grid(std::ostream& os) {
 		os << std::endl; 
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump referent grid failed");
 
@@ -3075,10 +4903,8 @@ tagd::code sqlite::dump_terms(std::ostream& os) {
 		"SELECT term, term_pos, ROWID FROM terms",
 		"dump terms"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_TERM = 0;
 	const int F_TERM_POS = 1;
@@ -3104,8 +4930,6 @@ tagd::code sqlite::dump_terms(std::ostream& os) {
 		   << std::endl; 
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump terms failed");
 
@@ -3124,10 +4948,8 @@ tagd::code sqlite::dump(std::ostream& os) {
 		"ORDER BY rank",
 		"dump tags"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_ID = 0;
 	const int F_SUB_REL = 1;
@@ -3153,8 +4975,6 @@ tagd::code sqlite::dump(std::ostream& os) {
 		os << ">> " << t << std::endl << std::endl;
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump tags failed");
 
@@ -3167,10 +4987,8 @@ tagd::code sqlite::dump(std::ostream& os) {
 		"ORDER BY rank",
 		"dump relations"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	// F_ID = 0
 	const int F_RELATOR = 1;
@@ -3220,8 +5038,6 @@ tagd::code sqlite::dump(std::ostream& os) {
 		delete t;
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump relations failed");
 
@@ -3232,10 +5048,8 @@ tagd::code sqlite::dump(std::ostream& os) {
 		"ORDER BY refers",
 		"dump referents"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_REFERS = 0;
 	const int F_REFERS_TO = 1;
@@ -3253,8 +5067,6 @@ tagd::code sqlite::dump(std::ostream& os) {
 		os << std::endl << ">> " << r << std::endl; 
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump referents failed");
 
@@ -3269,10 +5081,8 @@ tagd::code sqlite::dump_search(std::ostream& os) {
 		"SELECT docid, idt(docid), content FROM fts_tags",
 		"dump search"
 	);
-	if (tc != tagd::TAGD_OK) {
-		sqlite3_finalize(stmt);
+	if (tc != tagd::TAGD_OK)
 		return tc;
-	}
 
 	const int F_DOCID = 0;
 	const int F_TAG_ID = 1;
@@ -3296,8 +5106,6 @@ tagd::code sqlite::dump_search(std::ostream& os) {
 		   << std::endl; 
 	}
 
-	sqlite3_finalize(stmt);
-
 	if (s_rc == SQLITE_ERROR)
 		RET_SQLITE_FERROR(s_rc, "dump search failed");
 
@@ -3309,21 +5117,22 @@ tagd::code sqlite::max_child_rank(tagd::rank& next, const tagd::id_type& super_o
 	this->open();
 	OK_OR_RET_ERR();
 
-	int s_rc = this->prepare(&_max_child_rank_stmt,
+	sqlite3_stmt *max_child_rank_stmt = nullptr;
+	int s_rc = this->prepare(&max_child_rank_stmt,
 		"SELECT rank FROM tags WHERE super_object = tid(?) ORDER BY rank DESC LIMIT 1",
 		"child ranks"
 	);
 
-	this->bind_text(&_max_child_rank_stmt, 1, super_object.c_str(), "rank super_object");
+	this->bind_text(&max_child_rank_stmt, 1, super_object.c_str(), "rank super_object");
 	OK_OR_RET_ERR();
 
 	const int F_RANK = 0;
 	tagd::code rc;
 
-	s_rc = sqlite3_step(_max_child_rank_stmt);
+	s_rc = sqlite3_step(max_child_rank_stmt);
 
 	if (s_rc == SQLITE_ROW) {
-		rc = next.init( (const char*) sqlite3_column_text(_max_child_rank_stmt, F_RANK));
+		rc = next.init( (const char*) sqlite3_column_text(max_child_rank_stmt, F_RANK));
 		switch (rc) {
 			case tagd::TAGD_OK:
 				break;
@@ -3351,21 +5160,21 @@ tagd::code sqlite::child_ranks(tagd::rank_set& R, const tagd::id_type& super_obj
 	this->open();
 	OK_OR_RET_ERR();
 	
-
-	int s_rc = this->prepare(&_child_ranks_stmt ,
+	sqlite3_stmt *child_ranks_stmt = nullptr;
+	int s_rc = this->prepare(&child_ranks_stmt ,
 		"SELECT rank FROM tags WHERE super_object = tid(?)",
 		"child ranks"
 	);
 
-	this->bind_text(&_child_ranks_stmt, 1, super_object.c_str(), "rank super_object");
+	this->bind_text(&child_ranks_stmt, 1, super_object.c_str(), "rank super_object");
 	OK_OR_RET_ERR();
 
 	const int F_RANK = 0;
 	tagd::rank rank;
 	tagd::code rc;
 
-	while ((s_rc = sqlite3_step(_child_ranks_stmt)) == SQLITE_ROW) {
-		rc = rank.init( (const char*) sqlite3_column_text(_child_ranks_stmt, F_RANK));
+	while ((s_rc = sqlite3_step(child_ranks_stmt)) == SQLITE_ROW) {
+		rc = rank.init( (const char*) sqlite3_column_text(child_ranks_stmt, F_RANK));
 		switch (rc) {
 			case tagd::TAGD_OK:
 				break;
@@ -3425,6 +5234,18 @@ tagd::code sqlite::exec_mprintf(const char *fmt, ...) {
 }
 
 tagd::code sqlite::prepare(sqlite3_stmt **stmt, const char *sql, const char *label) {
+	*stmt = _stmt_cache.get(sql);
+	if (*stmt != nullptr)
+		return tagd::TAGD_OK;
+
+	tagd::code tc = this->prepare_stmt(stmt, sql, label);
+	if (tc == tagd::TAGD_OK)
+		_stmt_cache.put(sql, *stmt);
+
+	return tc;
+}
+
+tagd::code sqlite::prepare_stmt(sqlite3_stmt **stmt, const char *sql, const char *label) {
 	if (*stmt == nullptr) {
 		int s_rc = sqlite3_prepare_v2(
 			_db, 
@@ -3448,10 +5269,16 @@ tagd::code sqlite::prepare(sqlite3_stmt **stmt, const char *sql, const char *lab
 	return tagd::TAGD_OK;
 }
 
+// a statement failed to bind, it won't be handed out again
+void sqlite::finalize_stmt(sqlite3_stmt **stmt) {
+	_stmt_cache.erase(*stmt);
+	*stmt = nullptr;
+}
+
 tagd::code sqlite::bind_text(sqlite3_stmt**stmt, int i, const char *text, const char*label) {
 	int s_rc;
 	if ((s_rc = sqlite3_bind_text(*stmt, i, text, -1, SQLITE_TRANSIENT)) != SQLITE_OK) {
-		finalize_stmt(stmt);
+		this->finalize_stmt(stmt);
 		return this->ferror(tagd::TS_INTERNAL_ERR, "bind_text returned %s for label %s: %s", sqlite_err_code_str(s_rc), label, text);
 	}
 
@@ -3460,19 +5287,47 @@ tagd::code sqlite::bind_text(sqlite3_stmt**stmt, int i, const char *text, const
 
 tagd::code sqlite::bind_int(sqlite3_stmt**stmt, int i, int val, const char*label) {
 	if (sqlite3_bind_int(*stmt, i, val) != SQLITE_OK) {
-		finalize_stmt(stmt);
+		this->finalize_stmt(stmt);
 		return this->ferror(tagd::TS_INTERNAL_ERR, "bind failed: %s", label);
 	}
 
 	return tagd::TAGD_OK;
 }
 
+tagd::code sqlite::bind_double(sqlite3_stmt**stmt, int i, double val, const char*label) {
+	if (sqlite3_bind_double(*stmt, i, val) != SQLITE_OK) {
+		this->finalize_stmt(stmt);
+		return this->ferror(tagd::TS_INTERNAL_ERR, "bind failed: %s", label);
+	}
+
+	return tagd::TAGD_OK;
+}
+
+// binds the typed value of the modifier - INTEGER or REAL if numeric, otherwise NULL
+// (TEXT would collate after every number, so range predicates would match it)
+tagd::code sqlite::bind_modifier_value(sqlite3_stmt**stmt, int i, const tagd::predicate& p, const char*label) {
+	sqlite3_int64 ival;
+	double dval;
+	switch (modifier_numeric_value(p.modifier, p.modifier_type, &ival, &dval)) {
+		case SQLITE_INTEGER:
+			if (sqlite3_bind_int64(*stmt, i, ival) != SQLITE_OK) {
+				this->finalize_stmt(stmt);
+				return this->ferror(tagd::TS_INTERNAL_ERR, "bind failed: %s", label);
+			}
+			return tagd::TAGD_OK;
+		case SQLITE_FLOAT:
+			return this->bind_double(stmt, i, dval, label);
+		default:
+			return this->bind_null(stmt, i, label);
+	}
+}
+
 tagd::code sqlite::bind_rowid(sqlite3_stmt**stmt, int i, rowid_t id, const char*label) {
 	if (id <= 0)  // interpret as NULL
 		return this->bind_null(stmt, i, label);
  
 	if (sqlite3_bind_int64(*stmt, i, id) != SQLITE_OK) {
-		finalize_stmt(stmt);
+		this->finalize_stmt(stmt);
 		return this->ferror(tagd::TS_INTERNAL_ERR, "bind failed: %s", label);
 	}
 
@@ -3481,47 +5336,110 @@ tagd::code sqlite::bind_rowid(sqlite3_stmt**stmt, int i, rowid_t id, const char*
 
 tagd::code sqlite::bind_null(sqlite3_stmt**stmt, int i, const char*label) {
 	if (sqlite3_bind_null(*stmt, i) != SQLITE_OK) {
-		finalize_stmt(stmt);
+		this->finalize_stmt(stmt);
 		return this->ferror(tagd::TS_INTERNAL_ERR, "bind failed: %s", label);
 	}
 
 	return tagd::TAGD_OK;
 }
 
-#define FINALIZE(S) \
-	sqlite3_finalize(S); \
-	S = nullptr;
-
 void sqlite::finalize() {
-	FINALIZE(_get_stmt);
-	FINALIZE(_exists_stmt);
-	FINALIZE(_term_pos_stmt);
-	FINALIZE(_term_id_pos_stmt);
-	FINALIZE(_pos_stmt);
-	FINALIZE(_refers_to_stmt);
-	FINALIZE(_refers_stmt);
-	FINALIZE(_insert_term_stmt);
-	FINALIZE(_update_term_stmt);
-	FINALIZE(_delete_term_stmt);
-	FINALIZE(_insert_fts_tag_stmt);
-	FINALIZE(_update_fts_tag_stmt);
-	FINALIZE(_delete_fts_tag_stmt);
-	FINALIZE(_search_stmt);
-	FINALIZE(_insert_stmt);
-	FINALIZE(_update_tag_stmt);
-	FINALIZE(_update_ranks_stmt);
-	FINALIZE(_child_ranks_stmt);
-	FINALIZE(_max_child_rank_stmt);
-	FINALIZE(_insert_relations_stmt);
-	FINALIZE(_insert_referents_stmt);
-	FINALIZE(_delete_tag_stmt);
-	FINALIZE(_delete_subject_relations_stmt);
-	FINALIZE(_delete_relation_stmt);
-	FINALIZE(_delete_refers_to_stmt);
-	FINALIZE(_term_pos_occurence_stmt);
-	FINALIZE(_get_relations_stmt);
-	FINALIZE(_related_stmt);
-	FINALIZE(_get_children_stmt);
+	_stmt_cache.clear();
+}
+
+void stmt_cache::max_size(size_t sz) {
+	_max_size = (sz < MIN_SIZE ? MIN_SIZE : sz);
+	this->evict();
+}
+
+void stmt_cache::evict() {
+	// a statement still being stepped is in use, even when least recently handed out
+	auto it = _entries.end();
+	while (_entries.size() > _max_size && --it != _entries.begin()) {
+		if (sqlite3_stmt_busy(it->stmt))
+			continue;
+		this->count_steps(it->sql, it->stmt);
+		sqlite3_finalize(it->stmt);
+		_index.erase(it->sql);
+		it = _entries.erase(it);
+		_evictions++;
+	}
+}
+
+size_t stmt_cache::prepares(const std::string& sql) const {
+	auto it = _stats.find(sql);
+	return (it == _stats.end() ? 0 : it->second.prepares);
+}
+
+void stmt_cache::count_steps(const std::string& sql, sqlite3_stmt *stmt) {
+	auto &st = _stats[sql];
+	st.vm_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+	st.fullscan_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+}
+
+void stmt_cache::collect() {
+	for (auto& e : _entries)
+		this->count_steps(e.sql, e.stmt);
+}
+
+stmt_stats stmt_cache::totals() const {
+	stmt_stats T;
+	for (auto& it : _stats) {
+		T.prepares += it.second.prepares;
+		T.uses += it.second.uses;
+		T.vm_steps += it.second.vm_steps;
+		T.fullscan_steps += it.second.fullscan_steps;
+	}
+	return T;
+}
+
+sqlite3_stmt* stmt_cache::get(const char *sql) {
+	auto it = _index.find(sql);
+	if (it == _index.end())
+		return nullptr;
+
+	// move to the front as most recently used
+	_entries.splice(_entries.begin(), _entries, it->second);
+	sqlite3_stmt *stmt = it->second->stmt;
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	this->count_steps(it->first, stmt);
+	_stats[it->first].uses++;
+	return stmt;
+}
+
+void stmt_cache::put(const char *sql, sqlite3_stmt *stmt) {
+	auto &st = _stats[sql];
+	st.prepares++;
+	st.uses++;
+
+	_entries.push_front(entry{sql, stmt});
+	_index[_entries.front().sql] = _entries.begin();
+	this->evict();
+}
+
+void stmt_cache::erase(sqlite3_stmt *stmt) {
+	if (stmt == nullptr)
+		return;
+
+	for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+		if (it->stmt == stmt) {
+			this->count_steps(it->sql, stmt);
+			_index.erase(it->sql);
+			_entries.erase(it);
+			break;
+		}
+	}
+	sqlite3_finalize(stmt);
+}
+
+void stmt_cache::clear() {
+	for (auto& e : _entries) {
+		this->count_steps(e.sql, e.stmt);
+		sqlite3_finalize(e.stmt);
+	}
+	_entries.clear();
+	_index.clear();
 }
 
 } // namespace tagdb
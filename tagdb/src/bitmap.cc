@@ -0,0 +1,428 @@
+#include <cassert>
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+#include "tagdb/bitmap.h"
+
+namespace tagdb {
+
+bool bitmap::container::contains(uint16_t v) const {
+	if (this->is_bitmap())
+		return (words[v >> 6] >> (v & 63)) & 1;
+
+	return std::binary_search(array.begin(), array.end(), v);
+}
+
+void bitmap::container::add(uint16_t v) {
+	if (this->is_bitmap()) {
+		uint64_t bit = (uint64_t)1 << (v & 63);
+		if (!(words[v >> 6] & bit)) {
+			words[v >> 6] |= bit;
+			card++;
+		}
+		return;
+	}
+
+	// values are usually added in ascending order
+	if (array.empty() || array.back() < v) {
+		array.push_back(v);
+	} else {
+		auto it = std::lower_bound(array.begin(), array.end(), v);
+		if (*it == v)
+			return;
+		array.insert(it, v);
+	}
+
+	if (++card > ARRAY_MAX)
+		this->to_bitmap();
+}
+
+void bitmap::container::to_bitmap() {
+	if (this->is_bitmap())
+		return;
+
+	words.assign(BITMAP_WORDS, 0);
+	for (auto v : array)
+		words[v >> 6] |= (uint64_t)1 << (v & 63);
+	array.clear();
+	array.shrink_to_fit();
+}
+
+void bitmap::container::to_array() {
+	if (!this->is_bitmap())
+		return;
+
+	array.clear();
+	array.reserve(card);
+	for (size_t i = 0; i < BITMAP_WORDS; i++) {
+		uint64_t w = words[i];
+		while (w) {
+			array.push_back((uint16_t)((i << 6) + std::countr_zero(w)));
+			w &= w - 1;
+		}
+	}
+	words.clear();
+	words.shrink_to_fit();
+}
+
+void bitmap::container::optimize() {
+	if (this->is_bitmap()) {
+		if (card <= ARRAY_MAX)
+			this->to_array();
+	} else if (card > ARRAY_MAX) {
+		this->to_bitmap();
+	}
+}
+
+bitmap::container* bitmap::find(uint16_t key) {
+	auto it = std::lower_bound(_containers.begin(), _containers.end(), key,
+			[](const container& c, uint16_t k) { return c.key < k; });
+	return (it != _containers.end() && it->key == key) ? &(*it) : nullptr;
+}
+
+const bitmap::container* bitmap::find(uint16_t key) const {
+	auto it = std::lower_bound(_containers.begin(), _containers.end(), key,
+			[](const container& c, uint16_t k) { return c.key < k; });
+	return (it != _containers.end() && it->key == key) ? &(*it) : nullptr;
+}
+
+bitmap::container& bitmap::get_or_add(uint16_t key) {
+	if (_containers.empty() || _containers.back().key < key) {
+		_containers.emplace_back(key);
+		return _containers.back();
+	}
+
+	auto it = std::lower_bound(_containers.begin(), _containers.end(), key,
+			[](const container& c, uint16_t k) { return c.key < k; });
+	if (it != _containers.end() && it->key == key)
+		return *it;
+
+	return *_containers.emplace(it, key);
+}
+
+size_t bitmap::cardinality() const {
+	size_t n = 0;
+	for (auto& c : _containers)
+		n += c.card;
+	return n;
+}
+
+bool bitmap::contains(uint32_t v) const {
+	auto c = this->find((uint16_t)(v >> 16));
+	return (c != nullptr && c->contains((uint16_t)(v & 0xFFFF)));
+}
+
+void bitmap::add(uint32_t v) {
+	this->get_or_add((uint16_t)(v >> 16)).add((uint16_t)(v & 0xFFFF));
+}
+
+void bitmap::add_range(uint32_t lo, uint32_t hi) {
+	while (lo < hi) {
+		uint16_t key = (uint16_t)(lo >> 16);
+		// end of the range within this container
+		uint32_t end = std::min<uint64_t>(hi, ((uint64_t)key + 1) << 16);
+		container& c = this->get_or_add(key);
+		if ((end - lo) > ARRAY_MAX || c.is_bitmap()) {
+			c.to_bitmap();
+			for (uint32_t v = (lo & 0xFFFF), e = v + (end - lo); v < e; ) {
+				// whole words at a time where aligned
+				if ((v & 63) == 0 && (e - v) >= 64) {
+					c.words[v >> 6] = ~(uint64_t)0;
+					v += 64;
+				} else {
+					c.words[v >> 6] |= (uint64_t)1 << (v & 63);
+					v++;
+				}
+			}
+			c.card = 0;
+			for (auto w : c.words)
+				c.card += std::popcount(w);
+		} else {
+			for (uint32_t v = lo; v < end; v++)
+				c.add((uint16_t)(v & 0xFFFF));
+		}
+		lo = end;
+	}
+}
+
+bitmap::container bitmap::and_container(const container& a, const container& b) {
+	container r(a.key);
+	if (a.is_bitmap() && b.is_bitmap()) {
+		r.words.resize(BITMAP_WORDS);
+		for (size_t i = 0; i < BITMAP_WORDS; i++) {
+			r.words[i] = a.words[i] & b.words[i];
+			r.card += std::popcount(r.words[i]);
+		}
+		r.optimize();
+	} else if (a.is_bitmap() || b.is_bitmap()) {
+		const container& arr = (a.is_bitmap() ? b : a);
+		const container& bm = (a.is_bitmap() ? a : b);
+		for (auto v : arr.array) {
+			if (bm.contains(v))
+				r.array.push_back(v);
+		}
+		r.card = r.array.size();
+	} else {
+		std::set_intersection(a.array.begin(), a.array.end(),
+			b.array.begin(), b.array.end(), std::back_inserter(r.array));
+		r.card = r.array.size();
+	}
+	return r;
+}
+
+void bitmap::or_container(container& a, const container& b) {
+	if (!a.is_bitmap() && !b.is_bitmap()) {
+		std::vector<uint16_t> u;
+		u.reserve(a.array.size() + b.array.size());
+		std::set_union(a.array.begin(), a.array.end(),
+			b.array.begin(), b.array.end(), std::back_inserter(u));
+		a.array.swap(u);
+		a.card = a.array.size();
+		a.optimize();
+		return;
+	}
+
+	a.to_bitmap();
+	a.card = 0;
+	if (b.is_bitmap()) {
+		for (size_t i = 0; i < BITMAP_WORDS; i++) {
+			a.words[i] |= b.words[i];
+			a.card += std::popcount(a.words[i]);
+		}
+	} else {
+		for (auto v : b.array)
+			a.words[v >> 6] |= (uint64_t)1 << (v & 63);
+		for (auto w : a.words)
+			a.card += std::popcount(w);
+	}
+}
+
+bitmap& bitmap::operator|=(const bitmap& rhs) {
+	std::vector<container> r;
+	r.reserve(_containers.size() + rhs._containers.size());
+
+	auto a = _containers.begin();
+	auto b = rhs._containers.begin();
+	while (a != _containers.end() && b != rhs._containers.end()) {
+		if (a->key < b->key) {
+			r.push_back(std::move(*a++));
+		} else if (b->key < a->key) {
+			r.push_back(*b++);
+		} else {
+			or_container(*a, *b++);
+			r.push_back(std::move(*a++));
+		}
+	}
+	for (; a != _containers.end(); ++a)
+		r.push_back(std::move(*a));
+	r.insert(r.end(), b, rhs._containers.end());
+
+	_containers.swap(r);
+	return *this;
+}
+
+bitmap operator&(const bitmap& lhs, const bitmap& rhs) {
+	bitmap r;
+	auto a = lhs._containers.begin();
+	auto b = rhs._containers.begin();
+	while (a != lhs._containers.end() && b != rhs._containers.end()) {
+		if (a->key < b->key) {
+			++a;
+		} else if (b->key < a->key) {
+			++b;
+		} else {
+			auto c = bitmap::and_container(*a++, *b++);
+			if (c.card)
+				r._containers.push_back(std::move(c));
+		}
+	}
+	return r;
+}
+
+bitmap& bitmap::operator&=(const bitmap& rhs) {
+	*this = (*this & rhs);
+	return *this;
+}
+
+bool bitmap::operator==(const bitmap& rhs) const {
+	if (_containers.size() != rhs._containers.size())
+		return false;
+
+	for (size_t i = 0; i < _containers.size(); i++) {
+		auto& a = _containers[i];
+		auto& b = rhs._containers[i];
+		if (a.key != b.key || a.card != b.card)
+			return false;
+
+		if (a.is_bitmap() == b.is_bitmap()) {
+			if (a.array != b.array || a.words != b.words)
+				return false;
+		} else {
+			// same cardinality, so equal if the array values are all in the bitmap
+			auto& arr = (a.is_bitmap() ? b : a);
+			auto& bm = (a.is_bitmap() ? a : b);
+			for (auto v : arr.array) {
+				if (!bm.contains(v))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void bitmap::for_each(const std::function<bool(uint32_t)>& f) const {
+	for (auto& c : _containers) {
+		uint32_t high = (uint32_t)c.key << 16;
+		if (c.is_bitmap()) {
+			for (size_t i = 0; i < BITMAP_WORDS; i++) {
+				uint64_t w = c.words[i];
+				while (w) {
+					if (!f(high | (uint32_t)((i << 6) + std::countr_zero(w))))
+						return;
+					w &= w - 1;
+				}
+			}
+		} else {
+			for (auto v : c.array) {
+				if (!f(high | v))
+					return;
+			}
+		}
+	}
+}
+
+std::vector<uint32_t> bitmap::values() const {
+	std::vector<uint32_t> V;
+	V.reserve(this->cardinality());
+	this->for_each([&V](uint32_t v) { V.push_back(v); return true; });
+	return V;
+}
+
+void bitmap_index::clear() {
+	_ids.clear();
+	_ranks.clear();
+	_ends.clear();
+	_ordinals.clear();
+	_relators.clear();
+	_objects.clear();
+	_pairs.clear();
+	_built = false;
+}
+
+void bitmap_index::add_tag(const tagd::id_type& id, const tagd::rank& r) {
+	assert(_ranks.empty() || _ranks.back() < r || _ranks.back().empty());
+	_ordinals[id] = (ordinal)_ids.size();
+	_ids.push_back(id);
+	_ranks.push_back(r);
+}
+
+bool bitmap_index::add_relation(const tagd::id_type& subject, const tagd::id_type& relator, const tagd::id_type& object) {
+	ordinal s, r, o;
+	if (!this->ordinal_of(subject, &s) || !this->ordinal_of(relator, &r) || !this->ordinal_of(object, &o))
+		return false;
+
+	_relators[r].add(s);
+	_objects[o].add(s);
+	_pairs[std::make_pair(r, o)].add(s);
+	return true;
+}
+
+void bitmap_index::finish() {
+	// ranks are in order, so each tag ends the subtree ranges of
+	// the tags on the stack not containing it
+	_ends.assign(_ids.size(), (ordinal)_ids.size());
+	std::vector<ordinal> stack;
+	for (ordinal i = 0; i < _ids.size(); i++) {
+		while (!stack.empty()) {
+			auto& top = _ranks[stack.back()];
+			if (top.empty() || top.contains(_ranks[i]))  // _entity contains all
+				break;
+			_ends[stack.back()] = i;
+			stack.pop_back();
+		}
+		stack.push_back(i);
+	}
+	_built = true;
+}
+
+bool bitmap_index::ordinal_of(const tagd::id_type& id, ordinal *o) const {
+	auto it = _ordinals.find(id);
+	if (it == _ordinals.end())
+		return false;
+
+	*o = it->second;
+	return true;
+}
+
+bitmap bitmap_index::subtree_union(const std::map<ordinal, bitmap>& M, ordinal lo, ordinal hi) {
+	bitmap B;
+	for (auto it = M.lower_bound(lo); it != M.end() && it->first < hi; ++it)
+		B |= it->second;
+	return B;
+}
+
+bitmap bitmap_index::related(const tagd::id_type& relator, const tagd::id_type& object) const {
+	ordinal r = 0, o = 0;
+	if (!relator.empty() && !this->ordinal_of(relator, &r))
+		return bitmap();
+	if (!object.empty() && !this->ordinal_of(object, &o))
+		return bitmap();
+
+	if (relator.empty() && object.empty())
+		return subtree_union(_relators, 0, (ordinal)_ids.size());
+
+	if (object.empty())
+		return subtree_union(_relators, r, _ends[r]);
+
+	if (relator.empty())
+		return subtree_union(_objects, o, _ends[o]);
+
+	// a leaf relator and object is a single pair
+	if (_ends[r] == r + 1 && _ends[o] == o + 1) {
+		auto it = _pairs.find(std::make_pair(r, o));
+		return (it == _pairs.end() ? bitmap() : it->second);
+	}
+
+	bitmap B;
+	for (auto it = _pairs.lower_bound(std::make_pair(r, o));
+			it != _pairs.end() && it->first.first < _ends[r]; ++it) {
+		if (it->first.second >= o && it->first.second < _ends[o])
+			B |= it->second;
+	}
+	return B;
+}
+
+bitmap bitmap_index::closure(const bitmap& B) const {
+	bitmap C;
+	ordinal end = 0;
+	B.for_each([this, &C, &end](uint32_t o) {
+		// members within the last subtree added are already covered
+		if (o >= end) {
+			end = _ends[o];
+			C.add_range(o, end);
+		}
+		return true;
+	});
+	return C;
+}
+
+bitmap bitmap_index::within(const bitmap& B, ordinal super, size_t depth) const {
+	bitmap range;
+	range.add_range(super, _ends[super]);
+	bitmap W = (B & range);
+	if (depth == 0)
+		return W;
+
+	size_t max_depth = _ranks[super].depth() + depth;
+	bitmap D;
+	W.for_each([this, &D, max_depth](uint32_t o) {
+		if (_ranks[o].depth() <= max_depth)
+			D.add(o);
+		return true;
+	});
+	return D;
+}
+
+} // namespace tagdb
@@ -0,0 +1,128 @@
+#include "tagdb/query-cache.h"
+
+namespace tagdb {
+
+bool query_cache::overlaps(const tagd::rank& a, const tagd::rank& b) {
+	return (a.empty() || b.empty() || a.contains(b) || b.contains(a));
+}
+
+void query_cache::max_size(size_t sz) {
+	_max_size = sz;
+	while (_entries.size() > _max_size) {
+		_index.erase(_entries.back().key);
+		_entries.pop_back();
+		_stats.evictions++;
+	}
+}
+
+bool query_cache::get(tagd::tag_set& R, const std::string& key) {
+	auto it = _index.find(key);
+	if (it == _index.end()) {
+		_stats.misses++;
+		return false;
+	}
+
+	// move to the front as most recently used
+	_entries.splice(_entries.begin(), _entries, it->second);
+	R = it->second->result;
+	_stats.hits++;
+	return true;
+}
+
+void query_cache::put(const std::string& key, const tagd::tag_set& R, const query_deps& deps) {
+	if (!this->enabled())
+		return;
+
+	auto it = _index.find(key);
+	if (it != _index.end()) {
+		it->second->result = R;
+		it->second->deps = deps;
+		_entries.splice(_entries.begin(), _entries, it->second);
+		return;
+	}
+
+	if (_entries.size() >= _max_size) {
+		_index.erase(_entries.back().key);
+		_entries.pop_back();
+		_stats.evictions++;
+	}
+
+	_entries.push_front(entry{key, R, deps});
+	_index[key] = _entries.begin();
+}
+
+template <typename F>
+size_t query_cache::invalidate_if(F f) {
+	size_t n = 0;
+	auto it = _entries.begin();
+	while (it != _entries.end()) {
+		if (it->deps.all || f(it->deps)) {
+			_index.erase(it->key);
+			it = _entries.erase(it);
+			n++;
+		} else {
+			++it;
+		}
+	}
+
+	_stats.invalidations += n;
+	return n;
+}
+
+// a result tag or one of its super_objects was written (r contains the result rank),
+// or the written rank moves in or out of a subtree the query searches
+size_t query_cache::invalidate_tag(const tagd::rank& r, const tagd::id_type& id) {
+	return this->invalidate_if([&r, &id](const query_deps& deps) {
+		if (deps.terms.find(id) != deps.terms.end())
+			return true;
+
+		if (deps.has_super && overlaps(deps.super, r))
+			return true;
+
+		for (auto& p : deps.predicates) {
+			if ((!p.first.empty() && overlaps(p.first, r)) || (!p.second.empty() && overlaps(p.second, r)))
+				return true;
+		}
+
+		for (auto& d : deps.ranks) {
+			if (r.empty() || r.contains(d))
+				return true;
+		}
+
+		return false;
+	});
+}
+
+// the subject is a result tag, or it is under the super
+// and one of its predicates matches one of the query
+size_t query_cache::invalidate_relations(const tagd::rank& s, const tagd::id_type& subject, const rank_pair_vec& P) {
+	return this->invalidate_if([&s, &subject, &P](const query_deps& deps) {
+		if (deps.terms.find(subject) != deps.terms.end())
+			return true;
+
+		for (auto& d : deps.ranks) {
+			if (s.empty() || s.contains(d))
+				return true;
+		}
+
+		if (deps.has_super && !overlaps(deps.super, s))
+			return false;
+
+		for (auto& q : deps.predicates) {
+			for (auto& p : P) {
+				if (overlaps(q.first, p.first) && overlaps(q.second, p.second))
+					return true;
+			}
+		}
+
+		return false;
+	});
+}
+
+void query_cache::clear() {
+	_stats.invalidations += _entries.size();
+	_entries.clear();
+	_index.clear();
+}
+
+} // namespace tagdb
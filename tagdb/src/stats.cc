@@ -0,0 +1,76 @@
+#include "tagdb/stats.h"
+
+namespace tagdb {
+
+size_t histogram::bucket(uint64_t v) {
+	if (v < SUB_BUCKETS)
+		return v;
+
+	if (v >> MAX_BITS)
+		return BUCKETS - 1;
+
+	// magnitude (highest bit set) selects the power of two, the next SUB_BITS bits the sub bucket
+	size_t m = 63 - __builtin_clzll(v);
+	return (m - SUB_BITS + 1) * SUB_BUCKETS + ((v >> (m - SUB_BITS)) - SUB_BUCKETS);
+}
+
+uint64_t histogram::bucket_max(size_t b) {
+	if (b < SUB_BUCKETS)
+		return b;
+
+	size_t m = (b / SUB_BUCKETS) + SUB_BITS - 1;
+	uint64_t lower = static_cast<uint64_t>((b % SUB_BUCKETS) + SUB_BUCKETS) << (m - SUB_BITS);
+	return lower + (1ULL << (m - SUB_BITS)) - 1;
+}
+
+void histogram::record(uint64_t v) {
+	_counts[bucket(v)]++;
+	_count++;
+	_sum += v;
+	if (v > _max)
+		_max = v;
+}
+
+void histogram::clear() {
+	for (auto& c : _counts)
+		c = 0;
+	_count = _sum = _max = 0;
+}
+
+uint64_t histogram::percentile(double f) const {
+	if (_count == 0)
+		return 0;
+
+	uint64_t rank = static_cast<uint64_t>(f * _count + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	uint64_t n = 0;
+	for (size_t b = 0; b < BUCKETS; b++) {
+		n += _counts[b];
+		if (n >= rank)
+			return (bucket_max(b) < _max ? bucket_max(b) : _max);
+	}
+
+	return _max;
+}
+
+uint64_t histogram::count_below(uint64_t bound) const {
+	uint64_t n = 0;
+	for (size_t b = 0; b < BUCKETS && bucket_max(b) < bound; b++)
+		n += _counts[b];
+	return n;
+}
+
+const char* stat_op_str(stat_op op) {
+	switch (op) {
+		case STAT_GET:    return "get";
+		case STAT_PUT:    return "put";
+		case STAT_DEL:    return "del";
+		case STAT_QUERY:  return "query";
+		case STAT_SEARCH: return "search";
+		default:          return "unknown";
+	}
+}
+
+} // namespace tagdb
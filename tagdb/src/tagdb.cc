@@ -1,4 +1,5 @@
 #include <cassert>
+#include <map>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -19,6 +20,7 @@ tagd::code session::push_context(const tagd::id_type& id) {
 	tagd::abstract_tag t;
 	if (_tdb->exists(id)) {
 		_context.push_back(id);
+		this->clear_referent_cache();
 		return tagd::TAGD_OK;
 	}
 
@@ -29,8 +31,76 @@ const tagd::id_vec& session::context() const { return _context; }
 
 // though returning a tagd code is irrelevent here, it is useful
 // for derived classes to return a code
-tagd::code session::pop_context() { _context.pop_back(); return tagd::TAGD_OK; }
-tagd::code session::clear_context() { _context.clear(); return tagd::TAGD_OK; }
+tagd::code session::pop_context() {
+	_context.pop_back();
+	this->clear_referent_cache();
+	return tagd::TAGD_OK;
+}
+
+tagd::code session::clear_context() {
+	_context.clear();
+	this->clear_referent_cache();
+	return tagd::TAGD_OK;
+}
+
+bool session::referent_cache_stale() const {
+	return (_referents_version != _tdb->referents_version());
+}
+
+bool session::find_refers(const tagd::id_type& refers_to, tagd::id_type& refers) const {
+	if (this->referent_cache_stale())
+		return false;
+
+	auto it = _refers_cache.find(refers_to);
+	if (it == _refers_cache.end())
+		return false;
+
+	refers = it->second;
+	return true;
+}
+
+bool session::find_refers_to(const tagd::id_type& refers, tagd::id_type& refers_to) const {
+	if (this->referent_cache_stale())
+		return false;
+
+	auto it = _refers_to_cache.find(refers);
+	if (it == _refers_to_cache.end())
+		return false;
+
+	refers_to = it->second;
+	return true;
+}
+
+void session::cache_refers(const tagd::id_type& refers_to, const tagd::id_type& refers) {
+	if (this->referent_cache_stale())
+		this->clear_referent_cache();
+	_refers_cache[refers_to] = refers;
+}
+
+void session::cache_refers_to(const tagd::id_type& refers, const tagd::id_type& refers_to) {
+	if (this->referent_cache_stale())
+		this->clear_referent_cache();
+	_refers_to_cache[refers] = refers_to;
+}
+
+void session::clear_referent_cache() {
+	_refers_cache.clear();
+	_refers_to_cache.clear();
+	_referents_version = _tdb->referents_version();
+}
+
+void session::timeout(std::chrono::milliseconds ms) {
+	if (ms.count() <= 0)
+		_deadline = deadline_t();
+	else
+		_deadline = std::chrono::steady_clock::now() + ms;
+}
+
+cancel_token session::cancellation() {
+	if (!_cancel)
+		_cancel = std::make_shared<std::atomic<bool>>(false);
+	return _cancel;
+}
 
 void session::print_context() {
 	size_t i = 0, sz = this->context().size();
@@ -43,6 +113,227 @@ void session::print_context() {
 	}
 }
 
+tagd::code tagdb::get_many(tagd::tag_set& R, const tagd::id_vec& ids, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	size_t n = 0;
+	for (auto id : ids) {
+		tagd::abstract_tag t;
+		auto tc = this->get(t, id, ssn, (flags|F_NO_RESET|F_NO_NOT_FOUND_ERROR));
+		if (tc == tagd::TAGD_OK) {
+			R.insert(t);
+			n++;
+		} else if (tc != tagd::TS_NOT_FOUND) {
+			return tc;
+		}
+	}
+
+	return (n == 0 ? tagd::TS_NOT_FOUND : tagd::TAGD_OK);
+}
+
+tagd::code tagdb::query_count(size_t& n, const tagd::interrogator& q, session *ssn, flags_t flags) {
+	n = 0;
+
+	tagd::tag_set T;
+	auto tc = this->query(T, q, ssn, ((flags & ~F_EXISTS_ONLY)|F_NO_NOT_FOUND_ERROR));
+	if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+		return tc;
+
+	n = T.size();
+	return tagd::TAGD_OK;
+}
+
+tagd::code tagdb::lca(tagd::id_type& id, const tagd::id_type& a_id, const tagd::id_type& b_id, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	tagd::abstract_tag a, b;
+	auto tc = this->get(a, a_id, ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+	tc = this->get(b, b_id, ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	auto r = a.rank().common_ancestor(b.rank());
+
+	// walk up from the tag closest to the common ancestor
+	tagd::abstract_tag t = (a.rank().depth() <= b.rank().depth() ? a : b);
+	while (t.rank() != r && t.id() != HARD_TAG_ENTITY) {
+		tagd::id_type super_object = t.super_object();
+		t = tagd::abstract_tag();
+		tc = this->get(t, super_object, ssn, (flags|F_NO_RESET));
+		if (tc != tagd::TAGD_OK)
+			return tc;
+	}
+
+	id = t.id();
+	return tagd::TAGD_OK;
+}
+
+tagd::code tagdb::distance(size_t& d, const tagd::id_type& a_id, const tagd::id_type& b_id, session *ssn, flags_t flags) {
+	std::vector<size_t> D;
+	auto tc = this->distance(D, id_pair_vec{id_pair(a_id, b_id)}, ssn, flags);
+	if (tc == tagd::TAGD_OK)
+		d = D[0];
+
+	return tc;
+}
+
+tagd::code tagdb::distance(std::vector<size_t>& D, const id_pair_vec& pairs, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	D.clear();
+	D.reserve(pairs.size());
+
+	// every id is read by one get_many()
+	tagd::id_vec ids;
+	for (auto& p : pairs) {
+		ids.push_back(p.first);
+		ids.push_back(p.second);
+	}
+
+	tagd::tag_set T;
+	auto tc = this->get_many(T, ids, ssn, (flags|F_NO_RESET|F_NO_NOT_FOUND_ERROR));
+	if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+		return tc;
+
+	// ids transformed via referent are also found by the id referred to
+	std::map<tagd::id_type, tagd::rank> ranks;
+	for (auto& t : T) {
+		ranks[t.id()] = t.rank();
+		for (auto& p : t.relations) {
+			if (p.relator == HARD_TAG_REFERS_TO)
+				ranks[p.object] = t.rank();
+		}
+	}
+
+	auto f_rank = [ssn, &ranks](tagd::rank& r, const tagd::id_type& id) -> tagd::code {
+		auto it = ranks.find(id);
+		if (it == ranks.end()) {
+			if (ssn)
+				return ssn->error(tagd::TS_NOT_FOUND,
+					tagd::predicate(HARD_TAG_CAUSED_BY, HARD_TAG_UNKNOWN_TAG, id));
+			return tagd::TS_NOT_FOUND;
+		}
+
+		r = it->second;
+		return tagd::TAGD_OK;
+	};
+
+	for (auto p : pairs) {
+		tagd::rank a, b;
+		tc = f_rank(a, p.first);
+		if (tc != tagd::TAGD_OK)
+			return tc;
+		tc = f_rank(b, p.second);
+		if (tc != tagd::TAGD_OK)
+			return tc;
+
+		// edges from each tag up to their lowest common ancestor
+		D.push_back(a.depth() + b.depth() - (2 * a.common_depth(b)));
+	}
+
+	return tagd::TAGD_OK;
+}
+
+tagd::code tagdb::tree(tree_set& T, const tagd::id_type& id, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	T.clear();
+
+	tagd::abstract_tag t;
+	auto tc = this->get(t, id, ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	// children of a super_object, excluding _entity which is its own super_object
+	auto f_children = [this, ssn, flags](tagd::tag_set& S, const tagd::id_type& super_object) -> tagd::code {
+		tagd::tag_set R;
+		auto tc = this->query(R, tagd::interrogator(HARD_TAG_INTERROGATOR, super_object),
+				ssn, (flags|F_NO_RESET|F_NO_NOT_FOUND_ERROR));
+		if (tc == tagd::TS_NOT_FOUND) {
+			if (ssn) ssn->code(tagd::TAGD_OK);
+		} else if (tc != tagd::TAGD_OK) {
+			return tc;
+		}
+
+		for (auto& c : R) {
+			if (c.id() != HARD_TAG_ENTITY)
+				S.insert(c);
+		}
+		return tagd::TAGD_OK;
+	};
+
+	if (t.id() == HARD_TAG_ENTITY) {
+		T.siblings.insert(t);
+	} else {
+		tc = f_children(T.siblings, t.super_object());
+		if (tc != tagd::TAGD_OK)
+			return tc;
+
+		tagd::abstract_tag a = t;
+		while (a.id() != HARD_TAG_ENTITY) {
+			tagd::id_type super_object = a.super_object();
+			a = tagd::abstract_tag();
+			tc = this->get(a, super_object, ssn, (flags|F_NO_RESET));
+			if (tc != tagd::TAGD_OK)
+				return tc;
+			T.ancestors.insert(a);
+		}
+	}
+
+	return f_children(T.children, t.id());
+}
+
+tagd::code tagdb::neighborhood(neighborhood_set& N, const tagd::abstract_tag& t, session *ssn, flags_t flags) {
+	if (!(flags & F_NO_RESET)) this->reset(ssn);
+
+	N.clear();
+
+	auto tc = this->tree(N.tree, t.id(), ssn, (flags|F_NO_RESET));
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	auto f_query = [this, ssn, flags](tagd::tag_set& R, const tagd::interrogator& q) -> tagd::code {
+		auto tc = this->query(R, q, ssn, (flags|F_NO_RESET|F_NO_NOT_FOUND_ERROR));
+		if (tc != tagd::TS_NOT_FOUND)
+			return tc;
+
+		// an empty result is not an error of the neighborhood, and
+		// a session left not found would fail the queries that follow
+		if (ssn) ssn->code(tagd::TAGD_OK);
+		return tagd::TAGD_OK;
+	};
+
+	tagd::interrogator q_refers_to(HARD_TAG_INTERROGATOR, HARD_TAG_REFERENT);
+	(void)q_refers_to.relation(HARD_TAG_REFERS_TO, t.id());
+	tc = f_query(N.refers_to, q_refers_to);
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	tagd::interrogator q_refers(HARD_TAG_INTERROGATOR, HARD_TAG_REFERENT);
+	(void)q_refers.relation(HARD_TAG_REFERS, t.id());
+	tc = f_query(N.refers, q_refers);
+	if (tc != tagd::TAGD_OK)
+		return tc;
+
+	tagd::interrogator q_related(HARD_TAG_INTERROGATOR);
+	if (t.pos() == tagd::POS_RELATOR)
+		(void)q_related.relation(t.id(), "");
+	else
+		(void)q_related.relation("", t.id());
+	return f_query(N.related, q_related);
+}
+
+cursor* tagdb::query_cursor(const tagd::interrogator& q, session *ssn, flags_t flags) {
+	tagd::tag_set T;
+	auto tc = this->query(T, q, ssn, (flags|F_NO_NOT_FOUND_ERROR));
+	if (tc != tagd::TAGD_OK && tc != tagd::TS_NOT_FOUND)
+		return nullptr;
+
+	return new tag_set_cursor(T);
+}
+
 std::string util::user_db() {
 	struct passwd *pw = getpwuid(getuid());
 	std::string str(pw->pw_dir);  // home dir
@@ -301,6 +301,935 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT(!tdb.has_errors());
     }
 
+    void test_get_many(void) {
+        TDB_CONS_INIT();
+
+		tagd::tag_set S;
+		tagd::code tc = tdb.get_many(S, {"dog", "bird", "snarf", "canary"}, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 3);
+
+		tagd::tag dog;
+		tdb.get(dog, "dog", &ssn);
+		tagd::tag bird;
+		tdb.get(bird, "bird", &ssn);
+
+		auto it = S.begin();
+		if (S.size() == 3) {
+			// rank order
+			TS_ASSERT_EQUALS( it->id(), "dog" )
+			TS_ASSERT_EQUALS( it->super_object(), "mammal" )
+			TS_ASSERT_EQUALS( it->relations, dog.relations )
+			TS_ASSERT_EQUALS( (++it)->id(), "bird" )
+			TS_ASSERT_EQUALS( it->relations, bird.relations )
+			TS_ASSERT_EQUALS( it->rank(), bird.rank() )
+			TS_ASSERT_EQUALS( (++it)->id(), "canary" )
+			TS_ASSERT( it->relations.empty() )
+		}
+
+		S.clear();
+		tc = tdb.get_many(S, {"snarf", "cockamamy"}, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+        TS_ASSERT_EQUALS(S.size(), 0);
+		ssn.clear_errors();
+
+		// terms are bound as a json array
+		S.clear();
+		tc = tdb.get_many(S, {"\"dog\\", "dog", "\ncat"}, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( S.size() == 1 && S.begin()->id() == "dog" )
+
+		// referents decoded and encoded in context
+		ssn.push_context("simple_english");
+		S.clear();
+		tc = tdb.get_many(S, {"dog"}, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( S.size() == 1 && S.begin()->related("has", "tail") )
+    }
+
+    void test_hydrate_relations(void) {
+        TDB_CONS_INIT();
+
+		tagd::interrogator q(HARD_TAG_INTERROGATOR);
+		q.relation("can", "bark");
+
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT( S.size() == 1 && S.begin()->relations.size() == 1 )
+
+		S.clear();
+		tc = tdb.query(S, q, &ssn, tagdb::F_HYDRATE_RELATIONS);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT( S.size() == 1 && S.begin()->relations.size() == 3 )
+        TS_ASSERT( S.size() == 1 && S.begin()->related(HARD_TAG_HAS, "legs", "4") )
+
+		S.clear();
+		tc = tdb.get_children(S, "mammal", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 4);
+		for (auto t : S)
+			TS_ASSERT( t.relations.empty() )
+
+		S.clear();
+		tc = tdb.get_children(S, "mammal", &ssn, tagdb::F_HYDRATE_RELATIONS);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 4);
+		for (auto t : S) {
+			tagd::tag g;
+			tdb.get(g, t.id(), &ssn);
+			TS_ASSERT_EQUALS( t.relations, g.relations )
+			TS_ASSERT( !t.relations.empty() )
+		}
+    }
+
+    void test_query_cursor(void) {
+        TDB_CONS_INIT();
+
+		// cursor ids equal query ids, in rank order
+		auto f_cursor_ids = [&tdb, &ssn](const tagd::interrogator &q, size_t *rows_related = nullptr) {
+			std::string ids;
+			tagdb::cursor *c = tdb.query_cursor(q, &ssn);
+			TS_ASSERT( c != nullptr )
+			if (c == nullptr) return ids;
+			tagd::abstract_tag t;
+			while (c->next(t) == tagd::TAGD_OK) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+				if (rows_related) *rows_related += t.relations.size();
+			}
+			TS_ASSERT( !c->has_errors() )
+			delete c;
+			return ids;
+		};
+
+		auto f_query_ids = [&tdb, &ssn](const tagd::interrogator &q) {
+			std::string ids;
+			tagd::tag_set S;
+			tdb.query(S, q, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		tagd::interrogator q_children(HARD_TAG_INTERROGATOR, "mammal");
+		TS_ASSERT_EQUALS( f_cursor_ids(q_children), f_query_ids(q_children) )
+		TS_ASSERT_EQUALS( f_cursor_ids(q_children), "dog,cat,whale,bat" )
+
+		// rows of the same subject are merged into one tag
+		tagd::interrogator q_has(HARD_TAG_INTERROGATOR, "mammal");
+		q_has.relation(HARD_TAG_HAS, "body_part");
+		TS_ASSERT_EQUALS( f_cursor_ids(q_has), f_query_ids(q_has) )
+		TS_ASSERT_EQUALS( f_cursor_ids(q_has), "mammal,dog,cat,whale,bat" )
+		size_t n = 0;
+		tagd::interrogator q_dog(HARD_TAG_INTERROGATOR, "dog");
+		q_dog.relation(HARD_TAG_HAS, "body_part");
+		TS_ASSERT_EQUALS( f_cursor_ids(q_dog, &n), "dog" )
+		TS_ASSERT_EQUALS( n, 2 )  // legs, tail
+
+		// more than one predicate is intersected in memory
+		tagd::interrogator q_two(HARD_TAG_INTERROGATOR);
+		q_two.relation(HARD_TAG_HAS, "tail");
+		q_two.relation("can", "bark");
+		TS_ASSERT_EQUALS( f_cursor_ids(q_two), f_query_ids(q_two) )
+		TS_ASSERT_EQUALS( f_cursor_ids(q_two), "dog" )
+
+		// no results is not an error
+		tagd::interrogator q_none(HARD_TAG_INTERROGATOR);
+		q_none.relation("can", "meow");
+		q_none.relation("can", "bark");
+		TS_ASSERT_EQUALS( f_cursor_ids(q_none), "" )
+    }
+
+    void test_query_options(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		// children
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "mammal");
+		q.limit(2);
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog,cat" )
+
+		// next page after last tag of previous page
+		q.after("cat");
+		S.clear();
+		tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "whale,bat" )
+
+		q.after("bat");
+		S.clear();
+		tc = tdb.query(S, q, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+
+		// single predicate, limit counts tags, not relations
+		tagd::interrogator q_has(HARD_TAG_INTERROGATOR, "animal");
+		q_has.relation(HARD_TAG_HAS, "body_part");
+		q_has.limit(2);
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,dog" )
+		q_has.after("dog");
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "cat,whale" )
+
+		// merged predicates
+		tagd::interrogator q_two(HARD_TAG_INTERROGATOR);
+		q_two.relation(HARD_TAG_HAS, "legs");
+		q_two.relation(HARD_TAG_HAS, "tail");
+		S.clear();
+		tc = tdb.query(S, q_two, &ssn);
+		TS_ASSERT_EQUALS( f_ids(S), "dog,cat" )
+		q_two.limit(1);
+		S.clear();
+		tc = tdb.query(S, q_two, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog" )
+		q_two.after("dog");
+		S.clear();
+		tc = tdb.query(S, q_two, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "cat" )
+
+		// cursor
+		tagdb::cursor *c = tdb.query_cursor(q_has, &ssn);
+		TS_ASSERT( c != nullptr )
+		if (c != nullptr) {
+			std::string ids;
+			tagd::abstract_tag t;
+			while (c->next(t) == tagd::TAGD_OK) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			TS_ASSERT_EQUALS( ids, "cat,whale" )
+			delete c;
+		}
+
+		// misuse
+		tagd::interrogator q_bad(HARD_TAG_INTERROGATOR, "mammal");
+		(void)q_bad.relation(HARD_TAG_HAS, HARD_TAG_LIMIT, "many");
+		S.clear();
+		tc = tdb.query(S, q_bad, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_MISUSE");
+		ssn.clear_errors();
+
+		tagd::interrogator q_unk(HARD_TAG_INTERROGATOR, "mammal");
+		q_unk.after("snarf");
+		S.clear();
+		tc = tdb.query(S, q_unk, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		ssn.clear_errors();
+    }
+
+    void test_query_count(void) {
+        TDB_CONS_INIT();
+
+		// children
+		size_t n;
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "mammal");
+		tagd::code tc = tdb.query_count(n, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 4 )
+
+		q.after("cat");
+		tc = tdb.query_count(n, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 2 )
+
+		// single predicate counts tags, not relations
+		tagd::interrogator q_has(HARD_TAG_INTERROGATOR, "animal");
+		q_has.relation(HARD_TAG_HAS, "body_part");
+		tc = tdb.query_count(n, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tagd::tag_set S;
+		tdb.query(S, q_has, &ssn);
+		TS_ASSERT_EQUALS( n, S.size() )
+		TS_ASSERT_EQUALS( n, 8 )
+
+		q_has.limit(3);
+		tc = tdb.query_count(n, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 3 )
+
+		// merged predicates
+		tagd::interrogator q_two(HARD_TAG_INTERROGATOR);
+		q_two.relation(HARD_TAG_HAS, "legs");
+		q_two.relation(HARD_TAG_HAS, "tail");
+		tc = tdb.query_count(n, q_two, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 2 )
+
+		// nothing matching is a count of zero
+		tagd::interrogator q_none(HARD_TAG_INTERROGATOR, "dog");
+		tc = tdb.query_count(n, q_none, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 0 )
+
+		// existence only
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn, tagdb::F_EXISTS_ONLY);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( S.empty() )
+
+		tc = tdb.query(S, q_two, &ssn, tagdb::F_EXISTS_ONLY);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( S.empty() )
+
+		tc = tdb.query(S, q_none, &ssn, (tagdb::F_EXISTS_ONLY|tagdb::F_NO_NOT_FOUND_ERROR));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(ssn.code()), "TAGD_OK");
+    }
+
+    void test_query_inherited(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		tagd::interrogator q(HARD_TAG_INTERROGATOR);
+		q.relation(HARD_TAG_HAS, "teeth");
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,snake,spider" )  // fangs _is_a teeth
+
+		S.clear();
+		tc = tdb.query(S, q, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,dog,cat,whale,bat,snake,spider" )
+		// the inherited relation
+		for (auto t : S) {
+			if (t.id() == "dog")
+				TS_ASSERT( t.related(HARD_TAG_HAS, "teeth") )
+		}
+
+		size_t n;
+		tc = tdb.query_count(n, q, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 7 )
+
+		// modifiers of inherited relations
+		tagd::interrogator q_blood(HARD_TAG_INTERROGATOR, "mammal");
+		q_blood.relation(HARD_TAG_HAS, "blood", "warm");
+		S.clear();
+		tc = tdb.query(S, q_blood, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,dog,cat,whale,bat" )
+
+		// under a super_object, with query options
+		tagd::interrogator q_fly(HARD_TAG_INTERROGATOR, "vertibrate");
+		q_fly.relation("can", "fly");
+		S.clear();
+		tc = tdb.query(S, q_fly, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "bat,bird,canary" )
+		q_fly.after("bat");
+		q_fly.limit(1);
+		S.clear();
+		tc = tdb.query(S, q_fly, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "bird" )
+
+		// merged predicates
+		tagd::interrogator q_two(HARD_TAG_INTERROGATOR);
+		q_two.relation(HARD_TAG_HAS, "teeth");
+		q_two.relation("can", "bark");
+		S.clear();
+		tc = tdb.query(S, q_two, &ssn, tagdb::F_INHERITED);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog" )
+
+		// deep taxonomy, related at the top
+		tagd::tag top("level_0", "physical_object");
+		top.relation(HARD_TAG_HAS, "tail");
+		tc = tdb.put(top, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		for (int i = 1; i <= 64; i++) {
+			tc = tdb.put(tagd::tag("level_" + std::to_string(i), "level_" + std::to_string(i-1)), &ssn);
+			TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		}
+		tagd::interrogator q_deep(HARD_TAG_INTERROGATOR, "level_63");
+		q_deep.relation(HARD_TAG_HAS, "tail");
+		S.clear();
+		tc = tdb.query(S, q_deep, &ssn, (tagdb::F_INHERITED|tagdb::F_NO_NOT_FOUND_ERROR));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "level_63,level_64" )
+		S.clear();
+		tc = tdb.query(S, q_deep, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+    }
+
+    void test_query_depth(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		// descendants
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "animal");
+		q.depth(2);
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "vertibrate,mammal,reptile,bird,invertebrate,arthropod" )
+
+		size_t n;
+		tc = tdb.query_count(n, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( n, 6 )
+
+		q.limit(2);
+		q.after("mammal");
+		S.clear();
+		tc = tdb.query(S, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "reptile,bird" )
+
+		// depth 1 are the children
+		S.clear();
+		tc = tdb.get_children(S, "animal", &ssn, 0, 0, tagd::id_type(), 1);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "vertibrate,invertebrate" )
+
+		// related within a depth
+		tagd::interrogator q_has(HARD_TAG_INTERROGATOR, "vertibrate");
+		q_has.relation(HARD_TAG_HAS, "body_part");
+		q_has.depth(1);
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,bird" )
+
+		q_has.depth(2);
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,dog,cat,whale,bat,snake,bird" )
+
+		// cursor
+		tagd::interrogator q_cur(HARD_TAG_INTERROGATOR, "vertibrate");
+		q_cur.depth(2);
+		tagdb::cursor *c = tdb.query_cursor(q_cur, &ssn);
+		TS_ASSERT( c != nullptr )
+		if (c != nullptr) {
+			std::string ids;
+			tagd::abstract_tag t;
+			while (c->next(t) == tagd::TAGD_OK) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			TS_ASSERT_EQUALS( ids, "mammal,dog,cat,whale,bat,reptile,snake,bird,canary" )
+			delete c;
+		}
+
+		// misuse
+		tagd::interrogator q_bad(HARD_TAG_INTERROGATOR);
+		q_bad.relation(HARD_TAG_HAS, "tail");
+		q_bad.depth(2);
+		S.clear();
+		tc = tdb.query(S, q_bad, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_MISUSE");
+		ssn.clear_errors();
+    }
+
+    void test_query_cache(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		tdb.query_cache_size(2);
+
+		tagd::interrogator q_mammal(HARD_TAG_INTERROGATOR, "mammal");
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q_mammal, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog,cat,whale,bat" )
+		S.clear();
+		tc = tdb.query(S, q_mammal, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog,cat,whale,bat" )
+		TS_ASSERT_EQUALS( tdb.query_stats().hits, 1 )
+		TS_ASSERT_EQUALS( tdb.query_stats().misses, 1 )
+
+		tagd::interrogator q_teeth(HARD_TAG_INTERROGATOR);
+		q_teeth.relation(HARD_TAG_HAS, "teeth");
+		S.clear();
+		tc = tdb.query(S, q_teeth, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,snake,spider" )
+
+		// a put outside both queries invalidates neither
+		tc = tdb.put(tagd::tag("finch", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().invalidations, 0 )
+		S.clear();
+		tc = tdb.query(S, q_mammal, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().hits, 2 )
+
+		// a put under mammal invalidates only the mammal query
+		tc = tdb.put(tagd::tag("puppy", "dog"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().invalidations, 1 )
+		S.clear();
+		tc = tdb.query(S, q_teeth, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().hits, 3 )
+
+		// a relation matching the predicate
+		tagd::tag finch("finch", "bird");
+		finch.relation(HARD_TAG_HAS, "teeth");
+		tc = tdb.put(finch, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().invalidations, 2 )
+		S.clear();
+		tc = tdb.query(S, q_teeth, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,snake,finch,spider" )
+
+		// deleting the relation of a result
+		tagd::tag del_finch("finch");
+		del_finch.relation(HARD_TAG_HAS, "teeth");
+		tc = tdb.del(del_finch, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		S.clear();
+		tc = tdb.query(S, q_teeth, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "mammal,snake,spider" )
+
+		// least recently used is evicted
+		S.clear();
+		tc = tdb.query(S, q_mammal, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog,cat,whale,bat" )
+		tagd::interrogator q_bird(HARD_TAG_INTERROGATOR, "bird");
+		S.clear();
+		tc = tdb.query(S, q_bird, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "canary,finch" )
+		TS_ASSERT_EQUALS( tdb.query_stats().evictions, 1 )
+		size_t misses = tdb.query_stats().misses;
+		S.clear();
+		tc = tdb.query(S, q_teeth, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.query_stats().misses, misses + 1 )
+    }
+
+    void test_bitmap(void) {
+		tagdb::bitmap A, B;
+		TS_ASSERT( A.empty() )
+
+		// sparse, across containers
+		for (uint32_t v : {3, 70000, 5, 1, 70000})
+			A.add(v);
+		TS_ASSERT_EQUALS( A.cardinality(), 4 )
+		TS_ASSERT( A.contains(70000) )
+		TS_ASSERT( !A.contains(4) )
+		auto V = A.values();
+		TS_ASSERT_EQUALS( V.size(), 4 )
+		TS_ASSERT_EQUALS( V[0], 1 )
+		TS_ASSERT_EQUALS( V[3], 70000 )
+
+		// dense, converted to a bitmap container
+		B.add_range(0, 10000);
+		TS_ASSERT_EQUALS( B.cardinality(), 10000 )
+		auto C = (A & B);
+		TS_ASSERT_EQUALS( C.cardinality(), 3 )
+		TS_ASSERT( !C.contains(70000) )
+
+		C |= B;
+		TS_ASSERT_EQUALS( C.cardinality(), 10000 )
+		TS_ASSERT( C == B )
+
+		// intersection of dense containers becoming sparse
+		tagdb::bitmap D;
+		D.add_range(9990, 20000);
+		D &= B;
+		TS_ASSERT_EQUALS( D.cardinality(), 10 )
+		tagdb::bitmap E;
+		for (uint32_t v = 9990; v < 10000; v++)
+			E.add(v);
+		TS_ASSERT( D == E )
+
+		// unaligned range spanning containers
+		tagdb::bitmap F;
+		F.add_range(65530, 65540);
+		TS_ASSERT_EQUALS( F.cardinality(), 10 )
+		TS_ASSERT( F.contains(65535) && F.contains(65536) )
+	}
+
+    void test_query_bitmap_index(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		std::vector<tagd::interrogator> Q;
+		tagd::interrogator q_two(HARD_TAG_INTERROGATOR);
+		q_two.relation(HARD_TAG_HAS, "teeth");
+		q_two.relation("can", "bark");
+		Q.push_back(q_two);
+
+		tagd::interrogator q_animal(HARD_TAG_INTERROGATOR, "animal");
+		q_animal.relation(HARD_TAG_HAS, "body_part");
+		q_animal.relation(HARD_TAG_HAS, "teeth");
+		Q.push_back(q_animal);
+
+		tagd::interrogator q_opts(q_animal);
+		q_opts.after("mammal");
+		q_opts.limit(2);
+		Q.push_back(q_opts);
+
+		tagd::interrogator q_none(HARD_TAG_INTERROGATOR, "reptile");
+		q_none.relation(HARD_TAG_HAS, "teeth");
+		q_none.relation("can", "bark");
+		Q.push_back(q_none);
+
+		// the same results as merging the tags related by each predicate
+		std::vector<std::string> merged;
+		for (auto& q : Q) {
+			tagd::tag_set S;
+			tdb.query(S, q, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+			merged.push_back(f_ids(S));
+		}
+		TS_ASSERT_EQUALS( merged[0], "dog" )
+		TS_ASSERT_EQUALS( merged[3], "" )
+
+		tdb.use_bitmap_index(true);
+		for (size_t i = 0; i < Q.size(); i++) {
+			tagd::tag_set S;
+			tdb.query(S, Q[i], &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+			TS_ASSERT_EQUALS( f_ids(S), merged[i] )
+		}
+
+		// relations matching the predicates
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q_two, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( S.size(), 1 )
+		if (S.size() == 1)
+			TS_ASSERT( S.begin()->related("can", "bark") )
+
+		// rebuilt after a put
+		tagd::tag wolf("wolf", "mammal");
+		wolf.relation("can", "bark");
+		tc = tdb.put(wolf, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		S.clear();
+		tc = tdb.query(S, q_two, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(S), "dog,wolf" )
+	}
+
+    void test_lca_distance(void) {
+        TDB_CONS_INIT();
+
+		tagd::id_type id;
+		tagd::code tc = tdb.lca(id, "dog", "cat", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, "mammal" )
+
+		tc = tdb.lca(id, "dog", "canary", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, "vertibrate" )
+
+		tc = tdb.lca(id, "dog", "spider", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, "animal" )
+
+		// ancestor of the other
+		tc = tdb.lca(id, "animal", "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, "animal" )
+
+		tc = tdb.lca(id, "dog", "blood", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, HARD_TAG_ENTITY )
+
+		// base implementation walks super_objects
+		tc = tdb.tagdb::tagdb::lca(id, "dog", "canary", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( id, "vertibrate" )
+
+		size_t d;
+		tc = tdb.distance(d, "dog", "cat", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( d, 2 )
+
+		tc = tdb.distance(d, "dog", "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( d, 0 )
+
+		std::vector<size_t> D;
+		tagdb::id_pair_vec pairs{
+			tagdb::id_pair("dog", "canary"),
+			tagdb::id_pair("animal", "dog"),
+			tagdb::id_pair("dog", "spider")
+		};
+		tc = tdb.distance(D, pairs, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( D.size(), 3 )
+		if (D.size() == 3) {
+			TS_ASSERT_EQUALS( D[0], 4 )  // dog mammal vertibrate bird canary
+			TS_ASSERT_EQUALS( D[1], 3 )  // animal vertibrate mammal dog
+			TS_ASSERT_EQUALS( D[2], 7 )  // dog mammal vertibrate animal invertebrate arthropod insect spider
+		}
+
+		pairs.push_back(tagdb::id_pair("dog", "snarf"));
+		tc = tdb.distance(D, pairs, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		ssn.clear_errors();
+
+		tc = tdb.lca(id, "dog", "snarf", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+    }
+
+    void test_tree(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		tagdb::tree_set T;
+		tagd::code tc = tdb.tree(T, "cat", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(T.ancestors), "_entity,physical_object,living_thing,animal,vertibrate,mammal" )
+		TS_ASSERT_EQUALS( f_ids(T.siblings), "dog,cat,whale,bat" )
+		TS_ASSERT( T.children.empty() )
+
+		tc = tdb.tree(T, "mammal", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(T.siblings), "mammal,reptile,bird" )
+		TS_ASSERT_EQUALS( f_ids(T.children), "dog,cat,whale,bat" )
+
+		// base implementation gets the same tree
+		tagdb::tree_set B;
+		tc = tdb.tagdb::tagdb::tree(B, "mammal", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(B.ancestors), f_ids(T.ancestors) )
+		TS_ASSERT_EQUALS( f_ids(B.siblings), f_ids(T.siblings) )
+		TS_ASSERT_EQUALS( f_ids(B.children), f_ids(T.children) )
+
+		// top level
+		tc = tdb.tree(T, "physical_object", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(T.ancestors), HARD_TAG_ENTITY )
+		TS_ASSERT_EQUALS( f_ids(T.children), "living_thing,body_part,machine" )
+
+		// the root is its only sibling
+		tc = tdb.tree(T, HARD_TAG_ENTITY, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( T.ancestors.empty() )
+		TS_ASSERT_EQUALS( f_ids(T.siblings), HARD_TAG_ENTITY )
+		TS_ASSERT( f_ids(T.children).find("physical_object") != std::string::npos )
+		TS_ASSERT( T.children.size() > 0 )
+		tc = tdb.tagdb::tagdb::tree(B, HARD_TAG_ENTITY, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(B.children), f_ids(T.children) )
+
+		tc = tdb.tree(T, "not_a_tag", &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		TS_ASSERT( T.siblings.empty() )
+	}
+
+    void test_neighborhood(void) {
+        TDB_CONS_INIT();
+
+		auto f_ids = [](const tagd::tag_set &S) {
+			std::string ids;
+			for (auto t : S) {
+				if (!ids.empty()) ids.append(",");
+				ids.append(t.id());
+			}
+			return ids;
+		};
+
+		tagd::abstract_tag t;
+		tagd::code tc = tdb.get(t, "fangs", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		tagdb::neighborhood_set N;
+		tc = tdb.neighborhood(N, t, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(N.related), "snake,spider" )
+		TS_ASSERT_EQUALS( f_ids(N.tree.siblings), "fangs" )
+		TS_ASSERT( N.refers.empty() )
+		TS_ASSERT( N.refers_to.empty() )
+
+		// base implementation queries each
+		tagdb::neighborhood_set B;
+		tc = tdb.tagdb::tagdb::neighborhood(B, t, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(B.related), f_ids(N.related) )
+		TS_ASSERT_EQUALS( f_ids(B.tree.ancestors), f_ids(N.tree.ancestors) )
+
+		// referents refering to a tag
+		tc = tdb.get(t, HARD_TAG_IS_A, &ssn, tagdb::F_NO_TRANSFORM_REFERENTS);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.neighborhood(N, t, &ssn, tagdb::F_NO_TRANSFORM_REFERENTS);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( N.refers_to.size(), 1 )
+		TS_ASSERT( N.refers.empty() )
+		tc = tdb.tagdb::tagdb::neighborhood(B, t, &ssn, tagdb::F_NO_TRANSFORM_REFERENTS);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_ids(B.refers_to), f_ids(N.refers_to) )
+		TS_ASSERT_EQUALS( f_ids(B.related), f_ids(N.related) )
+
+		tc = tdb.neighborhood(N, tagd::abstract_tag("not_a_tag"), &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+	}
+
+    void test_version(void) {
+        TDB_CONS_INIT();
+
+		auto v = tdb.version();
+
+		// reads don't change the version
+		tagd::abstract_tag t;
+		tagd::code tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tagd::tag_set S;
+		tc = tdb.query(S, tagd::interrogator(HARD_TAG_INTERROGATOR, "mammal"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.version(), v )
+
+		tc = tdb.put(tagd::tag("finch", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.version() > v )
+		v = tdb.version();
+
+		tagd::tag finch("finch");
+		finch.relation("can", "fly");
+		tc = tdb.put(finch, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.version() > v )
+		v = tdb.version();
+
+		tc = tdb.put(tagd::referent("birdie", "finch", "simple_english"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.version() > v )
+		v = tdb.version();
+
+		tc = tdb.del(tagd::referent("birdie", "finch", "simple_english"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.version() > v )
+		v = tdb.version();
+
+		tc = tdb.del(tagd::tag("finch"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.version() > v )
+	}
+
+    void test_batch(void) {
+        TDB_CONS_INIT();
+		tdb.query_cache_size(16);
+
+		tagd::interrogator q_birds(HARD_TAG_INTERROGATOR, "bird");
+		tagd::tag_set S;
+		tagd::code tc = tdb.query(S, q_birds, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+		size_t birds = S.size();
+
+		// rolled back, including results cached during the batch
+		tc = tdb.batch_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.in_batch() )
+		tc = tdb.batch_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_MISUSE");
+		tc = tdb.put(tagd::tag("finch", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.del(tagd::tag("dog"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		S.clear();
+		tc = tdb.query(S, q_birds, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( S.size(), birds + 1 )
+		auto v = tdb.version();
+		tc = tdb.batch_end(false, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( !tdb.in_batch() )
+		TS_ASSERT( tdb.version() > v )
+		TS_ASSERT( !tdb.exists("finch") )
+		TS_ASSERT( tdb.exists("dog") )
+		S.clear();
+		tc = tdb.query(S, q_birds, &ssn, tagdb::F_NO_NOT_FOUND_ERROR);
+		TS_ASSERT_EQUALS( S.size(), birds )
+
+		// a failed statement is rolled back on its own
+		tc = tdb.batch_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.statement_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.put(tagd::tag("finch", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.statement_end(true, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.statement_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.put(tagd::tag("sparrow", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.put(tagd::tag("sparrow", "not_a_tag"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_SUB_UNK");
+		tc = tdb.statement_end(false, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.batch_end(true, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.exists("finch") )
+		TS_ASSERT( !tdb.exists("sparrow") )
+
+		// statements are only within a batch
+		tc = tdb.statement_begin(&ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_MISUSE");
+		tc = tdb.batch_end(true, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_MISUSE");
+	}
+
     void test_put_referent(void) {
         TDB_CONS_INIT();
 
@@ -386,6 +1315,18 @@ class Tester : public CxxTest::TestSuite {
 		}
 		ssn.clear_errors();
 
+		// the pos of a sub_relator is also its role in the tags it is the sub_relator of,
+		// but it is the cause of the dependency once
+		tc = tdb.put(tagd::abstract_tag("kind_of", HARD_TAG_SUB, HARD_TAG_SUB, tagd::POS_SUB_RELATOR), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.put(tagd::abstract_tag("robin", "kind_of", "bird", tagd::POS_TAG), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.del(tagd::tag("kind_of"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_RELATION_DEPENDENCY");
+		TS_ASSERT_EQUALS(ssn.errors().size() , 1);
+		TS_ASSERT(ssn.errors().front().related(HARD_TAG_CAUSED_BY, "sub_relator", "kind_of"));
+		ssn.clear_errors();
+
 		// delete failed, so tag still exists
 		tagd::tag d;
 		tc = tdb.get(d, "teeth", &ssn);
@@ -455,6 +1396,40 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
     }
 
+	void test_delete_term_pos_occurence(void) {
+        TDB_CONS_INIT();
+
+		tagd::tag a("three_legged_dog", "dog");
+		a.relation(tagd::predicate(HARD_TAG_HAS, "legs", "3", tagd::OP_EQ, tagd::TYPE_INTEGER));
+        tagd::code tc = tdb.put(a, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		tagd::tag b("tripod", "machine");
+		b.relation(tagd::predicate(HARD_TAG_HAS, "legs", "3", tagd::OP_EQ, tagd::TYPE_INTEGER));
+        tc = tdb.put(b, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("3")), "POS_MODIFIER");
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("three_legged_dog")), "POS_TAG,POS_SUBJECT");
+
+		// "3" still a modifier of tripod
+        tc = tdb.del(tagd::tag("three_legged_dog"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("3")), "POS_MODIFIER");
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("three_legged_dog")), "POS_UNKNOWN");
+
+		// no occurences left
+		tagd::tag c("tripod");
+		c.relation(HARD_TAG_HAS, "legs", "3");
+        tc = tdb.del(c, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("3")), "POS_UNKNOWN");
+		TS_ASSERT_EQUALS(pos_list_str(tdb.term_pos("tripod")), "POS_TAG");
+
+		// legs is still the object of other relations
+		TS_ASSERT(tdb.term_pos("legs") & tagd::POS_OBJECT);
+    }
+
 	void test_get_referent(void) {
         TDB_CONS_INIT();
 
@@ -537,6 +1512,318 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT_EQUALS(TAGD_CODE_STRING(tdb.code()), "TAGD_OK");
 	}
 
+    void test_referent_cache(void) {
+        TDB_CONS_INIT();
+
+		tagd::referent thing("thing", "animal", "living_thing");
+		auto tc = tdb.put(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		ssn.push_context("living_thing");
+		tagd::id_type id;
+		TS_ASSERT( !ssn.find_refers_to("thing", id) )
+
+		tagd::tag t;
+		tc = tdb.get(t, "thing", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( ssn.find_refers_to("thing", id) )
+        TS_ASSERT_EQUALS(id, "animal");
+		// resolved, and not a referent
+		TS_ASSERT( ssn.find_refers("animal", id) )
+        TS_ASSERT_EQUALS(id, "thing");
+		TS_ASSERT( !ssn.find_refers("dog", id) )
+		tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( ssn.find_refers("dog", id) )
+		TS_ASSERT( id.empty() )
+
+		// stale after a referent put
+		tagd::referent dog("dog", "cat", "living_thing");
+		tc = tdb.put(dog, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( !ssn.find_refers_to("dog", id) )
+		tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT(t.related(HARD_TAG_REFERS_TO, "cat"));
+
+		// and after deleting it
+		tc = tdb.del(dog, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tagd::tag t_dog;
+		tc = tdb.get(t_dog, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(t_dog.id(), "dog");
+        TS_ASSERT(!t_dog.related(HARD_TAG_REFERS_TO, "cat"));
+
+		// dropped when the context changes
+		tc = tdb.get(t, "thing", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( ssn.find_refers_to("thing", id) )
+		ssn.pop_context();
+		TS_ASSERT( !ssn.find_refers_to("thing", id) )
+	}
+
+    void test_stmt_cache(void) {
+        TDB_CONS_INIT();
+
+		const std::string all_referents_sql =
+			"SELECT idt(refers), idt(refers_to), idt(context) FROM referents";
+
+		auto f_prepares = [&tdb]() {
+			size_t n = 0;
+			for (auto& s : tdb.statements().stats())
+				n += s.second.prepares;
+			return n;
+		};
+
+		tagd::interrogator q_ref(HARD_TAG_INTERROGATOR, HARD_TAG_REFERENT);
+		tagd::tag_set R;
+		auto tc = tdb.query(R, q_ref, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( tdb.statements().prepares(all_referents_sql), 1 )
+		size_t n = R.size();
+
+		// repeated queries and gets reuse their statements
+		size_t prepares = f_prepares();
+		R.clear();
+		tc = tdb.query(R, q_ref, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( R.size(), n )
+		tagd::tag t;
+		tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.get(t, "cat", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_prepares(), prepares )
+		TS_ASSERT_EQUALS( tdb.statements().prepares(all_referents_sql), 1 )
+		TS_ASSERT( tdb.statements().stats().at(all_referents_sql).uses >= 2 )
+
+		// deleting a referent prepares its statement once
+		tagd::referent thing("thing", "animal", "living_thing");
+		tc = tdb.put(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.del(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		prepares = f_prepares();
+		tc = tdb.put(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.del(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_prepares(), prepares )
+
+		// evicted statements are prepared again
+		tdb.stmt_cache_size(0);
+		TS_ASSERT_EQUALS( tdb.statements().max_size(), tagdb::stmt_cache::MIN_SIZE )
+		TS_ASSERT( tdb.statements().size() <= tagdb::stmt_cache::MIN_SIZE )
+		tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(t.id(), "dog");
+
+		// steps are counted for the statements handed out again, and collected from the rest
+		auto T = tdb.statement_totals();
+		TS_ASSERT( T.vm_steps > 0 )
+		TS_ASSERT_EQUALS( T.prepares, f_prepares() )
+		TS_ASSERT( T.uses > T.prepares )
+		tc = tdb.get(t, "cat", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( tdb.statement_totals().vm_steps > T.vm_steps )
+	}
+
+	void test_histogram(void) {
+		// exact below SUB_BUCKETS, then SUB_BUCKETS buckets per power of two
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(0), 0 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(7), 7 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(15), 15 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(16), 16 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(17), 16 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(18), 17 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket_max(16), 17 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket(1ULL << 50), tagdb::histogram::BUCKETS - 1 )
+		TS_ASSERT_EQUALS( tagdb::histogram::bucket_max(tagdb::histogram::BUCKETS - 1), (1ULL << 40) - 1 )
+		for (uint64_t v : {1ULL, 9ULL, 100ULL, 1000ULL, 123456ULL, 1ULL << 30}) {
+			auto b = tagdb::histogram::bucket(v);
+			TS_ASSERT( tagdb::histogram::bucket_max(b) >= v )
+			TS_ASSERT( b == 0 || tagdb::histogram::bucket_max(b - 1) < v )
+		}
+
+		tagdb::histogram h;
+		TS_ASSERT_EQUALS( h.percentile(0.5), 0 )
+		for (uint64_t v = 1; v <= 1000; v++)
+			h.record(v);
+		TS_ASSERT_EQUALS( h.count(), 1000 )
+		TS_ASSERT_EQUALS( h.sum(), 500500 )
+		TS_ASSERT_EQUALS( h.max(), 1000 )
+		// within a bucket (1/8) of the value
+		TS_ASSERT( h.percentile(0.5) >= 500 && h.percentile(0.5) < 500 + 500 / 8 )
+		TS_ASSERT( h.percentile(0.99) >= 990 && h.percentile(0.99) <= 1000 )
+		TS_ASSERT_EQUALS( h.percentile(1.0), 1000 )
+		TS_ASSERT_EQUALS( h.count_below(256), 255 )
+		TS_ASSERT_EQUALS( h.count_below(1024), 1000 )
+
+		h.clear();
+		TS_ASSERT_EQUALS( h.count(), 0 )
+		TS_ASSERT_EQUALS( h.count_below(1024), 0 )
+	}
+
+	void test_op_stats(void) {
+        TDB_CONS_INIT();
+
+		auto f_count = [&tdb](tagdb::stat_op op) {
+			return tdb.ops().latency[op].count();
+		};
+		auto gets = f_count(tagdb::STAT_GET);
+		auto puts = f_count(tagdb::STAT_PUT);
+		auto queries = f_count(tagdb::STAT_QUERY);
+
+		// operations called by a timed operation aren't recorded
+		tagd::referent thing("thing", "animal", "living_thing");
+		auto tc = tdb.put(thing, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tagd::url u("http://hypermega.com/a/b");
+		tc = tdb.put(u, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_count(tagdb::STAT_PUT), puts + 2 )
+		TS_ASSERT_EQUALS( f_count(tagdb::STAT_GET), gets )
+
+		tagd::tag t;
+		tc = tdb.get(t, "dog", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		tc = tdb.get(t, "not_a_tag", &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		TS_ASSERT_EQUALS( f_count(tagdb::STAT_GET), gets + 2 )
+
+		tagd::interrogator q(HARD_TAG_INTERROGATOR, "animal");
+		tagd::tag_set R;
+		tc = tdb.query(R, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		size_t n;
+		tc = tdb.query_count(n, q, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT_EQUALS( f_count(tagdb::STAT_QUERY), queries + 2 )
+		TS_ASSERT_EQUALS( std::string(tagdb::stat_op_str(tagdb::STAT_QUERY)), "query" )
+	}
+
+    void test_deadline(void) {
+        TDB_CONS_INIT();
+
+		tagd::interrogator q_has(HARD_TAG_INTERROGATOR, "animal");
+		q_has.relation(HARD_TAG_HAS, "teeth");
+		tagd::tag_set S;
+
+		// a passed deadline interrupts reads, and writes aren't started
+		ssn.deadline(std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+		auto tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_TIMEOUT");
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(ssn.code()), "TS_TIMEOUT");
+		tc = tdb.put(tagd::tag("finch", "bird"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_TIMEOUT");
+		TS_ASSERT( !tdb.exists("finch") )
+
+		ssn.timeout(std::chrono::milliseconds(60000));
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( !S.empty() )
+
+		// cancelled by the token, until it is unset
+		ssn.timeout(std::chrono::milliseconds(0));
+		tagdb::cancel_token token = ssn.cancellation();
+		token->store(true);
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_CANCELLED");
+		tc = tdb.del(tagd::tag("dog", "mammal"), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_CANCELLED");
+		TS_ASSERT( tdb.exists("dog") )
+
+		// other sessions aren't interrupted
+		tagdb::session ssn2 = tdb.get_session();
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn2);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		token->store(false);
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		// a cursor is stepped under the deadline of its own session,
+		// not that of the last operation of another session
+		size_t sz = S.size();
+		tagdb::cursor *c = tdb.query_cursor(q_has, &ssn2);
+		TS_ASSERT( c != nullptr )
+		ssn.deadline(std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_TIMEOUT");
+		size_t n = 0;
+		tagd::abstract_tag t;
+		while ((tc = c->next(t)) == tagd::TAGD_OK)
+			n++;
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		TS_ASSERT_EQUALS( n, sz )
+		delete c;
+
+		// a statement still running at the deadline is interrupted by the progress handler
+		ssn.timeout(std::chrono::milliseconds(0));
+		tc = tdb.batch_begin(&ssn);
+		for (size_t i = 0; i < 5000; i++) {
+			tagd::tag a("animal_" + std::to_string(i), "animal");
+			a.relation(HARD_TAG_HAS, "teeth");
+			tdb.put(a, &ssn);
+		}
+		tc = tdb.batch_end(true, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		auto start = std::chrono::steady_clock::now();
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+		TS_ASSERT( S.size() > 5000 )
+
+		ssn.clear_errors();
+		ssn.deadline(std::chrono::steady_clock::now() + (elapsed / 10));
+		S.clear();
+		tc = tdb.query(S, q_has, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_TIMEOUT");
+		// interrupted while stepping, not before starting
+		TS_ASSERT( ssn.has_errors() && ssn.errors().front().related(HARD_TAG_CAUSED_BY, HARD_TAG_ACTION) )
+		TS_ASSERT( S.empty() )
+
+		// a put that has started isn't interrupted by its nested operations,
+		// so the tag is stored with all of its relations or not at all
+		tagd::tag menagerie("menagerie", "animal");
+		for (size_t i = 0; i < 3000; i++)
+			menagerie.relation(HARD_TAG_HAS, "animal_" + std::to_string(i));
+		for (size_t us = 0; us <= 20000; us += 2000) {
+			tagd::tag m(menagerie);
+			m.id("menagerie_" + std::to_string(us));
+			ssn.clear_errors();
+			ssn.deadline(std::chrono::steady_clock::now() + std::chrono::microseconds(us));
+			tc = tdb.put(m, &ssn);
+			ssn.timeout(std::chrono::milliseconds(0));
+			if (tc == tagd::TAGD_OK) {
+				tagd::abstract_tag got;
+				tc = tdb.get(got, m.id(), &ssn);
+				TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+				TS_ASSERT_EQUALS( got.relations.size(), 3000 )
+			} else {
+				TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_TIMEOUT");
+				TS_ASSERT( !tdb.exists(m.id()) )
+			}
+		}
+
+		// a put failing after the tag is inserted is rolled back
+		ssn.clear_errors();
+		tagd::tag m(menagerie);
+		m.id("menagerie_unk");
+		m.relation(HARD_TAG_HAS, "unicorn");
+		tc = tdb.put(m, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_OBJECT_UNK");
+		TS_ASSERT( !tdb.exists("menagerie_unk") )
+	}
+
     void test_referent_override(void) {
         TDB_CONS_INIT();
 
@@ -1294,6 +2581,51 @@ class Tester : public CxxTest::TestSuite {
         TS_ASSERT_EQUALS(S.size(), 5);
     }
 
+    void test_related_modifier_value(void) {
+        TDB_CONS_INIT();
+
+		tagd::tag a("hummingbird", "bird");
+		a.relation(tagd::predicate(HARD_TAG_HAS, "wings", "2.5", tagd::OP_EQ, tagd::TYPE_FLOAT));
+        tagd::code tc = tdb.put(a, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+		// float modifiers aren't truncated
+        tagd::tag_set S;
+        tc = tdb_related(tdb, S, tagd::predicate(HARD_TAG_HAS, "wings", "2.4", tagd::OP_GT, tagd::TYPE_FLOAT));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 1);
+        TS_ASSERT(tag_set_exists(S, "hummingbird"));
+
+        S.clear();
+        tc = tdb_related(tdb, S, tagd::predicate(HARD_TAG_HAS, "wings", "2", tagd::OP_LT_EQ, tagd::TYPE_INTEGER), &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TS_NOT_FOUND");
+		ssn.clear_errors();
+
+		// TYPE_TEXT modifiers (as in TAGL quantifiers) are compared numerically
+        S.clear();
+        tc = tdb_related(tdb, S, tagd::predicate(HARD_TAG_HAS, "legs", "10", tagd::OP_LT));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 3);
+
+        S.clear();
+        tc = tdb_related(tdb, S, tagd::predicate(HARD_TAG_HAS, "legs", "4.5", tagd::OP_GT_EQ));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT_EQUALS(S.size(), 1);
+        TS_ASSERT(tag_set_exists(S, "spider"));
+
+		// non-numeric modifiers have no modifier_value, so ranges never match them
+		tagd::tag c("centipede", "animal");
+		c.relation(HARD_TAG_HAS, "legs", "many");
+        tc = tdb.put(c, &ssn);
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+
+        S.clear();
+        tc = tdb_related(tdb, S, tagd::predicate(HARD_TAG_HAS, "legs", "2", tagd::OP_GT));
+        TS_ASSERT_EQUALS(TAGD_CODE_STRING(tc), "TAGD_OK");
+        TS_ASSERT(tag_set_exists(S, "spider"));
+        TS_ASSERT(!tag_set_exists(S, "centipede"));
+    }
+
     void test_query(void) {
         TDB_CONS_INIT();
 
@@ -0,0 +1,82 @@
+// benchmarks inherited relation queries on a deep taxonomy
+//   usage: bench [depth] [width]
+// ranks are at most RANK_MAX_LEN bytes, so depth is limited to about 250
+// each level has width leaves and one tag continuing the chain,
+// the relation is put on the top of the chain only
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include "tagd.h"
+#include "tagdb/sqlite.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+double elapsed_ms(bench_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	int depth = (argc > 1 ? std::atoi(argv[1]) : 200);
+	int width = (argc > 2 ? std::atoi(argv[2]) : 8);
+
+	tagdb::sqlite tdb;
+	if (tdb.init(":memory:") != tagd::TAGD_OK) {
+		tdb.print_errors();
+		return 1;
+	}
+
+	tdb.put(tagd::tag("physical_object", HARD_TAG_ENTITY), nullptr);
+	tdb.put(tagd::tag("body_part", "physical_object"), nullptr);
+	tdb.put(tagd::tag("tail", "body_part"), nullptr);
+
+	auto start = bench_clock::now();
+	tagd::tag top("level_0", "physical_object");
+	top.relation(HARD_TAG_HAS, "tail");
+	tdb.put(top, nullptr);
+	for (int i = 1; i <= depth; i++) {
+		std::string sup("level_" + std::to_string(i-1));
+		for (int j = 0; j < width; j++)
+			tdb.put(tagd::tag(sup + "_" + std::to_string(j), sup), nullptr);
+		tdb.put(tagd::tag("level_" + std::to_string(i), sup), nullptr);
+	}
+	if (tdb.has_errors()) {
+		tdb.print_errors();
+		return 1;
+	}
+	std::cout << "put " << (depth * (width + 1) + 1) << " tags: " << elapsed_ms(start) << " ms" << std::endl;
+
+	tagd::interrogator q(HARD_TAG_INTERROGATOR);
+	q.relation(HARD_TAG_HAS, "tail");
+
+	// inherited query
+	tagdb::session ssn = tdb.get_session();
+	tagd::tag_set S;
+	start = bench_clock::now();
+	tdb.query(S, q, &ssn, tagdb::F_INHERITED);
+	std::cout << "F_INHERITED query: " << S.size() << " tags in " << elapsed_ms(start) << " ms" << std::endl;
+
+	// follow up queries, expanding each direct subject by its children
+	start = bench_clock::now();
+	tagd::tag_set R, C;
+	tdb.query(R, q, &ssn);
+	tagd::id_vec ids;
+	for (auto t : R)
+		ids.push_back(t.id());
+	size_t n = 0;
+	while (!ids.empty()) {
+		tagd::id_type id = ids.back();
+		ids.pop_back();
+		n++;
+		C.clear();
+		tagd::interrogator q_children(HARD_TAG_INTERROGATOR, id);
+		if (tdb.query(C, q_children, &ssn, tagdb::F_NO_NOT_FOUND_ERROR) != tagd::TAGD_OK)
+			continue;
+		for (auto t : C)
+			ids.push_back(t.id());
+	}
+	std::cout << "children per subject: " << n << " tags in " << elapsed_ms(start) << " ms" << std::endl;
+
+	return 0;
+}
@@ -56,8 +56,12 @@ class tagdb_tester : public tagdb::tagdb {
 			put_test_tag(HARD_TAG_CAN, HARD_TAG_ENTITY, tagd::POS_RELATOR);
 			put_test_tag(HARD_TAG_INTERROGATOR, HARD_TAG_ENTITY, tagd::POS_INTERROGATOR);
 			put_test_tag(HARD_TAG_WHAT, HARD_TAG_ENTITY, tagd::POS_INTERROGATOR);
+			put_test_tag(HARD_TAG_HOW_MANY, HARD_TAG_ENTITY, tagd::POS_INTERROGATOR);
 			put_test_tag(HARD_TAG_TERMS, HARD_TAG_ENTITY, tagd::POS_TAG);
 			put_test_tag(HARD_TAG_MESSAGE, HARD_TAG_ENTITY, tagd::POS_TAG);
+			put_test_tag(HARD_TAG_LIMIT, HARD_TAG_INTERROGATOR, tagd::POS_TAG);
+			put_test_tag(HARD_TAG_AFTER, HARD_TAG_INTERROGATOR, tagd::POS_TAG);
+			put_test_tag(HARD_TAG_DEPTH, HARD_TAG_INTERROGATOR, tagd::POS_TAG);
 			put_test_tag(HARD_TAG_REFERENT, HARD_TAG_SUB, tagd::POS_REFERENT);
 			put_test_tag(HARD_TAG_REFERS, HARD_TAG_ENTITY, tagd::POS_REFERS);
 			put_test_tag(HARD_TAG_REFERS_TO, HARD_TAG_ENTITY, tagd::POS_REFERS_TO);
@@ -1412,6 +1416,36 @@ class Tester : public CxxTest::TestSuite {
 		TS_ASSERT_EQUALS( it->id(), "dog" )
 	}
 
+    void test_query_options(void) {
+		tagdb_tester tdb;
+		callback_tester cb(&tdb);
+		TAGL::driver tagl(&tdb, &cb);
+		tagd::code tc = tagl.execute("?? " HARD_TAG_WHAT " " HARD_TAG_IS_A " mammal "
+			HARD_TAG_HAS " " HARD_TAG_LIMIT " = 10, " HARD_TAG_AFTER " = cat, " HARD_TAG_DEPTH " = 2");
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(tc), "TAGD_OK" )
+		TS_ASSERT_EQUALS( cb.last_tag->pos() , tagd::POS_INTERROGATOR )
+		TS_ASSERT_EQUALS( cb.last_tag->super_object(), "mammal" )
+
+		const tagd::interrogator *q = dynamic_cast<const tagd::interrogator*>(&tagl.tag());
+		TS_ASSERT( q != nullptr )
+		if (q != nullptr) {
+			TS_ASSERT_EQUALS( q->limit(), 10 )
+			TS_ASSERT_EQUALS( q->after(), "cat" )
+			TS_ASSERT_EQUALS( q->depth(), 2 )
+		}
+	}
+
+    void test_query_how_many(void) {
+		tagdb_tester tdb;
+		callback_tester cb(&tdb);
+		TAGL::driver tagl(&tdb, &cb);
+		tagd::code tc = tagl.execute("?? " HARD_TAG_HOW_MANY " " HARD_TAG_IS_A " mammal");
+		TS_ASSERT_EQUALS( TAGD_CODE_STRING(tc), "TAGD_OK" )
+		TS_ASSERT_EQUALS( cb.last_tag->pos() , tagd::POS_INTERROGATOR )
+		TS_ASSERT_EQUALS( cb.last_tag->id(), HARD_TAG_HOW_MANY )
+		TS_ASSERT_EQUALS( cb.last_tag->super_object(), "mammal" )
+	}
+
     void test_query_children_empty(void) {
 		tagdb_tester tdb;
 		callback_tester cb(&tdb);
@@ -123,30 +123,64 @@ void tagsh_callback::cmd_del(const tagd::abstract_tag& t) {
 }
 
 void tagsh_callback::cmd_query(const tagd::interrogator& q) {
-	tagd::tag_set T;
 	auto ssn = _driver->session_ptr();
 
-	auto tc = _tdb->query(T, q, ssn, _driver->flags|tagdb::F_NO_NOT_FOUND_ERROR);
-	if (!CMD_OK()) {
+	if (q.id() == HARD_TAG_HOW_MANY) {
+		size_t n;
+		if (_tdb->query_count(n, q, ssn, _driver->flags) == tagd::TAGD_OK)
+			TAGD_COUT << n << std::endl;
+		else
+			this->handle_cmd_error();
+		add_history_lines_clear(_lines);
+		return;
+	}
+
+	// results are printed as they are read, rather than collected into a tag_set first
+	tagdb::cursor *c = _tdb->query_cursor(q, ssn, _driver->flags|tagdb::F_NO_NOT_FOUND_ERROR);
+	if (c == nullptr || !CMD_OK()) {
+		delete c;
 		this->handle_cmd_error();
 		add_history_lines_clear(_lines);
 		return;
 	}
 
-	switch(tc) {
-		case tagd::TAGD_OK:
-			if (q.super_object() == HARD_TAG_REFERENT)
-				tagd::print_tags(T);
+	// same output as tagd::print_tags() and tagd::print_tag_ids()
+	const bool print_tags = (q.super_object() == HARD_TAG_REFERENT);
+	size_t n = 0;
+	tagd::abstract_tag t;
+	tagd::code tc;
+	while ((tc = c->next(t)) == tagd::TAGD_OK) {
+		if (n++ > 0) {
+			if (print_tags)
+				TAGD_COUT << std::endl << std::endl;
 			else
-				tagd::print_tag_ids(T);
-			break;
-		case tagd::TS_NOT_FOUND:  // TS_NOT_FOUND not an error for queries
-			if (_tsh->echo_result_code)
-				TAGD_COUT << "-- " << tagd::code_str(tc) << std::endl;
-			break;
-		default:	
+				TAGD_COUT << ", ";
+		}
+
+		if (print_tags)
+			TAGD_COUT << t;
+		else
+			TAGD_COUT << t.id();
+	}
+	if (n > 0)
+		TAGD_COUT << std::endl;
+
+	if (c->has_errors()) {
+		if (CMD_OK()) {  // cursor errors not reported to a session
+			_driver->code(c->code()); // stops the scanner
+			c->print_errors();
+		} else {
 			this->handle_cmd_error();
+		}
+		delete c;
+		add_history_lines_clear(_lines);
+		return;
 	}
+	delete c;
+
+	// TS_NOT_FOUND not an error for queries
+	if (n == 0 && _tsh->echo_result_code)
+		TAGD_COUT << "-- " << tagd::code_str(tagd::TS_NOT_FOUND) << std::endl;
 
 	add_history_lines_clear(_lines);
 }